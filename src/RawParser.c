@@ -51,6 +51,40 @@ GNU General Public License:
 #include <stdlib.h>
 #include <malloc.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__linux__) && !defined(NO_JIT)
+#define JIT_X86_64
+#include <sys/mman.h>
+#endif
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(NO_THREADS)
+#define USE_THREADS
+#include <pthread.h>
+/* The state that is changed while parsing is local to the thread, such
+   that parsers can run on several threads (see 'Shadow verification') */
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+#if defined(__linux__) && !defined(NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define USE_IO_URING
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 #ifndef NULL
 #define NULL 0
@@ -78,6 +112,73 @@ void my_free(void *p, unsigned int line)
 	free(p);
 }
 
+#elif defined(MEMORY_BUDGET)
+
+/*  While a memory budget is active on the thread (see 'Memory budget'),
+	the allocated bytes are counted. Each block has a header with its size
+	and the generation of the budget that counted it (zero when none did),
+	such that FREE only subtracts the blocks counted by the active budget.
+	The free lists (of trees, for example) keep blocks without calling
+	FREE, and charge them again when they are taken from the list. */
+
+#define USE_MEMORY_BUDGET
+THREAD_LOCAL size_t *malloc_budget_used = NULL;
+THREAD_LOCAL unsigned long malloc_budget_generation = 0;
+THREAD_LOCAL unsigned long malloc_budget_nr_generations = 0;
+
+typedef union
+{
+	struct
+	{
+		size_t size;               /* Including the header */
+		unsigned long generation;
+	} info;
+	long double align;             /* Keeps the block aligned */
+} budget_header_t;
+
+void budget_charge(void *p)
+{
+	budget_header_t *header = (budget_header_t*)p - 1;
+	header->info.generation = 0;
+	if (malloc_budget_used != NULL)
+	{
+		header->info.generation = malloc_budget_generation;
+		*malloc_budget_used += header->info.size;
+	}
+}
+
+void budget_uncharge(void *p)
+{
+	budget_header_t *header = (budget_header_t*)p - 1;
+	if (   malloc_budget_used != NULL && header->info.generation != 0
+		&& header->info.generation == malloc_budget_generation)
+		*malloc_budget_used -= header->info.size;
+	header->info.generation = 0;
+}
+
+void *budget_malloc(size_t size)
+{
+	budget_header_t *header = (budget_header_t*)malloc(sizeof(budget_header_t) + size);
+	if (header == NULL)
+		return NULL;
+	header->info.size = sizeof(budget_header_t) + size;
+	budget_charge(header + 1);
+	return header + 1;
+}
+
+void budget_free(void *p)
+{
+	if (p == NULL)
+		return;
+	budget_uncharge(p);
+	free((budget_header_t*)p - 1);
+}
+
+#define BUDGET_CHARGE(P) budget_charge(P);
+#define BUDGET_UNCHARGE(P) budget_uncharge(P);
+#define my_malloc(X,L) budget_malloc(X)
+#define my_free(X,L) budget_free(X)
+
 #else
 
 #define my_malloc(X,L) malloc(X)
@@ -85,6 +186,11 @@ void my_free(void *p, unsigned int line)
 
 #endif
 
+#ifndef BUDGET_CHARGE
+#define BUDGET_CHARGE(P)
+#define BUDGET_UNCHARGE(P)
+#endif
+
 #define MALLOC(T) (T*)my_malloc(sizeof(T), __LINE__)
 #define MALLOC_N(N,T)  (T*)my_malloc((N)*sizeof(T), __LINE__)
 #define STR_MALLOC(N) (char*)my_malloc((N)+1, __LINE__)
@@ -92,6 +198,39 @@ void my_free(void *p, unsigned int line)
 #define FREE(X) my_free(X, __LINE__)
 
 
+/*
+	Static tracing probes
+	~~~~~~~~~~~~~~~~~~~~~
+
+	When <sys/sdt.h> (from systemtap) is available, the PROBE macros define
+	static (USDT) probes of the provider 'rawparser' at the decision points
+	of the parser, which only take a nop instruction when no tracer is
+	attached. They can be listed with: bpftrace -l 'usdt:./RawParser:*'.
+	The probes are:
+	- nt_enter(name, pos), nt_success(name, pos, next_pos) and nt_fail(name, pos)
+	- nt_cache_hit(name, pos, success) and nt_cache_miss(name, pos)
+	- element_match(kind, pos, next_pos) and element_fail(kind, pos)
+	- memo_find(name, pos, success) and memo_set(name, pos, success)
+	- alloc(data) and free(data) for reference counted results.
+	Define NO_PROBES to leave them out.
+*/
+
+#if !defined(NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define USE_PROBES
+#define PROBE1(N,A) STAP_PROBE1(rawparser, N, A);
+#define PROBE2(N,A,B) STAP_PROBE2(rawparser, N, A, B);
+#define PROBE3(N,A,B,C) STAP_PROBE3(rawparser, N, A, B, C);
+#endif
+#endif
+#ifndef PROBE1
+#define PROBE1(N,A)
+#define PROBE2(N,A,B)
+#define PROBE3(N,A,B,C)
+#endif
+
+
 /*
 	Internal representation parsing rules
 	~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -114,9 +253,11 @@ void my_free(void *p, unsigned int line)
 	consists of list of grammar elements. An element can be one of:
 	- character,
 	- character set,
+	- any characters until a delimiter,
 	- end of text,
-	- non-terminal, or
-	- grouping of rules.
+	- non-terminal,
+	- grouping of rules, or
+	- and/not predicate on a grouping of rules.
 	An element can have modifiers for making the element optional or a sequence.
 	It is also possible to specify that an optional and/or sequential element
 	should be avoided in favour of the remaining rule.
@@ -138,6 +279,8 @@ typedef struct non_terminal non_terminal_t, *non_terminal_p;
 typedef struct rule *rule_p;
 typedef struct element *element_p;
 typedef struct char_set *char_set_p;
+typedef struct recover *recover_p;
+typedef struct code_point_set *code_point_set_p;
 typedef struct result result_t, *result_p;
 typedef struct text_pos text_pos_t, *text_pos_p;
 
@@ -148,6 +291,15 @@ struct non_terminal
 	const char *name;     /* Name of the non-terminal */
 	rule_p normal;       /* Normal rules */
 	rule_p recursive;    /* Left-recursive rules */
+	char_set_p first;    /* Characters it can start with (set by grammar_analyse) */
+	bool nullable;       /* Whether it can be parsed from the empty string (idem) */
+	bool ll1;            /* Whether the rule can be predicted from the first character (idem) */
+	bool cheap;          /* Whether it does not depend on recursive non-terminals (idem) */
+	rule_p *predict;     /* For each character the rule to parse (idem) */
+	bool jit_supported;  /* Whether it can be compiled to machine code (set by jit_compile_grammar) */
+	bool jit_result_free;/* Whether it has no functions for processing results (idem) */
+	const char *(*jit_function)(const char *s, const char *end); /* The compiled function (idem) */
+	int min_depth;       /* Minimal depth of a derivation (set by generator_init) */
 };
 
 typedef struct non_terminal_dict *non_terminal_dict_p;
@@ -169,6 +321,15 @@ non_terminal_p find_nt(const char *name, non_terminal_dict_p *p_nt)
 	   (*p_nt)->elem.name = name;
 	   (*p_nt)->elem.normal = NULL;
 	   (*p_nt)->elem.recursive = NULL;
+	   (*p_nt)->elem.first = NULL;
+	   (*p_nt)->elem.nullable = FALSE;
+	   (*p_nt)->elem.ll1 = FALSE;
+	   (*p_nt)->elem.cheap = FALSE;
+	   (*p_nt)->elem.predict = NULL;
+	   (*p_nt)->elem.jit_supported = FALSE;
+	   (*p_nt)->elem.jit_result_free = FALSE;
+	   (*p_nt)->elem.jit_function = NULL;
+	   (*p_nt)->elem.min_depth = 0;
 	   (*p_nt)->next = NULL;
    }
    return &(*p_nt)->elem;
@@ -226,8 +387,12 @@ enum element_kind_t
 	rk_grouping, /* Grouping of one or more rules */
 	rk_char,     /* A character */
 	rk_charset,  /* A character set */
+	rk_cpset,    /* A code point (encoded in UTF-8) from a set */
 	rk_end,      /* End of input */
-	rk_term      /* User defined terminal scan function */
+	rk_term,     /* User defined terminal scan function */
+	rk_until,    /* Any characters up to a delimiter (with an optional escape character) */
+	rk_and,      /* Only succeeds if one of the rules can be parsed (without consuming it) */
+	rk_not       /* Only succeeds if none of the rules can be parsed */
 };
 
 struct element
@@ -238,13 +403,19 @@ struct element
 	bool back_tracking;         /* Whether a sequence is back-tracking */
 	bool avoid;                 /* Whether the elmeent should be avoided when it is optional and/or sequential. */
 	element_p chain_rule;       /* Chain rule, for between the sequential elements */
+	recover_p recover;          /* Error recovery for a sequence (or NULL) */
 	union 
 	{   non_terminal_p non_terminal; /* rk_nt: Pointer to non-terminal */
-		rule_p rules;                /* rk_grouping: Pointer to the rules */
+		rule_p rules;                /* rk_grouping, rk_and, rk_not: Pointer to the rules */
 		char ch;                     /* rk_char: The character */
 		char_set_p char_set;         /* rk_charset: Pointer to character set definition */
+		code_point_set_p code_point_set; /* rk_cpset: Pointer to code point set definition */
 		const char *(*terminal_function)(const char *input, result_p result);
 		                             /* rk_term: Pointer to user defined terminal scan function */
+		struct
+		{   const char *delimiter;   /* rk_until: The delimiter (which is not consumed) */
+			char escape;             /*   and the escape character (or '\0' for none) */
+		} until;
 	} info;
 
 	/* Function pointer to an optional Boolean function that is called after the
@@ -260,6 +431,14 @@ struct element
 	   literal character. */
 	bool (*add_char_function)(result_p prev, char ch, result_p result);
 
+	/* Function pointer to an optional Boolean function that is called after
+	   the characters up to a delimiter are parsed, to combine the result of
+	   the previous elements with these characters. When the function returns
+	   false, parsing fails. When the function pointer is null, it is
+	   equivalent with a function that always returns true and simple sets
+	   the result as the result of the previous element. */
+	bool (*add_span_function)(result_p prev, const char *text, size_t len, result_p result);
+
 	/* Function pointer to an optional Boolean function that is called after the
 	   element is parsed. When the function returns false, parsing fails. The
 	   function is called with the result of the element and a pointer to an
@@ -334,7 +513,9 @@ void element_init(element_p element, enum element_kind_t kind)
 	element->back_tracking = FALSE;
 	element->avoid = FALSE;
 	element->chain_rule = NULL;
+	element->recover = NULL;
 	element->add_char_function = 0;
+	element->add_span_function = 0;
 	element->condition = 0;
 	element->condition_argument = NULL;
 	element->add_function = 0;
@@ -383,6 +564,363 @@ void char_set_add_range(char_set_p char_set, char first, char last)
 	for (; ((byte)first) <= ch && ch <= ((byte)last); ch++)
 		char_set_add_char(char_set, ch);
 }
+void char_set_add_set(char_set_p char_set, char_set_p other)
+{
+	for (int i = 0; i < 32; i++)
+		char_set->bitvec[i] |= other->bitvec[i];
+}
+bool char_set_equal(char_set_p char_set, char_set_p other) { return memcmp(char_set->bitvec, other->bitvec, 32) == 0; }
+void char_set_add_chars(char_set_p char_set, const char *chars)
+{
+	for (; *chars != '\0'; chars++)
+		char_set_add_char(char_set, *chars);
+}
+
+/*
+	Definition of error recovery
+	
+	A sequence can be marked with synchronization characters for error
+	recovery. When the sequence ends at a character that cannot follow it,
+	the parser records the error and skips to the first character after a
+	skip past character or up to a stop before character (with a single
+	linear scan) after which it continues with the sequence. The function
+	add_error_function (if not null) is called to add an error node to the
+	result of the sequence. The scan also stops before a position (beyond
+	the start) where the non-terminal resume at (if not null) can be
+	recognized, for example a declaration. The non-terminal after (if not
+	null) is parsed after the skip, for example to skip white space.
+*/
+
+struct recover
+{
+	char_set_p skip_past;       /* Characters after which parsing resumes */
+	char_set_p stop_before;     /* Characters that may follow the sequence */
+	bool (*add_error_function)(result_p prev, text_pos_p start, result_p result);
+	non_terminal_p resume_at;   /* Non-terminal before which parsing resumes (or NULL) */
+	non_terminal_p after;       /* Non-terminal to parse after the skip (or NULL) */
+};
+
+recover_p new_recover(const char *skip_past, const char *stop_before)
+{
+	recover_p recover = MALLOC(struct recover);
+	recover->skip_past = new_char_set();
+	char_set_add_chars(recover->skip_past, skip_past);
+	recover->stop_before = new_char_set();
+	char_set_add_chars(recover->stop_before, stop_before);
+	recover->add_error_function = 0;
+	recover->resume_at = NULL;
+	recover->after = NULL;
+	return recover;
+}
+
+/*
+	- Finding the first character of a character set in a buffer
+
+	Searching for the first character from a character set in a buffer, is
+	an operation that is used when scanning a large text for places where
+	some element could start. If the character set consists of a small
+	number of ranges, the search can be performed on sixteen bytes at the
+	time with SSE2 instructions, by testing for each range whether the
+	difference with the first character of the range is not larger than
+	the size of the range.
+*/
+
+#define CHAR_SET_FINDER_MAX_RANGES 8
+
+typedef struct
+{
+	char_set_p char_set;
+	int nr_ranges;           /* Number of ranges, or -1 if there are too many */
+	byte from[CHAR_SET_FINDER_MAX_RANGES];
+	byte to[CHAR_SET_FINDER_MAX_RANGES];
+} char_set_finder_t, *char_set_finder_p;
+
+void char_set_finder_init(char_set_finder_p finder, char_set_p char_set)
+{
+	finder->char_set = char_set;
+	finder->nr_ranges = 0;
+	for (int ch = 0; ch < 256; ch++)
+	{
+		if (!char_set_contains(char_set, ch))
+			continue;
+		if (ch > 0 && char_set_contains(char_set, ch - 1))
+			finder->to[finder->nr_ranges - 1] = ch;
+		else if (finder->nr_ranges < CHAR_SET_FINDER_MAX_RANGES)
+		{
+			finder->from[finder->nr_ranges] = ch;
+			finder->to[finder->nr_ranges] = ch;
+			finder->nr_ranges++;
+		}
+		else
+		{
+			finder->nr_ranges = -1;
+			break;
+		}
+	}
+}
+
+const char *char_set_finder_find(char_set_finder_p finder, const char *s, const char *end)
+{
+	if (finder->nr_ranges == 0)
+		return end;
+	if (finder->nr_ranges == 1 && finder->from[0] == finder->to[0])
+	{
+		const char *found = (const char*)memchr(s, finder->from[0], end - s);
+		return found != NULL ? found : end;
+	}
+#ifdef __SSE2__
+	if (finder->nr_ranges > 0)
+	{
+		__m128i from[CHAR_SET_FINDER_MAX_RANGES];
+		__m128i size[CHAR_SET_FINDER_MAX_RANGES];
+		for (int i = 0; i < finder->nr_ranges; i++)
+		{
+			from[i] = _mm_set1_epi8((char)finder->from[i]);
+			size[i] = _mm_set1_epi8((char)(finder->to[i] - finder->from[i]));
+		}
+		const __m128i zero = _mm_setzero_si128();
+		for (; end - s >= 16; s += 16)
+		{
+			__m128i chars = _mm_loadu_si128((const __m128i*)s);
+			__m128i hit = zero;
+			for (int i = 0; i < finder->nr_ranges; i++)
+				hit = _mm_or_si128(hit, _mm_cmpeq_epi8(_mm_subs_epu8(_mm_sub_epi8(chars, from[i]), size[i]), zero));
+			int mask = _mm_movemask_epi8(hit);
+			if (mask != 0)
+				return s + __builtin_ctz(mask);
+		}
+	}
+#endif
+	for (; s < end; s++)
+		if (char_set_contains(finder->char_set, *s))
+			return s;
+	return end;
+}
+
+/*
+	- UTF-8 encoded code points
+
+	Code points above 127 are encoded in UTF-8 with a lead byte followed by
+	one to three continuation bytes (in the range 0x80 to 0xBF). A code
+	point set consists of a bit vector for the ASCII characters and a
+	sorted list of non-overlapping ranges for the other code points, which
+	is searched with a binary search. As most texts consist mostly of ASCII
+	characters, these hardly pay anything for the support of UTF-8.
+*/
+
+#define UTF8_CONTINUATION(C) ((((byte)(C)) & 0xC0) == 0x80)
+
+typedef struct
+{
+	unsigned long from;
+	unsigned long to;
+} code_point_range_t, *code_point_range_p;
+
+struct code_point_set
+{
+	struct char_set ascii;      /* The code points below 128 */
+	unsigned int nr_ranges;     /* The ranges of code points from 128 */
+	unsigned int max_ranges;
+	code_point_range_p ranges;
+};
+
+code_point_set_p new_code_point_set()
+{
+	code_point_set_p code_point_set = MALLOC(struct code_point_set);
+	for (int i = 0; i < 32; i++)
+		code_point_set->ascii.bitvec[i] = 0;
+	code_point_set->nr_ranges = 0;
+	code_point_set->max_ranges = 0;
+	code_point_set->ranges = NULL;
+	return code_point_set;
+}
+
+void code_point_set_add_range(code_point_set_p code_point_set, unsigned long from, unsigned long to)
+{
+	for (; from <= to && from < 128; from++)
+		char_set_add_char(&code_point_set->ascii, (char)from);
+	if (from > to)
+		return;
+	
+	/* Merge with all ranges that overlap or touch the new range */
+	unsigned int i = 0;
+	while (i < code_point_set->nr_ranges && code_point_set->ranges[i].to + 1 < from)
+		i++;
+	unsigned int j = i;
+	for (; j < code_point_set->nr_ranges && code_point_set->ranges[j].from <= to + 1; j++)
+	{
+		if (code_point_set->ranges[j].from < from)
+			from = code_point_set->ranges[j].from;
+		if (code_point_set->ranges[j].to > to)
+			to = code_point_set->ranges[j].to;
+	}
+	if (j == i)
+	{
+		/* Insert a new range at i */
+		if (code_point_set->nr_ranges == code_point_set->max_ranges)
+		{
+			code_point_set->max_ranges = code_point_set->max_ranges == 0 ? 4 : 2 * code_point_set->max_ranges;
+			code_point_range_p ranges = MALLOC_N(code_point_set->max_ranges, code_point_range_t);
+			for (unsigned int k = 0; k < code_point_set->nr_ranges; k++)
+				ranges[k] = code_point_set->ranges[k];
+			if (code_point_set->ranges != NULL)
+				FREE(code_point_set->ranges);
+			code_point_set->ranges = ranges;
+		}
+		for (unsigned int k = code_point_set->nr_ranges; k > i; k--)
+			code_point_set->ranges[k] = code_point_set->ranges[k - 1];
+		code_point_set->nr_ranges++;
+	}
+	else
+	{
+		/* Replace the ranges i up to j by one range */
+		for (unsigned int k = j; k < code_point_set->nr_ranges; k++)
+			code_point_set->ranges[k - (j - i - 1)] = code_point_set->ranges[k];
+		code_point_set->nr_ranges -= j - i - 1;
+	}
+	code_point_set->ranges[i].from = from;
+	code_point_set->ranges[i].to = to;
+}
+
+bool code_point_set_contains(code_point_set_p code_point_set, unsigned long code_point)
+{
+	if (code_point < 128)
+		return char_set_contains(&code_point_set->ascii, (char)code_point);
+	unsigned int low = 0;
+	unsigned int high = code_point_set->nr_ranges;
+	while (low < high)
+	{
+		unsigned int mid = (low + high) / 2;
+		if (code_point_set->ranges[mid].to < code_point)
+			low = mid + 1;
+		else if (code_point < code_point_set->ranges[mid].from)
+			high = mid;
+		else
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/*	- Function to decode the code point at the start of a string. Returns
+	  the number of bytes of the encoding, or 0 when it is not valid
+	  (including overlong encodings and surrogates). */
+
+int utf8_decode(const char *s, const char *end, unsigned long *code_point)
+{
+	if (s >= end)
+		return 0;
+	byte lead = (byte)*s;
+	if (lead < 0x80)
+	{
+		*code_point = lead;
+		return 1;
+	}
+	int len;
+	unsigned long min;
+	if (lead < 0xC2)
+		return 0;
+	else if (lead < 0xE0)
+	{
+		len = 2;
+		*code_point = lead & 0x1F;
+		min = 0x80;
+	}
+	else if (lead < 0xF0)
+	{
+		len = 3;
+		*code_point = lead & 0x0F;
+		min = 0x800;
+	}
+	else if (lead < 0xF5)
+	{
+		len = 4;
+		*code_point = lead & 0x07;
+		min = 0x10000;
+	}
+	else
+		return 0;
+	if (end - s < len)
+		return 0;
+	for (int i = 1; i < len; i++)
+	{
+		if (!UTF8_CONTINUATION(s[i]))
+			return 0;
+		*code_point = (*code_point << 6) | (s[i] & 0x3F);
+	}
+	if (*code_point < min || *code_point > 0x10FFFF || (0xD800 <= *code_point && *code_point <= 0xDFFF))
+		return 0;
+	return len;
+}
+
+/*	- Function to add the first bytes of the encodings of the code points
+	  in a set to a character set. (The lead byte is increasing with the
+	  code point.) */
+
+byte utf8_lead_byte(unsigned long code_point)
+{
+	return   code_point < 0x80    ? (byte)code_point
+	       : code_point < 0x800   ? (byte)(0xC0 | (code_point >> 6))
+	       : code_point < 0x10000 ? (byte)(0xE0 | (code_point >> 12))
+	       :                        (byte)(0xF0 | (code_point >> 18));
+}
+
+void char_set_add_code_point_set(char_set_p char_set, code_point_set_p code_point_set)
+{
+	char_set_add_set(char_set, &code_point_set->ascii);
+	for (unsigned int i = 0; i < code_point_set->nr_ranges; i++)
+		char_set_add_range(char_set, utf8_lead_byte(code_point_set->ranges[i].from), utf8_lead_byte(code_point_set->ranges[i].to));
+}
+
+/*
+	- Function to find the first character that is a tab or that is not
+	  an ASCII character. This is used to quickly count columns, where
+	  only tabs and continuation bytes are not counted as one column.
+*/
+
+const char *skip_plain_ascii(const char *s, const char *end)
+{
+#ifdef __SSE2__
+	const __m128i tabs = _mm_set1_epi8('\t');
+	for (; end - s >= 16; s += 16)
+	{
+		__m128i chars = _mm_loadu_si128((const __m128i*)s);
+		int mask = _mm_movemask_epi8(_mm_or_si128(chars, _mm_cmpeq_epi8(chars, tabs)));
+		if (mask != 0)
+			return s + __builtin_ctz(mask);
+	}
+#else
+	/* Eight bytes at the time, where a byte of word ^ 0x09.. is zero for a tab */
+	for (; end - s >= 8; s += 8)
+	{
+		unsigned long long word;
+		memcpy(&word, s, 8);
+		unsigned long long tabs = word ^ 0x0909090909090909ULL;
+		if (((word | ((tabs - 0x0101010101010101ULL) & ~tabs)) & 0x8080808080808080ULL) != 0)
+			break;
+	}
+#endif
+	for (; s < end; s++)
+		if ((*s & 0x80) != 0 || *s == '\t')
+			break;
+	return s;
+}
+
+unsigned int column_advance(unsigned int column, const char *s, const char *end, unsigned int tab_size)
+{
+	for (;;)
+	{
+		const char *plain_end = skip_plain_ascii(s, end);
+		column += plain_end - s;
+		s = plain_end;
+		if (s >= end)
+			return column;
+		if (*s == '\t')
+			column += tab_size - (column - 1) % tab_size;
+		else if (!UTF8_CONTINUATION(*s))
+			column++;
+		s++;
+	}
+}
 
 
 /*
@@ -474,12 +1012,33 @@ void element_print(FILE *f, element_p element)
 				fprintf(f, "-\\377");
 			fprintf(f, "] ");
 			break;
+		case rk_cpset:
+			fprintf(f, "[");
+			for (int ch = 0; ch < 128; ch++)
+				if (char_set_contains(&element->info.code_point_set->ascii, ch))
+					print_c_string_char(f, ch);
+			for (unsigned int i = 0; i < element->info.code_point_set->nr_ranges; i++)
+				fprintf(f, "\\u%04lx-\\u%04lx", element->info.code_point_set->ranges[i].from, element->info.code_point_set->ranges[i].to);
+			fprintf(f, "] ");
+			break;
 		case rk_end:
 			fprintf(f, "<eof> ");
 			break;
 		case rk_term:
 			fprintf(f, "<term> ");
 			break;
+		case rk_until:
+			fprintf(f, "<until \"");
+			for (const char *s = element->info.until.delimiter; *s != '\0'; s++)
+				print_c_string_char(f, *s);
+			fprintf(f, "\"> ");
+			break;
+		case rk_and:
+		case rk_not:
+			fprintf(f, element->kind == rk_and ? "&(" : "!(");
+			rules_print(f, element->info.rules);
+			fprintf(f, ")");
+			break;
 	}
 
 	if (element->sequence)
@@ -502,6 +1061,212 @@ void element_print(FILE *f, element_p element)
 	element_print(f, element->next);
 }
 
+/*
+	Grammar analysis
+	~~~~~~~~~~~~~~~~
+
+	For each non-terminal, the set of characters with which it can start
+	(its FIRST set) and whether it can be parsed from the empty string can
+	be derived from the grammar. These can be used to quickly determine
+	that there is no point in trying to parse a non-terminal at a certain
+	position. Because the non-terminals refer to each other, the sets are
+	calculated by repeating the calculation until nothing changes anymore.
+	Some things are not taken into account, such as the conditions and the
+	result functions that can make parsing fail, and user defined terminal
+	scan functions are assumed to accept any character. This means that
+	the calculated sets can be larger than strictly needed.
+*/
+
+bool element_add_first(element_p element, char_set_p first)
+/*  Adds the first characters of the (remainder of the) rule starting with
+	the given element to first and returns whether it can be empty. */
+{
+	for (; element != NULL; element = element->next)
+	{
+		bool nullable = element->optional;
+		switch (element->kind)
+		{
+			case rk_nt:
+				if (element->info.non_terminal->first != NULL)
+					char_set_add_set(first, element->info.non_terminal->first);
+				if (element->info.non_terminal->nullable)
+					nullable = TRUE;
+				break;
+			case rk_grouping:
+				for (rule_p rule = element->info.rules; rule != NULL; rule = rule->next)
+					if (element_add_first(rule->elements, first))
+						nullable = TRUE;
+				break;
+			case rk_char:
+				char_set_add_char(first, element->info.ch);
+				break;
+			case rk_charset:
+				char_set_add_set(first, element->info.char_set);
+				break;
+			case rk_cpset:
+				char_set_add_code_point_set(first, element->info.code_point_set);
+				break;
+			case rk_end:
+			case rk_and:
+			case rk_not:
+				nullable = TRUE;
+				break;
+			case rk_term:
+				char_set_add_range(first, 0, 255);
+				break;
+			case rk_until:
+				char_set_add_range(first, 0, 255);
+				nullable = TRUE;
+				break;
+		}
+		if (!nullable)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+	- A non-terminal is LL(1) when the rule to parse can be predicted from
+	  the first character. This is the case when it has no left-recursive
+	  rules, when none of its rules can be empty, and when the FIRST sets
+	  of its rules have no characters in common. (Because no rule can be
+	  empty, the FOLLOW set of the non-terminal does not need to be
+	  considered. It also implies that the non-terminal cannot be part of
+	  indirect left-recursion.) If the predicted rule fails, none of the
+	  other rules could succeed, because they cannot start with the
+	  character. Like the FIRST sets, this does not take conditions into
+	  account, which means that a keyword and an identifier overlap.
+*/
+
+void nt_classify_ll1(non_terminal_p nt)
+{
+	nt->ll1 = nt->recursive == NULL && nt->normal != NULL;
+	struct char_set all_first;
+	for (int i = 0; i < 32; i++)
+		all_first.bitvec[i] = 0;
+	for (rule_p rule = nt->normal; rule != NULL && nt->ll1; rule = rule->next)
+	{
+		struct char_set first;
+		for (int i = 0; i < 32; i++)
+			first.bitvec[i] = 0;
+		if (element_add_first(rule->elements, &first))
+		{
+			nt->ll1 = FALSE;
+			break;
+		}
+		for (int i = 0; i < 32; i++)
+			if ((first.bitvec[i] & all_first.bitvec[i]) != 0)
+				nt->ll1 = FALSE;
+		char_set_add_set(&all_first, &first);
+	}
+	if (!nt->ll1)
+		return;
+
+	if (nt->predict == NULL)
+		nt->predict = MALLOC_N(256, rule_p);
+	for (int ch = 0; ch < 256; ch++)
+		nt->predict[ch] = NULL;
+	for (rule_p rule = nt->normal; rule != NULL; rule = rule->next)
+	{
+		struct char_set first;
+		for (int i = 0; i < 32; i++)
+			first.bitvec[i] = 0;
+		element_add_first(rule->elements, &first);
+		for (int ch = 0; ch < 256; ch++)
+			if (char_set_contains(&first, ch))
+				nt->predict[ch] = rule;
+	}
+}
+
+/*
+	- A non-terminal is cheap when it has no left-recursive rules, no
+	  back-tracking sequences and only refers to cheap non-terminals. This
+	  excludes all (indirectly) recursive non-terminals. Parsing a cheap
+	  non-terminal again takes about as much time as looking it up in a
+	  cache. The cheap non-terminals are found by repeatedly marking those
+	  that only refer to non-terminals that were already marked.
+*/
+
+bool element_cheap(element_p element)
+{
+	for (; element != NULL; element = element->next)
+	{
+		if (element->back_tracking || (element->chain_rule != NULL && !element_cheap(element->chain_rule)))
+			return FALSE;
+		if (element->kind == rk_nt && !element->info.non_terminal->cheap)
+			return FALSE;
+		if (element->kind == rk_grouping || element->kind == rk_and || element->kind == rk_not)
+			for (rule_p rule = element->info.rules; rule != NULL; rule = rule->next)
+				if (!element_cheap(rule->elements))
+					return FALSE;
+	}
+	return TRUE;
+}
+
+void grammar_classify_cheap(non_terminal_dict_p all_nt)
+{
+	for (non_terminal_dict_p nt_dict = all_nt; nt_dict != NULL; nt_dict = nt_dict->next)
+		nt_dict->elem.cheap = FALSE;
+	bool changed = TRUE;
+	while (changed)
+	{
+		changed = FALSE;
+		for (non_terminal_dict_p nt_dict = all_nt; nt_dict != NULL; nt_dict = nt_dict->next)
+		{
+			non_terminal_p nt = &nt_dict->elem;
+			if (nt->cheap || nt->recursive != NULL)
+				continue;
+			bool cheap = TRUE;
+			for (rule_p rule = nt->normal; rule != NULL && cheap; rule = rule->next)
+				cheap = element_cheap(rule->elements);
+			if (cheap)
+			{
+				nt->cheap = TRUE;
+				changed = TRUE;
+			}
+		}
+	}
+}
+
+void grammar_analyse(non_terminal_dict_p all_nt)
+{
+	for (non_terminal_dict_p nt_dict = all_nt; nt_dict != NULL; nt_dict = nt_dict->next)
+		if (nt_dict->elem.first == NULL)
+			nt_dict->elem.first = new_char_set();
+
+	struct char_set first;
+	bool changed = TRUE;
+	while (changed)
+	{
+		changed = FALSE;
+		for (non_terminal_dict_p nt_dict = all_nt; nt_dict != NULL; nt_dict = nt_dict->next)
+		{
+			non_terminal_p nt = &nt_dict->elem;
+			first = *nt->first;
+			bool nullable = FALSE;
+			for (rule_p rule = nt->normal; rule != NULL; rule = rule->next)
+				if (element_add_first(rule->elements, &first))
+					nullable = TRUE;
+			/* Only when the non-terminal can be empty, can a left-recursive
+			   rule determine with which character it starts */
+			if (nullable)
+				for (rule_p rule = nt->recursive; rule != NULL; rule = rule->next)
+					element_add_first(rule->elements, &first);
+			if (nullable != nt->nullable || !char_set_equal(&first, nt->first))
+			{
+				*nt->first = first;
+				nt->nullable = nullable;
+				changed = TRUE;
+			}
+		}
+	}
+
+	for (non_terminal_dict_p nt_dict = all_nt; nt_dict != NULL; nt_dict = nt_dict->next)
+		nt_classify_ll1(&nt_dict->elem);
+	grammar_classify_cheap(all_nt);
+}
+
+
 /*  Some macro definitions for defining a grammar more easily.  */
 
 #define HEADER(N) non_terminal_dict_p *_nt = N; non_terminal_p nt; rule_p* ref_rule; rule_p* ref_rec_rule; rule_p rules; element_p* ref_element; element_p element;
@@ -517,14 +1282,26 @@ void element_print(FILE *f, element_p element)
 #define BACK_TRACKING element->back_tracking = TRUE;
 #define AVOID element->avoid = TRUE;
 #define SET_PS(F) element->set_pos = F;
+#define RECOVER(P,B,F) element->recover = new_recover(P, B); element->recover->add_error_function = F;
+#define RECOVER_AFTER(N) element->recover->after = find_nt(N, _nt);
+#define RECOVER_AT(N) element->recover->resume_at = find_nt(N, _nt);
 #define CHAR(C) _NEW_GR(rk_char) element->info.ch = C;
 #define CHARF(C,F) CHAR(C) element->add_char_function = F;
+#define UNTIL(D,E) _NEW_GR(rk_until) element->info.until.delimiter = D; element->info.until.escape = E;
+#define UNTILF(D,E,F) UNTIL(D,E) element->add_span_function = F;
 #define CHARSET(F) _NEW_GR(rk_charset) element->info.char_set = new_char_set(); element->add_char_function = F;
 #define ADD_CHAR(C) char_set_add_char(element->info.char_set, C);
+#define CPSET(F) _NEW_GR(rk_cpset) element->info.code_point_set = new_code_point_set(); element->add_span_function = F;
+#define ADD_CP_RANGE(F,T) code_point_set_add_range(element->info.code_point_set, F, T);
 #define REMOVE_CHAR(C) char_set_remove_char(element->info.char_set, C);
 #define ADD_RANGE(F,T) char_set_add_range(element->info.char_set, F, T);
 #define END_FUNCTION(F) rules->end_function = F;
 #define GROUPING _NEW_GR(rk_grouping) element->info.rules = new_rule(); rule_p* ref_rule = &element->info.rules; rule_p rules; element_p* ref_element; element_p element;
+#define AND_GROUPING _NEW_GR(rk_and) element->info.rules = new_rule(); rule_p* ref_rule = &element->info.rules; rule_p rules; element_p* ref_element; element_p element;
+#define NOT_GROUPING _NEW_GR(rk_not) element->info.rules = new_rule(); rule_p* ref_rule = &element->info.rules; rule_p rules; element_p* ref_element; element_p element;
+#define _PRED_NT(K,N) _NEW_GR(K) element->info.rules = new_rule(); element->info.rules->elements = new_element(rk_nt); element->info.rules->elements->info.non_terminal = find_nt(N, _nt);
+#define AND_NT(N) _PRED_NT(rk_and, N)
+#define NOT_NT(N) _PRED_NT(rk_not, N)
 		
 
 
@@ -536,7 +1313,10 @@ void element_print(FILE *f, element_p element)
 	pointers can be left 0. White space is defined as a (possible empty)
 	sequence of white space characters, the single line comment and the
 	traditional C-comment. '{ GROUPING' and '}' are used to define a
-	grouping. The grouping contains three rules.
+	grouping. The grouping contains three rules. The bodies of the comments
+	are parsed with an element that skips all characters up to the given
+	delimiter, which is much faster than parsing them character by
+	character.
 */
 
 void white_space_grammar(non_terminal_dict_p *all_nt)
@@ -551,13 +1331,12 @@ void white_space_grammar(non_terminal_dict_p *all_nt)
 				RULE /* for the single line comment starting with two slashes */
 					CHAR('/')
 					CHAR('/')
-					CHARSET(0) ADD_RANGE(' ', 255) ADD_CHAR('\t') SEQ(0, 0) OPT(0)
-					CHAR('\r') OPT(0)
+					UNTIL("\n", '\0')
 					CHAR('\n')
-				RULE /* for the traditional C-comment (using avoid modifier) */
+				RULE /* for the traditional C-comment */
 					CHAR('/')
 					CHAR('*')
-					CHARSET(0) ADD_RANGE(' ', 255) ADD_CHAR('\t') ADD_CHAR('\n') ADD_CHAR('\r') SEQ(0, 0) OPT(0) AVOID
+					UNTIL("*/", '\0')
 					CHAR('*')
 					CHAR('/')
 			} SEQ(0, 0) OPT(0)
@@ -603,13 +1382,12 @@ void number_grammar(non_terminal_dict_p *all_nt)
 	
 	We first define an interface for an output stream, which later
 	can be implemented as either outputting to a file or a string buffer.
+	The struct ostream, which only has a function pointer to put a
+	character, and the struct result (see below) are defined in
+	RawParser.h, because the C++ front-end (RawParser.hpp) uses them too.
 */
 
-typedef struct ostream ostream_t, *ostream_p;
-struct ostream
-{
-	void (*put)(ostream_p ostream, char ch);
-};
+#include "RawParser.h"
 
 void ostream_put(ostream_p ostream, char ch)
 {
@@ -630,23 +1408,11 @@ void ostream_puts(ostream_p ostream, const char *s)
 	are used by grammar rule, a void pointer is used. Reference counting
 	is often used to manage dynamically allocated memory. It is a good
 	idea to group the void pointer with functions to increment and decrement
-	the reference count. The struct 'result' below also adds a function
-	pointer to a print function.
+	the reference count. The struct 'result' (in RawParser.h) also adds a
+	function pointer to a print function. With CHECK_LOCAL_RESULT it also
+	records where a local result was declared (see DECL_RESULT below).
 */
 
-struct result
-{	
-	void *data;
-	void (*inc)(void *data);
-	void (*dec)(void *data);
-	void (*print)(void *data, ostream_p ostream);
-#ifdef CHECK_LOCAL_RESULT
-	int line;
-	const char *name;
-	result_p context;
-#endif
-};
-
 /*
 	- Function to initialize a result
 */
@@ -803,9 +1569,50 @@ bool use_sequence_result(result_p prev, result_p seq, result_p result)
 
 bool debug_allocations = FALSE;
 
-typedef struct
-{
-	unsigned long cnt;     /* A reference count */
+/*  When ALLOC_ATTRIBUTION is defined, the allocations of data (and of the
+	items of the caches and some arrays) are attributed to their type and
+	the non-terminal that was being parsed, as explained in 'Allocation
+	attribution' below. The sequence number of the allocation is stored
+	with the data (or next to the pointer to an array). */
+
+#ifdef ALLOC_ATTRIBUTION
+unsigned long alloc_attribute(const char *type, const char *nt, size_t size);
+void alloc_attribution_free(unsigned long seq);
+unsigned long alloc_attribution_mark();
+void alloc_attribution_backtrack(unsigned long mark);
+#define ALLOC_ATTRIBUTE(T,NT,X) (X)->alloc_seq = alloc_attribute(T, NT, sizeof(*(X)));
+#define ALLOC_ATTRIBUTE_ARRAY(T,NT,SEQ,A,N) SEQ = alloc_attribute(T, NT, (N) * sizeof(*(A)));
+#define ALLOC_FREE(X) alloc_attribution_free((X)->alloc_seq);
+#define ALLOC_FREE_SEQ(SEQ) alloc_attribution_free(SEQ);
+#define ALLOC_MARK(V) unsigned long V = alloc_attribution_mark();
+#define ALLOC_BACKTRACK(V) alloc_attribution_backtrack(V);
+#else
+#define ALLOC_ATTRIBUTE(T,NT,X)
+#define ALLOC_ATTRIBUTE_ARRAY(T,NT,SEQ,A,N)
+#define ALLOC_FREE(X)
+#define ALLOC_FREE_SEQ(SEQ)
+#define ALLOC_MARK(V)
+#define ALLOC_BACKTRACK(V)
+#endif
+
+/*  When SAFE_CASTING is defined, each piece of data records its type with
+	a pointer to a type descriptor, which is defined for each type with
+	DEFINE_TYPE. This makes checking a cast (see CAST) a single compare of
+	pointers, which is cheap enough to keep checking in production. */
+
+#ifdef SAFE_CASTING
+typedef struct type_descriptor
+{
+	const char *name;
+} type_descriptor_t, *type_descriptor_p;
+#define DEFINE_TYPE(T) type_descriptor_t T##_type_descriptor = { #T };
+#else
+#define DEFINE_TYPE(T)
+#endif
+
+typedef struct
+{
+	unsigned long cnt;     /* A reference count */
 
 	/* Function pointer to an optional void function that is called
 	   right before the data is freed. This is only needed when the
@@ -813,7 +1620,10 @@ typedef struct
 	   reference counts need to be decremented.
 	*/
 #ifdef SAFE_CASTING
-	const char* type_name;
+	type_descriptor_p type; /* The type of the data (see SET_TYPE) */
+#endif
+#ifdef ALLOC_ATTRIBUTION
+	unsigned long alloc_seq;
 #endif
 	void (*release)(void *);
 } ref_counted_base_t, *ref_counted_base_p;
@@ -824,6 +1634,8 @@ void ref_counted_base_dec(void *data)
 	if (--((ref_counted_base_p)data)->cnt == 0)
 	{
 		if (debug_allocations) fprintf(stdout, "Free %p\n", data);
+		PROBE1(free, data)
+		ALLOC_FREE((ref_counted_base_p)data)
 		if (((ref_counted_base_p)data)->release != 0)
 			((ref_counted_base_p)data)->release(data);
 		else
@@ -831,33 +1643,43 @@ void ref_counted_base_dec(void *data)
 	}
 }
 
+#ifdef ALLOC_ATTRIBUTION
+#define SET_ALLOC_TYPE(T, X) ((ref_counted_base_p)X)->alloc_seq = alloc_attribute(#T, NULL, sizeof(*(X)));
+#else
+#define SET_ALLOC_TYPE(T, X)
+#endif
+
 #ifdef SAFE_CASTING
-#define SET_TYPE(T, X) ((ref_counted_base_p)X)->type_name = T;
-#define CAST(T,X) ((T)check_type(#T,X,__LINE__))
+#define SET_TYPE(T, X) ((ref_counted_base_p)X)->type = &T##_type_descriptor; SET_ALLOC_TYPE(T, X)
+#define CAST(T,X) ((T)check_type(&T##_type_descriptor,X,__LINE__))
 
-void *check_type(const char *type_name, void *value, int line)
+void *check_type(type_descriptor_p type, void *value, int line)
 {
 	if (value == 0) return NULL;
-	const char *value_type_name = ((ref_counted_base_p)value)->type_name;
-	if (strcmp(value_type_name, type_name) != 0)
+	type_descriptor_p value_type = ((ref_counted_base_p)value)->type;
+	if (value_type != type)
 	{
-		printf("line %d Error: castring %s to %s\n", line, ((ref_counted_base_p)value)->type_name, type_name); fflush(stdout);
+		printf("line %d Error: castring %s to %s\n", line, value_type == NULL ? "(no type)" : value_type->name, type->name); fflush(stdout);
 		exit(1);
 		return NULL;
 	}
 	return value;
 }
 #else
-#define SET_TYPE(T, X)
+#define SET_TYPE(T, X) SET_ALLOC_TYPE(T, X)
 #define CAST(T,X) ((T)(X))
 #endif
 
 void result_assign_ref_counted(result_p result, void *data, void (*print)(void *data, ostream_p ostream))
 {
 	if (debug_allocations) fprintf(stdout, "Allocated %p\n", data);
+	PROBE1(alloc, data)
 	((ref_counted_base_p)data)->cnt = 1;
 #ifdef SAFE_CASTING
-	((ref_counted_base_p)data)->type_name = "";
+	((ref_counted_base_p)data)->type = NULL;
+#endif
+#ifdef ALLOC_ATTRIBUTION
+	((ref_counted_base_p)data)->alloc_seq = 0;
 #endif
 	result->data = data;
 	result->inc = ref_counted_base_inc;
@@ -878,6 +1700,7 @@ typedef struct number_data
 	ref_counted_base_t _base;
 	long num;
 } *number_data_p;
+DEFINE_TYPE(number_data_p)
 
 #define NUMBER_DATA_NUM(R) (CAST(number_data_p,(R)->data)->num)
 
@@ -893,7 +1716,7 @@ void new_number_data(result_p result)
 	number_data_p number_data = MALLOC(struct number_data);
 	number_data->_base.release = 0;
 	result_assign_ref_counted(result, number_data, number_print);
-	SET_TYPE("number_data_p",number_data);
+	SET_TYPE(number_data_p, number_data);
 }
 
 
@@ -1008,7 +1831,9 @@ void text_buffer_next(text_buffer_p text_buffer)
 			  text_buffer->pos.cur_column = 1;
 			  break;
 		  default:
-			  text_buffer->pos.cur_column++;
+			  /* Continuation bytes of UTF-8 encoded code points are not counted */
+			  if (!UTF8_CONTINUATION(*text_buffer->info))
+				  text_buffer->pos.cur_column++;
 			  break;
 	  }
 	  text_buffer->pos.pos++;
@@ -1020,2626 +1845,11624 @@ bool text_buffer_end(text_buffer_p text_buffer) {
  	return text_buffer->pos.pos >= text_buffer->buffer_len;
 }
 
+/*	- When parse_heatmap (see 'Backtracking heatmap' below) is set, the
+	  moves backwards in the text buffer are counted */
+
+typedef struct heatmap *heatmap_p;
+THREAD_LOCAL heatmap_p parse_heatmap = NULL;
+void heatmap_rewind(heatmap_p heatmap, size_t distance);
+
 void text_buffer_set_pos(text_buffer_p text_file, text_pos_p text_pos)
 {
 	if (text_file->pos.pos == text_pos->pos)
 		return;
+	if (parse_heatmap != NULL && text_pos->pos < text_file->pos.pos)
+		heatmap_rewind(parse_heatmap, text_file->pos.pos - text_pos->pos);
 	text_file->pos = *text_pos;
 	text_file->info = text_file->buffer + text_pos->pos;
 }
 
 /*
-	Caching intermediate parse states
-	~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-	
-	One way to improve the performance of back-tracking recursive-descent
-	parser is to use a cache were intermediate results are stored.
-	Because there are various caching strategies an abstract interface
-	for caching is provided. The parser struct, to be defined below, has
-	a pointer to a function that, if not NULL, is called to query the
-	cache and return a cache item. As long as the success status is
-	unknown, the cache item may not be freed from memory (during a
-	successive call to the function).
+	- Function to move forward to a position for which the line and
+	  column numbers are not known. Instead of calling text_buffer_next
+	  for every character, whole lines are skipped with the help of memchr
+	  and only on the last line the columns are counted.
 */
 
-enum success_t { s_unknown, s_fail, s_success } ;
-
-typedef struct
+void text_buffer_advance_to(text_buffer_p text_buffer, size_t pos)
 {
-	enum success_t success;  /* Could said non-terminal be parsed from position */
-	result_t result;         /* If so, what result did it produce */
-	text_pos_t next_pos;     /* and from which position (with line and column numbers) should parsing continue */
-} cache_item_t, *cache_item_p;
+	if (pos > text_buffer->buffer_len)
+		pos = text_buffer->buffer_len;
+	if (pos <= text_buffer->pos.pos)
+		return;
+	const char *s = text_buffer->info;
+	const char *end = text_buffer->buffer + pos;
+	for (;;)
+	{
+		const char *nl = (const char*)memchr(s, '\n', end - s);
+		if (nl == NULL)
+			break;
+		text_buffer->pos.cur_line++;
+		text_buffer->pos.cur_column = 1;
+		s = nl + 1;
+	}
+	text_buffer->pos.cur_column = column_advance(text_buffer->pos.cur_column, s, end, text_buffer->tab_size);
+	text_buffer->pos.pos = pos;
+	text_buffer->info = end;
+}
 
 /*
-	For debugging the parser
-	~~~~~~~~~~~~~~~~~~~~~~~~
+	- Function to find the first occurence of a delimiter that is not
+	  preceded by the escape character (if not '\0'). Returns NULL if it
+	  does not occur before the end. (memchr is usually implemented with
+	  vector instructions, making this much faster than a loop.)
 */
 
-int depth = 0;
-bool debug_parse = FALSE;
-bool debug_nt = FALSE;
-ostream_p stdout_stream;
-
-#define DEBUG_ENTER(X) if (debug_parse) { DEBUG_TAB; printf("Enter: %s", X); depth += 2; }
-#define DEBUG_ENTER_P1(X,A) if (debug_parse) { DEBUG_TAB; printf("Enter: "); printf(X,A); depth += 2; }
-#define DEBUG_ENTER_P2(X,A,B) if (debug_parse) { DEBUG_TAB; printf("Enter: "); printf(X,A,B); depth += 2; }
-#define DEBUG_ENTER_P3(X,A,B,C) if (debug_parse) { DEBUG_TAB; printf("Enter: "); printf(X,A,B,C); depth += 2; }
-#define DEBUG_EXIT(X) if (debug_parse) { depth -=2; DEBUG_TAB; printf("Leave: %s", X); }
-#define DEBUG_EXIT_P1(X,A) if (debug_parse) { depth -=2; DEBUG_TAB; printf("Leave: "); printf(X,A); }
-#define DEBUG_TAB if (debug_parse) printf("%*.*s", depth, depth, "")
-#define DEBUG_NL if (debug_parse) printf("\n")
-#define DEBUG_PT(X) if (debug_parse) result_print(X, stdout_stream);
-#define DEBUG_PO(X) if (debug_parse) rules_print(stdout, X)
-#define DEBUG_PR(X) if (debug_parse) element_print(stdout, X)
-#define DEBUG_(X)  if (debug_parse) printf(X)
-#define DEBUG_P1(X,A) if (debug_parse) printf(X,A)
-
+const char *find_delimiter(const char *s, const char *end, const char *delimiter, char escape)
+{
+	size_t len = strlen(delimiter);
+	if (len == 0)
+		return s;
+	while (s < end)
+	{
+		const char *found = (const char*)memchr(s, delimiter[0], end - s);
+		if (found == NULL)
+			return NULL;
+		if (escape != '\0')
+		{
+			const char *escaped = (const char*)memchr(s, escape, found - s);
+			if (escaped != NULL)
+			{
+				s = escaped + 2;
+				continue;
+			}
+		}
+		if ((size_t)(end - found) >= len && memcmp(found, delimiter, len) == 0)
+			return found;
+		s = found + 1;
+	}
+	return NULL;
+}
 
 /*
-	Parser struct definition
+	Reading compressed input
 	~~~~~~~~~~~~~~~~~~~~~~~~
+
+	Large inputs are often stored compressed. Instead of decompressing
+	them to a temporary file first, the functions below decompress a file
+	directly into the buffer of a text buffer, which is terminated with a
+	null character. The format is recognized from the first bytes of the
+	file: gzip (when compiled with HAVE_ZLIB and linked with -lz) and
+	zstd (when compiled with HAVE_ZSTD and linked with -lzstd). Other
+	files are read as they are. When the uncompressed size is stored in
+	the file, the buffer is allocated with this size, otherwise it grows
+	by doubling. Because a corrupt file can store any size, the stored
+	size is limited to TEXT_LOAD_MAX_RATIO times the size of the file.
+
+	Because the parser back-tracks and looks ahead (for example when
+	scanning for a delimiter, or in compiled non-terminals), it can only
+	start when the whole input is in memory. Hence, the decompression is
+	overlapped with parsing by loading the next input on a helper thread
+	(with text_load_start), while the current input is parsed. The input
+	is taken over by a text buffer with text_load_finish, which waits for
+	the helper thread. Without threads (or when NO_THREADS is defined),
+	text_load_start loads the input itself.
 */
 
-typedef struct nt_stack *nt_stack_p;
+#define TEXT_LOAD_CHUNK 65536
+#define TEXT_LOAD_MAX_RATIO 16
 
 typedef struct
 {
-	text_buffer_p text_buffer;
-	nt_stack_p nt_stack;
-	cache_item_p (*cache_hit_function)(void *cache, size_t pos, const char *nt);
-	void *cache;
-} parser_t, *parser_p;
+	const char *file_name;
+	char *buffer;
+	size_t len;
+	size_t allocated;
+	const char *error;      /* NULL, when the file was loaded */
+	bool on_thread;         /* Whether it is loaded on the helper thread */
+#ifdef USE_THREADS
+	pthread_t thread;
+#endif
+} text_load_t, *text_load_p;
 
-void parser_init(parser_p parser, text_buffer_p text_buffer)
+void text_load_init(text_load_p load, const char *file_name)
 {
-	parser->text_buffer = text_buffer;
-	parser->nt_stack = NULL;
-	parser->cache_hit_function = 0;
-	parser->cache = NULL;
+	load->file_name = file_name;
+	load->buffer = NULL;
+	load->len = 0;
+	load->allocated = 0;
+	load->error = NULL;
+	load->on_thread = FALSE;
 }
 
-nt_stack_p nt_stack_push(const char *name, parser_p parser);
-nt_stack_p nt_stack_pop(nt_stack_p cur);
+/*	- Macros to recognize the format from the first bytes of a file */
 
-/*
-	Parsing functions
-	~~~~~~~~~~~~~~~~~
-	
-	The parsing functions are described top-down, starting with the function
-	to parse a non-terminal, which is the top-level function to be called to
-	parse a text buffer.
-	
-*/
+#define TEXT_LOAD_GZIP(M,N) ((N) >= 2 && (M)[0] == 0x1F && (M)[1] == 0x8B)
+#define TEXT_LOAD_ZSTD(M,N) ((N) >= 4 && (M)[0] == 0x28 && (M)[1] == 0xB5 && (M)[2] == 0x2F && (M)[3] == 0xFD)
+#define TEXT_LOAD_COMPRESSED(M,N) (TEXT_LOAD_GZIP(M,N) || TEXT_LOAD_ZSTD(M,N))
 
-bool parse_rule(parser_p parser, element_p element, const result_p prev_result, rule_p rules, result_p rule_result);
+/*	- Function to make room for at least the given number of characters
+	  after the loaded part (and the terminating null character) */
 
-bool parse_nt(parser_p parser, non_terminal_p non_term, result_p result)
+void text_load_reserve(text_load_p load, size_t nr_chars)
 {
-	ENTER_RESULT_CONTEXT
-	const char *nt = non_term->name;
-
-	DEBUG_ENTER_P3("parse_nt(%s) at %d.%d", nt, parser->text_buffer->pos.cur_line, parser->text_buffer->pos.cur_column); DEBUG_NL;
+	if (load->len + nr_chars + 1 <= load->allocated)
+		return;
+	size_t new_allocated = load->allocated > 0 ? 2 * load->allocated : load->len + nr_chars + 1;
+	while (new_allocated < load->len + nr_chars + 1)
+		new_allocated *= 2;
+	char *new_buffer = MALLOC_N(new_allocated, char);
+	if (load->len > 0)
+		memcpy(new_buffer, load->buffer, load->len);
+	FREE(load->buffer);
+	load->buffer = new_buffer;
+	load->allocated = new_allocated;
+}
 
-	/* First try the cache (if available) */
-	cache_item_p cache_item = NULL;
-	if (parser->cache_hit_function != NULL)
+void text_load_plain(text_load_p load, FILE *f)
+{
+	fseek(f, 0L, SEEK_END);
+	long length = ftell(f);
+	fseek(f, 0L, SEEK_SET);
+	/* One more, to read the end of the file without growing the buffer */
+	text_load_reserve(load, length > 0 ? (size_t)length + 1 : TEXT_LOAD_CHUNK);
+	for (;;)
 	{
-		cache_item = parser->cache_hit_function(parser->cache, parser->text_buffer->pos.pos, nt);
-		if (cache_item != NULL)
-		{
-			if (cache_item->success == s_success)
-			{
-				DEBUG_EXIT_P1("parse_nt(%s) CACHE SUCCESS = ", nt);  DEBUG_PT(&cache_item->result)  DEBUG_NL;
-				result_assign(result, &cache_item->result);
-				text_buffer_set_pos(parser->text_buffer, &cache_item->next_pos);
-				EXIT_RESULT_CONTEXT
-				return TRUE;
-			}
-			else if (cache_item->success == s_fail)
-			{
-				DEBUG_EXIT_P1("parse_nt(%s) CACHE FAIL", nt);  DEBUG_NL;
-				EXIT_RESULT_CONTEXT
-				return FALSE;
-			}
-			cache_item->success = s_fail; // To deal with indirect left-recurssion
-		}
+		if (load->len + 1 == load->allocated)
+			text_load_reserve(load, TEXT_LOAD_CHUNK);
+		size_t nr_read = fread(load->buffer + load->len, 1, load->allocated - 1 - load->len, f);
+		if (nr_read == 0)
+			break;
+		load->len += nr_read;
 	}
-	
-	/* Push the current non-terminal on stack */
-	parser->nt_stack = nt_stack_push(nt, parser);
+	if (ferror(f))
+		load->error = "read error";
+}
 
-	if (debug_nt)
-	{   printf("%*.*s", depth, depth, "");
-		printf("Enter: %s\n", nt);
-		depth += 2; 
-	}
+/*	- Function to make room for the uncompressed size stored in the file
+	  (limited by the size of the file) */
 
-	/* Try the normal rules in order of declaration */
-	bool parsed_a_rule = FALSE;
-	for (rule_p rule = non_term->normal; rule != NULL; rule = rule->next )
+void text_load_reserve_stored_size(text_load_p load, FILE *f, size_t size)
+{
+	long pos = ftell(f);
+	fseek(f, 0L, SEEK_END);
+	long file_size = ftell(f);
+	fseek(f, pos, SEEK_SET);
+	if (file_size <= 0)
+		return;
+	size_t max_size = (size_t)file_size * TEXT_LOAD_MAX_RATIO;
+	text_load_reserve(load, (size < max_size ? size : max_size) + 1);
+}
+
+#ifdef HAVE_ZLIB
+
+void text_load_gzip(text_load_p load, FILE *f)
+{
+	/* The last four bytes hold the uncompressed size (modulo 2^32) of the last member */
+	byte size[4];
+	if (fseek(f, -4L, SEEK_END) == 0 && fread(size, 1, 4, f) == 4)
+		text_load_reserve_stored_size(load, f, size[0] | (size[1] << 8) | (size[2] << 16) | ((size_t)size[3] << 24));
+	gzFile gz = gzopen(load->file_name, "rb");
+	if (gz == NULL)
 	{
-		DECL_RESULT(start)
-		if (parse_rule(parser, rule->elements, &start, rule, result))
+		load->error = "cannot open gzip file";
+		return;
+	}
+	gzbuffer(gz, TEXT_LOAD_CHUNK);
+	for (;;)
+	{
+		if (load->len + 1 >= load->allocated)
+			text_load_reserve(load, TEXT_LOAD_CHUNK);
+		size_t room = load->allocated - 1 - load->len;
+		int nr_read = gzread(gz, load->buffer + load->len, room < (1U << 30) ? (unsigned)room : (1U << 30));
+		if (nr_read < 0)
 		{
-			parsed_a_rule = TRUE;
-			DISP_RESULT(start)
+			load->error = "corrupt gzip file";
 			break;
 		}
-		DISP_RESULT(start)
+		if (nr_read == 0)
+			break;
+		load->len += nr_read;
 	}
-	
-	if (!parsed_a_rule)
+	gzclose(gz);
+}
+
+#endif
+
+#ifdef HAVE_ZSTD
+
+void text_load_zstd(text_load_p load, FILE *f)
+{
+	size_t in_size = ZSTD_DStreamInSize();
+	char *in_buffer = MALLOC_N(in_size, char);
+	ZSTD_DStream *stream = ZSTD_createDStream();
+	ZSTD_initDStream(stream);
+	bool first = TRUE;
+	size_t result = 0;
+	for (;;)
 	{
-		/* No rule was succesful */
-		DEBUG_EXIT_P1("parse_nt(%s) - failed", nt);  DEBUG_NL;
-		if (debug_nt)
-		{   depth -= 2;
-			printf("%*.*s", depth, depth, "");
-			printf("Failed: %s\n", nt);
+		size_t nr_read = fread(in_buffer, 1, in_size, f);
+		if (nr_read == 0)
+			break;
+		if (first)
+		{
+			unsigned long long content_size = ZSTD_getFrameContentSize(in_buffer, nr_read);
+			if (content_size != ZSTD_CONTENTSIZE_UNKNOWN && content_size != ZSTD_CONTENTSIZE_ERROR)
+				text_load_reserve_stored_size(load, f, (size_t)content_size);
+			first = FALSE;
 		}
-		
-		/* Pop the current non-terminal from the stack */
-		parser->nt_stack = nt_stack_pop(parser->nt_stack);
-		
-		EXIT_RESULT_CONTEXT
-		return FALSE;
-	}
-	
-	/* Now that a normal rule was succesfull, repeatingly try left-recursive rules */
-	while (parsed_a_rule)
-	{
-		parsed_a_rule = FALSE;
-		for (rule_p rule = non_term->recursive; rule != NULL; rule = rule->next)
+		ZSTD_inBuffer input = { in_buffer, nr_read, 0 };
+		while (input.pos < input.size)
 		{
-			DECL_RESULT(start_result)
-			if (rule->rec_start_function != NULL)
-			{
-				if (!rule->rec_start_function(result, &start_result))
-				{
-					DISP_RESULT(start_result)
-					continue;
-				}
-			}
-			DECL_RESULT(rule_result)
-			if (parse_rule(parser, rule->elements, &start_result, rule, &rule_result))
+			if (load->len + 1 >= load->allocated)
+				text_load_reserve(load, TEXT_LOAD_CHUNK);
+			ZSTD_outBuffer output = { load->buffer + load->len, load->allocated - 1 - load->len, 0 };
+			result = ZSTD_decompressStream(stream, &output, &input);
+			if (ZSTD_isError(result))
 			{
-				parsed_a_rule = TRUE;
-				result_assign(result, &rule_result);
-				DISP_RESULT(rule_result)
-				DISP_RESULT(start_result)
+				load->error = "corrupt zstd file";
 				break;
 			}
-			DISP_RESULT(rule_result)
-			DISP_RESULT(start_result)
+			load->len += output.pos;
 		}
+		if (load->error != NULL)
+			break;
 	}
+	if (load->error == NULL && result != 0)
+		load->error = "truncated zstd file";
+	ZSTD_freeDStream(stream);
+	FREE(in_buffer);
+}
 
-	DEBUG_EXIT_P1("parse_nt(%s) = ", nt);
-	DEBUG_PT(result); DEBUG_NL;
-	if (debug_nt)
-	{   depth -= 2;
-		printf("%*.*s", depth, depth, "");
-		printf("Parsed: %s\n", nt);
+#endif
+
+void text_load(text_load_p load)
+{
+	FILE *f = fopen(load->file_name, "rb");
+	if (f == NULL)
+	{
+		load->error = "cannot open file";
+		return;
 	}
-	
-	/* Update the cache item, if available */
-	if (cache_item != NULL)
+	byte magic[4] = { 0, 0, 0, 0 };
+	size_t nr_magic = fread(magic, 1, 4, f);
+	fseek(f, 0L, SEEK_SET);
+	if (TEXT_LOAD_GZIP(magic, nr_magic))
 	{
-		result_assign(&cache_item->result, result);
-		cache_item->success = s_success;
-		cache_item->next_pos = parser->text_buffer->pos;
+#ifdef HAVE_ZLIB
+		text_load_gzip(load, f);
+#else
+		load->error = "gzip file (compile with HAVE_ZLIB)";
+#endif
 	}
-
-	/* Pop the current non-terminal from the stack */
-	parser->nt_stack = nt_stack_pop(parser->nt_stack);
-	
-	EXIT_RESULT_CONTEXT
-	return TRUE;
+	else if (TEXT_LOAD_ZSTD(magic, nr_magic))
+	{
+#ifdef HAVE_ZSTD
+		text_load_zstd(load, f);
+#else
+		load->error = "zstd file (compile with HAVE_ZSTD)";
+#endif
+	}
+	else
+		text_load_plain(load, f);
+	fclose(f);
+	text_load_reserve(load, 0);
+	load->buffer[load->len] = '\0';
 }
 
-/*
-	Parsing a rule
-	~~~~~~~~~~~~~~
-	
-	This function is called to parse (the remainder of) a rule. If it fails,
-	the current position in text buffer is reset to the position it was at
-	the start of the call. This function first tries to parse the first
-	element of the rule. If this is succeeds, the function will be called
-	recursively for the rest of the rule.
-	
-*/
+#ifdef USE_THREADS
 
-bool parse_element(parser_p parser, element_p element, const result_p prev_result, result_p result);
-bool parse_seq(parser_p parser, element_p element, const result_p prev_seq, const result_p prev, rule_p rule, result_p result);
+void *text_load_thread(void *data)
+{
+	text_load((text_load_p)data);
+	return NULL;
+}
 
-bool parse_rule(parser_p parser, element_p element, const result_p prev_result, rule_p rule, result_p rule_result)
+#endif
+
+void text_load_start(text_load_p load, const char *file_name)
 {
-	ENTER_RESULT_CONTEXT
-	DEBUG_ENTER_P2("parse_rule at %d.%d: ", parser->text_buffer->pos.cur_line, parser->text_buffer->pos.cur_column);
-	DEBUG_PR(element); DEBUG_NL;
+	text_load_init(load, file_name);
+#ifdef USE_THREADS
+	load->on_thread = pthread_create(&load->thread, NULL, text_load_thread, load) == 0;
+	if (load->on_thread)
+		return;
+#endif
+	text_load(load);
+}
 
-	if (element == NULL)
+/*	- Function to wait for the input and assign it to the text buffer (which
+	  owns the buffer from then on). Returns FALSE if loading failed. */
+
+bool text_load_finish(text_load_p load, text_buffer_p text_buffer)
+{
+#ifdef USE_THREADS
+	if (load->on_thread)
+		pthread_join(load->thread, NULL);
+#endif
+	if (load->error != NULL)
 	{
-		/* At the end of the rule: */
-		if (rule == NULL || rule->end_function == 0)
-			result_assign(rule_result, prev_result);
-		else if (!rule->end_function(prev_result, rule->end_function_data, rule_result))
-		{
-			DEBUG_EXIT("parse_rule failed by end function "); DEBUG_NL;
-			return FALSE;
-		}
-		DEBUG_EXIT("parse_rule = ");
-		DEBUG_PT(rule_result); DEBUG_NL;
-		EXIT_RESULT_CONTEXT
-		return TRUE;
+		FREE(load->buffer);
+		load->buffer = NULL;
+		return FALSE;
 	}
+	text_buffer->tab_size = 4;
+	text_buffer->buffer_len = load->len;
+	text_buffer->buffer = load->buffer;
+	text_buffer->info = text_buffer->buffer;
+	text_buffer->pos.pos = 0;
+	text_buffer->pos.cur_line = 1;
+	text_buffer->pos.cur_column = 1;
+	return TRUE;
+}
 
-	/* If the first element is optional and should be avoided, first an attempt
-	   will be made to skip the element and parse the remainder of the rule */
-	if (element->optional && element->avoid)
+bool text_buffer_from_compressed_file(text_buffer_p text_buffer, const char *file_name)
+{
+	text_load_t load;
+	text_load_init(&load, file_name);
+	text_load(&load);
+	return text_load_finish(&load, text_buffer);
+}
+
+/*
+	Loading many files
+	~~~~~~~~~~~~~~~~~~
+
+	When many small files are parsed, the time is dominated by the system
+	calls to open and read them, while the parser waits. The batch loader
+	below keeps a window of files in flight. On Linux, the files are opened
+	and read with io_uring (using the system calls directly), such that
+	the requests for all the files in the window are handled by the kernel
+	while a file is parsed. Otherwise (or when io_uring is not permitted or
+	the kernel does not support opening and reading files with it) the
+	files are read by a pool of threads. The loaded files are handed
+	to the parse function in the order of the given file names, on the
+	calling thread, because the parser is not thread safe (for example the
+	expected elements are global). All methods load a file with text_load,
+	thus compressed files are decompressed (see text_load_start), except
+	that io_uring reads the file as it is: when it turns out to be
+	compressed, it is loaded again with text_load. The buffer of the text
+	buffer is terminated with a null character and freed after the parse
+	function returns.
+*/
+
+typedef struct
+{
+	int window;                  /* Number of files in flight */
+	int nr_threads;              /* For the pool of threads */
+	bool use_io_uring;
+	bool used_io_uring;          /* Set by batch_load_files */
+	int nr_failed;               /* Set by batch_load_files */
+} batch_load_t, *batch_load_p;
+
+typedef void (*batch_parse_function_p)(void *data, int file_nr, text_buffer_p text_buffer, const char *error);
+
+void batch_load_init(batch_load_p batch)
+{
+	batch->window = 16;
+	batch->nr_threads = 4;
+	batch->use_io_uring = TRUE;
+	batch->used_io_uring = FALSE;
+	batch->nr_failed = 0;
+}
+
+/*	- Function to hand a loaded file to the parse function */
+
+void batch_parse_loaded(batch_load_p batch, int file_nr, text_load_p load, batch_parse_function_p parse, void *data)
+{
+	text_buffer_t text_buffer;
+	const char *error = load->error;
+	if (!text_load_finish(load, &text_buffer))
 	{
-		/* If a add skip function is defined, apply it. (An add skip function
-		   can be used to process the absence of the element with the result.)
-		   Otherwise, if a add function is defined, it will be called with an
-		   'empty' result, signaling that no element was parsed.
-		   Otherwise, the previous result is used. */
-		DECL_RESULT(skip_result);
-		if (element->add_skip_function != NULL)
+		batch->nr_failed++;
+		parse(data, file_nr, NULL, error);
+		return;
+	}
+	parse(data, file_nr, &text_buffer, NULL);
+	FREE((char*)text_buffer.buffer);
+}
+
+/*	- Function to load files one by one, from the given file */
+
+void batch_load_files_sequential(batch_load_p batch, const char **file_names, int file_nr, int nr_files, batch_parse_function_p parse, void *data)
+{
+	for (; file_nr < nr_files; file_nr++)
+	{
+		text_load_t load;
+		text_load_init(&load, file_names[file_nr]);
+		text_load(&load);
+		batch_parse_loaded(batch, file_nr, &load, parse, data);
+	}
+}
+
+#ifdef USE_IO_URING
+
+/*	- The rings of io_uring, mapped in memory */
+
+typedef struct
+{
+	int fd;
+	unsigned int entries;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+	unsigned int nr_to_submit;
+	unsigned int nr_in_flight;   /* Submitted, or to be submitted, without a completion */
+} uring_t, *uring_p;
+
+bool uring_init(uring_p uring, unsigned int entries)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	uring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (uring->fd < 0)
+		return FALSE;
+	uring->entries = params.sq_entries;
+	uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	uring->sq_ring = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+	uring->cq_ring = mmap(NULL, uring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING);
+	uring->sqes = (struct io_uring_sqe*)mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+	if (uring->sq_ring == MAP_FAILED || uring->cq_ring == MAP_FAILED || uring->sqes == MAP_FAILED)
+	{
+		if (uring->sq_ring != MAP_FAILED)
+			munmap(uring->sq_ring, uring->sq_ring_size);
+		if (uring->cq_ring != MAP_FAILED)
+			munmap(uring->cq_ring, uring->cq_ring_size);
+		if (uring->sqes != MAP_FAILED)
+			munmap(uring->sqes, uring->sqes_size);
+		close(uring->fd);
+		return FALSE;
+	}
+	char *sq_ring = (char*)uring->sq_ring;
+	uring->sq_head = (unsigned int*)(sq_ring + params.sq_off.head);
+	uring->sq_tail = (unsigned int*)(sq_ring + params.sq_off.tail);
+	uring->sq_mask = (unsigned int*)(sq_ring + params.sq_off.ring_mask);
+	uring->sq_array = (unsigned int*)(sq_ring + params.sq_off.array);
+	char *cq_ring = (char*)uring->cq_ring;
+	uring->cq_head = (unsigned int*)(cq_ring + params.cq_off.head);
+	uring->cq_tail = (unsigned int*)(cq_ring + params.cq_off.tail);
+	uring->cq_mask = (unsigned int*)(cq_ring + params.cq_off.ring_mask);
+	uring->cqes = (struct io_uring_cqe*)(cq_ring + params.cq_off.cqes);
+	uring->nr_to_submit = 0;
+	uring->nr_in_flight = 0;
+	return TRUE;
+}
+
+/*	- Function to check that the kernel supports the given operations.
+	  (Opening files and getting their size is supported since Linux 5.6,
+	  while io_uring itself exists since 5.1.) */
+
+bool uring_supports(uring_p uring, const unsigned char *opcodes, int nr_opcodes)
+{
+	size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe = (struct io_uring_probe*)MALLOC_N(size, char);
+	memset(probe, 0, size);
+	bool supported = syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+	for (int i = 0; i < nr_opcodes && supported; i++)
+		supported = opcodes[i] <= probe->last_op && (probe->ops[opcodes[i]].flags & IO_URING_OP_SUPPORTED) != 0;
+	FREE(probe);
+	return supported;
+}
+
+void uring_free(uring_p uring)
+{
+	munmap(uring->sqes, uring->sqes_size);
+	munmap(uring->cq_ring, uring->cq_ring_size);
+	munmap(uring->sq_ring, uring->sq_ring_size);
+	close(uring->fd);
+}
+
+/*	- Function to get the next submission entry. The caller should make
+	  sure that there are no more entries in flight than the ring holds. */
+
+struct io_uring_sqe *uring_get_sqe(uring_p uring, unsigned char opcode, unsigned long long user_data)
+{
+	unsigned int tail = *uring->sq_tail;
+	unsigned int index = tail & *uring->sq_mask;
+	struct io_uring_sqe *sqe = &uring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->user_data = user_data;
+	uring->sq_array[index] = index;
+	__atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	uring->nr_to_submit++;
+	uring->nr_in_flight++;
+	return sqe;
+}
+
+/*	- Function to submit the entries and wait for the given number of
+	  completions */
+
+bool uring_enter(uring_p uring, unsigned int min_complete)
+{
+	int nr_submitted = syscall(__NR_io_uring_enter, uring->fd, uring->nr_to_submit, min_complete,
+							   min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	if (nr_submitted < 0)
+		return FALSE;
+	uring->nr_to_submit -= nr_submitted;
+	return TRUE;
+}
+
+/*	- The state of a file in the window. The user data of an entry is
+	  the index of the slot times four plus the operation. */
+
+enum batch_op_t { batch_open, batch_statx, batch_read, batch_close };
+
+typedef struct
+{
+	text_load_t load;
+	int fd;
+	struct statx statx;
+	int nr_pending;              /* The number of operations in flight */
+	bool read_started;
+	bool done;
+} batch_slot_t, *batch_slot_p;
+
+void batch_slot_read(uring_p uring, batch_slot_p slot, int slot_nr)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(uring, IORING_OP_READ, 4 * slot_nr + batch_read);
+	sqe->fd = slot->fd;
+	sqe->addr = (unsigned long)(slot->load.buffer + slot->load.len);
+	sqe->len = slot->statx.stx_size - slot->load.len;
+	sqe->off = slot->load.len;
+	slot->nr_pending++;
+}
+
+/*	- Function to process a completion. When draining, no operations are
+	  started, and the slot is left as it is. */
+
+void batch_slot_complete(uring_p uring, batch_slot_t *slots, struct io_uring_cqe *cqe, bool draining)
+{
+	int slot_nr = cqe->user_data / 4;
+	enum batch_op_t op = (enum batch_op_t)(cqe->user_data % 4);
+	batch_slot_p slot = &slots[slot_nr];
+	uring->nr_in_flight--;
+	if (op == batch_close)
+		return;
+	slot->nr_pending--;
+	if (cqe->res < 0 && slot->load.error == NULL)
+		slot->load.error = op == batch_read ? "read error" : "cannot open file";
+	else if (op == batch_open)
+		slot->fd = cqe->res;
+	else if (op == batch_read)
+	{
+		slot->load.len += cqe->res;
+		if (cqe->res > 0 && slot->load.len < slot->statx.stx_size && !draining)
+			batch_slot_read(uring, slot, slot_nr);
+	}
+	if (slot->nr_pending > 0 || draining)
+		return;
+	if (slot->load.error == NULL && !slot->read_started)
+	{
+		/* Opened and the size is known: read the whole file at once */
+		slot->read_started = TRUE;
+		slot->load.allocated = slot->statx.stx_size + 1;
+		slot->load.buffer = MALLOC_N(slot->load.allocated, char);
+		if (slot->statx.stx_size > 0)
 		{
-			if (!element->add_skip_function(prev_result, &skip_result))
-			{
-				DISP_RESULT(skip_result);
-	            DEBUG_EXIT("parse_rule failed due to add skip function"); DEBUG_NL;
-				EXIT_RESULT_CONTEXT
-				return FALSE;
-			}
+			batch_slot_read(uring, slot, slot_nr);
+			return;
 		}
-		else if (element->add_function != NULL)
+	}
+	if (slot->fd >= 0)
+	{
+		struct io_uring_sqe *sqe = uring_get_sqe(uring, IORING_OP_CLOSE, 4 * slot_nr + batch_close);
+		sqe->fd = slot->fd;
+		slot->fd = -1;
+	}
+	if (slot->load.error == NULL)
+		slot->load.buffer[slot->load.len] = '\0';
+	slot->done = TRUE;
+}
+
+void batch_reap(uring_p uring, batch_slot_t *slots, bool draining)
+{
+	unsigned int head = *uring->cq_head;
+	unsigned int tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++)
+		batch_slot_complete(uring, slots, &uring->cqes[head & *uring->cq_mask], draining);
+	__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*	- Function to wait until all operations have completed, without
+	  starting new ones. Returns FALSE when io_uring fails, in which case
+	  the kernel may still write into the buffers and the slots. */
+
+bool batch_drain(uring_p uring, batch_slot_t *slots)
+{
+	while (uring->nr_in_flight > 0)
+	{
+		if (!uring_enter(uring, 1) && errno != EINTR)
+			return FALSE;
+		batch_reap(uring, slots, TRUE);
+	}
+	return TRUE;
+}
+
+/*	When io_uring fails while loading, the operations in flight are
+	drained before the buffers are freed, and the remaining files are
+	loaded one by one. When even draining fails, the buffers and the slots
+	are not freed (leaking them), because the kernel might still write
+	into them. */
+
+bool batch_load_files_io_uring(batch_load_p batch, const char **file_names, int nr_files, batch_parse_function_p parse, void *data)
+{
+	/* Each file has at most two operations in flight, and a close */
+	uring_t uring;
+	unsigned int entries = 4;
+	while (entries < 3 * (unsigned int)batch->window)
+		entries *= 2;
+	if (!uring_init(&uring, entries))
+		return FALSE;
+	static const unsigned char opcodes[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE };
+	if (!uring_supports(&uring, opcodes, sizeof(opcodes)))
+	{
+		uring_free(&uring);
+		return FALSE;
+	}
+	batch_slot_t *slots = MALLOC_N(batch->window, batch_slot_t);
+	int next_file_nr = 0;
+	for (int file_nr = 0; file_nr < nr_files; file_nr++)
+	{
+		/* Start loading the files in the window */
+		for (; next_file_nr < nr_files && next_file_nr < file_nr + batch->window; next_file_nr++)
 		{
-			DECL_RESULT(empty);
-			if (!element->add_function(prev_result, &empty, &skip_result))
+			int slot_nr = next_file_nr % batch->window;
+			batch_slot_p slot = &slots[slot_nr];
+			text_load_init(&slot->load, file_names[next_file_nr]);
+			slot->fd = -1;
+			slot->nr_pending = 2;
+			slot->read_started = FALSE;
+			slot->done = FALSE;
+			struct io_uring_sqe *sqe = uring_get_sqe(&uring, IORING_OP_OPENAT, 4 * slot_nr + batch_open);
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (unsigned long)file_names[next_file_nr];
+			sqe->open_flags = O_RDONLY;
+			sqe = uring_get_sqe(&uring, IORING_OP_STATX, 4 * slot_nr + batch_statx);
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (unsigned long)file_names[next_file_nr];
+			sqe->len = STATX_SIZE;
+			sqe->off = (unsigned long)&slot->statx;
+		}
+
+		/* Process the completions until the file is loaded */
+		batch_slot_p slot = &slots[file_nr % batch->window];
+		bool failed = FALSE;
+		for (bool wait = FALSE; !slot->done && !failed; wait = TRUE)
+		{
+			failed = (wait || uring.nr_to_submit > 0) && !uring_enter(&uring, wait ? 1 : 0) && errno != EINTR;
+			if (!failed)
+				batch_reap(&uring, slots, FALSE);
+		}
+		if (failed)
+		{
+			/* Abort: drain, drop the files that were not parsed, and load them
+			   (and the other remaining files) one by one */
+			if (batch_drain(&uring, slots))
 			{
-				DISP_RESULT(empty);
-				DISP_RESULT(skip_result);
-	            DEBUG_EXIT("parse_rule failed due to add function"); DEBUG_NL;
-				EXIT_RESULT_CONTEXT
-				return FALSE;
+				for (int i = file_nr; i < next_file_nr; i++)
+				{
+					batch_slot_p other = &slots[i % batch->window];
+					if (other->fd >= 0)
+						close(other->fd);
+					FREE(other->load.buffer);
+				}
+				FREE(slots);
 			}
-			DISP_RESULT(empty);
+			uring_free(&uring);
+			batch_load_files_sequential(batch, file_names, file_nr, nr_files, parse, data);
+			return TRUE;
 		}
-		else
-			result_assign(&skip_result, prev_result);
-			
-		if (parse_rule(parser, element->next, &skip_result, rule, rule_result))
+		if (uring.nr_to_submit > 0)
+			uring_enter(&uring, 0);
+		if (slot->load.error == NULL && TEXT_LOAD_COMPRESSED((byte*)slot->load.buffer, slot->load.len))
 		{
-			DISP_RESULT(skip_result);
-            DEBUG_EXIT("parse_rule = ");
-            DEBUG_PT(rule_result); DEBUG_NL;
-			EXIT_RESULT_CONTEXT
-			return TRUE;
+			/* Load a compressed file again, to decompress it */
+			FREE(slot->load.buffer);
+			text_load_init(&slot->load, file_names[file_nr]);
+			text_load(&slot->load);
 		}
-		DISP_RESULT(skip_result);
+		batch_parse_loaded(batch, file_nr, &slot->load, parse, data);
+	}
+	/* Wait for the last closes */
+	if (batch_drain(&uring, slots))
+		FREE(slots);
+	uring_free(&uring);
+	return TRUE;
+}
+
+#endif
+
+#ifdef USE_THREADS
+
+/*	- The state shared by the pool of threads */
+
+typedef struct
+{
+	const char **file_names;
+	int nr_files;
+	int window;
+	text_load_t *loads;          /* For each file in the window */
+	bool *loaded;
+	int next_file_nr;            /* The next file to load */
+	int nr_parsed;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} batch_pool_t, *batch_pool_p;
+
+void *batch_pool_thread(void *data)
+{
+	batch_pool_p pool = (batch_pool_p)data;
+	pthread_mutex_lock(&pool->mutex);
+	for (;;)
+	{
+		while (pool->next_file_nr < pool->nr_files && pool->next_file_nr >= pool->nr_parsed + pool->window)
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		if (pool->next_file_nr >= pool->nr_files)
+			break;
+		int file_nr = pool->next_file_nr++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		text_load_p load = &pool->loads[file_nr % pool->window];
+		text_load_init(load, pool->file_names[file_nr]);
+		text_load(load);
+
+		pthread_mutex_lock(&pool->mutex);
+		pool->loaded[file_nr % pool->window] = TRUE;
+		pthread_cond_broadcast(&pool->cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+bool batch_load_files_threads(batch_load_p batch, const char **file_names, int nr_files, batch_parse_function_p parse, void *data)
+{
+	batch_pool_t pool;
+	pool.file_names = file_names;
+	pool.nr_files = nr_files;
+	pool.window = batch->window;
+	pool.loads = MALLOC_N(batch->window, text_load_t);
+	pool.loaded = MALLOC_N(batch->window, bool);
+	for (int i = 0; i < batch->window; i++)
+		pool.loaded[i] = FALSE;
+	pool.next_file_nr = 0;
+	pool.nr_parsed = 0;
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+	pthread_t *threads = MALLOC_N(batch->nr_threads, pthread_t);
+	int nr_threads = 0;
+	while (nr_threads < batch->nr_threads && pthread_create(&threads[nr_threads], NULL, batch_pool_thread, &pool) == 0)
+		nr_threads++;
+	if (nr_threads > 0)
+		for (int file_nr = 0; file_nr < nr_files; file_nr++)
+		{
+			int slot_nr = file_nr % batch->window;
+			pthread_mutex_lock(&pool.mutex);
+			while (!pool.loaded[slot_nr])
+				pthread_cond_wait(&pool.cond, &pool.mutex);
+			pthread_mutex_unlock(&pool.mutex);
+
+			batch_parse_loaded(batch, file_nr, &pool.loads[slot_nr], parse, data);
+
+			pthread_mutex_lock(&pool.mutex);
+			pool.loaded[slot_nr] = FALSE;
+			pool.nr_parsed++;
+			pthread_cond_broadcast(&pool.cond);
+			pthread_mutex_unlock(&pool.mutex);
+		}
+	for (int i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_cond_destroy(&pool.cond);
+	pthread_mutex_destroy(&pool.mutex);
+	FREE(threads);
+	FREE(pool.loaded);
+	FREE(pool.loads);
+	return nr_threads > 0;
+}
+
+#endif
+
+void batch_load_files(batch_load_p batch, const char **file_names, int nr_files, batch_parse_function_p parse, void *data)
+{
+	batch->used_io_uring = FALSE;
+	batch->nr_failed = 0;
+	if (batch->window < 1)
+		batch->window = 1;
+#ifdef USE_IO_URING
+	if (batch->use_io_uring && batch_load_files_io_uring(batch, file_names, nr_files, parse, data))
+	{
+		batch->used_io_uring = TRUE;
+		return;
+	}
+#endif
+#ifdef USE_THREADS
+	if (batch->nr_threads > 0 && batch_load_files_threads(batch, file_names, nr_files, parse, data))
+		return;
+#endif
+	batch_load_files_sequential(batch, file_names, 0, nr_files, parse, data);
+}
+
+/*
+	Caching intermediate parse states
+	~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+	
+	One way to improve the performance of back-tracking recursive-descent
+	parser is to use a cache were intermediate results are stored.
+	Because there are various caching strategies an abstract interface
+	for caching is provided. The parser struct, to be defined below, has
+	a pointer to a function that, if not NULL, is called to query the
+	cache and return a cache item. As long as the success status is
+	unknown, the cache item may not be freed from memory (during a
+	successive call to the function). If the parser struct also has a
+	pointer to a function to set the result, this function is called when
+	the non-terminal has been parsed (or failed to be parsed) with the
+	updated cache item. This allows a cache to store the information in
+	some other (more compact) form and to reuse the cache item.
+*/
+
+enum success_t { s_unknown, s_fail, s_success } ;
+
+typedef struct parse_error *parse_error_p;
+
+typedef struct
+{
+	enum success_t success;  /* Could said non-terminal be parsed from position */
+	result_t result;         /* If so, what result did it produce */
+	text_pos_t next_pos;     /* and from which position (with line and column numbers) should parsing continue */
+	parse_error_p errors;    /* and from which errors was recovered (see parse_recover) */
+} cache_item_t, *cache_item_p;
+
+/*	- Functions to initialize and release a cache item, and to move the
+	  outcome of one item into another. The errors are owned by the item
+	  (the parser adds copies of them to its own errors on a hit). */
+
+parse_error_p parse_error_list_copy(parse_error_p errors, parse_error_p *ref_last);
+void parse_error_list_free(parse_error_p errors);
+
+void cache_item_init(cache_item_p item)
+{
+	item->success = s_unknown;
+	RESULT_INIT(&item->result);
+	item->errors = NULL;
+}
+
+void cache_item_release(cache_item_p item)
+{
+	RESULT_RELEASE(&item->result);
+	parse_error_list_free(item->errors);
+	item->errors = NULL;
+}
+
+void cache_item_write_back(cache_item_p item, cache_item_p outcome)
+{
+	item->success = outcome->success;
+	item->next_pos = outcome->next_pos;
+	result_transfer(&item->result, &outcome->result);
+	parse_error_list_free(item->errors);
+	item->errors = outcome->errors;
+	outcome->errors = NULL;
+}
+
+/*
+	All caches below start with the following struct with statistics,
+	such that they can be compared with the same functions. A lookup is a
+	hit when the outcome (success or failure) was known. A store is the
+	creation of an item in the cache, and an eviction is the removal of an
+	item before the cache is freed, such that the number of items is the
+	number of stores minus the number of evictions. (Writing the outcome
+	into an item that already exists is not counted. The compact cache
+	only has items for successes, as failures are stored as bits.)
+*/
+
+typedef struct
+{
+	unsigned long lookups;
+	unsigned long success_hits;
+	unsigned long fail_hits;
+	unsigned long stores;
+	unsigned long evictions;
+	size_t nr_items;         /* Number of items currently stored */
+	size_t max_items;        /* Maximum number of items stored at any time */
+} cache_stats_t, *cache_stats_p;
+
+void cache_stats_init(cache_stats_p stats)
+{
+	stats->lookups = 0;
+	stats->success_hits = 0;
+	stats->fail_hits = 0;
+	stats->stores = 0;
+	stats->evictions = 0;
+	stats->nr_items = 0;
+	stats->max_items = 0;
+}
+
+#define CACHE_STATS_ADD_ITEM(S) { (S)->stores++; if (++(S)->nr_items > (S)->max_items) (S)->max_items = (S)->nr_items; }
+
+/*	- Function to return the statistics of any of the caches below */
+
+cache_stats_p cache_stats(void *cache)
+{
+	return (cache_stats_p)cache;
+}
+
+void cache_stats_print(cache_stats_p stats, ostream_p ostream)
+{
+	char buffer[300];
+	unsigned long hits = stats->success_hits + stats->fail_hits;
+	snprintf(buffer, 300, "lookups %lu, hits %lu (%.1f%%, success %lu, fail %lu), stores %lu, evictions %lu, items %lu (max %lu)",
+			 stats->lookups, hits, stats->lookups > 0 ? 100.0 * hits / stats->lookups : 0.0,
+			 stats->success_hits, stats->fail_hits, stats->stores, stats->evictions,
+			 (unsigned long)stats->nr_items, (unsigned long)stats->max_items);
+	ostream_puts(ostream, buffer);
+}
+
+/*
+	For debugging the parser
+	~~~~~~~~~~~~~~~~~~~~~~~~
+*/
+
+THREAD_LOCAL int depth = 0;
+bool debug_parse = FALSE;
+bool debug_nt = FALSE;
+ostream_p stdout_stream;
+
+#define DEBUG_ENTER(X) if (debug_parse) { DEBUG_TAB; printf("Enter: %s", X); depth += 2; }
+#define DEBUG_ENTER_P1(X,A) if (debug_parse) { DEBUG_TAB; printf("Enter: "); printf(X,A); depth += 2; }
+#define DEBUG_ENTER_P2(X,A,B) if (debug_parse) { DEBUG_TAB; printf("Enter: "); printf(X,A,B); depth += 2; }
+#define DEBUG_ENTER_P3(X,A,B,C) if (debug_parse) { DEBUG_TAB; printf("Enter: "); printf(X,A,B,C); depth += 2; }
+#define DEBUG_EXIT(X) if (debug_parse) { depth -=2; DEBUG_TAB; printf("Leave: %s", X); }
+#define DEBUG_EXIT_P1(X,A) if (debug_parse) { depth -=2; DEBUG_TAB; printf("Leave: "); printf(X,A); }
+#define DEBUG_TAB if (debug_parse) printf("%*.*s", depth, depth, "")
+#define DEBUG_NL if (debug_parse) printf("\n")
+#define DEBUG_PT(X) if (debug_parse) result_print(X, stdout_stream);
+#define DEBUG_PO(X) if (debug_parse) rules_print(stdout, X)
+#define DEBUG_PR(X) if (debug_parse) element_print(stdout, X)
+#define DEBUG_(X)  if (debug_parse) printf(X)
+#define DEBUG_P1(X,A) if (debug_parse) printf(X,A)
+
+
+/*
+	Parser struct definition
+	~~~~~~~~~~~~~~~~~~~~~~~~
+*/
+
+typedef struct nt_stack *nt_stack_p;
+typedef struct memory_budget *memory_budget_p;
+
+/*  For the elements that skip up to a delimiter, the positions from which
+	the delimiter was not found (see rk_until), in a small table on the
+	address of the element */
+
+#define UNTIL_FAILS_SIZE 8
+
+typedef struct
+{
+	element_p element;
+	size_t pos;
+} until_fail_t;
+
+typedef struct
+{
+	text_buffer_p text_buffer;
+	nt_stack_p nt_stack;
+	cache_item_p (*cache_hit_function)(void *cache, size_t pos, const char *nt);
+	void (*cache_set_result_function)(void *cache, size_t pos, const char *nt, cache_item_p cache_item);
+	void (*cache_evict_function)(void *cache, size_t pos, nt_stack_p nt_stack);
+	void *cache;
+	bool memo_cheap;     /* Whether the cache is used for cheap non-terminals */
+	memory_budget_p budget;
+	int recognize_only;  /* When non-zero, no functions for processing results are called */
+	bool recover;        /* Whether sequences with synchronization characters recover from errors */
+	parse_error_p errors;/* The errors that were recovered from */
+	parse_error_p last_error;
+	bool reference;      /* Whether compiled functions and LL(1) predictions are not used */
+	until_fail_t until_fails[UNTIL_FAILS_SIZE];
+} parser_t, *parser_p;
+
+void parser_init(parser_p parser, text_buffer_p text_buffer)
+{
+	parser->text_buffer = text_buffer;
+	parser->nt_stack = NULL;
+	parser->cache_hit_function = 0;
+	parser->cache_set_result_function = 0;
+	parser->cache_evict_function = 0;
+	parser->cache = NULL;
+	parser->memo_cheap = TRUE;
+	parser->budget = NULL;
+	parser->recognize_only = 0;
+	parser->recover = FALSE;
+	parser->errors = NULL;
+	parser->last_error = NULL;
+	parser->reference = FALSE;
+	for (int i = 0; i < UNTIL_FAILS_SIZE; i++)
+		parser->until_fails[i].element = NULL;
+}
+
+void nt_stack_push(const char *name, parser_p parser);
+void nt_stack_pop(parser_p parser);
+void nt_stack_set_rule(nt_stack_p nt_stack, int rule_nr);
+bool heatmap_examine(heatmap_p heatmap, parser_p parser, size_t pos);
+bool memory_budget_check(parser_p parser);
+bool parse_recover(parser_p parser, element_p element, const result_p prev_seq, result_p result);
+void parse_errors_append(parser_p parser, parse_error_p errors, parse_error_p last);
+void parse_errors_truncate(parser_p parser, parse_error_p mark);
+parse_error_p parse_errors_copy_after(parser_p parser, parse_error_p mark);
+void expect_element(parser_p parser, element_p element);
+
+/*
+	Parsing functions
+	~~~~~~~~~~~~~~~~~
+	
+	The parsing functions are described top-down, starting with the function
+	to parse a non-terminal, which is the top-level function to be called to
+	parse a text buffer.
+	
+*/
+
+bool parse_rule(parser_p parser, element_p element, const result_p prev_result, rule_p rules, result_p rule_result);
+
+/*
+	For a LL(1) non-terminal (see nt_classify_ll1) only the rule predicted
+	by the current character is parsed. If no rule is predicted, the first
+	elements of all rules are reported as expected. When the non-terminal
+	is also cheap (see grammar_classify_cheap), the cache is not used,
+	because parsing it again costs about as much as a lookup. Otherwise,
+	parse_nt uses the prediction after the lookup in the cache.
+*/
+
+bool parse_nt_predictive(parser_p parser, non_terminal_p non_term, result_p result)
+{
+	ENTER_RESULT_CONTEXT
+	text_buffer_p text_buffer = parser->text_buffer;
+	DEBUG_ENTER_P3("parse_nt(%s) predictive at %d.%d", non_term->name, text_buffer->pos.cur_line, text_buffer->pos.cur_column); DEBUG_NL;
+#ifdef USE_PROBES
+	size_t start_pos = text_buffer->pos.pos;
+#endif
+	PROBE2(nt_enter, non_term->name, start_pos)
+	rule_p rule = text_buffer_end(text_buffer) ? NULL : non_term->predict[(byte)*text_buffer->info];
+	nt_stack_push(non_term->name, parser);
+	bool parsed = FALSE;
+	if (rule == NULL)
+	{
+		for (rule = non_term->normal; rule != NULL; rule = rule->next)
+			expect_element(parser, rule->elements);
+	}
+	else
+	{
+		int rule_nr = 0;
+		for (rule_p other = non_term->normal; other != rule; other = other->next)
+			rule_nr++;
+		nt_stack_set_rule(parser->nt_stack, rule_nr);
+		ALLOC_MARK(alloc_mark)
+		DECL_RESULT(start)
+		parsed = parse_rule(parser, rule->elements, &start, rule, result);
+		DISP_RESULT(start)
+		if (!parsed)
+		{	ALLOC_BACKTRACK(alloc_mark) }
+	}
+	nt_stack_pop(parser);
+	if (parsed)
+	{	PROBE3(nt_success, non_term->name, start_pos, text_buffer->pos.pos) }
+	else
+	{	PROBE2(nt_fail, non_term->name, start_pos) }
+	DEBUG_EXIT_P1("parse_nt(%s) predictive", non_term->name); DEBUG_NL;
+	EXIT_RESULT_CONTEXT
+	return parsed;
+}
+
+bool parse_nt(parser_p parser, non_terminal_p non_term, result_p result)
+{
+	if (non_term->jit_function != NULL && !parser->reference && (non_term->jit_result_free || parser->recognize_only > 0))
+	{
+		/* Call the compiled function (see jit_compile_grammar). If it fails,
+		   the interpreter is used to report what was expected. */
+		text_buffer_p text_buffer = parser->text_buffer;
+#ifdef USE_PROBES
+		size_t start_pos = text_buffer->pos.pos;
+#endif
+		PROBE2(nt_enter, non_term->name, start_pos)
+		nt_stack_push(non_term->name, parser);
+		const char *next = non_term->jit_function(text_buffer->info, text_buffer->buffer + text_buffer->buffer_len);
+		nt_stack_pop(parser);
+		if (next != NULL)
+		{
+			text_buffer_advance_to(text_buffer, next - text_buffer->buffer);
+			PROBE3(nt_success, non_term->name, start_pos, text_buffer->pos.pos)
+			return TRUE;
+		}
+		PROBE2(nt_fail, non_term->name, start_pos)
+	}
+	if (non_term->ll1 && non_term->cheap && !parser->reference)
+		return parse_nt_predictive(parser, non_term, result);
+
+	ENTER_RESULT_CONTEXT
+	const char *nt = non_term->name;
+
+	DEBUG_ENTER_P3("parse_nt(%s) at %d.%d", nt, parser->text_buffer->pos.cur_line, parser->text_buffer->pos.cur_column); DEBUG_NL;
+
+	/* First try the cache (if available) */
+	size_t start_pos = parser->text_buffer->pos.pos;
+	PROBE2(nt_enter, nt, start_pos)
+	cache_item_p cache_item = NULL;
+	if (parser->cache_hit_function != NULL && (parser->memo_cheap || !non_term->cheap))
+	{
+		cache_item = parser->cache_hit_function(parser->cache, start_pos, nt);
+		if (cache_item != NULL)
+		{
+			if (cache_item->success == s_success)
+			{
+				PROBE3(nt_cache_hit, nt, start_pos, 1)
+				DEBUG_EXIT_P1("parse_nt(%s) CACHE SUCCESS = ", nt);  DEBUG_PT(&cache_item->result)  DEBUG_NL;
+				result_assign(result, &cache_item->result);
+				text_buffer_set_pos(parser->text_buffer, &cache_item->next_pos);
+				if (cache_item->errors != NULL)
+				{
+					parse_error_p last;
+					parse_error_p errors = parse_error_list_copy(cache_item->errors, &last);
+					parse_errors_append(parser, errors, last);
+				}
+				EXIT_RESULT_CONTEXT
+				return TRUE;
+			}
+			else if (cache_item->success == s_fail)
+			{
+				PROBE3(nt_cache_hit, nt, start_pos, 0)
+				DEBUG_EXIT_P1("parse_nt(%s) CACHE FAIL", nt);  DEBUG_NL;
+				EXIT_RESULT_CONTEXT
+				return FALSE;
+			}
+			PROBE2(nt_cache_miss, nt, start_pos)
+			cache_item->success = s_fail; // To deal with indirect left-recurssion
+		}
+	}
+	
+	/* Mark the errors, such that those recorded while parsing the
+	   non-terminal can be removed or stored with the cache item */
+	parse_error_p errors_mark = parser->last_error;
+
+	/* Push the current non-terminal on stack */
+	nt_stack_push(nt, parser);
+
+	if (debug_nt)
+	{   printf("%*.*s", depth, depth, "");
+		printf("Enter: %s\n", nt);
+		depth += 2; 
+	}
+
+	/* Try the normal rules in order of declaration, or only the predicted
+	   rule for a LL(1) non-terminal */
+	bool predict = non_term->ll1 && !parser->reference;
+	rule_p predicted = NULL;
+	if (predict)
+	{
+		predicted = text_buffer_end(parser->text_buffer) ? NULL : non_term->predict[(byte)*parser->text_buffer->info];
+		if (predicted == NULL)
+			for (rule_p rule = non_term->normal; rule != NULL; rule = rule->next)
+				expect_element(parser, rule->elements);
+	}
+	bool parsed_a_rule = FALSE;
+	int rule_nr = 0;
+	for (rule_p rule = non_term->normal; rule != NULL; rule = rule->next, rule_nr++)
+	{
+		if (predict && rule != predicted)
+			continue;
+		nt_stack_set_rule(parser->nt_stack, rule_nr);
+		ALLOC_MARK(alloc_mark)
+		DECL_RESULT(start)
+		if (parse_rule(parser, rule->elements, &start, rule, result))
+		{
+			parsed_a_rule = TRUE;
+			DISP_RESULT(start)
+			break;
+		}
+		DISP_RESULT(start)
+		ALLOC_BACKTRACK(alloc_mark)
+	}
+	
+	if (!parsed_a_rule)
+	{
+		/* No rule was succesful */
+		PROBE2(nt_fail, nt, start_pos)
+		DEBUG_EXIT_P1("parse_nt(%s) - failed", nt);  DEBUG_NL;
+		if (debug_nt)
+		{   depth -= 2;
+			printf("%*.*s", depth, depth, "");
+			printf("Failed: %s\n", nt);
+		}
+		
+		/* Pop the current non-terminal from the stack */
+		nt_stack_pop(parser);
+		parse_errors_truncate(parser, errors_mark);
+		
+		/* The cache item already indicates failure, except when only
+		   recognizing: then the functions for processing results, which
+		   can reject the input, were not called, thus another alternative
+		   could have been taken in a full parse (see rk_and below) */
+		if (cache_item != NULL && parser->recognize_only > 0)
+			cache_item->success = s_unknown;
+		if (cache_item != NULL && parser->cache_set_result_function != NULL)
+			parser->cache_set_result_function(parser->cache, start_pos, nt, cache_item);
+
+		EXIT_RESULT_CONTEXT
+		return FALSE;
+	}
+	
+	/* Now that a normal rule was succesfull, repeatingly try left-recursive rules */
+	while (parsed_a_rule)
+	{
+		parsed_a_rule = FALSE;
+		rule_nr = -1;
+		for (rule_p rule = non_term->recursive; rule != NULL; rule = rule->next, rule_nr--)
+		{
+			nt_stack_set_rule(parser->nt_stack, rule_nr);
+			ALLOC_MARK(alloc_mark)
+			DECL_RESULT(start_result)
+			if (rule->rec_start_function != NULL && parser->recognize_only == 0)
+			{
+				if (!rule->rec_start_function(result, &start_result))
+				{
+					DISP_RESULT(start_result)
+					continue;
+				}
+			}
+			DECL_RESULT(rule_result)
+			if (parse_rule(parser, rule->elements, &start_result, rule, &rule_result))
+			{
+				parsed_a_rule = TRUE;
+				result_assign(result, &rule_result);
+				DISP_RESULT(rule_result)
+				DISP_RESULT(start_result)
+				break;
+			}
+			DISP_RESULT(rule_result)
+			DISP_RESULT(start_result)
+			ALLOC_BACKTRACK(alloc_mark)
+		}
+	}
+
+	PROBE3(nt_success, nt, start_pos, parser->text_buffer->pos.pos)
+	DEBUG_EXIT_P1("parse_nt(%s) = ", nt);
+	DEBUG_PT(result); DEBUG_NL;
+	if (debug_nt)
+	{   depth -= 2;
+		printf("%*.*s", depth, depth, "");
+		printf("Parsed: %s\n", nt);
+	}
+	
+	/* Update the cache item, if available. When only recognizing, there
+	   is no result that could be stored. */
+	if (cache_item != NULL)
+	{
+		if (parser->recognize_only > 0)
+			cache_item->success = s_unknown;
+		else
+		{
+			result_assign(&cache_item->result, result);
+			cache_item->success = s_success;
+			cache_item->next_pos = parser->text_buffer->pos;
+			parse_error_list_free(cache_item->errors);
+			cache_item->errors = parse_errors_copy_after(parser, errors_mark);
+		}
+		if (parser->cache_set_result_function != NULL)
+			parser->cache_set_result_function(parser->cache, start_pos, nt, cache_item);
+	}
+
+	/* Pop the current non-terminal from the stack */
+	nt_stack_pop(parser);
+	
+	EXIT_RESULT_CONTEXT
+	return TRUE;
+}
+
+/*
+	Parsing a rule
+	~~~~~~~~~~~~~~
+	
+	This function is called to parse (the remainder of) a rule. If it fails,
+	the current position in text buffer is reset to the position it was at
+	the start of the call. This function first tries to parse the first
+	element of the rule. If this is succeeds, the function will be called
+	recursively for the rest of the rule.
+	
+*/
+
+bool parse_element(parser_p parser, element_p element, const result_p prev_result, result_p result);
+bool parse_seq(parser_p parser, element_p element, const result_p prev_seq, const result_p prev, rule_p rule, result_p result);
+
+bool parse_rule(parser_p parser, element_p element, const result_p prev_result, rule_p rule, result_p rule_result)
+{
+	ENTER_RESULT_CONTEXT
+	DEBUG_ENTER_P2("parse_rule at %d.%d: ", parser->text_buffer->pos.cur_line, parser->text_buffer->pos.cur_column);
+	DEBUG_PR(element); DEBUG_NL;
+	parse_error_p errors_mark = parser->last_error;
+
+	if (element == NULL)
+	{
+		/* At the end of the rule: */
+		if (rule == NULL || rule->end_function == 0 || parser->recognize_only > 0)
+			result_assign(rule_result, prev_result);
+		else if (!rule->end_function(prev_result, rule->end_function_data, rule_result))
+		{
+			DEBUG_EXIT("parse_rule failed by end function "); DEBUG_NL;
+			return FALSE;
+		}
+		DEBUG_EXIT("parse_rule = ");
+		DEBUG_PT(rule_result); DEBUG_NL;
+		EXIT_RESULT_CONTEXT
+		return TRUE;
+	}
+
+	/* If the first element is optional and should be avoided, first an attempt
+	   will be made to skip the element and parse the remainder of the rule */
+	if (element->optional && element->avoid)
+	{
+		/* If a add skip function is defined, apply it. (An add skip function
+		   can be used to process the absence of the element with the result.)
+		   Otherwise, if a add function is defined, it will be called with an
+		   'empty' result, signaling that no element was parsed.
+		   Otherwise, the previous result is used. */
+		DECL_RESULT(skip_result);
+		if (parser->recognize_only > 0)
+			result_assign(&skip_result, prev_result);
+		else if (element->add_skip_function != NULL)
+		{
+			if (!element->add_skip_function(prev_result, &skip_result))
+			{
+				DISP_RESULT(skip_result);
+	            DEBUG_EXIT("parse_rule failed due to add skip function"); DEBUG_NL;
+				EXIT_RESULT_CONTEXT
+				return FALSE;
+			}
+		}
+		else if (element->add_function != NULL)
+		{
+			DECL_RESULT(empty);
+			if (!element->add_function(prev_result, &empty, &skip_result))
+			{
+				DISP_RESULT(empty);
+				DISP_RESULT(skip_result);
+	            DEBUG_EXIT("parse_rule failed due to add function"); DEBUG_NL;
+				EXIT_RESULT_CONTEXT
+				return FALSE;
+			}
+			DISP_RESULT(empty);
+		}
+		else
+			result_assign(&skip_result, prev_result);
+			
+		if (parse_rule(parser, element->next, &skip_result, rule, rule_result))
+		{
+			DISP_RESULT(skip_result);
+            DEBUG_EXIT("parse_rule = ");
+            DEBUG_PT(rule_result); DEBUG_NL;
+			EXIT_RESULT_CONTEXT
+			return TRUE;
+		}
+		DISP_RESULT(skip_result);
+	}
+		
+	/* Store the current position */
+	text_pos_t sp = parser->text_buffer->pos;
+	
+	if (element->sequence)
+	{
+		/* The first element of the rule is a sequence. */
+		DECL_RESULT(seq_begin);
+		if (element->begin_seq_function != NULL && parser->recognize_only == 0)
+			element->begin_seq_function(prev_result, &seq_begin);
+		
+		/* Try to parse the first element of the sequence (or recover from an error) */
+		DECL_RESULT(seq_elem);
+		if (   parse_element(parser, element, &seq_begin, &seq_elem)
+			|| parse_recover(parser, element, &seq_begin, &seq_elem))
+		{
+			if (element->back_tracking)
+			{
+				/* Now parse the remainder elements of the sequence (and thereafter the remainder of the rule. */
+				if (parse_seq(parser, element, &seq_elem, prev_result, rule, rule_result))
+				{
+					DISP_RESULT(seq_elem);
+					DISP_RESULT(seq_begin);
+					DEBUG_EXIT("parse_rule = ");
+					DEBUG_PT(rule_result); DEBUG_NL;
+					EXIT_RESULT_CONTEXT
+					return TRUE;
+				}
+			}
+			else
+			{
+				/* Now continue parsing more elements */
+				for (;;)
+				{
+					if (element->avoid)
+					{
+						DECL_RESULT(result);
+						if (element->add_seq_function != NULL && parser->recognize_only == 0 && !element->add_seq_function(prev_result, &seq_elem, &result))
+						{
+							DEBUG_TAB; DEBUG_("add_seq_function failed\n");
+							break;
+						}
+						if (parse_rule(parser, element->next, &result, rule, rule_result))
+						{
+							DISP_RESULT(result);
+							DISP_RESULT(seq_elem);
+							DISP_RESULT(seq_begin);
+							DEBUG_EXIT("parse_rule = ");
+							DEBUG_PT(rule_result); DEBUG_NL;
+							EXIT_RESULT_CONTEXT
+							return TRUE;
+						}
+						DISP_RESULT(result);
+					}
+					
+					/* Store the current position (and mark the errors) */
+					text_pos_t sp = parser->text_buffer->pos;
+					parse_error_p elem_errors_mark = parser->last_error;
+					
+					bool parsed_chain = TRUE;
+					if (element->chain_rule != NULL)
+					{
+						DECL_RESULT(dummy_prev_result);
+						DECL_RESULT(dummy_chain_elem);
+						parsed_chain = parse_rule(parser, element->chain_rule, &dummy_prev_result, NULL, &dummy_chain_elem);
+						DISP_RESULT(dummy_chain_elem);
+						DISP_RESULT(dummy_prev_result);
+					}
+					
+					DECL_RESULT(next_seq_elem);
+					if (parsed_chain && parse_element(parser, element, &seq_elem, &next_seq_elem))
+					{
+						result_assign(&seq_elem, &next_seq_elem);
+					}
+					else
+					{
+						/* Failed to parse the next element of the sequence: reset the current position to the saved position. */
+						text_buffer_set_pos(parser->text_buffer, &sp);
+						parse_errors_truncate(parser, elem_errors_mark);
+						if (!parse_recover(parser, element, &seq_elem, &next_seq_elem))
+						{
+							DISP_RESULT(next_seq_elem);
+							break;
+						}
+						result_assign(&seq_elem, &next_seq_elem);
+					}
+					DISP_RESULT(next_seq_elem);
+				}
+				
+				DECL_RESULT(result);
+				if (element->add_seq_function != NULL && parser->recognize_only == 0 && !element->add_seq_function(prev_result, &seq_elem, &result))
+				{
+					DEBUG_TAB; DEBUG_("add_seq_function failed\n");
+				}
+				else
+				{
+					if (parse_rule(parser, element->next, &result, rule, rule_result))
+					{
+						DISP_RESULT(result);
+						DISP_RESULT(seq_elem);
+						DISP_RESULT(seq_begin);
+						DEBUG_EXIT("parse_rule = ");
+						DEBUG_PT(rule_result); DEBUG_NL;
+						EXIT_RESULT_CONTEXT
+						return TRUE;
+					}
+				}
+				DISP_RESULT(result);
+			}
+		}
+		DISP_RESULT(seq_elem);
+		DISP_RESULT(seq_begin);
+	}
+	else
+	{
+		/* The first element is not a sequence: Try to parse the first element */
+		DECL_RESULT(elem);
+		if (parse_element(parser, element, prev_result, &elem))
+		{
+			if (parse_rule(parser, element->next, &elem, rule, rule_result))
+			{
+				DISP_RESULT(elem);
+				DEBUG_EXIT("parse_rule = ");
+				DEBUG_PT(rule_result); DEBUG_NL;
+				EXIT_RESULT_CONTEXT
+				return TRUE;
+			}
+		}
+		DISP_RESULT(elem);
+	}
+	
+	/* Failed to parse the rule: reset the current position to the saved
+	   position, and remove the errors that were recorded since. */
+	text_buffer_set_pos(parser->text_buffer, &sp);
+	parse_errors_truncate(parser, errors_mark);
+	
+	/* If the element was optional (and should not be avoided): Skip the element
+	   and try to parse the remainder of the rule */
+	if (element->optional && !element->avoid)
+	{
+		DECL_RESULT(skip_result);
+		if (parser->recognize_only > 0)
+			result_assign(&skip_result, prev_result);
+		else if (element->add_skip_function != NULL)
+		{
+			if (!element->add_skip_function(prev_result, &skip_result))
+			{
+				DISP_RESULT(skip_result);
+	            DEBUG_EXIT("parse_rule failed due to add skip function"); DEBUG_NL;
+				EXIT_RESULT_CONTEXT
+				return FALSE;
+			}
+		}
+		else if (element->add_function != NULL)
+		{
+			DECL_RESULT(empty);
+			if (!element->add_function(prev_result, &empty, &skip_result))
+			{
+				DISP_RESULT(empty);
+				DISP_RESULT(skip_result);
+	            DEBUG_EXIT("parse_rule failed due to add function"); DEBUG_NL;
+				EXIT_RESULT_CONTEXT
+				return FALSE;
+			}
+			DISP_RESULT(empty);
+		}
+		else
+			result_assign(&skip_result, prev_result);
+			
+		if (parse_rule(parser, element->next, &skip_result, rule, rule_result))
+		{
+			DISP_RESULT(skip_result);
+            DEBUG_EXIT("parse_rule = ");
+            DEBUG_PT(rule_result); DEBUG_NL;
+			EXIT_RESULT_CONTEXT
+			return TRUE;
+		}
+		DISP_RESULT(skip_result);
+	}
+
+	parse_errors_truncate(parser, errors_mark);
+    DEBUG_EXIT("parse_rule: failed"); DEBUG_NL;
+	EXIT_RESULT_CONTEXT
+	return FALSE;
+}
+
+bool parse_seq(parser_p parser, element_p element, const result_p prev_seq, const result_p prev, rule_p rule, result_p rule_result)
+{
+	ENTER_RESULT_CONTEXT
+	parse_error_p errors_mark = parser->last_error;
+	/* In case of the avoid modifier, first an attempt is made to parse the
+	   remained of the rule */
+	if (element->avoid)
+	{
+		DECL_RESULT(result);
+		if (element->add_seq_function != NULL && parser->recognize_only == 0 && !element->add_seq_function(prev, prev_seq, &result))
+		{
+			DISP_RESULT(result);
+			EXIT_RESULT_CONTEXT
+			return FALSE;
+		}
+		if (parse_rule(parser, element->next, &result, rule, rule_result))
+		{
+			DISP_RESULT(result);
+			EXIT_RESULT_CONTEXT
+			return TRUE;
+		}
+		DISP_RESULT(result);
+	}
+	
+	/* Store the current position */
+	text_pos_t sp = parser->text_buffer->pos;
+
+	/* If a chain rule is defined, try to parse it.*/
+	bool go = TRUE;
+	if (element->chain_rule != NULL)
+	{
+		DECL_RESULT(dummy_prev_result);
+		DECL_RESULT(dummy_chain_elem);
+		go = parse_rule(parser, element->chain_rule, &dummy_prev_result, NULL, &dummy_chain_elem);
+		DISP_RESULT(dummy_chain_elem);
+		DISP_RESULT(dummy_prev_result);
+	}
+	if (go)
+	{
+		/* Try to parse the next element of the sequence */
+		DECL_RESULT(seq_elem);
+		if (parse_element(parser, element, prev_seq, &seq_elem))
+		{
+			/* If succesful, try to parse the remainder of the sequence (and thereafter the remainder of the rule) */
+			if (parse_seq(parser, element, &seq_elem, prev, rule, rule_result))
+			{
+				DISP_RESULT(seq_elem);
+				EXIT_RESULT_CONTEXT
+				return TRUE;
+			}
+		}
+		DISP_RESULT(seq_elem);
+	}
+	
+	/* Failed to parse the next element of the sequence: reset the current
+	   position to the saved position, and remove the errors recorded since. */
+	text_buffer_set_pos(parser->text_buffer, &sp);
+	parse_errors_truncate(parser, errors_mark);
+
+	/* In case of the avoid modifier, an attempt to parse the remained of the
+	   rule, was already made. So, only in case of no avoid modifier, attempt
+	   to parse the remainder of the rule */
+	if (!element->avoid)
+	{
+		DECL_RESULT(result);
+		if (element->add_seq_function != NULL && parser->recognize_only == 0 && !element->add_seq_function(prev, prev_seq, &result))
+		{
+			DISP_RESULT(result);
+			EXIT_RESULT_CONTEXT
+			return FALSE;
+		}
+		
+		if (parse_rule(parser, element->next, &result, rule, rule_result))
+		{
+			DISP_RESULT(result);
+			EXIT_RESULT_CONTEXT
+			return TRUE;
+		}
+		DISP_RESULT(result);
+	}
+	
+	EXIT_RESULT_CONTEXT
+	return FALSE;
+}
+
+
+/*
+	Parse an element
+	~~~~~~~~~~~~~~~~
+	
+	The following function is used to parse a part of an element, not dealing
+	with if the element is optional or a sequence.
+*/
+
+void expect_element(parser_p parser, element_p element);
+
+bool parse_element(parser_p parser, element_p element, const result_p prev_result, result_p result)
+{
+	DEBUG_ENTER_P2("parse_element at %d.%d: ", parser->text_buffer->pos.cur_line, parser->text_buffer->pos.cur_column);
+	DEBUG_PR(element); DEBUG_NL;
+
+	ENTER_RESULT_CONTEXT
+	/* Store the current position */
+	text_pos_t sp = parser->text_buffer->pos;
+	if (parse_heatmap != NULL && !heatmap_examine(parse_heatmap, parser, sp.pos))
+	{
+		EXIT_RESULT_CONTEXT
+		DEBUG_EXIT("parse_element failed due to heatmap budget"); DEBUG_NL;
+		return FALSE;
+	}
+
+	switch( element->kind )
+	{
+		case rk_nt:
+			{
+				/* Apply the memory budget before a condition resets recognizing */
+				if (parser->budget != NULL && !memory_budget_check(parser))
+				{
+					EXIT_RESULT_CONTEXT
+					DEBUG_EXIT("parse_element failed due to memory budget"); DEBUG_NL;
+					return FALSE;
+				}
+
+				/* Parse the non-terminal. (A condition needs the result of the
+				   non-terminal, even when only recognizing.) */
+				int recognize_only = 0;
+				if (element->condition != 0)
+				{
+					recognize_only = parser->recognize_only;
+					parser->recognize_only = 0;
+				}
+				DECL_RESULT(nt_result)
+				bool parsed = parse_nt(parser, element->info.non_terminal, &nt_result);
+				parser->recognize_only += recognize_only;
+				if (!parsed)
+				{
+					DISP_RESULT(nt_result)
+					EXIT_RESULT_CONTEXT
+					DEBUG_EXIT("parse_element failed due to add skip function"); DEBUG_NL;
+					return FALSE;
+				}
+				
+				/* If there is a condition, evaluate the result */
+				if (element->condition != 0 && !(*element->condition)(&nt_result, element->condition_argument))
+				{
+					DISP_RESULT(nt_result)
+					text_buffer_set_pos(parser->text_buffer, &sp);
+					EXIT_RESULT_CONTEXT
+					DEBUG_EXIT("parse_element failed due to condition function"); DEBUG_NL;
+					return FALSE;
+				}
+				
+				/* Combine the result with the previous result */
+				if (element->add_function == 0 || parser->recognize_only > 0)
+					result_assign(result, prev_result);
+				else if (!(*element->add_function)(prev_result, &nt_result, result))
+				{
+					DISP_RESULT(nt_result)
+					text_buffer_set_pos(parser->text_buffer, &sp);
+					EXIT_RESULT_CONTEXT
+					DEBUG_EXIT("parse_element failed due to add function"); DEBUG_NL;
+					return FALSE;
+				}
+				DISP_RESULT(nt_result)
+			}
+			break;
+		case rk_grouping:
+			{
+				/* Try all rules in the grouping */
+				DECL_RESULT(rule_result);
+				rule_p rule = element->info.rules;
+				for ( ; rule != NULL; rule = rule->next )
+				{
+					ALLOC_MARK(alloc_mark)
+					DECL_RESULT(start);
+					if (element->add_function == 0 || parser->recognize_only > 0)
+						result_assign(&start, prev_result);
+					if (parse_rule(parser, rule->elements, &start, rule, &rule_result))
+					{
+						DISP_RESULT(start);
+						break;
+					}
+					DISP_RESULT(start);
+					ALLOC_BACKTRACK(alloc_mark)
+				}
+				if (rule == NULL)
+				{
+					/* Non of the rules worked */
+					DISP_RESULT(rule_result)
+					EXIT_RESULT_CONTEXT
+					DEBUG_EXIT("parse_element failed due to no rules parsed"); DEBUG_NL;
+					return FALSE;
+				}
+				
+				/* Combine the result of the rule with the previous result */
+				if (element->add_function == 0 || parser->recognize_only > 0)
+					result_assign(result, &rule_result);
+				else if (!(*element->add_function)(prev_result, &rule_result, result))
+				{
+					DISP_RESULT(rule_result)
+					text_buffer_set_pos(parser->text_buffer, &sp);
+					EXIT_RESULT_CONTEXT
+					DEBUG_EXIT("parse_element failed due to add function"); DEBUG_NL;
+					return FALSE;
+				}
+				DISP_RESULT(rule_result)
+			}
+			break;
+		case rk_end:
+			/* Check if the end of the buffer is reached */
+			if (!text_buffer_end(parser->text_buffer))
+			{
+				PROBE2(element_fail, element->kind, sp.pos)
+				expect_element(parser, element);
+				EXIT_RESULT_CONTEXT
+				DEBUG_EXIT("parse_element failed due to accept end"); DEBUG_NL;
+				return FALSE;
+			}
+			result_assign(result, prev_result);
+			break;
+		case rk_char:
+			/* Check if the specified character is found at the current position in the text buffer */
+			if (*parser->text_buffer->info != element->info.ch)
+			{
+				PROBE2(element_fail, element->kind, sp.pos)
+				expect_element(parser, element);
+				EXIT_RESULT_CONTEXT
+				DEBUG_EXIT_P1("parse_element failed due to accept char '%c'", element->info.ch); DEBUG_NL;
+				return FALSE;
+			}
+			/* Advance the current position of the text buffer */
+			text_buffer_next(parser->text_buffer);
+			/* Process the character */
+			if (element->add_char_function == 0 || parser->recognize_only > 0)
+				result_assign(result, prev_result);
+			else if (!(*element->add_char_function)(prev_result, element->info.ch, result))
+			{
+				EXIT_RESULT_CONTEXT
+				DEBUG_EXIT("parse_element failed due to add char function"); DEBUG_NL;
+				return FALSE;
+			}
+			break;
+		case rk_charset:
+			/* Check if the character at the current position in the text buffer is found in the character set */
+			if (!char_set_contains(element->info.char_set, *parser->text_buffer->info))
+			{
+				PROBE2(element_fail, element->kind, sp.pos)
+				expect_element(parser, element);
+				EXIT_RESULT_CONTEXT
+				DEBUG_EXIT("parse_element failed due to add charset"); DEBUG_NL;
+				return FALSE;
+			}
+			{
+				/* Remember the character and advance the current position of the text buffer */
+				char ch = *parser->text_buffer->info;
+				text_buffer_next(parser->text_buffer);
+				/* Process the character */
+				if (element->add_char_function == 0 || parser->recognize_only > 0)
+					result_assign(result, prev_result);
+				else if (!(*element->add_char_function)(prev_result, ch, result))
+				{
+					EXIT_RESULT_CONTEXT
+					DEBUG_EXIT("parse_element failed due to add char function"); DEBUG_NL;
+					return FALSE;
+				}
+			}
+			break;
+		case rk_cpset:
+			/* Decode the code point at the current position and check if it is found in the set */
+			{
+				const char *start = parser->text_buffer->info;
+				unsigned long code_point;
+				int len;
+				if ((byte)*start < 0x80 && !text_buffer_end(parser->text_buffer))
+				{
+					/* Fast path for ASCII characters */
+					code_point = (byte)*start;
+					len = char_set_contains(&element->info.code_point_set->ascii, *start) ? 1 : 0;
+				}
+				else
+				{
+					len = utf8_decode(start, parser->text_buffer->buffer + parser->text_buffer->buffer_len, &code_point);
+					if (len > 0 && !code_point_set_contains(element->info.code_point_set, code_point))
+						len = 0;
+				}
+				if (len == 0)
+				{
+					PROBE2(element_fail, element->kind, sp.pos)
+					expect_element(parser, element);
+					EXIT_RESULT_CONTEXT
+					DEBUG_EXIT("parse_element failed due to code point set"); DEBUG_NL;
+					return FALSE;
+				}
+				for (int i = 0; i < len; i++)
+					text_buffer_next(parser->text_buffer);
+				/* Process the encoding of the code point */
+				if (element->add_span_function == 0 || parser->recognize_only > 0)
+					result_assign(result, prev_result);
+				else if (!(*element->add_span_function)(prev_result, start, len, result))
+				{
+					EXIT_RESULT_CONTEXT
+					DEBUG_EXIT("parse_element failed due to add span function"); DEBUG_NL;
+					return FALSE;
+				}
+			}
+			break;
+		case rk_term:
+			/* Call the terminal parse function and see if it has parsed something */
+			{
+				const char *next_pos = element->info.terminal_function(parser->text_buffer->info, result);
+				/* If the start position is returned, assume that it failed. */
+				if (next_pos <= parser->text_buffer->info)
+				{
+					PROBE2(element_fail, element->kind, sp.pos)
+					expect_element(parser, element);
+					EXIT_RESULT_CONTEXT
+					DEBUG_EXIT("parse_element failed due to parse terminal function"); DEBUG_NL;
+					return FALSE;
+				}
+				/* Increment the buffer till the returned position */
+				while (parser->text_buffer->info < next_pos)
+					text_buffer_next(parser->text_buffer);
+			}
+			break;
+		case rk_until:
+			/* Search for the delimiter and skip all characters before it.
+			   When it was not found from an earlier position, it will not be
+			   found from this position either, such that an unterminated
+			   comment is not scanned again on every attempt. (With an escape
+			   character, this only holds for the same position, because the
+			   search could start at an escaped delimiter.) */
+			{
+				const char *start = parser->text_buffer->info;
+				until_fail_t *until_fail = &parser->until_fails[((size_t)element >> 4) % UNTIL_FAILS_SIZE];
+				bool failed_before =    until_fail->element == element
+									 && (element->info.until.escape == '\0' ? until_fail->pos <= sp.pos : until_fail->pos == sp.pos);
+				const char *found = failed_before ? NULL
+								  : find_delimiter(start, parser->text_buffer->buffer + parser->text_buffer->buffer_len,
+												   element->info.until.delimiter, element->info.until.escape);
+				if (found == NULL && !failed_before)
+				{
+					until_fail->element = element;
+					until_fail->pos = sp.pos;
+				}
+				if (found == NULL)
+				{
+					PROBE2(element_fail, element->kind, sp.pos)
+					expect_element(parser, element);
+					EXIT_RESULT_CONTEXT
+					DEBUG_EXIT("parse_element failed due to missing delimiter"); DEBUG_NL;
+					return FALSE;
+				}
+				text_buffer_advance_to(parser->text_buffer, found - parser->text_buffer->buffer);
+				/* Process the characters */
+				if (element->add_span_function == 0 || parser->recognize_only > 0)
+					result_assign(result, prev_result);
+				else if (!(*element->add_span_function)(prev_result, start, found - start, result))
+				{
+					EXIT_RESULT_CONTEXT
+					DEBUG_EXIT("parse_element failed due to add span function"); DEBUG_NL;
+					return FALSE;
+				}
+			}
+			break;
+		case rk_and:
+		case rk_not:
+			{
+				/* Try the rules without processing results and reset the
+				   position afterwards, such that no input is consumed.
+				   Note that a predicate is approximate: the checks made by
+				   the functions for processing results (such as the escapes
+				   in string_data_add_span) are skipped, thus a rule can be
+				   recognized where a full parse would reject it. Conditions
+				   are still evaluated. */
+				parser->recognize_only++;
+				rule_p rule = element->info.rules;
+				for ( ; rule != NULL; rule = rule->next )
+				{
+					DECL_RESULT(start)
+					DECL_RESULT(rule_result)
+					bool parsed = parse_rule(parser, rule->elements, &start, rule, &rule_result);
+					DISP_RESULT(rule_result)
+					DISP_RESULT(start)
+					if (parsed)
+						break;
+				}
+				parser->recognize_only--;
+				text_buffer_set_pos(parser->text_buffer, &sp);
+				if ((rule != NULL) != (element->kind == rk_and))
+				{
+					PROBE2(element_fail, element->kind, sp.pos)
+					expect_element(parser, element);
+					EXIT_RESULT_CONTEXT
+					DEBUG_EXIT("parse_element failed due to predicate"); DEBUG_NL;
+					return FALSE;
+				}
+				result_assign(result, prev_result);
+			}
+			break;
+		default:
+			EXIT_RESULT_CONTEXT
+			DEBUG_EXIT("parse_element failed due to unknown element"); DEBUG_NL;
+			return FALSE;
+			break;
+	}
+	
+	PROBE3(element_match, element->kind, sp.pos, parser->text_buffer->pos.pos)
+
+	/* Set the position on the result */
+	if (element->set_pos != NULL && parser->recognize_only == 0)
+		element->set_pos(result, &sp);
+
+	EXIT_RESULT_CONTEXT
+	DEBUG_EXIT("parse_element succeeded "); /*print_result(result);*/ DEBUG_NL;
+	return TRUE;
+}
+
+
+/*
+	Brute force cache
+	~~~~~~~~~~~~~~~~~
+	
+	A simple cache implementation, is one that simply stores all results for
+	all positions in the input text.
+
+*/
+
+typedef struct solution *solution_p;
+struct solution
+{
+	cache_item_t cache_item;
+	const char *nt;
+	solution_p next;
+#ifdef ALLOC_ATTRIBUTION
+	unsigned long alloc_seq;
+#endif
+};
+typedef struct
+{
+	cache_stats_t stats;     /* Must be the first member */
+	solution_p *sols;        /* Array of solutions at locations */
+	size_t len;              /* Length of array (equal to length of input) */
+} solutions_t, *solutions_p;
+
+
+void solutions_init(solutions_p solutions, text_buffer_p text_buffer)
+{
+    solutions->len = text_buffer->buffer_len;
+	cache_stats_init(&solutions->stats);
+	solutions->sols = MALLOC_N(solutions->len+1, solution_p);
+	size_t i;
+	for (i = 0; i < solutions->len+1; i++)
+		solutions->sols[i] = NULL;
+}
+
+void solutions_free(solutions_p solutions)
+{
+	size_t i;
+	for (i = 0; i < solutions->len+1; i++)
+	{	solution_p sol = solutions->sols[i];
+
+		while (sol != NULL)
+		{	cache_item_release(&sol->cache_item);
+			solution_p next_sol = sol->next;
+			ALLOC_FREE(sol)
+		    FREE(sol);
+			sol = next_sol;
+		}
+  	}
+	FREE(solutions->sols);
+}
+
+cache_item_p solutions_find(void *cache, size_t pos, const char *nt)
+{
+	solutions_p solutions = (solutions_p)cache;
+	solution_p sol;
+
+	if (pos > solutions->len)
+		pos = solutions->len;
+	solutions->stats.lookups++;
+
+	for (sol = solutions->sols[pos]; sol != NULL; sol = sol->next)
+		if (sol->nt == nt)
+		{
+			PROBE3(memo_find, nt, pos, sol->cache_item.success)
+			if (sol->cache_item.success == s_success)
+				solutions->stats.success_hits++;
+			else if (sol->cache_item.success == s_fail)
+				solutions->stats.fail_hits++;
+		 	return &sol->cache_item;
+		}
+	PROBE3(memo_find, nt, pos, s_unknown)
+	CACHE_STATS_ADD_ITEM(&solutions->stats)
+
+	sol = MALLOC(struct solution);
+	ALLOC_ATTRIBUTE("solution", nt, sol)
+	sol->next = solutions->sols[pos];
+	sol->nt = nt;
+	cache_item_init(&sol->cache_item);
+	solutions->sols[pos] = sol;
+	return &sol->cache_item;
+}
+
+/*
+	Compact cache
+	~~~~~~~~~~~~~
+
+	Most of the items stored by the brute force cache are for non-terminals
+	that could not be parsed at some position. For these only a single bit
+	is needed. The compact cache below has for each non-terminal a bit
+	vector over all positions in the input, in which a bit is set when it
+	is known that the non-terminal cannot be parsed at that position. For
+	the non-terminals that could be parsed, only the end position and the
+	result are stored in a hash table (per non-terminal). The line and
+	column numbers of the end position are recalculated from a table with
+	the start positions of all lines. The cache items that are returned
+	while a non-terminal is being parsed, are taken from a free list and are
+	returned to it, when the parser calls the function to set the result.
+	While a non-terminal is being parsed, its failure bit is set, to deal
+	with indirect left-recursion.
+*/
+
+typedef struct compact_success *compact_success_p;
+struct compact_success
+{
+	size_t pos;              /* Start position plus one (zero means unused) */
+	size_t next_pos;         /* Position from which parsing should continue */
+	result_t result;
+	parse_error_p errors;
+};
+
+typedef struct compact_memo_nt *compact_memo_nt_p;
+struct compact_memo_nt
+{
+	const char *nt;
+	unsigned long *fail_bits;      /* Bit vector over the positions */
+	compact_success_p successes;   /* Hash table with successes */
+	size_t nr_successes;
+	size_t size;                   /* Size of the hash table (power of two) */
+#ifdef ALLOC_ATTRIBUTION
+	unsigned long fail_bits_seq;
+	unsigned long successes_seq;
+#endif
+};
+
+typedef struct pending_cache_item *pending_cache_item_p;
+struct pending_cache_item
+{
+	cache_item_t cache_item;       /* Must be the first member */
+	pending_cache_item_p next;
+};
+
+/*	- Functions to take a cache item from a free list (for a non-terminal
+	  that is going to be parsed) and to return it */
+
+cache_item_p pending_cache_item_take(pending_cache_item_p *free_items)
+{
+	pending_cache_item_p pending = *free_items;
+	if (pending != NULL)
+	{
+		*free_items = pending->next;
+		BUDGET_CHARGE(pending)
+	}
+	else
+		pending = MALLOC(struct pending_cache_item);
+	cache_item_init(&pending->cache_item);
+	return &pending->cache_item;
+}
+
+void pending_cache_item_return(pending_cache_item_p *free_items, cache_item_p cache_item)
+{
+	cache_item_release(cache_item);
+	pending_cache_item_p pending = (pending_cache_item_p)cache_item;
+	BUDGET_UNCHARGE(pending)
+	pending->next = *free_items;
+	*free_items = pending;
+}
+
+void pending_cache_items_free(pending_cache_item_p *free_items)
+{
+	while (*free_items != NULL)
+	{
+		pending_cache_item_p next = (*free_items)->next;
+		FREE(*free_items);
+		*free_items = next;
+	}
+}
+
+typedef struct
+{
+	cache_stats_t stats;           /* Must be the first member */
+	text_buffer_p text_buffer;
+	size_t len;                    /* Length of the input */
+	size_t *line_starts;           /* Start positions of all lines */
+	size_t nr_lines;
+	compact_memo_nt_p nts;         /* Hash table on the non-terminals */
+	size_t nr_nts;
+	size_t nts_size;               /* Size of the hash table (power of two) */
+	pending_cache_item_p free_items;
+	cache_item_t hit_item;         /* Returned for successes */
+	cache_item_t fail_item;        /* Returned for failures */
+} compact_memo_t, *compact_memo_p;
+
+#define BITS_PER_LONG (8 * sizeof(unsigned long))
+
+void compact_memo_init(compact_memo_p memo, text_buffer_p text_buffer)
+{
+	cache_stats_init(&memo->stats);
+	memo->text_buffer = text_buffer;
+	memo->len = text_buffer->buffer_len;
+
+	/* Create table with the start positions of all lines */
+	memo->nr_lines = 1;
+	const char *s = text_buffer->buffer;
+	const char *end = s + memo->len;
+	while ((s = (const char*)memchr(s, '\n', end - s)) != NULL)
+	{
+		memo->nr_lines++;
+		s++;
+	}
+	memo->line_starts = MALLOC_N(memo->nr_lines, size_t);
+	memo->line_starts[0] = 0;
+	s = text_buffer->buffer;
+	for (size_t i = 1; i < memo->nr_lines; i++)
+	{
+		s = (const char*)memchr(s, '\n', end - s) + 1;
+		memo->line_starts[i] = s - text_buffer->buffer;
+	}
+
+	memo->nr_nts = 0;
+	memo->nts_size = 64;
+	memo->nts = MALLOC_N(memo->nts_size, struct compact_memo_nt);
+	for (size_t i = 0; i < memo->nts_size; i++)
+		memo->nts[i].nt = NULL;
+	memo->free_items = NULL;
+	cache_item_init(&memo->hit_item);
+	memo->hit_item.success = s_success;
+	cache_item_init(&memo->fail_item);
+	memo->fail_item.success = s_fail;
+}
+
+void compact_memo_free(compact_memo_p memo)
+{
+	for (size_t i = 0; i < memo->nts_size; i++)
+	{
+		compact_memo_nt_p memo_nt = &memo->nts[i];
+		if (memo_nt->nt == NULL)
+			continue;
+		ALLOC_FREE_SEQ(memo_nt->fail_bits_seq)
+		FREE(memo_nt->fail_bits);
+		for (size_t j = 0; j < memo_nt->size; j++)
+			if (memo_nt->successes[j].pos != 0)
+			{
+				RESULT_RELEASE(&memo_nt->successes[j].result);
+				parse_error_list_free(memo_nt->successes[j].errors);
+			}
+		ALLOC_FREE_SEQ(memo_nt->successes_seq)
+		FREE(memo_nt->successes);
+	}
+	FREE(memo->nts);
+	FREE(memo->line_starts);
+	pending_cache_items_free(&memo->free_items);
+}
+
+/*	- Function to calculate the line and column numbers of a position */
+
+void compact_memo_text_pos(compact_memo_p memo, size_t pos, text_pos_p text_pos)
+{
+	size_t low = 0;
+	size_t high = memo->nr_lines;
+	while (high - low > 1)
+	{
+		size_t mid = (low + high) / 2;
+		if (memo->line_starts[mid] <= pos)
+			low = mid;
+		else
+			high = mid;
+	}
+	text_pos->pos = pos;
+	text_pos->cur_line = low + 1;
+	text_pos->cur_column = column_advance(1, memo->text_buffer->buffer + memo->line_starts[low], memo->text_buffer->buffer + pos, memo->text_buffer->tab_size);
+}
+
+#define POINTER_HASH(P) ((((size_t)(P)) >> 3) * 2654435761U)
+
+compact_memo_nt_p compact_memo_find_nt(compact_memo_p memo, const char *nt)
+{
+	size_t mask = memo->nts_size - 1;
+	size_t i = POINTER_HASH(nt) & mask;
+	while (memo->nts[i].nt != NULL && memo->nts[i].nt != nt)
+		i = (i + 1) & mask;
+	if (memo->nts[i].nt != NULL)
+		return &memo->nts[i];
+
+	if (2 * (memo->nr_nts + 1) > memo->nts_size)
+	{
+		/* Double the size of the hash table */
+		compact_memo_nt_p old_nts = memo->nts;
+		size_t old_size = memo->nts_size;
+		memo->nts_size *= 2;
+		memo->nts = MALLOC_N(memo->nts_size, struct compact_memo_nt);
+		for (i = 0; i < memo->nts_size; i++)
+			memo->nts[i].nt = NULL;
+		mask = memo->nts_size - 1;
+		for (size_t j = 0; j < old_size; j++)
+			if (old_nts[j].nt != NULL)
+			{
+				for (i = POINTER_HASH(old_nts[j].nt) & mask; memo->nts[i].nt != NULL; i = (i + 1) & mask)
+					;
+				memo->nts[i] = old_nts[j];
+			}
+		FREE(old_nts);
+		for (i = POINTER_HASH(nt) & mask; memo->nts[i].nt != NULL; i = (i + 1) & mask)
+			;
+	}
+
+	compact_memo_nt_p memo_nt = &memo->nts[i];
+	memo_nt->nt = nt;
+	size_t nr_longs = memo->len / BITS_PER_LONG + 1;
+	memo_nt->fail_bits = MALLOC_N(nr_longs, unsigned long);
+	ALLOC_ATTRIBUTE_ARRAY("fail bits", nt, memo_nt->fail_bits_seq, memo_nt->fail_bits, nr_longs)
+	memset(memo_nt->fail_bits, 0, nr_longs * sizeof(unsigned long));
+	memo_nt->nr_successes = 0;
+	memo_nt->size = 16;
+	memo_nt->successes = MALLOC_N(memo_nt->size, struct compact_success);
+	ALLOC_ATTRIBUTE_ARRAY("successes", nt, memo_nt->successes_seq, memo_nt->successes, memo_nt->size)
+	for (size_t j = 0; j < memo_nt->size; j++)
+		memo_nt->successes[j].pos = 0;
+	memo->nr_nts++;
+	return memo_nt;
+}
+
+compact_success_p compact_memo_nt_find_success(compact_memo_nt_p memo_nt, size_t pos)
+/*  Returns the entry for the position, or the free entry where it should go */
+{
+	size_t mask = memo_nt->size - 1;
+	size_t i = (pos * 2654435761U) & mask;
+	while (memo_nt->successes[i].pos != 0 && memo_nt->successes[i].pos != pos + 1)
+		i = (i + 1) & mask;
+	return &memo_nt->successes[i];
+}
+
+void compact_memo_nt_add_success(compact_memo_nt_p memo_nt, size_t pos, cache_item_p cache_item)
+{
+	if (2 * (memo_nt->nr_successes + 1) > memo_nt->size)
+	{
+		/* Double the size of the hash table */
+		compact_success_p old_successes = memo_nt->successes;
+		size_t old_size = memo_nt->size;
+		memo_nt->size *= 2;
+		memo_nt->successes = MALLOC_N(memo_nt->size, struct compact_success);
+		for (size_t i = 0; i < memo_nt->size; i++)
+			memo_nt->successes[i].pos = 0;
+		for (size_t i = 0; i < old_size; i++)
+			if (old_successes[i].pos != 0)
+				*compact_memo_nt_find_success(memo_nt, old_successes[i].pos - 1) = old_successes[i];
+		ALLOC_FREE_SEQ(memo_nt->successes_seq)
+		ALLOC_ATTRIBUTE_ARRAY("successes", memo_nt->nt, memo_nt->successes_seq, memo_nt->successes, memo_nt->size)
+		FREE(old_successes);
+	}
+	compact_success_p success = compact_memo_nt_find_success(memo_nt, pos);
+	success->pos = pos + 1;
+	success->next_pos = cache_item->next_pos.pos;
+	RESULT_INIT(&success->result);
+	result_transfer(&success->result, &cache_item->result);
+	success->errors = cache_item->errors;
+	cache_item->errors = NULL;
+	memo_nt->nr_successes++;
+}
+
+#define FAIL_BIT_MASK(P) (1UL << ((P) % BITS_PER_LONG))
+
+cache_item_p compact_memo_find(void *cache, size_t pos, const char *nt)
+{
+	compact_memo_p memo = (compact_memo_p)cache;
+	if (pos > memo->len)
+		pos = memo->len;
+	compact_memo_nt_p memo_nt = compact_memo_find_nt(memo, nt);
+	memo->stats.lookups++;
+
+	/* Known failure: a single bit test */
+	unsigned long *fail_long = &memo_nt->fail_bits[pos / BITS_PER_LONG];
+	if ((*fail_long & FAIL_BIT_MASK(pos)) != 0)
+	{
+		PROBE3(memo_find, nt, pos, s_fail)
+		memo->stats.fail_hits++;
+		return &memo->fail_item;
+	}
+
+	/* Known success */
+	compact_success_p success = compact_memo_nt_find_success(memo_nt, pos);
+	if (success->pos != 0)
+	{
+		/* The parser will assign the result and copy the errors, thus a
+		   shallow copy suffices */
+		memo->hit_item.result = success->result;
+		memo->hit_item.errors = success->errors;
+		compact_memo_text_pos(memo, success->next_pos, &memo->hit_item.next_pos);
+		PROBE3(memo_find, nt, pos, s_success)
+		memo->stats.success_hits++;
+		return &memo->hit_item;
+	}
+	PROBE3(memo_find, nt, pos, s_unknown)
+
+	/* Unknown: mark as failure while it is being parsed */
+	*fail_long |= FAIL_BIT_MASK(pos);
+	return pending_cache_item_take(&memo->free_items);
+}
+
+void compact_memo_set_result(void *cache, size_t pos, const char *nt, cache_item_p cache_item)
+{
+	compact_memo_p memo = (compact_memo_p)cache;
+	if (cache_item == &memo->hit_item || cache_item == &memo->fail_item)
+		return;
+	if (pos > memo->len)
+		pos = memo->len;
+	compact_memo_nt_p memo_nt = compact_memo_find_nt(memo, nt);
+	PROBE3(memo_set, nt, pos, cache_item->success)
+
+	/* The failure bit was set; reset it if that is not the outcome */
+	if (cache_item->success != s_fail)
+		memo_nt->fail_bits[pos / BITS_PER_LONG] &= ~FAIL_BIT_MASK(pos);
+	if (cache_item->success == s_success)
+	{
+		compact_memo_nt_add_success(memo_nt, pos, cache_item);
+		CACHE_STATS_ADD_ITEM(&memo->stats)
+	}
+	pending_cache_item_return(&memo->free_items, cache_item);
+}
+
+/*
+	Bounded caches
+	~~~~~~~~~~~~~~
+
+	The brute force and the compact cache store everything, which for
+	large inputs takes a lot of memory, while most items are only used
+	shortly after they were stored, because a back-tracking parser seldom
+	returns far back. The caches below have a bounded size and differ in
+	which items they evict:
+	- The direct mapped cache has a fixed number of slots, and each
+	  combination of position and non-terminal has one slot, evicting the
+	  item that was there.
+	- The LRU cache has a maximum number of items and evicts the item that
+	  was used least recently.
+	- The window cache keeps all items for a number of positions, where
+	  each position has a slot (the position modulo the number of slots),
+	  evicting all items of the position that was there.
+	While a non-terminal is being parsed, its item may be evicted. Hence
+	these caches, like the compact cache, return an item from a free list
+	for a non-terminal that is going to be parsed, and write the outcome
+	back into the cache when the function to set the result is called.
+	Like the other caches, a failure is stored while the non-terminal is
+	being parsed, to deal with indirect left-recursion, but this is lost
+	when the item is evicted.
+*/
+
+#define CACHE_KEY_HASH(P,NT) ((P) * 2654435761U ^ POINTER_HASH(NT))
+
+/*	- Direct mapped cache */
+
+typedef struct
+{
+	size_t pos;
+	const char *nt;                /* NULL, when not used */
+	cache_item_t cache_item;
+} cache_slot_t, *cache_slot_p;
+
+typedef struct
+{
+	cache_stats_t stats;           /* Must be the first member */
+	cache_slot_p slots;
+	size_t nr_slots;               /* A power of two */
+	pending_cache_item_p free_items;
+} direct_cache_t, *direct_cache_p;
+
+void direct_cache_init(direct_cache_p cache, size_t nr_slots)
+{
+	cache_stats_init(&cache->stats);
+	cache->nr_slots = 1;
+	while (cache->nr_slots < nr_slots)
+		cache->nr_slots *= 2;
+	cache->slots = MALLOC_N(cache->nr_slots, cache_slot_t);
+	for (size_t i = 0; i < cache->nr_slots; i++)
+	{
+		cache->slots[i].nt = NULL;
+		cache_item_init(&cache->slots[i].cache_item);
+	}
+	cache->free_items = NULL;
+}
+
+void direct_cache_free(direct_cache_p cache)
+{
+	for (size_t i = 0; i < cache->nr_slots; i++)
+		cache_item_release(&cache->slots[i].cache_item);
+	FREE(cache->slots);
+	pending_cache_items_free(&cache->free_items);
+}
+
+cache_slot_p direct_cache_slot(direct_cache_p cache, size_t pos, const char *nt)
+/*  Returns the slot for the position and the non-terminal, evicting another item */
+{
+	cache_slot_p slot = &cache->slots[CACHE_KEY_HASH(pos, nt) & (cache->nr_slots - 1)];
+	if (slot->nt == nt && slot->pos == pos)
+		return slot;
+	if (slot->nt != NULL)
+	{
+		cache->stats.evictions++;
+		cache->stats.nr_items--;
+	}
+	CACHE_STATS_ADD_ITEM(&cache->stats)
+	slot->pos = pos;
+	slot->nt = nt;
+	slot->cache_item.success = s_unknown;
+	cache_item_release(&slot->cache_item);
+	return slot;
+}
+
+cache_item_p direct_cache_find(void *cache, size_t pos, const char *nt)
+{
+	direct_cache_p direct_cache = (direct_cache_p)cache;
+	direct_cache->stats.lookups++;
+	cache_slot_p slot = direct_cache_slot(direct_cache, pos, nt);
+	PROBE3(memo_find, nt, pos, slot->cache_item.success)
+	if (slot->cache_item.success == s_success)
+	{
+		direct_cache->stats.success_hits++;
+		return &slot->cache_item;
+	}
+	if (slot->cache_item.success == s_fail)
+	{
+		direct_cache->stats.fail_hits++;
+		return &slot->cache_item;
+	}
+	slot->cache_item.success = s_fail;
+	return pending_cache_item_take(&direct_cache->free_items);
+}
+
+void direct_cache_set_result(void *cache, size_t pos, const char *nt, cache_item_p cache_item)
+{
+	direct_cache_p direct_cache = (direct_cache_p)cache;
+	PROBE3(memo_set, nt, pos, cache_item->success)
+	cache_item_write_back(&direct_cache_slot(direct_cache, pos, nt)->cache_item, cache_item);
+	pending_cache_item_return(&direct_cache->free_items, cache_item);
+}
+
+/*	- LRU cache, with a hash table with chaining and a doubly linked list
+	  from the most to the least recently used item */
+
+typedef struct lru_item *lru_item_p;
+struct lru_item
+{
+	size_t pos;
+	const char *nt;
+	cache_item_t cache_item;
+	lru_item_p hash_next;          /* Next in the chain, or in the free list */
+	lru_item_p newer;
+	lru_item_p older;
+};
+
+typedef struct
+{
+	cache_stats_t stats;           /* Must be the first member */
+	lru_item_p items;              /* Array with the maximum number of items */
+	lru_item_p unused_items;
+	lru_item_p *buckets;
+	size_t nr_buckets;             /* A power of two */
+	lru_item_p newest;
+	lru_item_p oldest;
+	pending_cache_item_p free_items;
+} lru_cache_t, *lru_cache_p;
+
+void lru_cache_init(lru_cache_p cache, size_t max_items)
+{
+	cache_stats_init(&cache->stats);
+	if (max_items == 0)
+		max_items = 1;
+	cache->items = MALLOC_N(max_items, struct lru_item);
+	cache->unused_items = NULL;
+	for (size_t i = max_items; i > 0; i--)
+	{
+		cache_item_init(&cache->items[i - 1].cache_item);
+		cache->items[i - 1].hash_next = cache->unused_items;
+		cache->unused_items = &cache->items[i - 1];
+	}
+	cache->nr_buckets = 1;
+	while (cache->nr_buckets < max_items)
+		cache->nr_buckets *= 2;
+	cache->buckets = MALLOC_N(cache->nr_buckets, lru_item_p);
+	for (size_t i = 0; i < cache->nr_buckets; i++)
+		cache->buckets[i] = NULL;
+	cache->newest = NULL;
+	cache->oldest = NULL;
+	cache->free_items = NULL;
+}
+
+void lru_cache_free(lru_cache_p cache)
+{
+	for (lru_item_p item = cache->newest; item != NULL; item = item->older)
+		cache_item_release(&item->cache_item);
+	FREE(cache->items);
+	FREE(cache->buckets);
+	pending_cache_items_free(&cache->free_items);
+}
+
+lru_item_p lru_cache_item(lru_cache_p cache, size_t pos, const char *nt)
+/*  Returns the (most recently used) item for the position and the
+	non-terminal, evicting the least recently used item when needed */
+{
+	lru_item_p *ref_item = &cache->buckets[CACHE_KEY_HASH(pos, nt) & (cache->nr_buckets - 1)];
+	lru_item_p item = *ref_item;
+	while (item != NULL && (item->nt != nt || item->pos != pos))
+		item = item->hash_next;
+	if (item != NULL)
+	{
+		if (item == cache->newest)
+			return item;
+		/* Remove it from the list */
+		item->newer->older = item->older;
+		if (item->older != NULL)
+			item->older->newer = item->newer;
+		else
+			cache->oldest = item->newer;
+	}
+	else
+	{
+		if (cache->unused_items != NULL)
+		{
+			item = cache->unused_items;
+			cache->unused_items = item->hash_next;
+		}
+		else
+		{
+			/* Evict the least recently used item */
+			item = cache->oldest;
+			cache->oldest = item->newer;
+			if (cache->oldest != NULL)
+				cache->oldest->older = NULL;
+			else
+				cache->newest = NULL;
+			lru_item_p *ref_evicted = &cache->buckets[CACHE_KEY_HASH(item->pos, item->nt) & (cache->nr_buckets - 1)];
+			while (*ref_evicted != item)
+				ref_evicted = &(*ref_evicted)->hash_next;
+			*ref_evicted = item->hash_next;
+			cache_item_release(&item->cache_item);
+			cache->stats.evictions++;
+			cache->stats.nr_items--;
+		}
+		CACHE_STATS_ADD_ITEM(&cache->stats)
+		item->pos = pos;
+		item->nt = nt;
+		item->cache_item.success = s_unknown;
+		item->hash_next = *ref_item;
+		*ref_item = item;
+	}
+	/* Add it to the list as the newest */
+	item->newer = NULL;
+	item->older = cache->newest;
+	if (cache->newest != NULL)
+		cache->newest->newer = item;
+	else
+		cache->oldest = item;
+	cache->newest = item;
+	return item;
+}
+
+cache_item_p lru_cache_find(void *cache, size_t pos, const char *nt)
+{
+	lru_cache_p lru_cache = (lru_cache_p)cache;
+	lru_cache->stats.lookups++;
+	lru_item_p item = lru_cache_item(lru_cache, pos, nt);
+	PROBE3(memo_find, nt, pos, item->cache_item.success)
+	if (item->cache_item.success == s_success)
+	{
+		lru_cache->stats.success_hits++;
+		return &item->cache_item;
+	}
+	if (item->cache_item.success == s_fail)
+	{
+		lru_cache->stats.fail_hits++;
+		return &item->cache_item;
+	}
+	item->cache_item.success = s_fail;
+	return pending_cache_item_take(&lru_cache->free_items);
+}
+
+void lru_cache_set_result(void *cache, size_t pos, const char *nt, cache_item_p cache_item)
+{
+	lru_cache_p lru_cache = (lru_cache_p)cache;
+	PROBE3(memo_set, nt, pos, cache_item->success)
+	cache_item_write_back(&lru_cache_item(lru_cache, pos, nt)->cache_item, cache_item);
+	pending_cache_item_return(&lru_cache->free_items, cache_item);
+}
+
+/*	- Window cache, keeping the items for the last positions */
+
+typedef struct
+{
+	size_t pos;                    /* Position plus one (zero means unused) */
+	solution_p sols;
+} window_slot_t, *window_slot_p;
+
+typedef struct
+{
+	cache_stats_t stats;           /* Must be the first member */
+	window_slot_p slots;
+	size_t nr_slots;
+	pending_cache_item_p free_items;
+} window_cache_t, *window_cache_p;
+
+void window_cache_init(window_cache_p cache, size_t nr_positions)
+{
+	cache_stats_init(&cache->stats);
+	cache->nr_slots = nr_positions > 0 ? nr_positions : 1;
+	cache->slots = MALLOC_N(cache->nr_slots, window_slot_t);
+	for (size_t i = 0; i < cache->nr_slots; i++)
+	{
+		cache->slots[i].pos = 0;
+		cache->slots[i].sols = NULL;
+	}
+	cache->free_items = NULL;
+}
+
+void window_slot_clear(window_cache_p cache, window_slot_p slot, bool evict)
+{
+	while (slot->sols != NULL)
+	{
+		solution_p next = slot->sols->next;
+		cache_item_release(&slot->sols->cache_item);
+		ALLOC_FREE(slot->sols)
+		FREE(slot->sols);
+		slot->sols = next;
+		cache->stats.nr_items--;
+		if (evict)
+			cache->stats.evictions++;
+	}
+}
+
+void window_cache_free(window_cache_p cache)
+{
+	for (size_t i = 0; i < cache->nr_slots; i++)
+		window_slot_clear(cache, &cache->slots[i], FALSE);
+	FREE(cache->slots);
+	pending_cache_items_free(&cache->free_items);
+}
+
+cache_item_p window_cache_item(window_cache_p cache, size_t pos, const char *nt)
+/*  Returns the item for the position and the non-terminal, evicting the
+	items of the position that was in the slot */
+{
+	window_slot_p slot = &cache->slots[pos % cache->nr_slots];
+	if (slot->pos != pos + 1)
+	{
+		window_slot_clear(cache, slot, TRUE);
+		slot->pos = pos + 1;
+	}
+	for (solution_p sol = slot->sols; sol != NULL; sol = sol->next)
+		if (sol->nt == nt)
+			return &sol->cache_item;
+	solution_p sol = MALLOC(struct solution);
+	ALLOC_ATTRIBUTE("solution", nt, sol)
+	sol->next = slot->sols;
+	sol->nt = nt;
+	cache_item_init(&sol->cache_item);
+	slot->sols = sol;
+	CACHE_STATS_ADD_ITEM(&cache->stats)
+	return &sol->cache_item;
+}
+
+cache_item_p window_cache_find(void *cache, size_t pos, const char *nt)
+{
+	window_cache_p window_cache = (window_cache_p)cache;
+	window_cache->stats.lookups++;
+	cache_item_p item = window_cache_item(window_cache, pos, nt);
+	PROBE3(memo_find, nt, pos, item->success)
+	if (item->success == s_success)
+	{
+		window_cache->stats.success_hits++;
+		return item;
+	}
+	if (item->success == s_fail)
+	{
+		window_cache->stats.fail_hits++;
+		return item;
+	}
+	item->success = s_fail;
+	return pending_cache_item_take(&window_cache->free_items);
+}
+
+void window_cache_set_result(void *cache, size_t pos, const char *nt, cache_item_p cache_item)
+{
+	window_cache_p window_cache = (window_cache_p)cache;
+	PROBE3(memo_set, nt, pos, cache_item->success)
+	cache_item_write_back(window_cache_item(window_cache, pos, nt), cache_item);
+	pending_cache_item_return(&window_cache->free_items, cache_item);
+}
+
+/*
+	Searching for a non-terminal
+	~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+	Parsing a non-terminal only works from the current position. To find
+	all occurences of a non-terminal in a text, for example all strings in
+	a large source file, it has to be tried from every position. With the
+	FIRST set of the non-terminal (see grammar_analyse) the positions where
+	it cannot start, are skipped without calling the parser at all. When
+	the parser has a cache, it is used for all the attempts, such that the
+	results of non-terminals parsed at some position are reused by later
+	attempts.
+	The function below calls the match function for every (non-empty)
+	match, and continues after the end of the match, unless overlapping
+	matches are requested, in which case it continues with the next
+	position. When the match function returns false, the search is
+	stopped. The number of matches is returned.
+*/
+
+typedef bool (*scan_match_function_p)(void *data, text_pos_p start, text_pos_p end, result_p result);
+
+size_t parse_scan(parser_p parser, non_terminal_p non_term, bool overlapping, scan_match_function_p match, void *data)
+{
+	ENTER_RESULT_CONTEXT
+	text_buffer_p text_buffer = parser->text_buffer;
+	const char *end = text_buffer->buffer + text_buffer->buffer_len;
+
+	/* Only when the non-terminal cannot be empty, the FIRST set can be used
+	   to skip positions */
+	bool use_first = non_term->first != NULL && !non_term->nullable;
+	char_set_finder_t finder;
+	if (use_first)
+		char_set_finder_init(&finder, non_term->first);
+
+	size_t nr_matches = 0;
+	while (!text_buffer_end(text_buffer))
+	{
+		if (use_first)
+		{
+			const char *candidate = char_set_finder_find(&finder, text_buffer->info, end);
+			if (candidate == end)
+				break;
+			text_buffer_advance_to(text_buffer, candidate - text_buffer->buffer);
+		}
+		text_pos_t start = text_buffer->pos;
+
+		DECL_RESULT(result)
+		bool found = parse_nt(parser, non_term, &result) && text_buffer->pos.pos > start.pos;
+		if (found)
+		{
+			nr_matches++;
+			text_pos_t match_end = text_buffer->pos;
+			bool go_on = match == NULL || match(data, &start, &match_end, &result);
+			DISP_RESULT(result)
+			if (!go_on)
+				break;
+			if (!overlapping)
+				continue;
+		}
+		else
+			DISP_RESULT(result)
+		text_buffer_set_pos(text_buffer, &start);
+		text_buffer_next(text_buffer);
+	}
+
+	EXIT_RESULT_CONTEXT
+	return nr_matches;
+}
+
+/*
+	Earley parser
+	~~~~~~~~~~~~~
+
+	The back-tracking parser can take exponential time on some inputs, and
+	it cannot deal with indirect left-recursion. The Earley parser below
+	works on the same grammar definition and takes at most cubic time. It
+	first recognizes the input, building for every position the set of
+	items, where an item is a position in a rule (the dot) together with
+	the position where the rule started (the origin). Every time a rule is
+	completed, the span of its non-terminal (or grouping or chain rule) is
+	recorded. Thereafter, a derivation is selected with the help of these
+	spans and the functions for processing results are called for this
+	derivation only.
+
+	The elements of a rule are treated as follows:
+	- An optional element can be skipped.
+	- For a sequence, the phase of an item tells whether the first element
+	  is expected, whether more elements may follow (ep_more), or whether
+	  an element must follow after the chain rule (ep_after_chain).
+	- A left-recursive rule starts with the non-terminal itself
+	  (ep_rec_start).
+	- The terminal elements (and the and/not predicates) are scanned with
+	  parse_element, such that they have exactly the same meaning.
+	- Conditions and the functions for processing results are ignored while
+	  recognizing. When selecting the derivation, alternatives are tried in
+	  the order of the back-tracking parser: rules in order of definition,
+	  optional elements first, sequences as long as possible (unless the
+	  element should be avoided), and the longest span of the non-terminal
+	  for left-recursive rules. The failure of selecting a derivation for
+	  a part of a rule is remembered, assuming that the functions for
+	  processing results only fail depending on the element.
+*/
+
+enum earley_phase
+{
+	ep_first,        /* Before the (first) element */
+	ep_more,         /* After an element of a sequence */
+	ep_after_chain,  /* After the chain rule of a sequence */
+	ep_rec_start,    /* At the start of a left-recursive rule */
+	ep_end,          /* At the end of a rule */
+	ep_chain_end,    /* At the end of a chain rule */
+};
+
+enum earley_symbol_kind { es_none, es_nt, es_grouping, es_chain };
+
+/* Tags of the entries in the hash table */
+enum earley_tag
+{
+	et_ends = 10,    /* The ends of the spans of a symbol (with kind) from a start position */
+	et_nt = 20,      /* The derivation of a non-terminal for a span */
+	et_fail = 30,    /* Failure to derive (the remainder of) a rule (with phase) */
+	et_waiting = 40, /* The items in a set waiting for a symbol (with kind) */
+};
+
+typedef struct
+{
+	const void *symbol;            /* The non-terminal or the grouping or sequence element */
+	enum earley_symbol_kind kind;
+	rule_p rule;                   /* The rule (NULL for a chain rule) */
+	element_p element;             /* The element at the dot (NULL at the end) */
+	enum earley_phase phase;
+	size_t origin;
+} earley_item_t, *earley_item_p;
+
+typedef struct
+{
+	earley_item_p items;
+	size_t nr_items;
+	size_t max_items;
+	size_t *index;                 /* Hash table with (one more than) the indexes of the items */
+	size_t index_size;
+} earley_set_t, *earley_set_p;
+
+typedef struct earley_entry *earley_entry_p;
+struct earley_entry
+{
+	const void *key;
+	int tag;
+	size_t start;
+	size_t end;
+	union
+	{   size_t *ends;              /* et_ends: sorted array of ends, et_waiting: indexes of items */
+		struct
+		{   enum { ed_busy, ed_fail, ed_success } state;
+			result_t result;
+		} nt;                      /* et_nt: state of the derivation */
+	} value;
+	size_t nr_ends;                /* et_ends: number of ends */
+	size_t max_ends;
+};
+
+typedef struct
+{
+	parser_p parser;
+	size_t len;                    /* Length of the input */
+	text_pos_t *text_pos;          /* The line and column numbers of all positions */
+	earley_set_p sets;
+	earley_entry_p *entries;       /* Hash table (with open addressing) */
+	size_t nr_entries;
+	size_t size;
+} earley_t, *earley_p;
+
+size_t earley_hash(const void *key, int tag, size_t start, size_t end)
+{
+	/* The size of the table is a power of two, so the higher bits are mixed into the lower bits */
+	unsigned long long h = ((unsigned long long)(size_t)key >> 3) ^ ((unsigned long long)tag << 56) ^ ((unsigned long long)start << 24) ^ end;
+	h = (h ^ (h >> 31)) * 0x9E3779B97F4A7C15ULL;
+	h = (h ^ (h >> 29)) * 0xBF58476D1CE4E5B9ULL;
+	return (size_t)(h ^ (h >> 32));
+}
+
+earley_entry_p earley_find(earley_p earley, const void *key, int tag, size_t start, size_t end, bool add, bool *added)
+{
+	if (add && 2 * (earley->nr_entries + 1) > earley->size)
+	{
+		/* Double the size of the hash table */
+		size_t old_size = earley->size;
+		earley_entry_p *old_entries = earley->entries;
+		earley->size = old_size == 0 ? 1024 : 2 * old_size;
+		earley->entries = MALLOC_N(earley->size, earley_entry_p);
+		for (size_t i = 0; i < earley->size; i++)
+			earley->entries[i] = NULL;
+		for (size_t i = 0; i < old_size; i++)
+			if (old_entries[i] != NULL)
+			{
+				earley_entry_p entry = old_entries[i];
+				size_t j = earley_hash(entry->key, entry->tag, entry->start, entry->end) & (earley->size - 1);
+				while (earley->entries[j] != NULL)
+					j = (j + 1) & (earley->size - 1);
+				earley->entries[j] = entry;
+			}
+		if (old_entries != NULL)
+			FREE(old_entries);
+	}
+	if (added != NULL)
+		*added = FALSE;
+	if (earley->size == 0)
+		return NULL;
+	size_t i = earley_hash(key, tag, start, end) & (earley->size - 1);
+	for (; earley->entries[i] != NULL; i = (i + 1) & (earley->size - 1))
+	{
+		earley_entry_p entry = earley->entries[i];
+		if (entry->key == key && entry->tag == tag && entry->start == start && entry->end == end)
+			return entry;
+	}
+	if (!add)
+		return NULL;
+	earley_entry_p entry = MALLOC(struct earley_entry);
+	entry->key = key;
+	entry->tag = tag;
+	entry->start = start;
+	entry->end = end;
+	entry->nr_ends = 0;
+	entry->max_ends = 0;
+	entry->value.ends = NULL;
+	earley->entries[i] = entry;
+	earley->nr_entries++;
+	if (added != NULL)
+		*added = TRUE;
+	return entry;
+}
+
+/*	- Functions for the spans of symbols */
+
+void earley_entry_append(earley_entry_p entry, size_t end)
+{
+	if (entry->nr_ends == entry->max_ends)
+	{
+		entry->max_ends = entry->max_ends == 0 ? 4 : 2 * entry->max_ends;
+		size_t *ends = MALLOC_N(entry->max_ends, size_t);
+		for (size_t i = 0; i < entry->nr_ends; i++)
+			ends[i] = entry->value.ends[i];
+		if (entry->value.ends != NULL)
+			FREE(entry->value.ends);
+		entry->value.ends = ends;
+	}
+	entry->value.ends[entry->nr_ends++] = end;
+}
+
+void earley_add_span(earley_p earley, const void *symbol, enum earley_symbol_kind kind, size_t start, size_t end)
+{
+	earley_entry_p entry = earley_find(earley, symbol, et_ends + kind, start, 0, TRUE, NULL);
+	/* The spans are added in the order of their ends */
+	if (entry->nr_ends == 0 || entry->value.ends[entry->nr_ends - 1] != end)
+		earley_entry_append(entry, end);
+}
+
+size_t earley_span_ends(earley_p earley, const void *symbol, enum earley_symbol_kind kind, size_t start, const size_t **ends)
+{
+	earley_entry_p entry = earley_find(earley, symbol, et_ends + kind, start, 0, FALSE, NULL);
+	if (entry == NULL)
+	{
+		*ends = NULL;
+		return 0;
+	}
+	*ends = entry->value.ends;
+	return entry->nr_ends;
+}
+
+bool earley_has_span(earley_p earley, const void *symbol, enum earley_symbol_kind kind, size_t start, size_t end)
+{
+	const size_t *ends;
+	size_t nr_ends = earley_span_ends(earley, symbol, kind, start, &ends);
+	size_t low = 0;
+	size_t high = nr_ends;
+	while (low < high)
+	{
+		size_t mid = (low + high) / 2;
+		if (ends[mid] < end)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low < nr_ends && ends[low] == end;
+}
+
+/*	- Function to determine for which symbol an item is waiting (if any) */
+
+enum earley_symbol_kind earley_unit_kind(element_p element)
+{
+	return   element->kind == rk_nt ? es_nt
+	       : element->kind == rk_grouping ? es_grouping
+	       : es_none;
+}
+
+enum earley_symbol_kind earley_waits_for(earley_item_p item, const void **symbol)
+{
+	switch (item->phase)
+	{
+		case ep_rec_start:
+			*symbol = item->symbol;
+			return es_nt;
+		case ep_more:
+			if (item->element->chain_rule != NULL)
+			{
+				*symbol = item->element;
+				return es_chain;
+			}
+			/* fall through */
+		case ep_first:
+		case ep_after_chain:
+			if (item->element == NULL)
+				return es_none;
+			*symbol = item->element->kind == rk_nt ? (const void*)item->element->info.non_terminal : (const void*)item->element;
+			return earley_unit_kind(item->element);
+		default:
+			return es_none;
+	}
+}
+
+/*	- Function to add an item (and the items that follow from it without
+	  parsing anything) to a set */
+
+void earley_add_item(earley_p earley, size_t set, earley_item_t item);
+
+void earley_advance_item(earley_p earley, size_t set, earley_item_t item)
+{
+	switch (item.phase)
+	{
+		case ep_rec_start:
+			item.element = item.rule->elements;
+			item.phase = ep_first;
+			break;
+		case ep_more:
+			if (item.element->chain_rule != NULL)
+			{
+				item.phase = ep_after_chain;
+				break;
+			}
+			/* fall through */
+		default:
+			if (item.element->sequence)
+				item.phase = ep_more;
+			else
+			{
+				item.element = item.element->next;
+				item.phase = ep_first;
+			}
+			break;
+	}
+	earley_add_item(earley, set, item);
+}
+
+/*	- Function to find an item in a set. (The position in the rule is
+	  identified by the element, except at the start of a left-recursive
+	  rule and at the end of a rule.) */
+
+const void *earley_item_key(earley_item_p item)
+{
+	return   item->phase == ep_rec_start || item->phase == ep_end ? (const void*)item->rule
+	       : item->phase == ep_chain_end ? item->symbol
+	       : (const void*)item->element;
+}
+
+bool earley_set_contains(earley_set_p earley_set, earley_item_p item, size_t *slot)
+{
+	const void *key = earley_item_key(item);
+	size_t i = earley_hash(key, item->phase, item->origin, 0) & (earley_set->index_size - 1);
+	for (; earley_set->index[i] != 0; i = (i + 1) & (earley_set->index_size - 1))
+	{
+		earley_item_p other = &earley_set->items[earley_set->index[i] - 1];
+		if (earley_item_key(other) == key && other->phase == item->phase && other->origin == item->origin)
+			return TRUE;
+	}
+	*slot = i;
+	return FALSE;
+}
+
+void earley_add_item(earley_p earley, size_t set, earley_item_t item)
+{
+	if (item.element == NULL && item.phase == ep_first)
+		item.phase = item.kind == es_chain ? ep_chain_end : ep_end;
+	earley_set_p earley_set = &earley->sets[set];
+	if (2 * (earley_set->nr_items + 1) > earley_set->index_size)
+	{
+		/* Double the size of the hash table */
+		if (earley_set->index != NULL)
+			FREE(earley_set->index);
+		earley_set->index_size = earley_set->index_size == 0 ? 32 : 2 * earley_set->index_size;
+		earley_set->index = MALLOC_N(earley_set->index_size, size_t);
+		for (size_t i = 0; i < earley_set->index_size; i++)
+			earley_set->index[i] = 0;
+		for (size_t i = 0; i < earley_set->nr_items; i++)
+		{
+			size_t slot;
+			earley_set_contains(earley_set, &earley_set->items[i], &slot);
+			earley_set->index[slot] = i + 1;
+		}
+	}
+	size_t slot;
+	if (earley_set_contains(earley_set, &item, &slot))
+		return;
+	earley_set->index[slot] = earley_set->nr_items + 1;
+	if (earley_set->nr_items == earley_set->max_items)
+	{
+		earley_set->max_items = earley_set->max_items == 0 ? 16 : 2 * earley_set->max_items;
+		earley_item_p items = MALLOC_N(earley_set->max_items, earley_item_t);
+		for (size_t i = 0; i < earley_set->nr_items; i++)
+			items[i] = earley_set->items[i];
+		if (earley_set->items != NULL)
+			FREE(earley_set->items);
+		earley_set->items = items;
+	}
+	earley_set->items[earley_set->nr_items++] = item;
+
+	/* Index the item on the symbol it is waiting for */
+	const void *symbol;
+	enum earley_symbol_kind kind = earley_waits_for(&item, &symbol);
+	if (kind != es_none)
+		earley_entry_append(earley_find(earley, symbol, et_waiting + kind, set, 0, TRUE, NULL), earley_set->nr_items - 1);
+
+	/* Skipping an optional element or ending a sequence */
+	if (item.phase == ep_first && item.element->optional)
+	{
+		earley_item_t next = item;
+		next.element = item.element->next;
+		earley_add_item(earley, set, next);
+	}
+	else if (item.phase == ep_more)
+	{
+		earley_item_t next = item;
+		next.element = item.element->next;
+		next.phase = ep_first;
+		earley_add_item(earley, set, next);
+	}
+
+	/* If the symbol waited for, was already completed without consuming
+	   anything, the item can be advanced. */
+	if (kind != es_none && earley_has_span(earley, symbol, kind, set, set))
+		earley_advance_item(earley, set, item);
+}
+
+/*	- Function to add the items for the rules of a symbol */
+
+void earley_predict(earley_p earley, size_t set, const void *symbol, enum earley_symbol_kind kind)
+{
+	earley_item_t item;
+	item.symbol = symbol;
+	item.kind = kind;
+	item.origin = set;
+	item.phase = ep_first;
+	if (kind == es_chain)
+	{
+		item.rule = NULL;
+		item.element = ((element_p)symbol)->chain_rule;
+		earley_add_item(earley, set, item);
+		return;
+	}
+	rule_p rules = kind == es_nt ? ((non_terminal_p)symbol)->normal : ((element_p)symbol)->info.rules;
+	for (item.rule = rules; item.rule != NULL; item.rule = item.rule->next)
+	{
+		item.element = item.rule->elements;
+		earley_add_item(earley, set, item);
+	}
+	if (kind == es_nt)
+	{
+		item.element = NULL;
+		item.phase = ep_rec_start;
+		for (item.rule = ((non_terminal_p)symbol)->recursive; item.rule != NULL; item.rule = item.rule->next)
+			earley_add_item(earley, set, item);
+	}
+}
+
+/*	- Function to scan a terminal element (or evaluate a predicate) at a
+	  position. Returns whether it succeeded and the end position. */
+
+bool earley_scan(earley_p earley, element_p element, size_t pos, size_t *end)
+{
+	ENTER_RESULT_CONTEXT
+	parser_p parser = earley->parser;
+	text_buffer_set_pos(parser->text_buffer, &earley->text_pos[pos]);
+	DECL_RESULT(prev)
+	DECL_RESULT(result)
+	parser->recognize_only++;
+	bool parsed = parse_element(parser, element, &prev, &result);
+	parser->recognize_only--;
+	DISP_RESULT(result)
+	DISP_RESULT(prev)
+	*end = parser->text_buffer->pos.pos;
+	EXIT_RESULT_CONTEXT
+	return parsed;
+}
+
+/*	- Function to recognize the input. Returns whether the start symbol
+	  was recognized from the given position. */
+
+bool earley_recognize(earley_p earley, non_terminal_p non_term, size_t start)
+{
+	earley_predict(earley, start, non_term, es_nt);
+	for (size_t set = start; set <= earley->len; set++)
+	{
+		earley_set_p earley_set = &earley->sets[set];
+		for (size_t i = 0; i < earley_set->nr_items; i++)
+		{
+			earley_item_t item = earley_set->items[i];
+			if (item.phase == ep_end || item.phase == ep_chain_end)
+			{
+				/* Complete: advance all items that were waiting for the symbol */
+				earley_add_span(earley, item.symbol, item.kind, item.origin, set);
+				earley_entry_p waiting = earley_find(earley, item.symbol, et_waiting + item.kind, item.origin, 0, FALSE, NULL);
+				/* (The number of waiting items can grow while advancing) */
+				for (size_t j = 0; waiting != NULL && j < waiting->nr_ends; j++)
+					earley_advance_item(earley, set, earley->sets[item.origin].items[waiting->value.ends[j]]);
+				continue;
+			}
+			const void *symbol;
+			enum earley_symbol_kind kind = earley_waits_for(&item, &symbol);
+			if (kind != es_none)
+				earley_predict(earley, set, symbol, kind);
+			else
+			{
+				size_t end;
+				if (earley_scan(earley, item.element, set, &end))
+					earley_advance_item(earley, end, item);
+			}
+		}
+	}
+	const size_t *ends;
+	return earley_span_ends(earley, non_term, es_nt, start, &ends) > 0;
+}
+
+/*	- Functions to select a derivation and process the results for it */
+
+bool earley_derive_rest(earley_p earley, element_p element, size_t start, size_t end, const result_p prev, rule_p rule, result_p result);
+bool earley_derive_more(earley_p earley, element_p element, size_t start, size_t end, const result_p prev, const result_p seq, rule_p rule, result_p result);
+
+size_t earley_unit_ends(earley_p earley, element_p element, size_t start, size_t *single, const size_t **ends)
+{
+	enum earley_symbol_kind kind = earley_unit_kind(element);
+	if (kind == es_nt)
+		return earley_span_ends(earley, element->info.non_terminal, kind, start, ends);
+	if (kind == es_grouping)
+		return earley_span_ends(earley, element, kind, start, ends);
+	*ends = single;
+	return earley_scan(earley, element, start, single) ? 1 : 0;
+}
+
+bool earley_derive_nt(earley_p earley, non_terminal_p non_term, size_t start, size_t end, result_p result)
+{
+	ENTER_RESULT_CONTEXT
+	if (!earley_has_span(earley, non_term, es_nt, start, end))
+	{
+		EXIT_RESULT_CONTEXT
+		return FALSE;
+	}
+	bool added;
+	earley_entry_p entry = earley_find(earley, non_term, et_nt, start, end, TRUE, &added);
+	if (!added)
+	{
+		if (entry->value.nt.state == ed_success)
+			result_assign(result, &entry->value.nt.result);
+		EXIT_RESULT_CONTEXT
+		return entry->value.nt.state == ed_success;
+	}
+	entry->value.nt.state = ed_busy;
+	RESULT_INIT(&entry->value.nt.result);
+
+	bool derived = FALSE;
+	
+	/* First try left-recursive rules, with the longest span for the
+	   non-terminal at the start */
+	const size_t *ends;
+	size_t nr_ends = non_term->recursive != NULL ? earley_span_ends(earley, non_term, es_nt, start, &ends) : 0;
+	for (size_t i = nr_ends; i > 0 && !derived; i--)
+	{
+		size_t mid = ends[i - 1];
+		if (mid >= end)
+			continue;
+		DECL_RESULT(left)
+		if (earley_derive_nt(earley, non_term, start, mid, &left))
+			for (rule_p rule = non_term->recursive; rule != NULL && !derived; rule = rule->next)
+			{
+				DECL_RESULT(start_result)
+				if (rule->rec_start_function == NULL || rule->rec_start_function(&left, &start_result))
+					derived = earley_derive_rest(earley, rule->elements, mid, end, &start_result, rule, result);
+				DISP_RESULT(start_result)
+			}
+		DISP_RESULT(left)
+	}
+	
+	for (rule_p rule = non_term->normal; rule != NULL && !derived; rule = rule->next)
+	{
+		DECL_RESULT(start_result)
+		derived = earley_derive_rest(earley, rule->elements, start, end, &start_result, rule, result);
+		DISP_RESULT(start_result)
+	}
+
+	/* The entry has to be looked up again, because the hash table could
+	   have been resized */
+	entry = earley_find(earley, non_term, et_nt, start, end, FALSE, NULL);
+	entry->value.nt.state = derived ? ed_success : ed_fail;
+	if (derived)
+		result_assign(&entry->value.nt.result, result);
+	EXIT_RESULT_CONTEXT
+	return derived;
+}
+
+bool earley_derive_unit(earley_p earley, element_p element, size_t start, size_t end, const result_p prev, result_p result)
+{
+	ENTER_RESULT_CONTEXT
+	parser_p parser = earley->parser;
+	bool derived = FALSE;
+	if (element->kind == rk_nt)
+	{
+		DECL_RESULT(nt_result)
+		if (   earley_derive_nt(earley, element->info.non_terminal, start, end, &nt_result)
+			&& (element->condition == 0 || (*element->condition)(&nt_result, element->condition_argument)))
+		{
+			if (element->add_function == 0)
+			{
+				result_assign(result, prev);
+				derived = TRUE;
+			}
+			else
+				derived = (*element->add_function)(prev, &nt_result, result);
+		}
+		DISP_RESULT(nt_result)
+	}
+	else if (element->kind == rk_grouping)
+	{
+		if (earley_has_span(earley, element, es_grouping, start, end))
+		{
+			DECL_RESULT(rule_result)
+			for (rule_p rule = element->info.rules; rule != NULL && !derived; rule = rule->next)
+			{
+				DECL_RESULT(start_result)
+				if (element->add_function == 0)
+					result_assign(&start_result, prev);
+				derived = earley_derive_rest(earley, rule->elements, start, end, &start_result, rule, &rule_result);
+				DISP_RESULT(start_result)
+			}
+			if (derived)
+			{
+				if (element->add_function == 0)
+					result_assign(result, &rule_result);
+				else
+					derived = (*element->add_function)(prev, &rule_result, result);
+			}
+			DISP_RESULT(rule_result)
+		}
+	}
+	else
+	{
+		/* Terminal elements are parsed by parse_element */
+		text_buffer_set_pos(parser->text_buffer, &earley->text_pos[start]);
+		derived = parse_element(parser, element, prev, result) && parser->text_buffer->pos.pos == end;
+		EXIT_RESULT_CONTEXT
+		return derived;
+	}
+	if (derived && element->set_pos != NULL)
+		element->set_pos(result, &earley->text_pos[start]);
+	EXIT_RESULT_CONTEXT
+	return derived;
+}
+
+bool earley_derive_skip(element_p element, const result_p prev, result_p result)
+{
+	ENTER_RESULT_CONTEXT
+	bool skipped = TRUE;
+	if (element->add_skip_function != NULL)
+		skipped = element->add_skip_function(prev, result);
+	else if (element->add_function != NULL)
+	{
+		DECL_RESULT(empty)
+		skipped = element->add_function(prev, &empty, result);
+		DISP_RESULT(empty)
+	}
+	else
+		result_assign(result, prev);
+	EXIT_RESULT_CONTEXT
+	return skipped;
+}
+
+bool earley_derive_rest(earley_p earley, element_p element, size_t start, size_t end, const result_p prev, rule_p rule, result_p result)
+{
+	ENTER_RESULT_CONTEXT
+	if (element == NULL)
+	{
+		bool derived = start == end;
+		if (derived)
+		{
+			if (rule == NULL || rule->end_function == 0)
+				result_assign(result, prev);
+			else
+				derived = rule->end_function(prev, rule->end_function_data, result);
+		}
+		EXIT_RESULT_CONTEXT
+		return derived;
+	}
+	if (earley_find(earley, element, et_fail + ep_first, start, end, FALSE, NULL) != NULL)
+	{
+		EXIT_RESULT_CONTEXT
+		return FALSE;
+	}
+
+	bool derived = FALSE;
+	if (element->optional && element->avoid)
+	{
+		DECL_RESULT(skip_result)
+		derived =    earley_derive_skip(element, prev, &skip_result)
+		          && earley_derive_rest(earley, element->next, start, end, &skip_result, rule, result);
+		DISP_RESULT(skip_result)
+	}
+
+	size_t single;
+	const size_t *ends;
+	size_t nr_ends = derived ? 0 : earley_unit_ends(earley, element, start, &single, &ends);
+	for (size_t i = nr_ends; i > 0 && !derived; i--)
+	{
+		size_t mid = ends[i - 1];
+		if (mid > end)
+			continue;
+		if (element->sequence)
+		{
+			DECL_RESULT(seq_begin)
+			if (element->begin_seq_function != NULL)
+				element->begin_seq_function(prev, &seq_begin);
+			DECL_RESULT(seq_elem)
+			derived =    earley_derive_unit(earley, element, start, mid, &seq_begin, &seq_elem)
+			          && earley_derive_more(earley, element, mid, end, prev, &seq_elem, rule, result);
+			DISP_RESULT(seq_elem)
+			DISP_RESULT(seq_begin)
+		}
+		else
+		{
+			DECL_RESULT(elem)
+			derived =    earley_derive_unit(earley, element, start, mid, prev, &elem)
+			          && earley_derive_rest(earley, element->next, mid, end, &elem, rule, result);
+			DISP_RESULT(elem)
+		}
+	}
+
+	if (!derived && element->optional && !element->avoid)
+	{
+		DECL_RESULT(skip_result)
+		derived =    earley_derive_skip(element, prev, &skip_result)
+		          && earley_derive_rest(earley, element->next, start, end, &skip_result, rule, result);
+		DISP_RESULT(skip_result)
+	}
+
+	if (!derived)
+		earley_find(earley, element, et_fail + ep_first, start, end, TRUE, NULL);
+	EXIT_RESULT_CONTEXT
+	return derived;
+}
+
+bool earley_derive_end_seq(earley_p earley, element_p element, size_t start, size_t end, const result_p prev, const result_p seq, rule_p rule, result_p result)
+{
+	ENTER_RESULT_CONTEXT
+	DECL_RESULT(seq_result)
+	bool derived = TRUE;
+	if (element->add_seq_function != NULL)
+		derived = element->add_seq_function(prev, seq, &seq_result);
+	else
+		result_assign(&seq_result, prev);
+	derived = derived && earley_derive_rest(earley, element->next, start, end, &seq_result, rule, result);
+	DISP_RESULT(seq_result)
+	EXIT_RESULT_CONTEXT
+	return derived;
+}
+
+bool earley_derive_more(earley_p earley, element_p element, size_t start, size_t end, const result_p prev, const result_p seq, rule_p rule, result_p result)
+{
+	ENTER_RESULT_CONTEXT
+	if (earley_find(earley, element, et_fail + ep_more, start, end, FALSE, NULL) != NULL)
+	{
+		EXIT_RESULT_CONTEXT
+		return FALSE;
+	}
+	bool derived = element->avoid && earley_derive_end_seq(earley, element, start, end, prev, seq, rule, result);
+
+	/* Try the chain rule (if any) and a next element */
+	const size_t *chain_ends;
+	size_t nr_chain_ends = 1;
+	size_t no_chain = start;
+	if (element->chain_rule != NULL)
+		nr_chain_ends = earley_span_ends(earley, element, es_chain, start, &chain_ends);
+	else
+		chain_ends = &no_chain;
+	for (size_t i = nr_chain_ends; i > 0 && !derived; i--)
+	{
+		size_t chain_end = chain_ends[i - 1];
+		if (chain_end > end)
+			continue;
+		if (element->chain_rule != NULL)
+		{
+			DECL_RESULT(dummy_prev_result)
+			DECL_RESULT(dummy_chain_elem)
+			bool derived_chain = earley_derive_rest(earley, element->chain_rule, start, chain_end, &dummy_prev_result, NULL, &dummy_chain_elem);
+			DISP_RESULT(dummy_chain_elem)
+			DISP_RESULT(dummy_prev_result)
+			if (!derived_chain)
+				continue;
+		}
+		size_t single;
+		const size_t *ends;
+		size_t nr_ends = earley_unit_ends(earley, element, chain_end, &single, &ends);
+		for (size_t j = nr_ends; j > 0 && !derived; j--)
+		{
+			size_t mid = ends[j - 1];
+			/* Every next element should consume something */
+			if (mid > end || mid == start)
+				continue;
+			DECL_RESULT(next_seq)
+			derived =    earley_derive_unit(earley, element, chain_end, mid, seq, &next_seq)
+			          && earley_derive_more(earley, element, mid, end, prev, &next_seq, rule, result);
+			DISP_RESULT(next_seq)
+		}
+	}
+
+	if (!derived && !element->avoid)
+		derived = earley_derive_end_seq(earley, element, start, end, prev, seq, rule, result);
+
+	if (!derived)
+		earley_find(earley, element, et_fail + ep_more, start, end, TRUE, NULL);
+	EXIT_RESULT_CONTEXT
+	return derived;
+}
+
+void earley_free(earley_p earley)
+{
+	for (size_t i = 0; i < earley->size; i++)
+	{
+		earley_entry_p entry = earley->entries[i];
+		if (entry == NULL)
+			continue;
+		if (entry->tag == et_nt && entry->value.nt.state == ed_success)
+			RESULT_RELEASE(&entry->value.nt.result);
+		else if (((entry->tag >= et_ends && entry->tag < et_nt) || entry->tag >= et_waiting) && entry->value.ends != NULL)
+			FREE(entry->value.ends);
+		FREE(entry);
+	}
+	if (earley->entries != NULL)
+		FREE(earley->entries);
+	for (size_t i = 0; i <= earley->len; i++)
+		if (earley->sets[i].items != NULL)
+		{
+			FREE(earley->sets[i].items);
+			FREE(earley->sets[i].index);
+		}
+	FREE(earley->sets);
+	FREE(earley->text_pos);
+}
+
+/*
+	- Function to parse a non-terminal from the current position, like
+	  parse_nt, but with the Earley parser. The longest match is taken.
+*/
+
+bool earley_parse_nt(parser_p parser, non_terminal_p non_term, result_p result)
+{
+	text_buffer_p text_buffer = parser->text_buffer;
+	earley_t earley;
+	earley.parser = parser;
+	earley.len = text_buffer->buffer_len;
+	earley.entries = NULL;
+	earley.nr_entries = 0;
+	earley.size = 0;
+	earley.sets = MALLOC_N(earley.len + 1, earley_set_t);
+	earley.text_pos = MALLOC_N(earley.len + 1, text_pos_t);
+	text_pos_t start = text_buffer->pos;
+	for (size_t i = 0; i <= earley.len; i++)
+	{
+		earley.sets[i].items = NULL;
+		earley.sets[i].nr_items = 0;
+		earley.sets[i].max_items = 0;
+		earley.sets[i].index = NULL;
+		earley.sets[i].index_size = 0;
+		if (i >= start.pos)
+		{
+			earley.text_pos[i] = text_buffer->pos;
+			text_buffer_next(text_buffer);
+		}
+	}
+
+	bool parsed = FALSE;
+	if (earley_recognize(&earley, non_term, start.pos))
+	{
+		const size_t *ends;
+		size_t nr_ends = earley_span_ends(&earley, non_term, es_nt, start.pos, &ends);
+		for (size_t i = nr_ends; i > 0 && !parsed; i--)
+			if (earley_derive_nt(&earley, non_term, start.pos, ends[i - 1], result))
+			{
+				text_buffer_set_pos(text_buffer, &earley.text_pos[ends[i - 1]]);
+				parsed = TRUE;
+			}
+	}
+	if (!parsed)
+		text_buffer_set_pos(text_buffer, &start);
+	earley_free(&earley);
+	return parsed;
+}
+
+/*
+	Compiling a grammar to machine code
+	~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+	For grammars that are only known at run-time (for example, a user
+	defined format for a configuration file), the switches in parse_rule
+	and parse_element are executed for every element that is parsed. This
+	can be avoided by compiling non-terminals into machine code. The
+	function jit_compile_grammar compiles every non-terminal for which
+	this is supported into a function that returns the position after the
+	parsed text (or NULL if it could not be parsed). This is supported for
+	non-terminals without left-recursive rules, of which the elements are
+	characters, character sets, groupings, and/not predicates, the end of
+	the input, elements that skip up to a delimiter (calling find_delimiter)
+	and non-terminals for which it is also supported. These may be
+	optional and/or non-back-tracking sequences, but may not have a chain
+	rule, the avoid modifier, a condition or error recovery.
+
+	The compiled function does not call the functions for processing
+	results. For this reason, parse_nt only calls it when the parser is
+	only recognizing or when the non-terminal (and all non-terminals it
+	depends on) has no functions for processing results, as is the case
+	for white space. When the compiled function fails, parse_nt falls
+	back to the interpreter, such that what was expected is reported.
+	(What was expected at positions where the compiled function did not
+	fail, is not reported.)
+
+	Around the call of the compiled function, parse_nt pushes the
+	non-terminal on the stack of non-terminals and fires the probes for
+	entering and leaving it, as for the interpreter, so that the sampling
+	profiler and the probes see it. Other features only see the compiled
+	non-terminal as a whole: the cache is not used for it (like for a
+	cheap LL(1) non-terminal), the heatmap only counts the examination of
+	the element that refers to it, and the memory budget is only checked
+	before it, which is sufficient because the compiled function does not
+	allocate memory.
+
+	Code is only generated for x86-64 with the System V calling convention.
+	On other platforms, jit_compile_grammar returns NULL and the interpreter
+	is used.
+*/
+
+typedef struct jit_code *jit_code_p;
+struct jit_code
+{
+	void *code;
+	size_t size;
+	non_terminal_dict_p all_nt;
+};
+
+/*	- Functions to check whether (the elements of) rules can be compiled */
+
+bool jit_rules_supported(rule_p rules, bool *result_free);
+
+bool jit_element_supported(element_p element, bool *result_free)
+{
+	if (   element->back_tracking || element->avoid || element->chain_rule != NULL
+		|| element->recover != NULL || element->condition != NULL)
+		return FALSE;
+	if (   element->add_char_function != NULL || element->add_span_function != NULL
+		|| element->add_function != NULL || element->add_skip_function != NULL
+		|| element->begin_seq_function != NULL || element->add_seq_function != NULL
+		|| element->set_pos != NULL)
+		*result_free = FALSE;
+	switch (element->kind)
+	{
+		case rk_nt:
+			if (!element->info.non_terminal->jit_result_free)
+				*result_free = FALSE;
+			return element->info.non_terminal->jit_supported;
+		case rk_grouping:
+		case rk_and:
+		case rk_not:
+			return jit_rules_supported(element->info.rules, result_free);
+		case rk_char:
+		case rk_charset:
+		case rk_end:
+		case rk_until:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+bool jit_rules_supported(rule_p rules, bool *result_free)
+{
+	for (rule_p rule = rules; rule != NULL; rule = rule->next)
+	{
+		if (rule->end_function != NULL)
+			*result_free = FALSE;
+		for (element_p element = rule->elements; element != NULL; element = element->next)
+			if (!jit_element_supported(element, result_free))
+				return FALSE;
+	}
+	return TRUE;
+}
+
+#ifdef JIT_X86_64
+
+/*
+	The generated code consists of blocks that are called with the current
+	position in rdi and that return the next position (or 0 on failure)
+	in rax. The end of the input is kept in rbx. There are three kinds of
+	blocks: for trying the rules of a non-terminal or a grouping in order
+	(jb_choice), for parsing the remainder of a rule starting with an
+	element (jb_suffix) and for parsing a single element (jb_unit). A block
+	that needs to remember positions, saves r12, r13 and r14, which also
+	keeps the stack aligned for calling functions. Calls of blocks are
+	recorded as fix-ups, which are patched after all blocks have been
+	generated.
+*/
+
+enum jit_block_kind { jb_choice, jb_suffix, jb_unit };
+
+typedef struct
+{
+	enum jit_block_kind kind;
+	const void *key;     /* The rules or the element */
+	size_t offset;
+} jit_block_t, *jit_block_p;
+
+typedef struct
+{
+	size_t at;           /* Offset of the 32-bits relative address */
+	size_t block;        /* Index of the called block */
+} jit_fixup_t, *jit_fixup_p;
+
+typedef struct
+{
+	byte *code;
+	size_t len;
+	size_t max_len;
+	jit_block_p blocks;
+	size_t nr_blocks;
+	size_t max_blocks;
+	jit_fixup_p fixups;
+	size_t nr_fixups;
+	size_t max_fixups;
+} jit_emitter_t, *jit_emitter_p;
+
+void jit_emit(jit_emitter_p emitter, const byte *bytes, size_t len)
+{
+	if (emitter->len + len > emitter->max_len)
+	{
+		emitter->max_len = emitter->max_len == 0 ? 4096 : 2 * emitter->max_len;
+		byte *code = MALLOC_N(emitter->max_len, byte);
+		if (emitter->code != NULL)
+		{
+			memcpy(code, emitter->code, emitter->len);
+			FREE(emitter->code);
+		}
+		emitter->code = code;
+	}
+	memcpy(emitter->code + emitter->len, bytes, len);
+	emitter->len += len;
+}
+
+#define JIT_EMIT(...) { static const byte _bytes[] = { __VA_ARGS__ }; jit_emit(emitter, _bytes, sizeof(_bytes)); }
+#define JIT_PROLOGUE JIT_EMIT(0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x49, 0x89, 0xFC) /* push r12; push r13; push r14; mov r12, rdi */
+#define JIT_EPILOGUE JIT_EMIT(0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0xC3)             /* pop r14; pop r13; pop r12; ret */
+#define JIT_TEST_RAX JIT_EMIT(0x48, 0x85, 0xC0)                                    /* test rax, rax */
+#define JIT_FAIL JIT_EMIT(0x31, 0xC0)                                              /* xor eax, eax */
+
+void jit_emit_imm(jit_emitter_p emitter, unsigned long long value, int len)
+{
+	byte bytes[8];
+	for (int i = 0; i < len; i++)
+		bytes[i] = (byte)(value >> (8 * i));
+	jit_emit(emitter, bytes, len);
+}
+
+/*	- Function to emit a jump (with a 32-bits relative address) that is patched later */
+
+size_t jit_emit_jump(jit_emitter_p emitter, const byte *opcode, size_t len)
+{
+	jit_emit(emitter, opcode, len);
+	jit_emit_imm(emitter, 0, 4);
+	return emitter->len - 4;
+}
+
+void jit_patch_here(jit_emitter_p emitter, size_t at)
+{
+	size_t rel = emitter->len - (at + 4);
+	for (int i = 0; i < 4; i++)
+		emitter->code[at + i] = (byte)(rel >> (8 * i));
+}
+
+static const byte jit_jz[] = { 0x0F, 0x84 };
+static const byte jit_jne[] = { 0x0F, 0x85 };
+static const byte jit_call[] = { 0xE8 };
+static const byte jit_jmp[] = { 0xE9 };
+
+/*	- Function to emit a call of (or jump to) a block */
+
+void jit_emit_block(jit_emitter_p emitter, const byte *opcode, enum jit_block_kind kind, const void *key)
+{
+	size_t block = 0;
+	while (block < emitter->nr_blocks && (emitter->blocks[block].kind != kind || emitter->blocks[block].key != key))
+		block++;
+	if (block == emitter->nr_blocks)
+	{
+		if (emitter->nr_blocks == emitter->max_blocks)
+		{
+			emitter->max_blocks = emitter->max_blocks == 0 ? 64 : 2 * emitter->max_blocks;
+			jit_block_p blocks = MALLOC_N(emitter->max_blocks, jit_block_t);
+			for (size_t i = 0; i < emitter->nr_blocks; i++)
+				blocks[i] = emitter->blocks[i];
+			if (emitter->blocks != NULL)
+				FREE(emitter->blocks);
+			emitter->blocks = blocks;
+		}
+		emitter->blocks[block].kind = kind;
+		emitter->blocks[block].key = key;
+		emitter->blocks[block].offset = 0;
+		emitter->nr_blocks++;
+	}
+	if (emitter->nr_fixups == emitter->max_fixups)
+	{
+		emitter->max_fixups = emitter->max_fixups == 0 ? 256 : 2 * emitter->max_fixups;
+		jit_fixup_p fixups = MALLOC_N(emitter->max_fixups, jit_fixup_t);
+		for (size_t i = 0; i < emitter->nr_fixups; i++)
+			fixups[i] = emitter->fixups[i];
+		if (emitter->fixups != NULL)
+			FREE(emitter->fixups);
+		emitter->fixups = fixups;
+	}
+	emitter->fixups[emitter->nr_fixups].at = jit_emit_jump(emitter, opcode, opcode == jit_call || opcode == jit_jmp ? 1 : 2);
+	emitter->fixups[emitter->nr_fixups].block = block;
+	emitter->nr_fixups++;
+}
+
+/*	- Function to emit a block that tries rules in order */
+
+void jit_emit_choice(jit_emitter_p emitter, rule_p rules)
+{
+	JIT_PROLOGUE
+	for (rule_p rule = rules; rule != NULL; rule = rule->next)
+	{
+		JIT_EMIT(0x4C, 0x89, 0xE7)                   /* mov rdi, r12 */
+		jit_emit_block(emitter, jit_call, jb_suffix, rule->elements);
+		JIT_TEST_RAX
+		JIT_EMIT(0x74, 0x07)                         /* jz over the epilogue */
+		JIT_EPILOGUE
+	}
+	JIT_FAIL
+	JIT_EPILOGUE
+}
+
+/*	- Function to emit a block that parses the remainder of a rule (as parse_rule) */
+
+void jit_emit_suffix(jit_emitter_p emitter, element_p element)
+{
+	if (element == NULL)
+	{
+		JIT_EMIT(0x48, 0x89, 0xF8, 0xC3)             /* mov rax, rdi; ret */
+		return;
+	}
+	JIT_PROLOGUE
+	jit_emit_block(emitter, jit_call, jb_unit, element);
+	JIT_TEST_RAX
+	size_t skip = jit_emit_jump(emitter, jit_jz, 2);
+	if (element->sequence)
+	{
+		/* Parse as many elements as possible (stopping when nothing is consumed) */
+		size_t loop = emitter->len;
+		JIT_EMIT(0x49, 0x89, 0xC5)                   /* mov r13, rax */
+		JIT_EMIT(0x48, 0x89, 0xC7)                   /* mov rdi, rax */
+		jit_emit_block(emitter, jit_call, jb_unit, element);
+		JIT_TEST_RAX
+		JIT_EMIT(0x74, 0x09)                         /* jz over the loop test */
+		JIT_EMIT(0x4C, 0x39, 0xE8)                   /* cmp rax, r13 */
+		size_t back = jit_emit_jump(emitter, jit_jne, 2);
+		size_t rel = loop - (back + 4);
+		for (int i = 0; i < 4; i++)
+			emitter->code[back + i] = (byte)(rel >> (8 * i));
+		JIT_EMIT(0x4C, 0x89, 0xE8)                   /* mov rax, r13 */
+	}
+	JIT_EMIT(0x48, 0x89, 0xC7)                       /* mov rdi, rax */
+	jit_emit_block(emitter, jit_call, jb_suffix, element->next);
+	JIT_TEST_RAX
+	size_t skip2 = jit_emit_jump(emitter, jit_jz, 2);
+	JIT_EPILOGUE
+	jit_patch_here(emitter, skip);
+	jit_patch_here(emitter, skip2);
+	if (element->optional)
+	{
+		JIT_EMIT(0x4C, 0x89, 0xE7)                   /* mov rdi, r12 */
+		jit_emit_block(emitter, jit_call, jb_suffix, element->next);
+	}
+	else
+		JIT_FAIL
+	JIT_EPILOGUE
+}
+
+/*	- Function to emit a block that parses a single element (as parse_element) */
+
+void jit_emit_unit(jit_emitter_p emitter, element_p element)
+{
+	switch (element->kind)
+	{
+		case rk_nt:
+			jit_emit_block(emitter, jit_jmp, jb_choice, element->info.non_terminal->normal);
+			break;
+		case rk_grouping:
+			jit_emit_block(emitter, jit_jmp, jb_choice, element->info.rules);
+			break;
+		case rk_and:
+		case rk_not:
+			JIT_PROLOGUE
+			jit_emit_block(emitter, jit_call, jb_choice, element->info.rules);
+			JIT_TEST_RAX
+			if (element->kind == rk_and)
+				JIT_EMIT(0x74, 0x0A)                 /* jz fail */
+			else
+				JIT_EMIT(0x75, 0x0A)                 /* jnz fail */
+			JIT_EMIT(0x4C, 0x89, 0xE0)               /* mov rax, r12 */
+			JIT_EPILOGUE
+			JIT_FAIL
+			JIT_EPILOGUE
+			break;
+		case rk_char:
+			JIT_EMIT(0x48, 0x39, 0xDF, 0x73, 0x0A)   /* cmp rdi, rbx; jae fail */
+			JIT_EMIT(0x80, 0x3F)                     /* cmp byte [rdi], ch */
+			jit_emit_imm(emitter, (byte)element->info.ch, 1);
+			JIT_EMIT(0x75, 0x05)                     /* jne fail */
+			JIT_EMIT(0x48, 0x8D, 0x47, 0x01, 0xC3)   /* lea rax, [rdi+1]; ret */
+			JIT_FAIL
+			JIT_EMIT(0xC3)
+			break;
+		case rk_charset:
+			JIT_EMIT(0x48, 0x39, 0xDF, 0x73, 0x17)   /* cmp rdi, rbx; jae fail */
+			JIT_EMIT(0x0F, 0xB6, 0x07)               /* movzx eax, byte [rdi] */
+			JIT_EMIT(0x48, 0xB9)                     /* mov rcx, bitvec */
+			jit_emit_imm(emitter, (unsigned long long)(size_t)element->info.char_set->bitvec, 8);
+			JIT_EMIT(0x0F, 0xA3, 0x01, 0x73, 0x05)   /* bt [rcx], eax; jnc fail */
+			JIT_EMIT(0x48, 0x8D, 0x47, 0x01, 0xC3)   /* lea rax, [rdi+1]; ret */
+			JIT_FAIL
+			JIT_EMIT(0xC3)
+			break;
+		case rk_end:
+			JIT_EMIT(0x48, 0x39, 0xDF, 0x72, 0x04)   /* cmp rdi, rbx; jb fail */
+			JIT_EMIT(0x48, 0x89, 0xF8, 0xC3)         /* mov rax, rdi; ret */
+			JIT_FAIL
+			JIT_EMIT(0xC3)
+			break;
+		case rk_until:
+			/* Tail call of find_delimiter(rdi, rbx, delimiter, escape) */
+			JIT_EMIT(0x48, 0x89, 0xDE)               /* mov rsi, rbx */
+			JIT_EMIT(0x48, 0xBA)                     /* mov rdx, delimiter */
+			jit_emit_imm(emitter, (unsigned long long)(size_t)element->info.until.delimiter, 8);
+			JIT_EMIT(0xB9)                           /* mov ecx, escape */
+			jit_emit_imm(emitter, (byte)element->info.until.escape, 4);
+			JIT_EMIT(0x48, 0xB8)                     /* mov rax, find_delimiter */
+			jit_emit_imm(emitter, (unsigned long long)(size_t)find_delimiter, 8);
+			JIT_EMIT(0xFF, 0xE0)                     /* jmp rax */
+			break;
+		default:
+			break;
+	}
+}
+
+#endif
+
+/*	- Function to compile a grammar. Returns NULL if nothing was compiled. */
+
+jit_code_p jit_compile_grammar(non_terminal_dict_p all_nt)
+{
+	/* Determine which non-terminals are supported, until nothing changes */
+	for (non_terminal_dict_p nt_dict = all_nt; nt_dict != NULL; nt_dict = nt_dict->next)
+	{
+		nt_dict->elem.jit_function = NULL;
+		nt_dict->elem.jit_supported = nt_dict->elem.recursive == NULL;
+		nt_dict->elem.jit_result_free = nt_dict->elem.jit_supported;
+	}
+	for (bool changed = TRUE; changed;)
+	{
+		changed = FALSE;
+		for (non_terminal_dict_p nt_dict = all_nt; nt_dict != NULL; nt_dict = nt_dict->next)
+			if (nt_dict->elem.jit_supported)
+			{
+				bool result_free = TRUE;
+				bool supported = jit_rules_supported(nt_dict->elem.normal, &result_free);
+				if (supported != nt_dict->elem.jit_supported || (supported && result_free) != nt_dict->elem.jit_result_free)
+				{
+					nt_dict->elem.jit_supported = supported;
+					nt_dict->elem.jit_result_free = supported && result_free;
+					changed = TRUE;
+				}
+			}
+	}
+
+#ifdef JIT_X86_64
+	jit_emitter_t emitter_data;
+	jit_emitter_p emitter = &emitter_data;
+	memset(emitter, 0, sizeof(jit_emitter_t));
+
+	/* For each non-terminal an entry that can be called from C, which sets rbx */
+	size_t nr_entries = 0;
+	for (non_terminal_dict_p nt_dict = all_nt; nt_dict != NULL; nt_dict = nt_dict->next)
+		if (nt_dict->elem.jit_supported)
+		{
+			JIT_EMIT(0x53, 0x48, 0x89, 0xF3)         /* push rbx; mov rbx, rsi */
+			jit_emit_block(emitter, jit_call, jb_choice, nt_dict->elem.normal);
+			JIT_EMIT(0x5B, 0xC3)                     /* pop rbx; ret */
+			nr_entries++;
+		}
+	if (nr_entries == 0)
+		return NULL;
+
+	/* Emit the blocks (which can add more blocks) and patch the calls */
+	for (size_t i = 0; i < emitter->nr_blocks; i++)
+	{
+		emitter->blocks[i].offset = emitter->len;
+		if (emitter->blocks[i].kind == jb_choice)
+			jit_emit_choice(emitter, (rule_p)emitter->blocks[i].key);
+		else if (emitter->blocks[i].kind == jb_suffix)
+			jit_emit_suffix(emitter, (element_p)emitter->blocks[i].key);
+		else
+			jit_emit_unit(emitter, (element_p)emitter->blocks[i].key);
+	}
+	for (size_t i = 0; i < emitter->nr_fixups; i++)
+	{
+		size_t at = emitter->fixups[i].at;
+		size_t rel = emitter->blocks[emitter->fixups[i].block].offset - (at + 4);
+		for (int j = 0; j < 4; j++)
+			emitter->code[at + j] = (byte)(rel >> (8 * j));
+	}
+
+	/* Copy the code to memory that is made executable */
+	jit_code_p jit_code = NULL;
+	void *code = mmap(NULL, emitter->len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code != MAP_FAILED)
+	{
+		memcpy(code, emitter->code, emitter->len);
+		if (mprotect(code, emitter->len, PROT_READ | PROT_EXEC) == 0)
+		{
+			jit_code = MALLOC(struct jit_code);
+			jit_code->code = code;
+			jit_code->size = emitter->len;
+			jit_code->all_nt = all_nt;
+			/* The entries are at the start of the code, each 11 bytes long */
+			size_t offset = 0;
+			for (non_terminal_dict_p nt_dict = all_nt; nt_dict != NULL; nt_dict = nt_dict->next)
+				if (nt_dict->elem.jit_supported)
+				{
+					nt_dict->elem.jit_function = (const char *(*)(const char *, const char *))((byte *)code + offset);
+					offset += 11;
+				}
+		}
+		else
+			munmap(code, emitter->len);
+	}
+	FREE(emitter->code);
+	FREE(emitter->blocks);
+	FREE(emitter->fixups);
+	return jit_code;
+#else
+	return NULL;
+#endif
+}
+
+void jit_code_free(jit_code_p jit_code)
+{
+	if (jit_code == NULL)
+		return;
+	for (non_terminal_dict_p nt_dict = jit_code->all_nt; nt_dict != NULL; nt_dict = nt_dict->next)
+		nt_dict->elem.jit_function = NULL;
+#ifdef JIT_X86_64
+	munmap(jit_code->code, jit_code->size);
+#endif
+	FREE(jit_code);
+}
+
+/*
+	White space tests
+	~~~~~~~~~~~~~~~~~
+*/
+
+void test_parse_white_space(non_terminal_dict_p *all_nt, const char *input)
+{
+	ENTER_RESULT_CONTEXT
+
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, input);
+	
+	solutions_t solutions;
+	solutions_init(&solutions, &text_buffer);
+	
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	parser.cache_hit_function = solutions_find;
+	parser.cache = &solutions;
+	
+	DECL_RESULT(result);
+	if (parse_nt(&parser, find_nt("white_space", all_nt), &result) && text_buffer_end(&text_buffer))
+	{
+		fprintf(stderr, "OK: parsed white space\n");
+	}
+	else
+	{
+		fprintf(stderr, "ERROR: failed to parse white space from '%s'\n", input);
+	}
+	DISP_RESULT(result);
+
+	solutions_free(&solutions);
+
+	EXIT_RESULT_CONTEXT
+}
+
+void test_white_space_grammar(non_terminal_dict_p *all_nt)
+{
+	test_parse_white_space(all_nt, " ");
+	test_parse_white_space(all_nt, "/* */");
+	test_parse_white_space(all_nt, "/* a ** b */ // line\r\n\t/**/");
+}
+
+/*	A delimiter that was not found, is not searched for again from later
+	positions. In the grammar below, each '<' of an input without '>' tries
+	the first rule. Only the first attempt should be recorded. */
+
+void until_test_grammar(non_terminal_dict_p *all_nt)
+{
+	HEADER(all_nt)
+	(void)ref_rec_rule;
+
+	NT_DEF("tags")
+		RULE
+			{ GROUPING
+				RULE CHAR('<') UNTIL(">", '\0') CHAR('>')
+				RULE CHARSET(0) ADD_RANGE(' ', '~')
+			} SEQ(0, 0)
+			END
+}
+
+void test_until_fails()
+{
+	ENTER_RESULT_CONTEXT
+	non_terminal_dict_p all_nt = NULL;
+	until_test_grammar(&all_nt);
+	non_terminal_p tags = find_nt("tags", &all_nt);
+	element_p until = tags->normal->elements->info.rules->elements->next;
+	char input[1001];
+	memset(input, '<', 1000);
+	input[1000] = '\0';
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, input);
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	DECL_RESULT(result);
+	bool parsed = parse_nt(&parser, tags, &result) && text_buffer_end(&text_buffer);
+	DISP_RESULT(result);
+	until_fail_t *until_fail = &parser.until_fails[((size_t)until >> 4) % UNTIL_FAILS_SIZE];
+	if (!parsed || until->kind != rk_until || until_fail->element != until || until_fail->pos != 1)
+		fprintf(stderr, "ERROR: unterminated delimiter was searched for again\n");
+	else
+		fprintf(stderr, "OK: unterminated delimiter was searched for once\n");
+	EXIT_RESULT_CONTEXT
+}
+
+/*
+	Number tests
+	~~~~~~~~~~~~
+*/
+
+void test_parse_number(non_terminal_dict_p *all_nt, const char *input, int num)
+{
+	ENTER_RESULT_CONTEXT
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, input);
+	
+	solutions_t solutions;
+	solutions_init(&solutions, &text_buffer);
+	
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	parser.cache_hit_function = solutions_find;
+	parser.cache = &solutions;
+	
+	DECL_RESULT(result);
+	if (parse_nt(&parser, find_nt("number", all_nt), &result) && text_buffer_end(&text_buffer))
+	{
+		if (result.data == NULL)
+			fprintf(stderr, "ERROR: parsing '%s' did not return result\n", input);
+		else if (CAST(number_data_p, result.data)->num != num)
+			fprintf(stderr, "ERROR: parsed value %ld from '%s' instead of expected %d\n",
+				CAST(number_data_p, result.data)->num, input, num);
+		else
+			fprintf(stderr, "OK: parsed value %ld from '%s'\n", CAST(number_data_p, result.data)->num, input);
+	}
+	else
+		fprintf(stderr, "ERROR: failed to parse number from '%s'\n", input);
+	DISP_RESULT(result);
+
+	solutions_free(&solutions);
+	EXIT_RESULT_CONTEXT
+}
+
+void test_number_grammar(non_terminal_dict_p *all_nt)
+{
+	test_parse_number(all_nt, "0", 0);
+	test_parse_number(all_nt, "123", 123);
+}
+
+/*
+	Abstract Syntax Tree
+	~~~~~~~~~~~~~~~~~~~~
+	The following section of the code implements a representation for
+	Abstract Syntax Trees.
+*/
+
+typedef struct
+{
+	ref_counted_base_t _base;
+	const char *type_name;
+	unsigned int line;
+	unsigned int column;
+} tree_node_t, *tree_node_p;
+
+void init_tree_node(tree_node_p tree_node, const char *type_name, void (*release_node)(void *))
+{
+	tree_node->_base.cnt = 1;
+	tree_node->_base.release = release_node;
+	tree_node->type_name = type_name;
+	tree_node->line = 0;
+	tree_node->column = 0;
+}
+
+void tree_node_set_pos(tree_node_p tree_node, text_pos_p ps)
+{
+	tree_node->line = ps->cur_line;
+	tree_node->column = ps->cur_column;
+}
+
+typedef struct tree_t *tree_p;
+DEFINE_TYPE(tree_p)
+struct tree_t
+{
+	tree_node_t _node;
+	const char *tree_name;
+	unsigned int nr_children;
+	result_t *children;
+	struct ast_kind *kind;     /* When built by a rule of a bound schema (see 'Typed abstract syntax trees') */
+#ifdef ALLOC_ATTRIBUTION
+	unsigned long children_seq;
+#endif
+};
+
+THREAD_LOCAL tree_p old_trees = NULL;
+THREAD_LOCAL long alloced_trees = 0L;
+
+void release_tree(void *data)
+{
+	tree_p tree = CAST(tree_p, data);
+
+	alloced_trees--;
+
+	if (tree->nr_children > 0)
+	{
+		for (int i = 0; i < tree->nr_children; i++)
+			RESULT_RELEASE(&tree->children[i]);
+		ALLOC_FREE_SEQ(tree->children_seq)
+		FREE(tree->children);
+	}
+	BUDGET_UNCHARGE(tree)
+	*(tree_p*)tree = old_trees;
+	old_trees = tree;
+}
+
+const char *tree_node_type = "tree_node_type";
+
+tree_p malloc_tree(const char *name)
+{
+	tree_p new_tree;
+
+	if (old_trees)
+	{   new_tree = old_trees;
+		old_trees = *(tree_p*)old_trees;
+		BUDGET_CHARGE(new_tree)
+	}
+	else
+		new_tree = MALLOC(struct tree_t);
+
+	init_tree_node(&new_tree->_node, tree_node_type, release_tree);
+	new_tree->tree_name = name;
+	new_tree->nr_children = 0;
+	new_tree->children = NULL;
+	new_tree->kind = NULL;
+	
+	alloced_trees++;
+
+	return new_tree;
+}
+
+typedef struct prev_child_t *prev_child_p;
+DEFINE_TYPE(prev_child_p)
+struct prev_child_t
+{
+	ref_counted_base_t _base;
+	prev_child_p prev;
+	result_t child;
+};
+
+THREAD_LOCAL prev_child_p old_prev_child = NULL;
+
+void release_prev_child( void *data )
+{
+	prev_child_p prev_child = CAST(prev_child_p, data);
+	RESULT_RELEASE(&prev_child->child);
+	if (prev_child != NULL)
+		ref_counted_base_dec(prev_child);
+	FREE(prev_child);
+}
+
+prev_child_p malloc_prev_child()
+{
+	prev_child_p new_prev_child = MALLOC(struct prev_child_t);
+	new_prev_child->_base.cnt = 1;
+	new_prev_child->_base.release = release_prev_child;
+	RESULT_INIT(&new_prev_child->child);
+	new_prev_child->prev = NULL;
+	return new_prev_child;
+}
+
+void prev_child_print(void *data, ostream_p ostream)
+{
+	ostream_puts(ostream, "prev_child[ ");
+	prev_child_p prev_child = prev_child != NULL ? CAST(prev_child_p, data) : NULL;
+	for (; prev_child != NULL; prev_child = prev_child->prev)
+	{
+		if (prev_child->child.data == NULL || prev_child->child.print == NULL)
+			ostream_puts(ostream, "NULL");
+		else
+			prev_child->child.print(prev_child->child.data, ostream);
+		printf(" ");
+	}
+	ostream_puts(ostream, "]");
+}
+
+
+bool add_child(result_p prev, result_p elem, result_p result)
+{
+	prev_child_p prev_child = CAST(prev_child_p, prev->data);
+	if (prev_child != NULL)
+		ref_counted_base_inc(prev_child);
+	prev_child_p new_prev_child = malloc_prev_child();
+	new_prev_child->prev = prev_child;
+	result_assign(&new_prev_child->child, elem);
+	result_assign_ref_counted(result, new_prev_child, prev_child_print);
+	SET_TYPE(prev_child_p, new_prev_child);
+	return TRUE;
+}
+
+bool rec_add_child(result_p rec_result, result_p result)
+{
+	prev_child_p new_prev_child = malloc_prev_child();
+	new_prev_child->prev = NULL;
+	result_assign(&new_prev_child->child, rec_result);
+	result_assign_ref_counted(result, new_prev_child, prev_child_print);
+	SET_TYPE(prev_child_p, new_prev_child);
+	return TRUE;
+}
+
+bool take_child(result_p prev, result_p elem, result_p result)
+{
+	result_assign(result, elem);
+	return TRUE;
+}
+
+tree_p make_tree_with_children(const char* name, prev_child_p children)
+{
+	tree_p tree = malloc_tree(name);
+	prev_child_p child;
+	int i = 0;
+	for (child = children; child != NULL; child = child->prev)
+		i++;
+	tree->nr_children = i;
+	tree->children = MALLOC_N(tree->nr_children, result_t);
+	ALLOC_ATTRIBUTE_ARRAY("children", NULL, tree->children_seq, tree->children, tree->nr_children)
+	for (child = children; child != NULL; child = child->prev)
+	{
+		i--;
+		RESULT_INIT(&tree->children[i]);
+		result_assign(&tree->children[i], &child->child);
+	}
+	return tree;
+}
+
+void tree_print(void *data, ostream_p ostream)
+{
+	tree_p tree = CAST(tree_p, data);
+	if (tree->_node.type_name != NULL)
+		ostream_puts(ostream, tree->tree_name);
+	ostream_put(ostream, '(');
+	for (int i = 0; i < tree->nr_children; i++)
+	{
+		if (i > 0)
+			ostream_put(ostream, ',');
+		result_print(&tree->children[i], ostream);
+	}
+	ostream_put(ostream, ')');
+}
+
+bool make_tree(const result_p rule_result, void* data, result_p result)
+{
+	prev_child_p children = CAST(prev_child_p, rule_result->data);
+	const char *name = (const char*)data;
+	tree_p tree = make_tree_with_children(name, children);
+	result_assign_ref_counted(result, tree, tree_print);
+	SET_TYPE(tree_p, tree);
+	return TRUE;
+}
+
+bool pass_tree(const result_p rule_result, void* data, result_p result)
+{
+	/* The rule can be empty, such as the root for an empty input */
+	prev_child_p child = CAST(prev_child_p, rule_result->data);
+	if (child != NULL)
+		result_transfer(result, &child->child);
+	return TRUE;
+}
+
+
+/*
+	Keywords
+	~~~~~~~~
+	Many programming languages have keywords, which have the same lexical
+	catagory as identifiers. This means we need some function to test
+	whether an identifier is equal to one of the keywords. One way to
+	do this is to use hexadecimal hash tree. This can also be used to map
+	every identifier to a unique pointer, such that comparing two identifiers
+	can simply be done by comparing the two pointers.
+
+	A hexadecimal hash tree
+	~~~~~~~~~~~~~~~~~~~~~~~	
+	The following structure implements a mapping of strings to an integer
+	value in the range [0..254]. It is a tree of hashs in combination with
+	a very fast incremental hash function. In this way, it tries to combine
+	the benefits of trees and hashs. The incremental hash function will first
+	return the lower 4 bits of the characters in the string, and following
+	this the higher 4 bits of the characters.
+*/
+
+typedef struct hexa_hash_tree_t hexa_hash_tree_t, *hexa_hash_tree_p;
+
+struct hexa_hash_tree_t
+{	byte state;
+	union
+	{	char *string;
+		hexa_hash_tree_p *children;
+	} data;
+};
+
+THREAD_LOCAL byte *keyword_state = NULL;
+
+char *ident_string_locked(char *s)
+/*  Returns a unique address representing the string. the global
+    keyword_state will point to the integer value in the range [0..254].
+	If the string does not occure in the store, it is added and the state
+	is initialized with 0.
+*/
+{
+	static hexa_hash_tree_p hash_tree = NULL;
+	hexa_hash_tree_p *r_node = &hash_tree;
+	char *vs = s;
+	int depth;
+	int mode = 0;
+
+	for (depth = 0; ; depth++)
+	{   hexa_hash_tree_p node = *r_node;
+
+		if (node == NULL)
+		{   node = MALLOC(hexa_hash_tree_t);
+			node->state = 0;
+			STRCPY(node->data.string, s);
+			*r_node = node;
+			keyword_state = &node->state;
+			return node->data.string;
+		}
+
+		if (node->state != 255)
+		{   char *cs = node->data.string;
+			hexa_hash_tree_p *children;
+			unsigned short i, v = 0;
+
+			if (*cs == *s && strcmp(cs+1, s+1) == 0)
+			{   keyword_state = &node->state;
+				return node->data.string;
+			}
+
+			children = MALLOC_N(16, hexa_hash_tree_t*);
+			for (i = 0; i < 16; i++)
+				children[i] = NULL;
+
+			i = strlen(cs);
+			if (depth <= i)
+				v = ((byte)cs[depth]) & 15;
+			else if (depth <= i*2)
+				v = ((byte)cs[depth-i-1]) >> 4;
+
+			children[v] = node;
+
+			node = MALLOC(hexa_hash_tree_t);
+			node->state = 255;
+			node->data.children = children;
+			*r_node = node;
+		}
+		{   unsigned short v;
+			if (*vs == '\0')
+			{   v = 0;
+				if (mode == 0)
+				{   mode = 1;
+					vs = s;
+				}
+			}
+			else if (mode == 0)
+				v = ((byte)*vs++) & 15;
+			else
+				v = ((byte)*vs++) >> 4;
+
+			r_node = &node->data.children[v];
+		}
+	}
+}
+
+/*  The store is shared by all threads. (The nodes do not move when the
+	store grows, thus keyword_state remains valid after unlocking.) */
+
+char *ident_string(char *s)
+{
+#ifdef USE_THREADS
+	static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+	pthread_mutex_lock(&mutex);
+	char *result = ident_string_locked(s);
+	pthread_mutex_unlock(&mutex);
+	return result;
+#else
+	return ident_string_locked(s);
+#endif
+}
+
+/*  Parsing an identifier  */
+
+/*  Data structure needed during parsing.
+    Only the first 64 bytes of the identifier will be significant. A code
+    point that does not fit completely, ends the significant part. */
+
+typedef struct ident_data
+{
+	ref_counted_base_t _base;
+	char ident[65];
+	int len;
+	bool full;
+	text_pos_t ps;
+} *ident_data_p;
+DEFINE_TYPE(ident_data_p)
+
+ident_data_p ident_data_assign(result_p prev, result_p result)
+{
+	if (prev->data == NULL)
+	{
+		ident_data_p ident_data = MALLOC(struct ident_data);
+		ident_data->_base.release = NULL;
+		result_assign_ref_counted(result, ident_data, NULL);
+		SET_TYPE(ident_data_p, ident_data);
+		ident_data->len = 0;
+		ident_data->full = FALSE;
+		return ident_data;
+	}
+	result_assign(result, prev);
+	return CAST(ident_data_p, result->data);
+}
+
+bool ident_add_char(result_p prev, char ch, result_p result)
+{
+	ident_data_p ident_data = ident_data_assign(prev, result);
+	if (!ident_data->full && ident_data->len < 64)
+		ident_data->ident[ident_data->len++] = ch;
+	return TRUE;
+}
+
+bool ident_add_span(result_p prev, const char *text, size_t len, result_p result)
+{
+	ident_data_p ident_data = ident_data_assign(prev, result);
+	if (ident_data->full || ident_data->len + len > 64)
+		ident_data->full = TRUE;
+	else
+	{
+		memcpy(ident_data->ident + ident_data->len, text, len);
+		ident_data->len += len;
+	}
+	return TRUE;
+}
+
+void ident_set_pos(result_p result, text_pos_p ps)
+{
+	if (result->data != 0)
+		(CAST(ident_data_p, result->data))->ps = *ps;
+}
+
+void pass_to_sequence(result_p prev, result_p seq)
+{
+	result_assign(seq, prev);
+}
+
+/*  Ident tree node structure */
+
+typedef struct ident_t *ident_p;
+DEFINE_TYPE(ident_p)
+struct ident_t
+{
+	tree_node_t _node;
+	const char *name;
+	bool is_keyword;
+};
+
+void ident_print(void *data, ostream_p ostream)
+{
+	ostream_puts(ostream, CAST(ident_p, data)->name);
+}
+const char *ident_node_type = "ident_node_type";
+
+bool create_ident_tree(const result_p rule_result, void* data, result_p result)
+{
+	ident_data_p ident_data = CAST(ident_data_p, rule_result->data);
+	if (ident_data == 0)
+	{
+		fprintf(stderr, "NULL\n");
+		return TRUE;
+	}
+	ident_data->ident[ident_data->len] = '\0';
+	ident_p ident = MALLOC(struct ident_t);
+	init_tree_node(&ident->_node, ident_node_type, NULL);
+	tree_node_set_pos(&ident->_node, &ident_data->ps);
+	ident->name = ident_string(ident_data->ident);
+	ident->is_keyword = *keyword_state == 1;
+	result_assign_ref_counted(result, ident, ident_print);
+	SET_TYPE(ident_p, ident);
+	return TRUE;
+}
+
+/*  Ident grammar  (with letters from other scripts encoded in UTF-8) */
+
+#define ADD_IDENT_LETTERS ADD_CP_RANGE('a', 'z') ADD_CP_RANGE('A', 'Z') ADD_CP_RANGE('_', '_') \
+	ADD_CP_RANGE(0xC0, 0xD6) ADD_CP_RANGE(0xD8, 0xF6) ADD_CP_RANGE(0xF8, 0x2FF) ADD_CP_RANGE(0x370, 0x1FFF) \
+	ADD_CP_RANGE(0x3040, 0xD7FF) ADD_CP_RANGE(0xF900, 0xFDCF)
+
+void ident_grammar(non_terminal_dict_p *all_nt)
+{
+	HEADER(all_nt)
+	
+	NT_DEF("ident")
+		RULE
+			CPSET(ident_add_span) ADD_IDENT_LETTERS SET_PS(ident_set_pos)
+			CPSET(ident_add_span) ADD_IDENT_LETTERS ADD_CP_RANGE('0', '9') SEQ(pass_to_sequence, use_sequence_result) OPT(0)
+			END_FUNCTION(create_ident_tree)
+}
+
+/*
+	Ident tests
+	~~~~~~~~~~~
+*/
+
+void test_parse_ident(non_terminal_dict_p *all_nt, const char *input, const char *exp)
+{
+	ENTER_RESULT_CONTEXT
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, input);
+	
+	solutions_t solutions;
+	solutions_init(&solutions, &text_buffer);
+	
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	parser.cache_hit_function = solutions_find;
+	parser.cache = &solutions;
+	
+	DECL_RESULT(result);
+	if (parse_nt(&parser, find_nt("ident", all_nt), &result) && text_buffer_end(&text_buffer))
+	{
+		if (result.data == NULL)
+			fprintf(stderr, "ERROR: parsing '%s' did not return result\n", input);
+		else
+		{
+			tree_node_p tree_node = (tree_node_p)result.data;
+			if (tree_node->line != 1 && tree_node->column != 1)
+				fprintf(stderr, "WARNING: tree node position %d:%d is not 1:1\n", tree_node->line, tree_node->column);
+			if (tree_node->type_name != ident_node_type)
+				fprintf(stderr, "ERROR: tree node is not of type ident_node_type\n");
+			else
+			{
+				ident_p ident = CAST(ident_p, tree_node);
+				if (strcmp(ident->name, exp) != 0)
+					fprintf(stderr, "ERROR: parsed value '%s' from '%s' instead of expected '%s'\n",
+					ident->name, input, exp);
+				else
+					fprintf(stderr, "OK: parsed ident '%s' from '%s'\n", ident->name, input);
+			}
+		}
+	}
+	else
+	{
+		fprintf(stderr, "ERROR: failed to parse ident from '%s'\n", input);
+	}
+	DISP_RESULT(result);
+	
+	solutions_free(&solutions);
+	EXIT_RESULT_CONTEXT
+}
+
+void test_ident_grammar(non_terminal_dict_p *all_nt)
+{
+	test_parse_ident(all_nt, "aBc", "aBc");
+	test_parse_ident(all_nt, "_123", "_123");
+	test_parse_ident(all_nt, "gr\xC3\xB6\xC3\x9F" "e", "gr\xC3\xB6\xC3\x9F" "e");
+	test_parse_ident(all_nt, "\xCE\xB1\xCE\xB2\xCE\xB3" "1", "\xCE\xB1\xCE\xB2\xCE\xB3" "1");
+	/* A long name is cut before the code point that does not fit */
+	const char *long_name = "a123456789012345678901234567890123456789012345678901234567890" "\xCE\xB1\xCE\xB2" "b";
+	test_parse_ident(all_nt, long_name, "a123456789012345678901234567890123456789012345678901234567890" "\xCE\xB1");
+}
+
+/*
+	Char result
+	~~~~~~~~~~~
+
+	The struct for representing the char has but two members,
+	one for the character and one for the start position.
+	(besides the member for the reference counting base).
+*/
+
+typedef struct char_data
+{
+	ref_counted_base_t _base;
+	char ch;
+	text_pos_t ps;
+} *char_data_p;
+DEFINE_TYPE(char_data_p)
+
+void print_single_char(char ch, char del, ostream_p ostream)
+{
+	if (ch == '\0')
+		ostream_puts(ostream, "\\0");
+	else if (ch == del)
+	{
+		ostream_put(ostream, '\\');
+		ostream_put(ostream, del);
+	}
+	else if (ch == '\n')
+		ostream_puts(ostream, "\\n");
+	else if (ch == '\r')
+		ostream_puts(ostream, "\\r");
+	else if (ch == '\\')
+		ostream_puts(ostream, "\\\\");
+	else
+		ostream_put(ostream, ch);
+}
+
+void char_data_print(void *data, ostream_p ostream)
+{
+	ostream_puts(ostream, "char '");
+	print_single_char(CAST(char_data_p, data)->ch, '\'', ostream);
+	ostream_puts(ostream, "'");
+}
+
+void char_set_pos(result_p result, text_pos_p ps)
+{
+	char_data_p char_data = MALLOC(struct char_data);
+	char_data->ps = *ps;
+	char_data->_base.release = 0;
+	result_assign_ref_counted(result, char_data, char_data_print);
+	SET_TYPE(char_data_p, char_data);
+}
+
+bool normal_char(result_p prev, char ch, result_p result)
+{
+	result_assign(result, prev);
+	CAST(char_data_p, result->data)->ch = ch;
+	return TRUE;
+}
+
+bool escaped_char(result_p prev, char ch, result_p result)
+{
+	return normal_char(prev,
+		ch == '0' ? '\0' :
+		ch == 'a' ? '\a' :
+		ch == 'b' ? '\b' :
+		ch == 'f' ? '\f' :
+		ch == 'n' ? '\n' :
+		ch == 'r' ? '\r' :
+		ch == 't' ? '\t' :
+		ch == 'v' ? '\v' : ch, result);
+}
+
+/*	The characters between the quotes (found by searching for the closing
+	quote) should be a single normal or escaped character. */
+
+bool char_data_add_span(result_p prev, const char *text, size_t len, result_p result)
+{
+	if (len == 1 && ' ' <= text[0] && text[0] <= 126 && text[0] != '\\')
+		return normal_char(prev, text[0], result);
+	if (len == 2 && text[0] == '\\' && text[1] != '\0' && strchr("0\"'\\abfnrtv", text[1]) != NULL)
+		return escaped_char(prev, text[1], result);
+	return FALSE;
+}
+
+/*	Char tree node structure */
+
+typedef struct char_node_t *char_node_p;
+DEFINE_TYPE(char_node_p)
+struct char_node_t
+{
+	tree_node_t _node;
+	char ch;
+};
+
+const char *char_node_type = "char_node_type";
+
+void char_node_print(void *data, ostream_p ostream)
+{
+	ostream_puts(ostream, "char '");
+	print_single_char(((char_node_p)data)->ch, '\'', ostream);
+	ostream_puts(ostream, "'");
+}
+
+bool create_char_tree(const result_p rule_result, void* data, result_p result)
+{
+	char_data_p char_data = CAST(char_data_p, rule_result->data);
+
+	char_node_p char_node = MALLOC(struct char_node_t);
+	init_tree_node(&char_node->_node, char_node_type, NULL);
+	tree_node_set_pos(&char_node->_node, &char_data->ps);
+	char_node->ch = char_data->ch;
+	result_assign_ref_counted(result, char_node, char_node_print);
+	SET_TYPE(char_node_p, char_node);
+	return TRUE;
+}
+
+/*  Char grammar  */
+
+void char_grammar(non_terminal_dict_p *all_nt)
+{
+	HEADER(all_nt)
+	
+	NT_DEF("char")
+		RULE
+			CHAR('\'') SET_PS(char_set_pos)
+			UNTILF("'", '\\', char_data_add_span)
+			CHAR('\'')
+			END_FUNCTION(create_char_tree)
+}
+
+/*
+	Char tests
+	~~~~~~~~~~
+*/
+
+void test_parse_char(non_terminal_dict_p *all_nt, const char *input, char ch)
+{
+	ENTER_RESULT_CONTEXT
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, input);
+	
+	solutions_t solutions;
+	solutions_init(&solutions, &text_buffer);
+	
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	parser.cache_hit_function = solutions_find;
+	parser.cache = &solutions;
+	
+	DECL_RESULT(result);
+	if (parse_nt(&parser, find_nt("char", all_nt), &result) && text_buffer_end(&text_buffer))
+	{
+		if (result.data == NULL)
+			fprintf(stderr, "ERROR: parsing '%s' did not return result\n", input);
+		else
+		{
+			tree_node_p tree_node = (tree_node_p)result.data;
+			if (tree_node->line != 1 && tree_node->column != 1)
+				fprintf(stderr, "WARNING: tree node position %d:%d is not 1:1\n", tree_node->line, tree_node->column);
+			if (tree_node->type_name != char_node_type)
+				fprintf(stderr, "ERROR: tree node is not of type char_node_type\n");
+			else
+			{
+				char_node_p char_node = (char_node_p)tree_node;
+				if (char_node->ch != ch)
+					fprintf(stderr, "ERROR: parsed value '%c' from '%s' instead of expected '%c'\n",
+					char_node->ch, input, ch);
+				else
+					fprintf(stderr, "OK: parsed char %d from '%s'\n", char_node->ch, input);
+			}
+		}
+	}
+	else
+	{
+		fprintf(stderr, "ERROR: failed to parse char from '%s'\n", input);
+	}
+	DISP_RESULT(result);
+	
+	solutions_free(&solutions);
+
+	EXIT_RESULT_CONTEXT
+}
+
+void test_char_grammar(non_terminal_dict_p *all_nt)
+{
+	test_parse_char(all_nt, "'c'", 'c');
+	test_parse_char(all_nt, "'\\0'", '\0');
+	test_parse_char(all_nt, "'\\''", '\'');
+	test_parse_char(all_nt, "'\\\\'", '\\');
+	test_parse_char(all_nt, "'\\n'", '\n');
+	test_parse_char(all_nt, "'\"'", '"');
+}
+
+/*
+	String result
+	~~~~~~~~~~~~~
+	
+	The struct representing the string has several members.
+	But we first need to define a string buffer type that is
+	needed as a temporary storage while the string is parsed
+	before memory is allocated to contain the whole string.
+*/
+
+typedef struct string_buffer *string_buffer_p;
+struct string_buffer
+{
+	char buf[100];
+	string_buffer_p next;
+};
+THREAD_LOCAL string_buffer_p global_string_buffer = NULL;
+
+string_buffer_p new_string_buffer()
+{
+	string_buffer_p string_buffer = MALLOC(struct string_buffer);
+	string_buffer->next = NULL;
+	return string_buffer;
+}
+
+typedef struct string_data
+{
+	ref_counted_base_t _base;
+	string_buffer_p buffer;
+	size_t length;
+	text_pos_t ps;
+} *string_data_p;
+DEFINE_TYPE(string_data_p)
+
+void string_data_print(void *data, ostream_p ostream)
+{
+	string_data_p string_data = CAST(string_data_p, data);
+	ostream_puts(ostream, "char \"");
+	string_buffer_p string_buffer = global_string_buffer;
+	int j = 0;
+	for (size_t i = 0; i < string_data->length; i++)
+	{
+		print_single_char(string_buffer->buf[j], '"', ostream);
+		if (++j == 100)
+		{
+			string_buffer = string_buffer->next;
+			if (string_buffer == NULL)
+				break;
+			j = 0;
+		}
+	}
+	ostream_puts(ostream, "\"");
+}
+
+void string_set_pos(result_p result, text_pos_p ps)
+{
+	if (result->data == NULL)
+	{
+		string_data_p string_data = MALLOC(struct string_data);
+		string_data->ps = *ps;
+		string_data->buffer = NULL;
+		string_data->length = 0;
+		string_data->_base.release = 0;
+		result_assign_ref_counted(result, string_data, string_data_print);
+		SET_TYPE(string_data_p, string_data);
+	}
+}
+
+void string_data_add_char(string_data_p string_data, char ch)
+{
+	int j = string_data->length % 100;
+	if (j == 0)
+	{
+		string_buffer_p *ref_string_buffer = string_data->length == 0 ? &global_string_buffer : &string_data->buffer->next;
+		if (*ref_string_buffer == NULL)
+			*ref_string_buffer = new_string_buffer();
+		string_data->buffer = *ref_string_buffer;
+	}
+	string_data->buffer->buf[j] = ch;
+	string_data->length++;
+}
+
+/*	The characters between the double quotes (found by searching for the
+	closing double quote) are processed in a single call. A character is
+	either a normal character, an octal character, or an escaped character.
+*/
+
+bool string_data_add_span(result_p prev, const char *text, size_t len, result_p result)
+{
+	result_assign(result, prev);
+	string_data_p string_data = CAST(string_data_p, result->data);
+	for (const char *end = text + len; text < end; text++)
+	{
+		char ch = *text;
+		if (ch == '\\')
+		{
+			if (   end - text >= 4 && (text[1] == '0' || text[1] == '1')
+				&& '0' <= text[2] && text[2] <= '7' && '0' <= text[3] && text[3] <= '7')
+			{
+				/* Octal character */
+				ch = ((text[1] - '0') << 6) | ((text[2] - '0') << 3) | (text[3] - '0');
+				text += 3;
+			}
+			else if (end - text >= 2 && text[1] != '\0' && strchr("0'\"\\nr", text[1]) != NULL)
+			{
+				/* Escaped character */
+				text++;
+				ch = *text == '0' ? '\0' : *text == 'n' ? '\n' : *text == 'r' ? '\r' : *text;
+			}
+			else
+				return FALSE;
+		}
+		else if (ch < ' ' || ch > 126)
+			return FALSE;
+		string_data_add_char(string_data, ch);
+	}
+	return TRUE;
+}
+
+/*	String tree node structure */
+
+typedef struct string_node_t *string_node_p;
+DEFINE_TYPE(string_node_p)
+struct string_node_t
+{
+	tree_node_t _node;
+	const char *str;
+	size_t length;
+};
+
+const char *string_node_type = "string_node_type";
+
+void string_node_print(void *data, ostream_p ostream)
+{
+	string_node_p string_node = CAST(string_node_p, data);
+	ostream_puts(ostream, "string \"");
+	for (size_t i = 0; i < string_node->length - 1; i++)
+		print_single_char(string_node->str[i], '"', ostream);
+	ostream_puts(ostream, "\"");
+}
+
+bool create_string_tree(const result_p rule_result, void* data, result_p result)
+{
+	string_data_p string_data = CAST(string_data_p, rule_result->data);
+	
+	string_node_p string_node = MALLOC(struct string_node_t);
+	init_tree_node(&string_node->_node, string_node_type, NULL);
+	tree_node_set_pos(&string_node->_node, &string_data->ps);
+	char *s = MALLOC_N(string_data->length + 1, char);
+	string_node->str = s;
+	string_node->length = string_data->length + 1;
+	string_buffer_p string_buffer = global_string_buffer;
+	int j = 0;
+	for (size_t i = 0; i < string_data->length; i++)
+	{
+		*s++ = string_buffer->buf[j++];
+		if (j == 100)
+		{
+			string_buffer = string_buffer->next;
+			j = 0;
+		}
+	}
+	*s = '\0';
+	result_assign_ref_counted(result, string_node, string_node_print);
+	SET_TYPE(string_node_p, string_node);
+	return TRUE;
+}
+		
+/*	String grammar */
+
+void string_grammar(non_terminal_dict_p *all_nt)
+{
+	HEADER(all_nt)
+	
+	NT_DEF("string")
+		RULE
+			{ GROUPING
+				RULE
+					CHAR('"') SET_PS(string_set_pos)
+					UNTILF("\"", '\\', string_data_add_span)
+					CHAR('"')
+			} SEQ(pass_to_sequence, use_sequence_result) { CHAIN NTF("white_space", 0) }
+			END_FUNCTION(create_string_tree)
+}
+
+void test_parse_string(non_terminal_dict_p *all_nt, const char *input, const char *str)
+{
+	ENTER_RESULT_CONTEXT
+
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, input);
+	
+	solutions_t solutions;
+	solutions_init(&solutions, &text_buffer);
+	
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	parser.cache_hit_function = solutions_find;
+	parser.cache = &solutions;
+	
+	DECL_RESULT(result);
+	if (parse_nt(&parser, find_nt("string", all_nt), &result) && text_buffer_end(&text_buffer))
+	{
+		if (result.data == NULL)
+			fprintf(stderr, "ERROR: parsing '%s' did not return result\n", input);
+		else
+		{
+			tree_node_p tree_node = (tree_node_p)result.data;
+			if (tree_node->line != 1 && tree_node->column != 1)
+				fprintf(stderr, "WARNING: tree node position %d:%d is not 1:1\n", tree_node->line, tree_node->column);
+			if (tree_node->type_name != string_node_type)
+				fprintf(stderr, "ERROR: tree node is not of type string_node_type\n");
+			else
+			{
+				string_node_p string_node = CAST(string_node_p, tree_node);
+				if (strcmp(string_node->str, str) != 0)
+					fprintf(stderr, "ERROR: parsed value '%s' from '%s' instead of expected '%s'\n",
+					string_node->str, input, str);
+				else
+					fprintf(stderr, "OK: parsed string \"%s\" from \"%s\"\n", string_node->str, input);
+			}
+		}
+	}
+	else
+	{
+		fprintf(stderr, "ERROR: failed to parse string from '%s'\n", input);
+	}
+	DISP_RESULT(result);
+	
+	solutions_free(&solutions);
+
+	EXIT_RESULT_CONTEXT
+}
+
+void test_string_grammar(non_terminal_dict_p *all_nt)
+{
+	test_parse_string(all_nt, "\"abc\"", "abc");
+	test_parse_string(all_nt, "\"\\0\"", "");
+	test_parse_string(all_nt, "\"\\'\"", "\'");
+	test_parse_string(all_nt, "\"abc\" /* */ \"def\"", "abcdef");
+	test_parse_string(all_nt, "\"\\n\"", "\n");
+	test_parse_string(all_nt, "\"a\\101\\\"\\\\\"", "aA\"\\");
+}
+
+/*
+	Int result
+	~~~~~~~~~~
+	
+	For parsing an integer value a single function will used,
+	which will implement a co-routine for processing the
+	characters.
+*/
+
+typedef struct int_data
+{
+	ref_counted_base_t _base;
+	long long int value;
+	int state;
+	int sign;
+	text_pos_t ps;
+} *int_data_p;
+DEFINE_TYPE(int_data_p)
+
+void int_data_print(void *data, ostream_p ostream)
+{
+	int_data_p int_data = CAST(int_data_p, data);
+	char buffer[51];
+	snprintf(buffer, 50, "int %lld", int_data->sign * int_data->value);
+	buffer[50] = '\0';
+	ostream_puts(ostream, buffer);
+}
+
+void int_set_pos(result_p result, text_pos_p ps)
+{
+	if (result->data != NULL && CAST(int_data_p, result->data)->ps.cur_line == -1)
+		CAST(int_data_p, result->data)->ps = *ps;
+}
+
+#define INT_DATA_WAIT_NEXT_CHAR(X)  int_data->state = X; return TRUE; L##X:
+
+bool int_data_add_char(result_p prev, char ch, result_p result)
+{
+	if (prev->data == NULL)
+	{
+		int_data_p int_data = MALLOC(struct int_data);
+		int_data->value = 0;
+		int_data->state = 0;
+		int_data->sign = 1;
+		int_data->_base.release = 0;
+		int_data->ps.cur_line = -1;
+		result_assign_ref_counted(result, int_data, int_data_print);
+		SET_TYPE(int_data_p, int_data);
+	}
+	else
+		result_assign(result, prev);
+	int_data_p int_data = CAST(int_data_p, result->data);
+	
+	switch (int_data->state)
+	{
+		case 0: goto L0;
+		case 1: goto L1;
+		case 2: goto L2;
+		case 3: goto L3;
+		case 4: goto L4;
+		case 5: goto L5;
+		case 6: goto L6;
+	}
+	L0:
+	
+	if (ch == '-')
+	{
+		int_data->sign = -1;
+		INT_DATA_WAIT_NEXT_CHAR(1)
+	}
+	if (ch == '0')
+	{
+		INT_DATA_WAIT_NEXT_CHAR(2)
+		if (ch == 'x')
+		{
+			// Process hexa decimal number
+			INT_DATA_WAIT_NEXT_CHAR(3)
+			for (;;)
+			{
+				if ('0' <= ch && ch <= '9')
+					int_data->value = 16 * int_data->value + ch - '0';
+				else if ('A' <= ch && ch <= 'F')
+					int_data->value = 16 * int_data->value + ch + (10 - 'A');
+				else if ('a' <= ch && ch <= 'f')
+					int_data->value = 16 * int_data->value + ch + (10 - 'a');
+				else
+					break;
+				INT_DATA_WAIT_NEXT_CHAR(4)
+			}
+		}
+		else
+		{
+			// Process octal number
+			while ('0' <= ch && ch <= '7')
+			{
+				int_data->value = 8 * int_data->value +  ch - '0';
+				INT_DATA_WAIT_NEXT_CHAR(5)
+			}
+		}
+	}
+	else
+	{
+		// Process decimal number
+		while ('0' <= ch && ch <= '9')
+		{
+			int_data->value = 10 * int_data->value + ch - '0';
+			INT_DATA_WAIT_NEXT_CHAR(6)
+		}
+	}
+	return FALSE;
+}
+
+/*	Int tree node structure */
+
+typedef struct int_node_t *int_node_p;
+DEFINE_TYPE(int_node_p)
+struct int_node_t
+{
+	tree_node_t _node;
+	long long int value;
+};
+
+const char *int_node_type = "int_node_type";
+
+void int_node_print(void *data, ostream_p ostream)
+{
+	int_node_p int_node = (int_node_p)data;
+	char buffer[51];
+	snprintf(buffer, 50, "int %lld", int_node->value);
+	buffer[50] = '\0';
+	ostream_puts(ostream, buffer);
+}
+
+bool create_int_tree(const result_p rule_result, void* data, result_p result)
+{
+	int_data_p int_data = CAST(int_data_p, rule_result->data);
+	
+	int_node_p int_node = MALLOC(struct int_node_t);
+	init_tree_node(&int_node->_node, int_node_type, NULL);
+	tree_node_set_pos(&int_node->_node, &int_data->ps);
+	int_node->value = int_data->sign * int_data->value;
+	result_assign_ref_counted(result, int_node, int_node_print);
+	SET_TYPE(int_node_p, int_node);
+	return TRUE;
+}
+		
+/*	Int grammar */
+
+void int_grammar(non_terminal_dict_p *all_nt)
+{
+	HEADER(all_nt)
+	
+	NT_DEF("int")
+		RULE
+			CHARF('-', int_data_add_char) OPT(0) SET_PS(int_set_pos)
+			{ GROUPING
+				RULE // hexadecimal representaion
+					CHARF('0', int_data_add_char) SET_PS(int_set_pos) 
+					CHARF('x', int_data_add_char)
+					CHARSET(int_data_add_char) ADD_RANGE('0','9') ADD_RANGE('A','F') ADD_RANGE('a','f') SEQ(pass_to_sequence, use_sequence_result)
+				RULE // octal representation
+					CHARF('0', int_data_add_char) SET_PS(int_set_pos) 
+					CHARSET(int_data_add_char) ADD_RANGE('0','7') SEQ(pass_to_sequence, use_sequence_result) OPT(0)
+				RULE // decimal representation
+					CHARSET(int_data_add_char) ADD_RANGE('1','9') SET_PS(int_set_pos) 
+					CHARSET(int_data_add_char) ADD_RANGE('0','9') SEQ(pass_to_sequence, use_sequence_result) OPT(0)
+ 			}
+			CHAR('U') OPT(0)
+			CHAR('L') OPT(0)
+			CHAR('L') OPT(0)
+			END_FUNCTION(create_int_tree)
+}
+
+void test_parse_int(non_terminal_dict_p *all_nt, const char *input, long long int value)
+{
+	ENTER_RESULT_CONTEXT
+
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, input);
+	
+	solutions_t solutions;
+	solutions_init(&solutions, &text_buffer);
+	
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	parser.cache_hit_function = solutions_find;
+	parser.cache = &solutions;
+	
+	DECL_RESULT(result);
+	if (parse_nt(&parser, find_nt("int", all_nt), &result) && text_buffer_end(&text_buffer))
+	{
+		if (result.data == NULL)
+			fprintf(stderr, "ERROR: parsing '%s' did not return result\n", input);
+		else
+		{
+			tree_node_p tree_node = (tree_node_p)result.data;
+			if (tree_node->line != 1 && tree_node->column != 1)
+				fprintf(stderr, "WARNING: tree node position %d:%d is not 1:1\n", tree_node->line, tree_node->column);
+			if (tree_node->type_name != int_node_type)
+				fprintf(stderr, "ERROR: tree node is not of type int_node_type\n");
+			else
+			{
+				int_node_p int_node = (int_node_p)tree_node;
+				if (int_node->value != value)
+					fprintf(stderr, "ERROR: parsed value %lld from '%s' instead of expected %lld\n",
+					int_node->value, input, value);
+				else
+					fprintf(stderr, "OK: parsed integer %lld from \"%s\"\n", int_node->value, input);
+			}
+		}
+	}
+	else
+	{
+		fprintf(stderr, "ERROR: failed to parse int from '%s'\n", input);
+	}
+	DISP_RESULT(result);
+	
+	solutions_free(&solutions);
+
+	EXIT_RESULT_CONTEXT
+}
+
+void test_int_grammar(non_terminal_dict_p *all_nt)
+{
+	test_parse_int(all_nt, "0", 0);
+	test_parse_int(all_nt, "1", 1);
+	test_parse_int(all_nt, "-1", -1);
+	test_parse_int(all_nt, "077", 077);
+	test_parse_int(all_nt, "0xAbc", 0xAbc);
+	test_parse_int(all_nt, "1234L", 1234);
+	test_parse_int(all_nt, "-23", -23);
+	test_parse_int(all_nt, "46464664", 46464664);
+}
+
+bool equal_string(result_p result, const void *argument)
+{
+	const char *keyword_name = (const char*)argument;
+	return    result->data != NULL
+		   && ((tree_node_p)result->data)->type_name == ident_node_type
+		   && strcmp(CAST(ident_p, result->data)->name, keyword_name) == 0;
+}
+
+bool not_a_keyword(result_p result, const void *argument)
+{
+	ident_p ident = CAST(ident_p, result->data);
+	return !ident->is_keyword;
+}
+
+const char* list_type = "list";
+
+bool add_seq_as_list(result_p prev, result_p seq, result_p result)
+{
+	prev_child_p prev_child = CAST(prev_child_p, prev->data);
+	if (prev_child != NULL)
+		ref_counted_base_inc(prev_child);
+	prev_child_p new_prev_child = malloc_prev_child();
+	new_prev_child->prev = prev_child;
+	tree_p list = make_tree_with_children(list_type, CAST(prev_child_p, seq->data));
+	result_assign_ref_counted(&new_prev_child->child, list, tree_print);
+	SET_TYPE(tree_p, list);
+	result_assign_ref_counted(result, new_prev_child, NULL);
+	SET_TYPE(prev_child_p, new_prev_child);
+	return TRUE;
+}
+
+const char* error_type = "error";
+
+bool add_error_child(result_p prev, text_pos_p start, result_p result)
+{
+	ENTER_RESULT_CONTEXT
+	tree_p error = malloc_tree(error_type);
+	tree_node_set_pos(&error->_node, start);
+	DECL_RESULT(elem);
+	result_assign_ref_counted(&elem, error, tree_print);
+	SET_TYPE(tree_p, error);
+	bool added = add_child(prev, &elem, result);
+	DISP_RESULT(elem);
+	EXIT_RESULT_CONTEXT
+	return added;
+}
+
+#define ADD_CHILD element->add_function = add_child;
+#define NT(S) NTF(S, add_child)
+#define NTP(S) NTF(S, take_child)
+#define WS NTF("white_space", 0)
+#define PASS rules->end_function = pass_tree;
+#define TREE(N) rules->end_function = make_tree; rules->end_function_data = N;
+/*  A keyword is parsed as the characters of the keyword not followed by a
+	character that could be part of an identifier. It is also registered as
+	a keyword, such that it is not accepted as an identifier. */
+#define NOT_IDENT_CHAR { NOT_GROUPING RULE CPSET(0) ADD_IDENT_LETTERS ADD_CP_RANGE('0', '9') }
+#define KEYWORD(K) ident_string(K); *keyword_state = 1; for (const char *_k = K; *_k != '\0'; _k++) { CHAR(*_k) } NOT_IDENT_CHAR WS
+#define OPTN OPT(0)
+#define IDENT NTF("ident", add_child) element->condition = not_a_keyword; WS
+#define IDENT_OPT NTF("ident", add_child) element->condition = not_a_keyword; OPTN WS
+#define SEQL SEQ(0, add_seq_as_list)
+#define REC_RULEC REC_RULE(rec_add_child);
+#define CHAR_WS(C) CHAR(C) WS
+#define RECOVER_WS(P,B) RECOVER(P, B, add_error_child) RECOVER_AFTER("white_space")
+
+void c_grammar(non_terminal_dict_p *all_nt)
+{
+	white_space_grammar(all_nt);
+	ident_grammar(all_nt);
+	
+	HEADER(all_nt)
+	
+	NT_DEF("primary_expr")
+		RULE IDENT PASS
+		RULE NTP("int") WS
+		RULE NTP("double") WS
+		RULE NTP("char") WS
+		RULE NTP("string") WS
+		RULE CHAR_WS('(') NTP("expr") CHAR_WS(')')
+
+	NT_DEF("postfix_expr")
+		RULE NTP("primary_expr")
+		REC_RULEC CHAR_WS('[') NT("expr") CHAR_WS(']') TREE("arrayexp")
+		REC_RULEC CHAR_WS('(') NT("assignment_expr") SEQL { CHAIN CHAR_WS(',') } OPTN CHAR_WS(')') TREE("call")
+		REC_RULEC CHAR_WS('.') IDENT TREE("field")
+		REC_RULEC CHAR('-') CHAR_WS('>') IDENT TREE("fieldderef")
+		REC_RULEC CHAR('+') CHAR_WS('+') TREE("post_inc")
+		REC_RULEC CHAR('-') CHAR_WS('-') TREE("post_dec")
+
+	NT_DEF("unary_expr")
+		RULE CHAR('+') CHAR_WS('+') NT("unary_expr") TREE("pre_inc")
+		RULE CHAR('-') CHAR_WS('-') NT("unary_expr") TREE("pre_dec")
+		RULE CHAR_WS('&') NT("cast_expr") TREE("address_of")
+		RULE CHAR_WS('*') NT("cast_expr") TREE("deref")
+		RULE CHAR_WS('+') NT("cast_expr") TREE("plus")
+		RULE CHAR_WS('-') NT("cast_expr") TREE("min")
+		RULE CHAR_WS('~') NT("cast_expr") TREE("invert")
+		RULE CHAR_WS('!') NT("cast_expr") TREE("not")
+		RULE KEYWORD("sizeof") CHAR_WS('(') NT("sizeof_type") CHAR_WS(')') TREE("sizeof")
+		RULE KEYWORD("sizeof") NT("unary_expr") TREE("sizeof_expr")
+		RULE NTP("postfix_expr")
+
+	NT_DEF("sizeof_type")
+		RULE KEYWORD("char") TREE("char")
+		RULE KEYWORD("short") TREE("short")
+		RULE KEYWORD("int") TREE("int")
+		RULE KEYWORD("long") TREE("long")
+		RULE KEYWORD("signed") NT("sizeof_type") TREE("signed")
+		RULE KEYWORD("unsigned") NT("sizeof_type") TREE("unsigned")
+		RULE KEYWORD("float") TREE("float")
+		RULE KEYWORD("double") NT("sizeof_type") OPTN TREE("double")
+		RULE KEYWORD("const") NT("sizeof_type") TREE("const")
+		RULE KEYWORD("volatile") NT("sizeof_type") TREE("volatile")
+		RULE KEYWORD("void") TREE("void")
+		RULE KEYWORD("struct") IDENT TREE("structdecl")
+		RULE IDENT PASS
+		REC_RULEC WS CHAR_WS('*') TREE("pointdecl")
+
+	NT_DEF("cast_expr")
+		RULE CHAR_WS('(') NT("abstract_declaration") CHAR_WS(')') NT("cast_expr") TREE("cast")
+		RULE NTP("unary_expr")
+
+	NT_DEF("l_expr1")
+		RULE NTP("cast_expr")
+		REC_RULEC WS CHAR_WS('*') NT("cast_expr") TREE("times")
+		REC_RULEC WS CHAR_WS('/') NT("cast_expr") TREE("div")
+		REC_RULEC WS CHAR_WS('%') NT("cast_expr") TREE("mod")
+
+	NT_DEF("l_expr2")
+		RULE NTP("l_expr1")
+		REC_RULEC WS CHAR_WS('+') NT("l_expr1") TREE("add")
+		REC_RULEC WS CHAR_WS('-') NT("l_expr1") TREE("sub")
+
+	NT_DEF("l_expr3")
+		RULE NTP("l_expr2")
+		REC_RULEC WS CHAR('<') CHAR_WS('<') NT("l_expr2") TREE("ls")
+		REC_RULEC WS CHAR('>') CHAR_WS('>') NT("l_expr2") TREE("rs")
+
+	NT_DEF("l_expr4")
+		RULE NTP("l_expr3")
+		REC_RULEC WS CHAR('<') CHAR_WS('=') NT("l_expr3") TREE("le")
+		REC_RULEC WS CHAR('>') CHAR_WS('=') NT("l_expr3") TREE("ge")
+		REC_RULEC WS CHAR_WS('<') NT("l_expr3") TREE("lt")
+		REC_RULEC WS CHAR_WS('>') NT("l_expr3") TREE("gt")
+		REC_RULEC WS CHAR('=') CHAR_WS('=') NT("l_expr3") TREE("eq")
+		REC_RULEC WS CHAR('!') CHAR_WS('=') NT("l_expr3") TREE("ne")
+
+	NT_DEF("l_expr5")
+		RULE NTP("l_expr4")
+		REC_RULEC WS CHAR_WS('^') NT("l_expr4") TREE("bexor")
+
+	NT_DEF("l_expr6")
+		RULE NTP("l_expr5")
+		REC_RULEC WS CHAR_WS('&') NT("l_expr5") TREE("land")
+
+	NT_DEF("l_expr7")
+		RULE NTP("l_expr6")
+		REC_RULEC WS CHAR_WS('|') NT("l_expr6") TREE("lor")
+
+	NT_DEF("l_expr8")
+		RULE NTP("l_expr7")
+		REC_RULEC WS CHAR('&') CHAR_WS('&') NT("l_expr7") TREE("and")
+
+	NT_DEF("l_expr9")
+		RULE NTP("l_expr8")
+		REC_RULEC WS CHAR('|') CHAR_WS('|') NT("l_expr8") TREE("or")
+
+	NT_DEF("conditional_expr")
+		RULE NT("l_expr9") WS CHAR_WS('?') NT("l_expr9") WS CHAR_WS(':') NT("conditional_expr") TREE("if_expr")
+		RULE NTP("l_expr9")
+
+	NT_DEF("assignment_expr")
+		RULE NT("unary_expr") WS NT("assignment_operator") WS NT("assignment_expr") TREE("assignment")
+		RULE NTP("conditional_expr")
+
+	NT_DEF("assignment_operator")
+		RULE CHAR_WS('=') TREE("ass")
+		RULE CHAR('*') CHAR_WS('=') TREE("times_ass")
+		RULE CHAR('/') CHAR_WS('=') TREE("div_ass")
+		RULE CHAR('%') CHAR_WS('=') TREE("mod_ass")
+		RULE CHAR('+') CHAR_WS('=') TREE("add_ass")
+		RULE CHAR('-') CHAR_WS('=') TREE("sub_ass")
+		RULE CHAR('<') CHAR('<') CHAR_WS('=') TREE("sl_ass")
+		RULE CHAR('>') CHAR('>') CHAR_WS('=') TREE("sr_ass")
+		RULE CHAR('&') CHAR_WS('=') TREE("and_ass")
+		RULE CHAR('|') CHAR_WS('=') TREE("or_ass")
+		RULE CHAR('^') CHAR_WS('=') TREE("exor_ass")
+
+	NT_DEF("expr")
+		RULE NT("assignment_expr") SEQL { CHAIN CHAR_WS(',') } PASS
+
+	NT_DEF("constant_expr")
+		RULE NTP("conditional_expr")
+
+	NT_DEF("declaration")
+		RULE
+		{ GROUPING
+			RULE NT("storage_class_specifier") PASS
+			RULE NT("type_specifier") PASS
+		} SEQL OPTN ADD_CHILD AVOID
+		{ GROUPING
+			RULE NT("func_declarator") CHAR_WS('(')
+			{ GROUPING
+				RULE NTP("parameter_declaration_list") OPTN
+				RULE KEYWORD("void") TREE("void")
+			} ADD_CHILD
+			CHAR_WS(')')
+			{ GROUPING
+				RULE CHAR_WS(';')
+				RULE CHAR_WS('{') NTP("decl_or_stat") CHAR_WS('}')
+			} ADD_CHILD TREE("new_style") WS
+			RULE NT("func_declarator") CHAR_WS('(') NT("ident_list") OPTN CHAR_WS(')') NT("declaration") SEQL OPTN CHAR_WS('{') NT("decl_or_stat") CHAR_WS('}') TREE("old_style")
+			RULE
+			{ GROUPING
+				RULE NT("declarator")
+				{ GROUPING
+					RULE WS CHAR_WS('=') NTP("initializer")
+				} OPTN ADD_CHILD TREE("decl_init")
+			} SEQL OPTN ADD_CHILD { CHAIN CHAR_WS(',') } CHAR_WS(';') TREE("decl")
+		}
+
+	NT_DEF("storage_class_specifier")
+		RULE KEYWORD("typedef") TREE("typedef")
+		RULE KEYWORD("extern") TREE("extern")
+		RULE KEYWORD("inline") TREE("inline")
+		RULE KEYWORD("static") TREE("static")
+		RULE KEYWORD("auto") TREE("auto")
+		RULE KEYWORD("register") TREE("register")
+
+	NT_DEF("type_specifier")
+		RULE KEYWORD("char") TREE("char")
+		RULE KEYWORD("short") TREE("short")
+		RULE KEYWORD("int") TREE("int")
+		RULE KEYWORD("long") TREE("long")
+		RULE KEYWORD("signed") TREE("signed")
+		RULE KEYWORD("unsigned") TREE("unsigned")
+		RULE KEYWORD("float") TREE("float")
+		RULE KEYWORD("double") TREE("double")
+		RULE KEYWORD("const") TREE("const")
+		RULE KEYWORD("volatile") TREE("volatile")
+		RULE KEYWORD("void") TREE("void")
+		RULE NT("struct_or_union_specifier")
+		RULE NT("enum_specifier")
+		RULE IDENT PASS
+
+	NT_DEF("struct_or_union_specifier")
+		RULE KEYWORD("struct") IDENT_OPT
+		{ GROUPING
+			RULE CHAR_WS('{')
+			{ GROUPING
+				RULE NTP("struct_declaration_or_anon")
+			} SEQL ADD_CHILD
+			CHAR_WS('}') PASS
+		} OPTN ADD_CHILD TREE("struct")
+		RULE KEYWORD("union") IDENT_OPT
+		{ GROUPING
+			RULE CHAR_WS('{')
+			{ GROUPING
+				RULE NTP("struct_declaration_or_anon")
+			} SEQL ADD_CHILD
+			CHAR_WS('}') PASS
+		} OPTN ADD_CHILD TREE("union")
+
+	NT_DEF("struct_declaration_or_anon")
+		RULE NTP("struct_or_union_specifier") CHAR_WS(';')
+		RULE NTP("struct_declaration")
+
+	NT_DEF("struct_declaration")
+		RULE NT("type_specifier") NT("struct_declaration") TREE("type")
+		RULE NT("struct_declarator") SEQL { CHAIN CHAR_WS(',') } CHAR_WS(';') TREE("strdec")
+
+	NT_DEF("struct_declarator")
+		RULE NT("declarator")
+		{ GROUPING
+			RULE CHAR_WS(':') NT("constant_expr")
+		} OPTN ADD_CHILD TREE("record_field")
+
+	NT_DEF("enum_specifier")
+		RULE KEYWORD("enum") IDENT_OPT CHAR_WS('{') NT("enumerator") SEQL { CHAIN CHAR_WS(',') } CHAR_WS('}') TREE("enum")
+
+	NT_DEF("enumerator")
+		RULE IDENT
+		{ GROUPING
+			RULE CHAR_WS('=') NTP("constant_expr")
+		} OPTN ADD_CHILD TREE("enumerator")
+
+	NT_DEF("func_declarator")
+		RULE CHAR_WS('*')
+		{ GROUPING
+			RULE KEYWORD("const") TREE("const")
+		} OPTN ADD_CHILD NT("func_declarator") TREE("pointdecl")
+		RULE CHAR_WS('(') NT("func_declarator") CHAR_WS(')')
+		RULE IDENT PASS
+
+	NT_DEF("declarator")
+		RULE CHAR_WS('*')
+		{ GROUPING
+			RULE KEYWORD("const") TREE("const")
+		} OPTN ADD_CHILD NT("declarator") TREE("pointdecl")
+		RULE CHAR_WS('(') NT("declarator") CHAR_WS(')') TREE("brackets")
+		RULE WS IDENT PASS
+		REC_RULEC CHAR_WS('[') NT("constant_expr") OPTN CHAR_WS(']') TREE("array")
+		REC_RULEC CHAR_WS('(') NT("abstract_declaration_list") OPTN CHAR_WS(')') TREE("function")
+
+	NT_DEF("abstract_declaration_list")
+		RULE
+			NT("abstract_declaration") SEQL BACK_TRACKING { CHAIN CHAR_WS(',') }
+			{ GROUPING
+				RULE CHAR_WS(',') CHAR('.') CHAR('.') CHAR_WS('.') TREE("varargs")
+			} OPTN ADD_CHILD TREE("abstract_declaration_list")
+
+	NT_DEF("parameter_declaration_list")
+		RULE
+			NT("parameter_declaration") SEQL BACK_TRACKING { CHAIN CHAR_WS(',') }
+			{ GROUPING
+				RULE CHAR_WS(',') CHAR('.') CHAR('.') CHAR_WS('.') TREE("varargs")
+			} OPTN ADD_CHILD TREE("parameter_declaration_list")
+
+	NT_DEF("ident_list")
+		RULE IDENT
+		{ GROUPING
+			RULE CHAR_WS(',')
+			{ GROUPING
+				RULE CHAR('.') CHAR('.') CHAR_WS('.') TREE("varargs")
+				RULE NT("ident_list") TREE("ident_list")
+			}
+		} OPTN ADD_CHILD TREE("ident_list")
+
+	NT_DEF("parameter_declaration")
+		RULE NT("type_specifier") NT("parameter_declaration") TREE("type")
+		RULE NTP("declarator")
+		RULE NTP("abstract_declarator")
+
+	NT_DEF("abstract_declaration")
+		RULE NT("type_specifier") NT("parameter_declaration") TREE("type")
+		RULE NTP("abstract_declarator")
+
+	NT_DEF("abstract_declarator")
+		RULE CHAR_WS('*')
+		{ GROUPING
+			RULE KEYWORD("const") TREE("const")
+		} OPTN ADD_CHILD NT("abstract_declarator") TREE("abs_pointdecl")
+		RULE CHAR_WS('(') NT("abstract_declarator") CHAR_WS(')') TREE("abs_brackets")
+		RULE
+		REC_RULEC CHAR_WS('[') NT("constant_expr") OPTN CHAR_WS(']') TREE("abs_array")
+		REC_RULEC CHAR_WS('(') NT("parameter_declaration_list") CHAR_WS(')') TREE("abs_func")
+
+	NT_DEF("initializer")
+		RULE NTP("assignment_expr")
+		RULE CHAR_WS('{') NT("initializer") SEQL { CHAIN CHAR_WS(',') } CHAR(',') OPTN WS CHAR_WS('}') TREE("initializer")
+
+	NT_DEF("decl_or_stat")
+		RULE NT("declaration") SEQL OPTN NT("statement") SEQL OPTN RECOVER_WS(";", "}") TREE("decl_or_stat")
+
+	NT_DEF("statement")
+		RULE
+		{ GROUPING
+			RULE
+			{ GROUPING
+				RULE IDENT
+				RULE KEYWORD("case") NT("constant_expr") TREE("case")
+				RULE KEYWORD("default") TREE("default")
+			} ADD_CHILD CHAR_WS(':') NT("statement") TREE("label")
+			RULE CHAR_WS('{') NTP("decl_or_stat") CHAR_WS('}')
+		}
+		RULE
+		{ GROUPING
+			RULE NTP("expr") OPTN CHAR_WS(';')
+			RULE KEYWORD("if") WS CHAR_WS('(') NT("expr") CHAR_WS(')') NT("statement")
+			{ GROUPING
+				RULE KEYWORD("else") NTP("statement")
+			} OPTN ADD_CHILD TREE("if")
+			RULE KEYWORD("switch") WS CHAR_WS('(') NT("expr") CHAR_WS(')') NT("statement") TREE("switch")
+			RULE KEYWORD("while") WS CHAR_WS('(') NT("expr") CHAR_WS(')') NT("statement") TREE("while")
+			RULE KEYWORD("do") NT("statement") KEYWORD("while") WS CHAR_WS('(') NT("expr") CHAR_WS(')') CHAR_WS(';') TREE("do")
+			RULE KEYWORD("for") WS CHAR_WS('(') NT("expr") OPTN CHAR_WS(';')
+			{ GROUPING
+				RULE WS NTP("expr")
+			} OPTN ADD_CHILD CHAR_WS(';')
+			{ GROUPING
+				RULE WS NTP("expr")
+			} OPTN ADD_CHILD CHAR_WS(')') NT("statement") TREE("for")
+			RULE KEYWORD("goto") IDENT CHAR_WS(';') TREE("goto")
+			RULE KEYWORD("continue") CHAR_WS(';') TREE("cont")
+			RULE KEYWORD("break") CHAR_WS(';') TREE("break")
+			RULE KEYWORD("return") NT("expr") OPTN CHAR_WS(';') TREE("ret")
+		}
+
+	NT_DEF("root")
+		RULE
+		WS
+		{ GROUPING
+			RULE NT("declaration")
+		} SEQL OPTN RECOVER_WS(";}", "") END PASS
+}
+
+
+/*
+	Fixed string output stream
+	~~~~~~~~~~~~~~~~~~~~~~~~~~
+*/
+
+typedef struct fixed_string_ostream fixed_string_ostream_t, *fixed_string_ostream_p;
+struct fixed_string_ostream
+{
+	ostream_t ostream;
+	char *buffer;
+	unsigned int i;
+	unsigned int len;
+};
+
+void fixed_string_ostream_put(ostream_p ostream, char ch)
+{
+	if (((fixed_string_ostream_p)ostream)->i < ((fixed_string_ostream_p)ostream)->len)
+		((fixed_string_ostream_p)ostream)->buffer[((fixed_string_ostream_p)ostream)->i++] = ch;
+}
+
+void fixed_string_ostream_init(fixed_string_ostream_p ostream, char *buffer, unsigned int len)
+{
+	ostream->ostream.put = fixed_string_ostream_put;
+	ostream->buffer = buffer;
+	ostream->i = 0;
+	ostream->len = len - 1;
+}
+
+void fixed_string_ostream_finish(fixed_string_ostream_p ostream)
+{
+	ostream->buffer[ostream->i] = '\0';
+}
+
+
+
+
+void test_parse_grammar(non_terminal_dict_p *all_nt, const char *nt, const char *input, const char *exp_output)
+{
+	ENTER_RESULT_CONTEXT
+
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, input);
+	
+	solutions_t solutions;
+	solutions_init(&solutions, &text_buffer);
+	
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	parser.cache_hit_function = solutions_find;
+	parser.cache = &solutions;
+	
+	DECL_RESULT(result);
+	if (parse_nt(&parser, find_nt(nt, all_nt), &result) && text_buffer_end(&text_buffer))
+	{
+		if (result.data == NULL)
+			fprintf(stderr, "ERROR: parsing '%s' did not return result\n", input);
+		else
+		{
+			char output[200];
+			fixed_string_ostream_t fixed_string_ostream;
+			fixed_string_ostream_init(&fixed_string_ostream, output, 200);
+			result_print(&result, &fixed_string_ostream.ostream);
+			fixed_string_ostream_finish(&fixed_string_ostream);
+			if (strcmp(output, exp_output) != 0)
+			{
+				fprintf(stderr, "ERROR: parsed value '%s' from '%s' instead of expected '%s'\n",
+						output, input, exp_output);
+			}
+			else
+				fprintf(stderr, "OK: parsed '%s' to '%s'\n", input, output);
+		}
+	}
+	else
+	{
+		fprintf(stderr, "ERROR: failed to parse ident from '%s'\n", input);
+	}
+	DISP_RESULT(result);
+	
+	solutions_free(&solutions);
+
+	EXIT_RESULT_CONTEXT
+}
+
+void test_ll1(non_terminal_dict_p *all_nt, const char *nt, bool exp_ll1)
+{
+	if (find_nt(nt, all_nt)->ll1 != exp_ll1)
+		fprintf(stderr, "ERROR: %s is %sLL(1)\n", nt, exp_ll1 ? "not " : "");
+	else
+		fprintf(stderr, "OK: %s is %sLL(1)\n", nt, exp_ll1 ? "" : "not ");
+}
+
+void test_c_grammar(non_terminal_dict_p *all_nt)
+{
+	/* The analysis is done on a copy, to not change the grammar for later tests */
+	non_terminal_dict_p analysed_nt = NULL;
+	c_grammar(&analysed_nt);
+	grammar_analyse(analysed_nt);
+	test_ll1(&analysed_nt, "assignment_operator", TRUE);
+	test_ll1(&analysed_nt, "storage_class_specifier", TRUE);
+	test_ll1(&analysed_nt, "expr", TRUE);
+	test_ll1(&analysed_nt, "statement", FALSE);
+	test_ll1(&analysed_nt, "type_specifier", FALSE);
+	test_parse_grammar(&analysed_nt, "root", "int f(int a) { return *a ? b : c; }",
+					   "list(new_style(list(int()),f,parameter_declaration_list(list(type(int(),type(a,<>))),<>),decl_or_stat(<>,list(ret(list(if_expr(deref(a),b,c)))))))");
+
+	test_parse_grammar(all_nt, "expr", "a", "list(a)");
+	test_parse_grammar(all_nt, "expr", "a*b", "list(times(a,b))");
+	test_parse_grammar(all_nt, "expr", "sizeof(int)", "list(sizeof(int()))");
+	test_parse_grammar(all_nt, "statement", "do a = b; while (double_x);", "do(list(assignment(a,ass(),b)),list(double_x))");
+}
+
+/*
+	Scan tests
+	~~~~~~~~~~
+*/
+
+typedef struct
+{
+	const char *input;
+	fixed_string_ostream_p ostream;
+} scan_test_data_t, *scan_test_data_p;
+
+bool scan_test_match(void *data, text_pos_p start, text_pos_p end, result_p result)
+{
+	(void)result;
+	scan_test_data_p scan_test_data = (scan_test_data_p)data;
+	char buffer[41];
+	snprintf(buffer, 40, "%s%d.%d:", scan_test_data->ostream->i > 0 ? "|" : "", start->cur_line, start->cur_column);
+	ostream_puts(&scan_test_data->ostream->ostream, buffer);
+	for (size_t i = start->pos; i < end->pos; i++)
+		ostream_put(&scan_test_data->ostream->ostream, scan_test_data->input[i]);
+	return TRUE;
+}
+
+void test_scan_nt(non_terminal_dict_p *all_nt, const char *nt, const char *input, bool overlapping, const char *exp_output)
+{
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, input);
+	
+	solutions_t solutions;
+	solutions_init(&solutions, &text_buffer);
+	
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	parser.cache_hit_function = solutions_find;
+	parser.cache = &solutions;
+
+	char output[200];
+	fixed_string_ostream_t fixed_string_ostream;
+	fixed_string_ostream_init(&fixed_string_ostream, output, 200);
+	scan_test_data_t scan_test_data;
+	scan_test_data.input = input;
+	scan_test_data.ostream = &fixed_string_ostream;
+	parse_scan(&parser, find_nt(nt, all_nt), overlapping, scan_test_match, &scan_test_data);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+	if (strcmp(output, exp_output) != 0)
+		fprintf(stderr, "ERROR: scanning %s in '%s' gave '%s' instead of expected '%s'\n", nt, input, output, exp_output);
+	else
+		fprintf(stderr, "OK: scanning %s in '%s' gave '%s'\n", nt, input, output);
+
+	solutions_free(&solutions);
+}
+
+void test_scan(non_terminal_dict_p *all_nt)
+{
+	grammar_analyse(*all_nt);
+	test_scan_nt(all_nt, "int", "a = 12; b = 0x1F + 7;", FALSE, "1.5:12|1.13:0x1F|1.20:7");
+	test_scan_nt(all_nt, "int", "x\n\ty-3", FALSE, "2.6:-3");
+	test_scan_nt(all_nt, "ident", "ab c1", FALSE, "1.1:ab|1.4:c1");
+	test_scan_nt(all_nt, "ident", "ab c1", TRUE, "1.1:ab|1.2:b|1.4:c1");
+	test_scan_nt(all_nt, "ident", "a gr\xC3\xB6\xC3\x9F" "e\t\xE2\x82\xAC b", FALSE, "1.1:a|1.3:gr\xC3\xB6\xC3\x9F" "e|1.11:b");
+	test_scan_nt(all_nt, "string", "f(\"a\", 'b', \"c\" \"d\")", FALSE, "1.3:\"a\"|1.13:\"c\" \"d\"");
+}
+
+/*
+	Compact cache tests
+	~~~~~~~~~~~~~~~~~~~
+
+	The compact cache should give the same results as the brute force cache.
+*/
+
+bool parse_to_string(parser_p parser, non_terminal_p nt, char *output, unsigned int len)
+{
+	ENTER_RESULT_CONTEXT
+	DECL_RESULT(result);
+	bool parsed = parse_nt(parser, nt, &result) && text_buffer_end(parser->text_buffer);
+	fixed_string_ostream_t fixed_string_ostream;
+	fixed_string_ostream_init(&fixed_string_ostream, output, len);
+	if (parsed)
+		result_print(&result, &fixed_string_ostream.ostream);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+	DISP_RESULT(result);
+	EXIT_RESULT_CONTEXT
+	return parsed;
+}
+
+void test_parse_grammar_compact_memo(non_terminal_dict_p *all_nt, const char *nt, const char *input)
+{
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, input);
+
+	solutions_t solutions;
+	solutions_init(&solutions, &text_buffer);
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	parser.cache_hit_function = solutions_find;
+	parser.cache = &solutions;
+	char exp_output[1000];
+	bool exp_parsed = parse_to_string(&parser, find_nt(nt, all_nt), exp_output, 1000);
+	solutions_free(&solutions);
+
+	text_buffer_assign_string(&text_buffer, input);
+	compact_memo_t compact_memo;
+	compact_memo_init(&compact_memo, &text_buffer);
+	parser_init(&parser, &text_buffer);
+	parser.cache_hit_function = compact_memo_find;
+	parser.cache_set_result_function = compact_memo_set_result;
+	parser.cache = &compact_memo;
+	char output[1000];
+	bool parsed = parse_to_string(&parser, find_nt(nt, all_nt), output, 1000);
+
+	/* Check the calculation of line and column numbers for all positions */
+	text_buffer_t walk_buffer;
+	text_buffer_assign_string(&walk_buffer, input);
+	bool pos_ok = TRUE;
+	for (;;)
+	{
+		text_pos_t text_pos;
+		compact_memo_text_pos(&compact_memo, walk_buffer.pos.pos, &text_pos);
+		if (text_pos.cur_line != walk_buffer.pos.cur_line || text_pos.cur_column != walk_buffer.pos.cur_column)
+			pos_ok = FALSE;
+		if (text_buffer_end(&walk_buffer))
+			break;
+		text_buffer_next(&walk_buffer);
+	}
+	compact_memo_free(&compact_memo);
+
+	if (!exp_parsed)
+		fprintf(stderr, "ERROR: failed to parse '%s' with brute force cache\n", input);
+	else if (!parsed || strcmp(output, exp_output) != 0)
+		fprintf(stderr, "ERROR: parsed '%s' to '%s' with compact cache instead of '%s'\n", input, output, exp_output);
+	else if (!pos_ok)
+		fprintf(stderr, "ERROR: wrong line and column numbers with compact cache for '%s'\n", input);
+	else
+		fprintf(stderr, "OK: parsed '%s' to '%s' with compact cache\n", input, output);
+}
+
+void test_c_grammar_compact_memo(non_terminal_dict_p *all_nt)
+{
+	test_parse_grammar_compact_memo(all_nt, "expr", "a*b+c");
+	test_parse_grammar_compact_memo(all_nt, "root", "int f(int a)\n{\n\tint b = a; /* one */\n\treturn b * (a + b);\n}\n");
+}
+
+/*
+	Cache strategy tests
+	~~~~~~~~~~~~~~~~~~~~
+*/
+
+void test_cache_strategy(non_terminal_dict_p *all_nt, const char *name, void *cache,
+						 cache_item_p (*find)(void *cache, size_t pos, const char *nt),
+						 void (*set_result)(void *cache, size_t pos, const char *nt, cache_item_p cache_item),
+						 const char *input, const char *exp_output, bool exp_evictions)
+{
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, input);
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	parser.cache_hit_function = find;
+	parser.cache_set_result_function = set_result;
+	parser.cache = cache;
+	char output[10000];
+	bool parsed = parse_to_string(&parser, find_nt("root", all_nt), output, 10000);
+
+	cache_stats_p stats = cache_stats(cache);
+	char stats_output[300];
+	fixed_string_ostream_t fixed_string_ostream;
+	fixed_string_ostream_init(&fixed_string_ostream, stats_output, 300);
+	cache_stats_print(stats, &fixed_string_ostream.ostream);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+	if (!parsed || strcmp(output, exp_output) != 0)
+		fprintf(stderr, "ERROR: parsed with %s cache to '%s'\n", name, output);
+	else if (   stats->lookups == 0 || stats->success_hits + stats->fail_hits == 0 || (stats->evictions > 0) != exp_evictions
+			 || stats->stores - stats->evictions != stats->nr_items)
+		fprintf(stderr, "ERROR: %s cache has statistics: %s\n", name, stats_output);
+	else
+		fprintf(stderr, "OK: parsed with %s cache: %s\n", name, stats_output);
+}
+
+void test_cache_strategies(non_terminal_dict_p *all_nt)
+{
+	const char *unit = "int f(int a)\n{\n\tint b = a; /* one */\n\treturn b * (a + b);\n}\n";
+	size_t unit_len = strlen(unit);
+	char *input = MALLOC_N(4 * unit_len + 1, char);
+	for (int i = 0; i < 4; i++)
+		strcpy(input + i * unit_len, unit);
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, input);
+
+	/* The brute force cache gives the expected output */
+	solutions_t solutions;
+	solutions_init(&solutions, &text_buffer);
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	parser.cache_hit_function = solutions_find;
+	parser.cache = &solutions;
+	char *exp_output = MALLOC_N(10000, char);
+	if (!parse_to_string(&parser, find_nt("root", all_nt), exp_output, 10000))
+		fprintf(stderr, "ERROR: failed to parse with brute force cache\n");
+	test_cache_strategy(all_nt, "brute force", &solutions, solutions_find, NULL, input, exp_output, FALSE);
+	solutions_free(&solutions);
+
+	compact_memo_t compact_memo;
+	compact_memo_init(&compact_memo, &text_buffer);
+	test_cache_strategy(all_nt, "compact", &compact_memo, compact_memo_find, compact_memo_set_result, input, exp_output, FALSE);
+	compact_memo_free(&compact_memo);
+
+	direct_cache_t direct_cache;
+	direct_cache_init(&direct_cache, 64);
+	test_cache_strategy(all_nt, "direct mapped", &direct_cache, direct_cache_find, direct_cache_set_result, input, exp_output, TRUE);
+	direct_cache_free(&direct_cache);
+
+	lru_cache_t lru_cache;
+	lru_cache_init(&lru_cache, 50);
+	test_cache_strategy(all_nt, "LRU", &lru_cache, lru_cache_find, lru_cache_set_result, input, exp_output, TRUE);
+	lru_cache_free(&lru_cache);
+
+	/* (With a single item, the item that is evicted is also the newest) */
+	lru_cache_init(&lru_cache, 1);
+	test_cache_strategy(all_nt, "LRU with one item", &lru_cache, lru_cache_find, lru_cache_set_result, input, exp_output, TRUE);
+	lru_cache_free(&lru_cache);
+
+	window_cache_t window_cache;
+	window_cache_init(&window_cache, 8);
+	test_cache_strategy(all_nt, "window", &window_cache, window_cache_find, window_cache_set_result, input, exp_output, TRUE);
+	window_cache_free(&window_cache);
+
+	FREE(exp_output);
+	FREE(input);
+}
+
+/*
+	Predicate tests
+	~~~~~~~~~~~~~~~
+
+	A failure found while recognizing is not stored in the cache. In the
+	grammar below, 'pred_pair' fails on "aab" inside the not predicate,
+	because the first rule of 'pred_a' is accepted without calling its add
+	function, while a full parse takes the second rule.
+*/
+
+bool predicate_test_reject(result_p prev, char ch, result_p result)
+{
+	(void)prev;
+	(void)ch;
+	(void)result;
+	return FALSE;
+}
+
+void predicate_test_grammar(non_terminal_dict_p *all_nt)
+{
+	HEADER(all_nt)
+	(void)ref_rec_rule;
+
+	NT_DEF("pred_root")
+		RULE NOT_NT("pred_pair") CHAR('x')
+		RULE NT("pred_pair") END TREE("root")
+	NT_DEF("pred_pair")
+		RULE NT("pred_a") CHAR('b') TREE("pair")
+	NT_DEF("pred_a")
+		RULE CHARF('a', predicate_test_reject)
+		RULE CHAR('a') CHAR('a') TREE("aa")
+}
+
+void test_predicates()
+{
+	non_terminal_dict_p all_nt = NULL;
+	predicate_test_grammar(&all_nt);
+	const char *input = "aab";
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, input);
+	solutions_t solutions;
+	solutions_init(&solutions, &text_buffer);
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	parser.cache_hit_function = solutions_find;
+	parser.cache = &solutions;
+	char output[100];
+	bool parsed = parse_to_string(&parser, find_nt("pred_root", &all_nt), output, 100);
+	solutions_free(&solutions);
+	if (!parsed || strcmp(output, "root(pair(aa()))") != 0)
+		fprintf(stderr, "ERROR: failure found in predicate was cached for '%s'\n", input);
+	else
+		fprintf(stderr, "OK: parsed '%s' to '%s' after a predicate\n", input, output);
+}
+
+/*
+	Earley parser tests
+	~~~~~~~~~~~~~~~~~~~
+
+	When no output is expected, the result should be equal to that of the
+	back-tracking parser.
+*/
+
+void earley_test_grammar(non_terminal_dict_p *all_nt)
+{
+	HEADER(all_nt)
+	(void)ref_rec_rule;
+	
+	/* Indirect left-recursion */
+	NT_DEF("left_a")
+		RULE NT("left_b") CHAR('a') TREE("a")
+		RULE CHAR('x') TREE("x")
+	NT_DEF("left_b")
+		RULE NT("left_a") CHAR('b') TREE("b")
+
+	/* A sequence that should not consume all elements */
+	NT_DEF("seq_a")
+		RULE NT("elem_a") SEQL NT("elem_a") END TREE("seq")
+	NT_DEF("elem_a")
+		RULE CHAR('a') TREE("a")
+}
+
+void test_parse_earley(non_terminal_dict_p *all_nt, const char *nt, const char *input, const char *exp_output)
+{
+	ENTER_RESULT_CONTEXT
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, input);
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+
+	char back_tracking_output[1000];
+	if (exp_output == NULL)
+	{
+		solutions_t solutions;
+		solutions_init(&solutions, &text_buffer);
+		parser.cache_hit_function = solutions_find;
+		parser.cache = &solutions;
+		if (!parse_to_string(&parser, find_nt(nt, all_nt), back_tracking_output, 1000))
+			fprintf(stderr, "ERROR: failed to parse '%s' with back-tracking parser\n", input);
+		exp_output = back_tracking_output;
+		solutions_free(&solutions);
+		text_buffer_assign_string(&text_buffer, input);
+		parser_init(&parser, &text_buffer);
+	}
+
+	DECL_RESULT(result)
+	char output[1000];
+	fixed_string_ostream_t fixed_string_ostream;
+	fixed_string_ostream_init(&fixed_string_ostream, output, 1000);
+	bool parsed = earley_parse_nt(&parser, find_nt(nt, all_nt), &result) && text_buffer_end(&text_buffer);
+	if (parsed)
+		result_print(&result, &fixed_string_ostream.ostream);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+	DISP_RESULT(result)
+
+	if (!parsed)
+		fprintf(stderr, "ERROR: failed to parse '%s' with Earley parser\n", input);
+	else if (strcmp(output, exp_output) != 0)
+		fprintf(stderr, "ERROR: parsed '%s' to '%s' with Earley parser instead of '%s'\n", input, output, exp_output);
+	else
+		fprintf(stderr, "OK: parsed '%s' to '%s' with Earley parser\n", input, output);
+	EXIT_RESULT_CONTEXT
+}
+
+void test_earley(non_terminal_dict_p *all_nt)
+{
+	test_parse_earley(all_nt, "expr", "a*b+c", NULL);
+	test_parse_earley(all_nt, "statement", "do a = b; while (double_x);", NULL);
+	test_parse_earley(all_nt, "root", "int f(int a)\n{\n\tint b = a; /* one */\n\treturn b * (a + b);\n}\n", NULL);
+
+	non_terminal_dict_p all_nt_earley = NULL;
+	earley_test_grammar(&all_nt_earley);
+	test_parse_earley(&all_nt_earley, "left_a", "xbaba", "a(b(a(b(x()))))");
+	test_parse_earley(&all_nt_earley, "seq_a", "aaa", "seq(list(a(),a()),a())");
+}
+
+/*
+	Tests for compiling to machine code
+	~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+*/
+
+void test_jit_function(non_terminal_dict_p *all_nt, const char *nt, const char *input, int exp_len)
+{
+	non_terminal_p non_term = find_nt(nt, all_nt);
+	if (non_term->jit_function == NULL)
+	{
+		fprintf(stderr, "ERROR: %s was not compiled\n", nt);
+		return;
+	}
+	const char *next = non_term->jit_function(input, input + strlen(input));
+	int len = next == NULL ? -1 : next - input;
+	if (len != exp_len)
+		fprintf(stderr, "ERROR: compiled %s parsed %d characters of '%s' instead of %d\n", nt, len, input, exp_len);
+	else
+		fprintf(stderr, "OK: compiled %s parsed %d characters of '%s'\n", nt, len, input);
+}
+
+void test_jit(non_terminal_dict_p *all_nt)
+{
+	non_terminal_dict_p all_nt_number = NULL;
+	number_grammar(&all_nt_number);
+	jit_code_p number_code = jit_compile_grammar(all_nt_number);
+	jit_code_p c_code = jit_compile_grammar(*all_nt);
+#ifdef JIT_X86_64
+	test_jit_function(&all_nt_number, "number", "123x", 3);
+	test_jit_function(&all_nt_number, "number", "x", -1);
+	test_jit_function(all_nt, "white_space", " \t/* a */ // b\n x", 16);
+	test_jit_function(all_nt, "white_space", "/* a ", 0);
+	if (find_nt("number", &all_nt_number)->jit_result_free || !find_nt("white_space", all_nt)->jit_result_free)
+		fprintf(stderr, "ERROR: wrong functions for processing results\n");
+	if (find_nt("expr", all_nt)->jit_supported)
+		fprintf(stderr, "ERROR: expr should not be compiled\n");
+#endif
+	/* The compiled white space should not change the results */
+	test_parse_grammar(all_nt, "expr", "a /* x */ * // y\n b", "list(times(a,b))");
+	test_parse_grammar(all_nt, "statement", "do a = b; while (double_x);", "do(list(assignment(a,ass(),b)),list(double_x))");
+	jit_code_free(c_code);
+	jit_code_free(number_code);
+}
+
+/*
+	File output stream
+	~~~~~~~~~~~~~~~~~~
+*/
+
+typedef struct file_ostream file_ostream_t, *file_ostream_p;
+struct file_ostream
+{
+	ostream_t ostream;
+	FILE *f;
+};
+
+void file_ostream_put(ostream_p ostream, char ch)
+{
+	if (((file_ostream_p)ostream)->f != NULL)
+		fputc(ch, ((file_ostream_p)ostream)->f);
+}
+
+void file_ostream_init(file_ostream_p ostream, FILE *f)
+{
+	ostream->ostream.put = file_ostream_put;
+	ostream->f = f;
+}
+
+/*
+	Expect
+*/
+
+#define MAX_EXP_SYM 200
+
+struct nt_stack
+{
+	const char *name;
+	unsigned long int ref_count;
+	text_pos_t pos;
+	int rule_nr;      /* The rule being parsed (negative for the left-recursive rules) */
+	nt_stack_p parent;
+};
+THREAD_LOCAL nt_stack_p nt_stack_allocated = NULL;
+
+/*	The sampling profiler (see below) reads the stack of a parser from a
+	signal handler, which can interrupt the parser at any moment. For this
+	the push stores the new top only after it has been linked completely,
+	and the pop removes the top before it is moved to the free list. */
+
+#ifdef __GNUC__
+#define NT_STACK_PUBLISH(P, S) { __atomic_store_n(&(P)->nt_stack, S, __ATOMIC_RELEASE); __atomic_signal_fence(__ATOMIC_SEQ_CST); }
+#define NT_STACK_TOP(P) __atomic_load_n(&(P)->nt_stack, __ATOMIC_ACQUIRE)
+#else
+#define NT_STACK_PUBLISH(P, S) (P)->nt_stack = S;
+#define NT_STACK_TOP(P) (P)->nt_stack
+#endif
+
+void nt_stack_push(const char *name, parser_p parser)
+{
+	nt_stack_p child;
+	if (nt_stack_allocated != NULL)
+	{
+		child = nt_stack_allocated;
+		nt_stack_allocated = child->parent;
+		BUDGET_CHARGE(child)
+	}
+	else
+		child = MALLOC(struct nt_stack);
+	child->name = name;
+	child->ref_count = 1;
+	child->pos = parser->text_buffer->pos;
+	child->rule_nr = 0;
+	child->parent = parser->nt_stack;
+	if (parser->nt_stack != 0)
+		parser->nt_stack->ref_count++;
+	//DEBUG_TAB; DEBUG_P1("push %s\n", child->name);
+	NT_STACK_PUBLISH(parser, child)
+}
+
+void nt_stack_dispose(nt_stack_p nt_stack)
+{
+	while (nt_stack != NULL && --nt_stack->ref_count == 0)
+	{
+		nt_stack_p parent = nt_stack->parent;
+		BUDGET_UNCHARGE(nt_stack)
+		nt_stack->parent = nt_stack_allocated;
+		nt_stack_allocated = nt_stack;
+		nt_stack = parent;
+	}
+}
+
+void nt_stack_pop(parser_p parser)
+{
+	nt_stack_p cur = parser->nt_stack;
+	//DEBUG_TAB; DEBUG_P1("pop %s\n", cur == NULL ? "<NULL>" : cur->name);
+	NT_STACK_PUBLISH(parser, cur->parent)
+	nt_stack_dispose(cur);
+}
+
+void nt_stack_set_rule(nt_stack_p nt_stack, int rule_nr)
+{
+	nt_stack->rule_nr = rule_nr;
+}
+
+THREAD_LOCAL text_pos_t highest_pos;
+typedef struct
+{
+	nt_stack_p nt_stack;
+	element_p element;
+} expect_t;
+THREAD_LOCAL expect_t expected[MAX_EXP_SYM];
+THREAD_LOCAL int nr_expected;
+
+void init_expected()
+{
+	highest_pos.pos = 0;
+	nr_expected = 0;
+}
+
+void expect_element(parser_p parser, element_p element)
+{
+	if (parser->text_buffer->pos.pos < highest_pos.pos) return;
+	/* What fails inside a predicate, was not expected to be there */
+	if (parser->recognize_only > 0) return;
+	
+	if (parser->text_buffer->pos.pos > highest_pos.pos)
+	{
+		highest_pos = parser->text_buffer->pos;
+		//for (int i = 0; i < nr_expected; i++)
+		//	nt_stack_dispose(expected[i].nt_stack);
+		nr_expected = 0;
+	}
+	for (int i = 0; i < nr_expected; i++)
+		if (expected[i].nt_stack == parser->nt_stack && expected[i].element == element)
+			return;
+	if (nr_expected < MAX_EXP_SYM)
+	{
+		parser->nt_stack->ref_count++;
+		expected[nr_expected].nt_stack = parser->nt_stack;
+		expected[nr_expected].element = element;
+		nr_expected++;
+	}
+}
+
+
+
+/*	- Function to release the free lists of the calling thread (and the
+	  expected elements, which refer to the stack of non-terminals). A
+	  thread that parsed should call it before it exits, because the free
+	  lists are local to the thread (see THREAD_LOCAL). */
+
+void parse_thread_free()
+{
+	for (int i = 0; i < nr_expected; i++)
+		nt_stack_dispose(expected[i].nt_stack);
+	init_expected();
+	while (nt_stack_allocated != NULL)
+	{
+		nt_stack_p next = nt_stack_allocated->parent;
+		FREE(nt_stack_allocated);
+		nt_stack_allocated = next;
+	}
+	while (old_trees != NULL)
+	{
+		tree_p next = *(tree_p*)old_trees;
+		FREE(old_trees);
+		old_trees = next;
+	}
+	while (global_string_buffer != NULL)
+	{
+		string_buffer_p next = global_string_buffer->next;
+		FREE(global_string_buffer);
+		global_string_buffer = next;
+	}
+}
+
+void print_expected(FILE *fout)
+{
+	fprintf(fout, "Expect at %d.%d:\n", highest_pos.cur_line, highest_pos.cur_column);
+	for (int i = 0; i < nr_expected; i++)
+	{
+		element_p element = expected[i].element;
+		fprintf(fout, "- expect ");
+		element_print(fout, element);
+		fprintf(fout, "\n");
+		for (nt_stack_p nt_stack = expected[i].nt_stack; nt_stack != NULL; nt_stack = nt_stack->parent)
+			fprintf(fout, "  in %s at %d.%d\n", nt_stack->name, nt_stack->pos.cur_line, nt_stack->pos.cur_column);
 	}
-		
-	/* Store the current position */
-	text_pos_t sp = parser->text_buffer->pos;
-	
-	if (element->sequence)
+}
+
+/*
+	Sampling profiler
+	~~~~~~~~~~~~~~~~~
+
+	A profile of the C functions only shows the recursion of parse_rule,
+	parse_element and parse_seq, not which parts of the grammar are costly.
+	The profiler below samples the stack of non-terminals (with the number
+	of the rule being parsed) of a parser on a timer signal, counting each
+	distinct stack in a table that is allocated in advance, because the
+	signal handler may not allocate memory. The counts are written in the
+	folded format (frames separated by semicolons, followed by the count),
+	which can be rendered as a flame graph of the grammar. A frame is
+	written as the name of the non-terminal followed by '#' and the number
+	of the rule (with 'r' for the left-recursive rules). When the stack is
+	deeper than PROFILE_MAX_DEPTH, the frames nearest to the root are
+	replaced by '...'.
+
+	The parser is sampled on the thread that called profile_start. On
+	Linux, a timer that measures the processor time of that thread sends
+	the signal to it. Elsewhere, the timer of the process is used, and the
+	handler ignores the signal on other threads, because the parser being
+	profiled is local to the thread. The table with the samples (and the
+	timer) is global, thus only one profile can be taken at a time. The
+	action for the signal that was there before profile_start, is
+	restored by profile_stop.
+*/
+
+#define PROFILE_MAX_DEPTH 64
+#define PROFILE_TABLE_SIZE 4096
+
+typedef struct
+{
+	unsigned long count;
+	int depth;                              /* Zero, when not used */
+	bool truncated;
+	const char *names[PROFILE_MAX_DEPTH];   /* From the leaf to the root */
+	int rule_nrs[PROFILE_MAX_DEPTH];
+} profile_stack_t, *profile_stack_p;
+
+profile_stack_p profile_stacks = NULL;
+unsigned long profile_nr_samples = 0;
+unsigned long profile_nr_lost = 0;
+THREAD_LOCAL parser_p volatile profile_parser = NULL;
+
+/*	- Function to add a sample of the stack of non-terminals of a parser */
+
+void profile_sample(parser_p parser)
+{
+	const char *names[PROFILE_MAX_DEPTH];
+	int rule_nrs[PROFILE_MAX_DEPTH];
+	int depth = 0;
+	unsigned long hash = 0;
+	nt_stack_p nt_stack = NT_STACK_TOP(parser);
+	for (; nt_stack != NULL && depth < PROFILE_MAX_DEPTH; nt_stack = nt_stack->parent)
 	{
-		/* The first element of the rule is a sequence. */
-		DECL_RESULT(seq_begin);
-		if (element->begin_seq_function != NULL)
-			element->begin_seq_function(prev_result, &seq_begin);
-		
-		/* Try to parse the first element of the sequence. */
-		DECL_RESULT(seq_elem);
-		if (parse_element(parser, element, &seq_begin, &seq_elem))
+		names[depth] = nt_stack->name;
+		rule_nrs[depth] = nt_stack->rule_nr;
+		hash = (hash ^ (size_t)nt_stack->name ^ (unsigned long)nt_stack->rule_nr) * 0x100000001B3UL;
+		depth++;
+	}
+	if (depth == 0)
+		return;
+	profile_nr_samples++;
+	bool truncated = nt_stack != NULL;
+
+	for (unsigned long i = 0; i < PROFILE_TABLE_SIZE; i++)
+	{
+		profile_stack_p stack = &profile_stacks[(hash + i) & (PROFILE_TABLE_SIZE - 1)];
+		if (stack->depth == 0)
 		{
-			if (element->back_tracking)
+			/* Only use three quarters of the table, such that probing stays short */
+			if (4 * i >= 3 * PROFILE_TABLE_SIZE)
+				break;
+			for (int j = 0; j < depth; j++)
 			{
-				/* Now parse the remainder elements of the sequence (and thereafter the remainder of the rule. */
-				if (parse_seq(parser, element, &seq_elem, prev_result, rule, rule_result))
-				{
-					DISP_RESULT(seq_elem);
-					DISP_RESULT(seq_begin);
-					DEBUG_EXIT("parse_rule = ");
-					DEBUG_PT(rule_result); DEBUG_NL;
-					EXIT_RESULT_CONTEXT
-					return TRUE;
-				}
+				stack->names[j] = names[j];
+				stack->rule_nrs[j] = rule_nrs[j];
 			}
-			else
+			stack->truncated = truncated;
+			stack->count = 1;
+			stack->depth = depth;
+			return;
+		}
+		if (stack->depth == depth && stack->truncated == truncated)
+		{
+			int j = 0;
+			while (j < depth && stack->names[j] == names[j] && stack->rule_nrs[j] == rule_nrs[j])
+				j++;
+			if (j == depth)
 			{
-				/* Now continue parsing more elements */
-				for (;;)
-				{
-					if (element->avoid)
-					{
-						DECL_RESULT(result);
-						if (element->add_seq_function != NULL && !element->add_seq_function(prev_result, &seq_elem, &result))
-						{
-							DEBUG_TAB; DEBUG_("add_seq_function failed\n");
-							break;
-						}
-						if (parse_rule(parser, element->next, &result, rule, rule_result))
-						{
-							DISP_RESULT(result);
-							DISP_RESULT(seq_elem);
-							DISP_RESULT(seq_begin);
-							DEBUG_EXIT("parse_rule = ");
-							DEBUG_PT(rule_result); DEBUG_NL;
-							EXIT_RESULT_CONTEXT
-							return TRUE;
-						}
-						DISP_RESULT(result);
-					}
-					
-					/* Store the current position */
-					text_pos_t sp = parser->text_buffer->pos;
-					
-					if (element->chain_rule != NULL)
-					{
-						DECL_RESULT(dummy_prev_result);
-						DECL_RESULT(dummy_chain_elem);
-						bool parsed_chain = parse_rule(parser, element->chain_rule, &dummy_prev_result, NULL, &dummy_chain_elem);
-						DISP_RESULT(dummy_chain_elem);
-						DISP_RESULT(dummy_prev_result);
-						if (!parsed_chain)
-							break;
-					}
-					
-					DECL_RESULT(next_seq_elem);
-					if (parse_element(parser, element, &seq_elem, &next_seq_elem))
-					{
-						result_assign(&seq_elem, &next_seq_elem);
-					}
-					else
-					{
-						/* Failed to parse the next element of the sequence: reset the current position to the saved position. */
-						text_buffer_set_pos(parser->text_buffer, &sp);
-						DISP_RESULT(next_seq_elem);
-						break;
-					}
-					DISP_RESULT(next_seq_elem);
-				}
-				
-				DECL_RESULT(result);
-				if (element->add_seq_function != NULL && !element->add_seq_function(prev_result, &seq_elem, &result))
-				{
-					DEBUG_TAB; DEBUG_("add_seq_function failed\n");
-				}
-				else
-				{
-					if (parse_rule(parser, element->next, &result, rule, rule_result))
-					{
-						DISP_RESULT(result);
-						DISP_RESULT(seq_elem);
-						DISP_RESULT(seq_begin);
-						DEBUG_EXIT("parse_rule = ");
-						DEBUG_PT(rule_result); DEBUG_NL;
-						EXIT_RESULT_CONTEXT
-						return TRUE;
-					}
-				}
-				DISP_RESULT(result);
+				stack->count++;
+				return;
 			}
 		}
-		DISP_RESULT(seq_elem);
-		DISP_RESULT(seq_begin);
 	}
-	else
+	profile_nr_lost++;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <signal.h>
+#include <sys/time.h>
+#if defined(__linux__) && defined(SIGEV_THREAD_ID)
+#define PROFILE_THREAD_TIMER
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+timer_t profile_timer;
+#endif
+struct sigaction profile_old_action;
+bool profile_old_action_saved = FALSE;
+
+void profile_signal_handler(int signal_nr)
+{
+	(void)signal_nr;
+	parser_p parser = profile_parser;
+	if (parser != NULL)
+		profile_sample(parser);
+}
+#endif
+
+void profile_reset()
+{
+	if (profile_stacks == NULL)
+		profile_stacks = MALLOC_N(PROFILE_TABLE_SIZE, profile_stack_t);
+	for (int i = 0; i < PROFILE_TABLE_SIZE; i++)
+		profile_stacks[i].depth = 0;
+	profile_nr_samples = 0;
+	profile_nr_lost = 0;
+}
+
+/*	- Functions to start (with an interval in micro seconds of processor
+	  time) and stop sampling a parser. Returns FALSE if not supported. */
+
+bool profile_start(parser_p parser, long interval_us)
+{
+	profile_reset();
+#if defined(__unix__) || defined(__APPLE__)
+	profile_parser = parser;
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = profile_signal_handler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGPROF, &action, &profile_old_action) != 0)
+		return FALSE;
+	profile_old_action_saved = TRUE;
+#ifdef PROFILE_THREAD_TIMER
+	struct sigevent event;
+	memset(&event, 0, sizeof(event));
+	event.sigev_notify = SIGEV_THREAD_ID;
+	event.sigev_signo = SIGPROF;
+	event.sigev_notify_thread_id = syscall(SYS_gettid);
+	if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &profile_timer) != 0)
+		return FALSE;
+	struct itimerspec timer;
+	timer.it_interval.tv_sec = interval_us / 1000000;
+	timer.it_interval.tv_nsec = (interval_us % 1000000) * 1000;
+	timer.it_value = timer.it_interval;
+	return timer_settime(profile_timer, 0, &timer, NULL) == 0;
+#else
+	struct itimerval timer;
+	timer.it_interval.tv_sec = interval_us / 1000000;
+	timer.it_interval.tv_usec = interval_us % 1000000;
+	timer.it_value = timer.it_interval;
+	return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+#endif
+#else
+	return FALSE;
+#endif
+}
+
+void profile_stop()
+{
+#if defined(__unix__) || defined(__APPLE__)
+#ifdef PROFILE_THREAD_TIMER
+	timer_delete(profile_timer);
+#else
+	struct itimerval timer;
+	memset(&timer, 0, sizeof(timer));
+	setitimer(ITIMER_PROF, &timer, NULL);
+#endif
+	/* Ignoring the signal discards a signal that is still pending, which
+	   otherwise could terminate the process, when the old action is the
+	   default action */
+	signal(SIGPROF, SIG_IGN);
+	if (profile_old_action_saved)
+		sigaction(SIGPROF, &profile_old_action, NULL);
+	profile_old_action_saved = FALSE;
+#endif
+	profile_parser = NULL;
+}
+
+/*	- Function to write the samples in the folded format */
+
+void profile_write(ostream_p ostream)
+{
+	char buffer[30];
+	for (int i = 0; i < PROFILE_TABLE_SIZE; i++)
 	{
-		/* The first element is not a sequence: Try to parse the first element */
-		DECL_RESULT(elem);
-		if (parse_element(parser, element, prev_result, &elem))
+		profile_stack_p stack = &profile_stacks[i];
+		if (stack->depth == 0)
+			continue;
+		if (stack->truncated)
+			ostream_puts(ostream, "...;");
+		for (int j = stack->depth - 1; j >= 0; j--)
 		{
-			if (parse_rule(parser, element->next, &elem, rule, rule_result))
-			{
-				DISP_RESULT(elem);
-				DEBUG_EXIT("parse_rule = ");
-				DEBUG_PT(rule_result); DEBUG_NL;
-				EXIT_RESULT_CONTEXT
-				return TRUE;
-			}
+			ostream_puts(ostream, stack->names[j]);
+			if (stack->rule_nrs[j] >= 0)
+				snprintf(buffer, 30, "#%d", stack->rule_nrs[j]);
+			else
+				snprintf(buffer, 30, "#r%d", -1 - stack->rule_nrs[j]);
+			ostream_puts(ostream, buffer);
+			ostream_put(ostream, j > 0 ? ';' : ' ');
 		}
-		DISP_RESULT(elem);
+		snprintf(buffer, 30, "%lu\n", stack->count);
+		ostream_puts(ostream, buffer);
 	}
-	
-	/* Failed to parse the rule: reset the current position to the saved position. */
-	text_buffer_set_pos(parser->text_buffer, &sp);
-	
-	/* If the element was optional (and should not be avoided): Skip the element
-	   and try to parse the remainder of the rule */
-	if (element->optional && !element->avoid)
+}
+
+/*
+	Backtracking heatmap
+	~~~~~~~~~~~~~~~~~~~~
+
+	A back-tracking parser can examine the same part of the input many
+	times, especially when the grammar has alternatives with a long common
+	prefix and there is no cache. To find the inputs and the parts of the
+	grammar that cause this, a heatmap can be assigned to parse_heatmap.
+	It counts for each offset in the input how often parse_element started
+	at it, and the number of moves backwards in the text buffer with their
+	distance (in a histogram with powers of two). The number of
+	examinations divided by the length of the input, the re-scan ratio,
+	shows how much work is repeated. For each region of HEATMAP_REGION_SIZE
+	bytes, the examinations are also counted per non-terminal on top of
+	the nt_stack, such that the non-terminals that are responsible for the
+	hot regions can be reported. The counts per offset can be exported as
+	comma separated values for visualization. (Non-terminals that are
+	compiled to machine code, do not call parse_element.) When a maximum
+	number of examinations is set, parse_element fails from then on, such
+	that parsing an input that makes the parser explode ends quickly.
+*/
+
+#define HEATMAP_REGION_SIZE 64
+#define HEATMAP_NR_BUCKETS 32
+#define HEATMAP_NR_NTS 5
+
+typedef struct
+{
+	size_t region;
+	const char *name;      /* NULL, when not used */
+	unsigned long count;
+} heatmap_nt_t, *heatmap_nt_p;
+
+struct heatmap
+{
+	text_buffer_p text_buffer;
+	unsigned long *examinations;    /* For each offset, including the end */
+	unsigned long nr_examinations;
+	unsigned long max_examinations; /* When non-zero, the budget for parse_element */
+	unsigned long nr_rewinds;
+	unsigned long long rewind_distance;
+	size_t max_rewind;
+	unsigned long rewind_histogram[HEATMAP_NR_BUCKETS];  /* Distance 1, 2-3, 4-7, ... */
+	heatmap_nt_p nts;               /* Hash table with linear probing */
+	size_t nr_nts;
+	size_t allocated_nts;
+};
+typedef struct heatmap heatmap_t;
+
+void heatmap_init(heatmap_p heatmap, text_buffer_p text_buffer)
+{
+	heatmap->text_buffer = text_buffer;
+	heatmap->examinations = MALLOC_N(text_buffer->buffer_len + 1, unsigned long);
+	for (size_t i = 0; i <= text_buffer->buffer_len; i++)
+		heatmap->examinations[i] = 0;
+	heatmap->nr_examinations = 0;
+	heatmap->max_examinations = 0;
+	heatmap->nr_rewinds = 0;
+	heatmap->rewind_distance = 0;
+	heatmap->max_rewind = 0;
+	for (int i = 0; i < HEATMAP_NR_BUCKETS; i++)
+		heatmap->rewind_histogram[i] = 0;
+	heatmap->nts = NULL;
+	heatmap->nr_nts = 0;
+	heatmap->allocated_nts = 0;
+}
+
+void heatmap_release(heatmap_p heatmap)
+{
+	FREE(heatmap->examinations);
+	FREE(heatmap->nts);
+	heatmap->examinations = NULL;
+	heatmap->nts = NULL;
+}
+
+heatmap_nt_p heatmap_find_nt(heatmap_nt_p nts, size_t allocated_nts, size_t region, const char *name)
+{
+	size_t i = (region * 0x9E3779B1UL ^ (size_t)name) & (allocated_nts - 1);
+	while (nts[i].name != NULL && (nts[i].region != region || nts[i].name != name))
+		i = (i + 1) & (allocated_nts - 1);
+	return &nts[i];
+}
+
+bool heatmap_examine(heatmap_p heatmap, parser_p parser, size_t pos)
+{
+	if (heatmap->max_examinations > 0 && heatmap->nr_examinations >= heatmap->max_examinations)
+		return FALSE;
+	heatmap->examinations[pos]++;
+	heatmap->nr_examinations++;
+	if (parser->nt_stack == NULL)
+		return TRUE;
+
+	/* Keep the table at most three quarters full */
+	if (4 * (heatmap->nr_nts + 1) > 3 * heatmap->allocated_nts)
 	{
-		DECL_RESULT(skip_result);
-		if (element->add_skip_function != NULL)
+		size_t new_allocated_nts = heatmap->allocated_nts == 0 ? 64 : 2 * heatmap->allocated_nts;
+		heatmap_nt_p new_nts = MALLOC_N(new_allocated_nts, heatmap_nt_t);
+		for (size_t i = 0; i < new_allocated_nts; i++)
+			new_nts[i].name = NULL;
+		for (size_t i = 0; i < heatmap->allocated_nts; i++)
+			if (heatmap->nts[i].name != NULL)
+				*heatmap_find_nt(new_nts, new_allocated_nts, heatmap->nts[i].region, heatmap->nts[i].name) = heatmap->nts[i];
+		FREE(heatmap->nts);
+		heatmap->nts = new_nts;
+		heatmap->allocated_nts = new_allocated_nts;
+	}
+
+	size_t region = pos / HEATMAP_REGION_SIZE;
+	heatmap_nt_p nt = heatmap_find_nt(heatmap->nts, heatmap->allocated_nts, region, parser->nt_stack->name);
+	if (nt->name == NULL)
+	{
+		nt->region = region;
+		nt->name = parser->nt_stack->name;
+		nt->count = 0;
+		heatmap->nr_nts++;
+	}
+	nt->count++;
+	return TRUE;
+}
+
+void heatmap_rewind(heatmap_p heatmap, size_t distance)
+{
+	heatmap->nr_rewinds++;
+	heatmap->rewind_distance += distance;
+	if (distance > heatmap->max_rewind)
+		heatmap->max_rewind = distance;
+	int bucket = 0;
+	while (bucket < HEATMAP_NR_BUCKETS - 1 && (distance >> (bucket + 1)) > 0)
+		bucket++;
+	heatmap->rewind_histogram[bucket]++;
+}
+
+double heatmap_rescan_ratio(heatmap_p heatmap)
+{
+	size_t len = heatmap->text_buffer->buffer_len;
+	return (double)heatmap->nr_examinations / (double)(len > 0 ? len : 1);
+}
+
+/*	- Function to determine the line and column of an offset */
+
+text_pos_t heatmap_text_pos(heatmap_p heatmap, size_t pos)
+{
+	text_buffer_t text_buffer = *heatmap->text_buffer;
+	text_buffer.info = text_buffer.buffer;
+	text_buffer.pos.pos = 0;
+	text_buffer.pos.cur_line = 1;
+	text_buffer.pos.cur_column = 1;
+	text_buffer_advance_to(&text_buffer, pos);
+	return text_buffer.pos;
+}
+
+/*	- Function to write the examinations for each offset as comma
+	  separated values */
+
+void heatmap_write_csv(heatmap_p heatmap, ostream_p ostream)
+{
+	char buffer[80];
+	ostream_puts(ostream, "offset,line,column,examinations\n");
+	text_buffer_t text_buffer = *heatmap->text_buffer;
+	text_buffer.info = text_buffer.buffer;
+	text_buffer.pos.pos = 0;
+	text_buffer.pos.cur_line = 1;
+	text_buffer.pos.cur_column = 1;
+	for (size_t pos = 0; pos <= text_buffer.buffer_len; pos++)
+	{
+		snprintf(buffer, 80, "%lu,%u,%u,%lu\n", (unsigned long)pos,
+				 text_buffer.pos.cur_line, text_buffer.pos.cur_column, heatmap->examinations[pos]);
+		ostream_puts(ostream, buffer);
+		text_buffer_next(&text_buffer);
+	}
+}
+
+/*	- Function to write the totals, the histogram of the rewind distances
+	  and the given number of hottest regions with the non-terminals that
+	  examined them most */
+
+void heatmap_write_report(heatmap_p heatmap, ostream_p ostream, int nr_hot)
+{
+	char buffer[200];
+	size_t len = heatmap->text_buffer->buffer_len;
+	snprintf(buffer, 200, "examinations: %lu of %lu bytes, re-scan ratio %.2f\n",
+			 heatmap->nr_examinations, (unsigned long)len, heatmap_rescan_ratio(heatmap));
+	ostream_puts(ostream, buffer);
+	snprintf(buffer, 200, "rewinds: %lu, average distance %.2f, maximum distance %lu\n",
+			 heatmap->nr_rewinds,
+			 heatmap->nr_rewinds > 0 ? (double)heatmap->rewind_distance / heatmap->nr_rewinds : 0.0,
+			 (unsigned long)heatmap->max_rewind);
+	ostream_puts(ostream, buffer);
+	for (int i = 0; i < HEATMAP_NR_BUCKETS; i++)
+		if (heatmap->rewind_histogram[i] > 0)
 		{
-			if (!element->add_skip_function(prev_result, &skip_result))
-			{
-				DISP_RESULT(skip_result);
-	            DEBUG_EXIT("parse_rule failed due to add skip function"); DEBUG_NL;
-				EXIT_RESULT_CONTEXT
-				return FALSE;
-			}
+			snprintf(buffer, 200, "  distance %lu-%lu: %lu\n", 1UL << i, (2UL << i) - 1, heatmap->rewind_histogram[i]);
+			ostream_puts(ostream, buffer);
 		}
-		else if (element->add_function != NULL)
+
+	size_t nr_regions = len / HEATMAP_REGION_SIZE + 1;
+	unsigned long *region_counts = MALLOC_N(nr_regions, unsigned long);
+	for (size_t region = 0; region < nr_regions; region++)
+		region_counts[region] = 0;
+	for (size_t pos = 0; pos <= len; pos++)
+		region_counts[pos / HEATMAP_REGION_SIZE] += heatmap->examinations[pos];
+
+	for (int i = 0; i < nr_hot; i++)
+	{
+		/* Select the hottest region that has not been reported */
+		size_t hot = 0;
+		for (size_t region = 1; region < nr_regions; region++)
+			if (region_counts[region] > region_counts[hot])
+				hot = region;
+		if (region_counts[hot] == 0)
+			break;
+		size_t start = hot * HEATMAP_REGION_SIZE;
+		size_t end = start + HEATMAP_REGION_SIZE < len ? start + HEATMAP_REGION_SIZE : len;
+		text_pos_t start_pos = heatmap_text_pos(heatmap, start);
+		text_pos_t end_pos = heatmap_text_pos(heatmap, end);
+		snprintf(buffer, 200, "%u.%u-%u.%u: %lu examinations, %.2f per byte:",
+				 start_pos.cur_line, start_pos.cur_column, end_pos.cur_line, end_pos.cur_column,
+				 region_counts[hot], (double)region_counts[hot] / (end > start ? end - start : 1));
+		ostream_puts(ostream, buffer);
+		region_counts[hot] = 0;
+
+		/* The non-terminals with the most examinations in the region */
+		heatmap_nt_p reported[HEATMAP_NR_NTS];
+		for (int j = 0; j < HEATMAP_NR_NTS; j++)
 		{
-			DECL_RESULT(empty);
-			if (!element->add_function(prev_result, &empty, &skip_result))
+			reported[j] = NULL;
+			for (size_t k = 0; k < heatmap->allocated_nts; k++)
 			{
-				DISP_RESULT(empty);
-				DISP_RESULT(skip_result);
-	            DEBUG_EXIT("parse_rule failed due to add function"); DEBUG_NL;
-				EXIT_RESULT_CONTEXT
-				return FALSE;
+				heatmap_nt_p nt = &heatmap->nts[k];
+				if (nt->name == NULL || nt->region != hot || (reported[j] != NULL && nt->count <= reported[j]->count))
+					continue;
+				bool already_reported = FALSE;
+				for (int l = 0; l < j; l++)
+					if (reported[l] == nt)
+						already_reported = TRUE;
+				if (!already_reported)
+					reported[j] = nt;
 			}
-			DISP_RESULT(empty);
+			if (reported[j] == NULL)
+				break;
+			snprintf(buffer, 200, "%s %s %lu", j == 0 ? "" : ",", reported[j]->name, reported[j]->count);
+			ostream_puts(ostream, buffer);
 		}
-		else
-			result_assign(&skip_result, prev_result);
-			
-		if (parse_rule(parser, element->next, &skip_result, rule, rule_result))
+		ostream_put(ostream, '\n');
+	}
+	FREE(region_counts);
+}
+
+/*
+	Allocation attribution
+	~~~~~~~~~~~~~~~~~~~~~~
+
+	When ALLOC_ATTRIBUTION is defined, the allocations of the data of the
+	results (tagged by SET_TYPE), of the arrays with the children of trees,
+	of the items of the brute force and window caches, and of the tables
+	of the compact cache are attributed to their type and the non-terminal
+	on top of the nt_stack of the parser given to alloc_attribution_start
+	(or, for a cache item or table, the non-terminal it is for). For each combination,
+	the number of allocations and bytes (of the struct), how much of it is
+	still live and the lifetime of the freed allocations are counted. The
+	lifetime (or age) is measured in the number of attributed allocations
+	that were made in between, such that it does not depend on the speed
+	of the machine. When a rule fails, everything that was allocated while
+	parsing it, is counted as wasted by back-tracking. (Some of it could
+	still be used through the cache.) For this, every allocation is
+	recorded, and the failed ranges of allocations are kept on a stack,
+	such that each allocation is counted as wasted at most once.
+	Allocations are only recorded between alloc_attribution_start and
+	alloc_attribution_stop, while freeing them is counted until
+	alloc_attribution_reset. Data from before the start should be freed
+	before the next start. Only the thread that called
+	alloc_attribution_start records allocations, but the data can be freed
+	on any thread, hence the tables are guarded by a mutex (when compiled
+	with USE_THREADS).
+	Not everything is attributed: the slots of the direct mapped and LRU
+	caches are allocated in advance, the items for non-terminals that are
+	being parsed are taken from free lists, and for a typed tree only the
+	fixed part of the struct is counted. The report states these limits.
+*/
+
+#ifdef ALLOC_ATTRIBUTION
+
+typedef struct alloc_site *alloc_site_p;
+struct alloc_site
+{
+	const char *type;
+	const char *nt;
+	unsigned long count;
+	unsigned long bytes;
+	unsigned long live_count;
+	unsigned long live_bytes;
+	unsigned long total_age;       /* Of the freed allocations */
+	unsigned long max_age;
+	unsigned long wasted_count;
+	unsigned long wasted_bytes;
+	alloc_site_p next;
+};
+
+typedef struct
+{
+	alloc_site_p site;
+	size_t size;
+	bool freed;
+} alloc_record_t, *alloc_record_p;
+
+typedef struct
+{
+	unsigned long start;
+	unsigned long end;
+} alloc_range_t;
+
+#define ALLOC_SITES_SIZE 256
+
+THREAD_LOCAL parser_p alloc_parser = NULL;
+THREAD_LOCAL bool alloc_recording = FALSE;
+alloc_site_p alloc_sites[ALLOC_SITES_SIZE];
+alloc_record_p alloc_records = NULL;   /* Record of allocation with sequence number i + 1 */
+unsigned long alloc_nr_records = 0;
+unsigned long alloc_allocated_records = 0;
+alloc_range_t *alloc_wasted = NULL;    /* Stack of disjoint ranges, in increasing order */
+unsigned long alloc_nr_wasted = 0;
+unsigned long alloc_allocated_wasted = 0;
+
+#ifdef USE_THREADS
+pthread_mutex_t alloc_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define ALLOC_LOCK pthread_mutex_lock(&alloc_mutex);
+#define ALLOC_UNLOCK pthread_mutex_unlock(&alloc_mutex);
+#else
+#define ALLOC_LOCK
+#define ALLOC_UNLOCK
+#endif
+
+void alloc_attribution_reset()
+{
+	ALLOC_LOCK
+	for (int i = 0; i < ALLOC_SITES_SIZE; i++)
+		while (alloc_sites[i] != NULL)
 		{
-			DISP_RESULT(skip_result);
-            DEBUG_EXIT("parse_rule = ");
-            DEBUG_PT(rule_result); DEBUG_NL;
-			EXIT_RESULT_CONTEXT
-			return TRUE;
+			alloc_site_p next = alloc_sites[i]->next;
+			FREE(alloc_sites[i]);
+			alloc_sites[i] = next;
 		}
-		DISP_RESULT(skip_result);
+	FREE(alloc_records);
+	FREE(alloc_wasted);
+	alloc_records = NULL;
+	alloc_nr_records = 0;
+	alloc_allocated_records = 0;
+	alloc_wasted = NULL;
+	alloc_nr_wasted = 0;
+	alloc_allocated_wasted = 0;
+	alloc_parser = NULL;
+	alloc_recording = FALSE;
+	ALLOC_UNLOCK
+}
+
+void alloc_attribution_start(parser_p parser)
+{
+	alloc_attribution_reset();
+	alloc_parser = parser;
+	alloc_recording = TRUE;
+}
+
+void alloc_attribution_stop()
+{
+	alloc_recording = FALSE;
+}
+
+unsigned long alloc_attribute(const char *type, const char *nt, size_t size)
+{
+	if (!alloc_recording)
+		return 0;
+	if (nt == NULL)
+		nt = alloc_parser != NULL && alloc_parser->nt_stack != NULL ? alloc_parser->nt_stack->name : "";
+
+	ALLOC_LOCK
+	alloc_site_p *ref_site = &alloc_sites[(POINTER_HASH(type) ^ POINTER_HASH(nt)) % ALLOC_SITES_SIZE];
+	while (*ref_site != NULL && ((*ref_site)->type != type || (*ref_site)->nt != nt))
+		ref_site = &(*ref_site)->next;
+	if (*ref_site == NULL)
+	{
+		alloc_site_p site = MALLOC(struct alloc_site);
+		memset(site, 0, sizeof(struct alloc_site));
+		site->type = type;
+		site->nt = nt;
+		*ref_site = site;
 	}
+	alloc_site_p site = *ref_site;
+	site->count++;
+	site->bytes += size;
+	site->live_count++;
+	site->live_bytes += size;
 
-    DEBUG_EXIT("parse_rule: failed"); DEBUG_NL;
-	EXIT_RESULT_CONTEXT
-	return FALSE;
+	if (alloc_nr_records == alloc_allocated_records)
+	{
+		unsigned long new_allocated_records = alloc_allocated_records == 0 ? 1024 : 2 * alloc_allocated_records;
+		alloc_record_p new_records = MALLOC_N(new_allocated_records, alloc_record_t);
+		for (unsigned long i = 0; i < alloc_nr_records; i++)
+			new_records[i] = alloc_records[i];
+		FREE(alloc_records);
+		alloc_records = new_records;
+		alloc_allocated_records = new_allocated_records;
+	}
+	alloc_record_p record = &alloc_records[alloc_nr_records++];
+	record->site = site;
+	record->size = size;
+	record->freed = FALSE;
+	unsigned long seq = alloc_nr_records;
+	ALLOC_UNLOCK
+	return seq;
 }
 
-bool parse_seq(parser_p parser, element_p element, const result_p prev_seq, const result_p prev, rule_p rule, result_p rule_result)
+void alloc_attribution_free(unsigned long seq)
 {
-	ENTER_RESULT_CONTEXT
-	/* In case of the avoid modifier, first an attempt is made to parse the
-	   remained of the rule */
-	if (element->avoid)
+	if (seq == 0)
+		return;
+	ALLOC_LOCK
+	if (seq > alloc_nr_records || alloc_records[seq - 1].freed)
 	{
-		DECL_RESULT(result);
-		if (element->add_seq_function != NULL && !element->add_seq_function(prev, prev_seq, &result))
-		{
-			DISP_RESULT(result);
-			EXIT_RESULT_CONTEXT
-			return FALSE;
-		}
-		if (parse_rule(parser, element->next, &result, rule, rule_result))
-		{
-			DISP_RESULT(result);
-			EXIT_RESULT_CONTEXT
-			return TRUE;
-		}
-		DISP_RESULT(result);
+		ALLOC_UNLOCK
+		return;
 	}
-	
-	/* Store the current position */
-	text_pos_t sp = parser->text_buffer->pos;
+	alloc_record_p record = &alloc_records[seq - 1];
+	record->freed = TRUE;
+	alloc_site_p site = record->site;
+	site->live_count--;
+	site->live_bytes -= record->size;
+	unsigned long age = alloc_nr_records - seq;
+	site->total_age += age;
+	if (age > site->max_age)
+		site->max_age = age;
+	ALLOC_UNLOCK
+}
 
-	/* If a chain rule is defined, try to parse it.*/
-	bool go = TRUE;
-	if (element->chain_rule != NULL)
+/*	- Functions called around a rule to count what was allocated while
+	  parsing it as wasted, when it fails */
+
+unsigned long alloc_attribution_mark()
+{
+	if (!alloc_recording)
+		return 0;
+	ALLOC_LOCK
+	unsigned long mark = alloc_nr_records;
+	ALLOC_UNLOCK
+	return mark;
+}
+
+void alloc_attribution_waste(unsigned long start, unsigned long end)
+{
+	for (unsigned long i = start; i < end; i++)
 	{
-		DECL_RESULT(dummy_prev_result);
-		DECL_RESULT(dummy_chain_elem);
-		go = parse_rule(parser, element->chain_rule, &dummy_prev_result, NULL, &dummy_chain_elem);
-		DISP_RESULT(dummy_chain_elem);
-		DISP_RESULT(dummy_prev_result);
+		alloc_records[i].site->wasted_count++;
+		alloc_records[i].site->wasted_bytes += alloc_records[i].size;
 	}
-	if (go)
+}
+
+void alloc_attribution_backtrack(unsigned long mark)
+{
+	if (!alloc_recording)
+		return;
+	ALLOC_LOCK
+	unsigned long end = alloc_nr_records;
+	if (mark >= end)
 	{
-		/* Try to parse the next element of the sequence */
-		DECL_RESULT(seq_elem);
-		if (parse_element(parser, element, prev_seq, &seq_elem))
-		{
-			/* If succesful, try to parse the remainder of the sequence (and thereafter the remainder of the rule) */
-			if (parse_seq(parser, element, &seq_elem, prev, rule, rule_result))
-			{
-				DISP_RESULT(seq_elem);
-				EXIT_RESULT_CONTEXT
-				return TRUE;
-			}
-		}
-		DISP_RESULT(seq_elem);
+		ALLOC_UNLOCK
+		return;
 	}
-	
-	/* Failed to parse the next element of the sequence: reset the current position to the saved position. */
-	text_buffer_set_pos(parser->text_buffer, &sp);
 
-	/* In case of the avoid modifier, an attempt to parse the remained of the
-	   rule, was already made. So, only in case of no avoid modifier, attempt
-	   to parse the remainder of the rule */
-	if (!element->avoid)
+	/* Ranges that were wasted before are within this range */
+	unsigned long unwasted_end = end;
+	while (alloc_nr_wasted > 0 && alloc_wasted[alloc_nr_wasted - 1].start >= mark)
 	{
-		DECL_RESULT(result);
-		if (element->add_seq_function != NULL && !element->add_seq_function(prev, prev_seq, &result))
-		{
-			DISP_RESULT(result);
-			EXIT_RESULT_CONTEXT
-			return FALSE;
-		}
-		
-		if (parse_rule(parser, element->next, &result, rule, rule_result))
+		alloc_nr_wasted--;
+		alloc_attribution_waste(alloc_wasted[alloc_nr_wasted].end, unwasted_end);
+		unwasted_end = alloc_wasted[alloc_nr_wasted].start;
+	}
+	alloc_attribution_waste(mark, unwasted_end);
+
+	if (alloc_nr_wasted == alloc_allocated_wasted)
+	{
+		unsigned long new_allocated_wasted = alloc_allocated_wasted == 0 ? 64 : 2 * alloc_allocated_wasted;
+		alloc_range_t *new_wasted = MALLOC_N(new_allocated_wasted, alloc_range_t);
+		for (unsigned long i = 0; i < alloc_nr_wasted; i++)
+			new_wasted[i] = alloc_wasted[i];
+		FREE(alloc_wasted);
+		alloc_wasted = new_wasted;
+		alloc_allocated_wasted = new_allocated_wasted;
+	}
+	alloc_wasted[alloc_nr_wasted].start = mark;
+	alloc_wasted[alloc_nr_wasted].end = end;
+	alloc_nr_wasted++;
+	ALLOC_UNLOCK
+}
+
+/*	- Function to write the counts for each type and non-terminal, sorted
+	  on the number of allocated bytes */
+
+void alloc_attribution_write(ostream_p ostream)
+{
+	ALLOC_LOCK
+	unsigned long nr_sites = 0;
+	for (int i = 0; i < ALLOC_SITES_SIZE; i++)
+		for (alloc_site_p site = alloc_sites[i]; site != NULL; site = site->next)
+			nr_sites++;
+	alloc_site_p *sites = MALLOC_N(nr_sites + 1, alloc_site_p);
+	nr_sites = 0;
+	for (int i = 0; i < ALLOC_SITES_SIZE; i++)
+		for (alloc_site_p site = alloc_sites[i]; site != NULL; site = site->next)
 		{
-			DISP_RESULT(result);
-			EXIT_RESULT_CONTEXT
-			return TRUE;
+			/* Insertion sort */
+			unsigned long j = nr_sites++;
+			for (; j > 0 && sites[j - 1]->bytes < site->bytes; j--)
+				sites[j] = sites[j - 1];
+			sites[j] = site;
 		}
-		DISP_RESULT(result);
+
+	char buffer[300];
+	snprintf(buffer, 300, "%-16s %-24s %9s %11s %9s %11s %9s %9s %9s %11s\n",
+			 "type", "non-terminal", "count", "bytes", "live", "live bytes", "avg age", "max age", "wasted", "wasted bytes");
+	ostream_puts(ostream, buffer);
+	for (unsigned long i = 0; i < nr_sites; i++)
+	{
+		alloc_site_p site = sites[i];
+		unsigned long nr_freed = site->count - site->live_count;
+		snprintf(buffer, 300, "%-16s %-24s %9lu %11lu %9lu %11lu %9.1f %9lu %9lu %11lu\n",
+				 site->type, site->nt, site->count, site->bytes, site->live_count, site->live_bytes,
+				 nr_freed > 0 ? (double)site->total_age / nr_freed : 0.0, site->max_age,
+				 site->wasted_count, site->wasted_bytes);
+		ostream_puts(ostream, buffer);
 	}
-	
-	EXIT_RESULT_CONTEXT
-	return FALSE;
+	ostream_puts(ostream, "(Not attributed: the slots of the direct mapped and LRU caches, the items of\n"
+						  " non-terminals being parsed, and the children of typed trees.)\n");
+	ALLOC_UNLOCK
+	FREE(sites);
 }
 
+#endif
 
 /*
-	Parse an element
-	~~~~~~~~~~~~~~~~
-	
-	The following function is used to parse a part of an element, not dealing
-	with if the element is optional or a sequence.
+	Memory budget
+	~~~~~~~~~~~~~
+
+	A few very large inputs can make the cache and the results use so much
+	memory that the process is killed. A memory budget limits the memory
+	allocated by a parser. While it is active, the bytes allocated on the
+	thread are counted (see budget_malloc). Whenever an element with a
+	non-terminal is parsed, the usage is compared with the limit, and as it approaches the
+	limit, the parser degrades in steps:
+	- Above evict_level, the items in the cache for the positions before
+	  the current position are evicted, if the cache supports this. This
+	  is repeated when the usage has grown with another sixteenth of the
+	  limit since the last eviction.
+	- Above no_memo_level, the cheap non-terminals (see grammar_analyse)
+	  are no longer looked up in (and added to) the cache. When the
+	  grammar was not analysed, no non-terminal is cheap, and this step
+	  has no effect.
+	- Above recognize_level, the parser switches to recognizing only: no
+	  functions for processing results are called anymore. The parse still
+	  tells (approximately, because the checks made by these functions are
+	  skipped, see rk_and) whether the input is correct, but its result is
+	  incomplete.
+	- Above the limit, parsing is abandoned: all non-terminals fail.
+	The degradations that were applied are recorded in the budget. The
+	usage is only counted when compiled with MEMORY_BUDGET, because this
+	adds a header to every allocated block; otherwise no degradations are
+	applied. A block is only subtracted when it is freed while the budget
+	that counted it is active, thus blocks of an outer budget that are freed
+	while an inner budget is active, remain counted by the outer budget.
 */
 
-void expect_element(parser_p parser, element_p element);
+enum memory_degradation_t
+{
+	md_evict = 1,
+	md_no_memo = 2,
+	md_recognize_only = 4,
+	md_abandon = 8
+};
 
-bool parse_element(parser_p parser, element_p element, const result_p prev_result, result_p result)
+struct memory_budget
+{
+	size_t limit;              /* In bytes */
+	double evict_level;        /* Fractions of the limit at which degradations start */
+	double no_memo_level;
+	double recognize_level;
+	size_t used;               /* Bytes allocated while active (and not freed) */
+	size_t peak;               /* Highest usage seen when a non-terminal was parsed */
+	size_t next_evict;
+	unsigned int degradations; /* Applied degradations (memory_degradation_t) */
+	unsigned long nr_evictions;
+	size_t evicted;            /* Bytes freed by evictions */
+	size_t *outer_used;        /* The counter of the thread before it became active */
+	unsigned long outer_generation;
+};
+typedef struct memory_budget memory_budget_t;
+
+void memory_budget_init(memory_budget_p budget, size_t limit)
+{
+	budget->limit = limit;
+	budget->evict_level = 0.6;
+	budget->no_memo_level = 0.75;
+	budget->recognize_level = 0.9;
+	budget->used = 0;
+	budget->peak = 0;
+	budget->next_evict = 0;
+	budget->degradations = 0;
+	budget->nr_evictions = 0;
+	budget->evicted = 0;
+	budget->outer_used = NULL;
+	budget->outer_generation = 0;
+}
+
+/*	- Functions to make the budget active for the parser (and the
+	  allocations on this thread) and to deactivate it */
+
+void memory_budget_start(memory_budget_p budget, parser_p parser)
 {
-	DEBUG_ENTER_P2("parse_element at %d.%d: ", parser->text_buffer->pos.cur_line, parser->text_buffer->pos.cur_column);
-	DEBUG_PR(element); DEBUG_NL;
+	parser->budget = budget;
+#ifdef USE_MEMORY_BUDGET
+	budget->outer_used = malloc_budget_used;
+	budget->outer_generation = malloc_budget_generation;
+	malloc_budget_used = &budget->used;
+	malloc_budget_generation = ++malloc_budget_nr_generations;
+#endif
+}
 
-	ENTER_RESULT_CONTEXT
-	/* Store the current position */
-	text_pos_t sp = parser->text_buffer->pos;
+void memory_budget_stop(memory_budget_p budget, parser_p parser)
+{
+#ifdef USE_MEMORY_BUDGET
+	malloc_budget_used = budget->outer_used;
+	malloc_budget_generation = budget->outer_generation;
+#endif
+	parser->budget = NULL;
+	parser->memo_cheap = TRUE;
+	if ((budget->degradations & md_recognize_only) != 0)
+		parser->recognize_only--;
+}
 
-	switch( element->kind )
+/*	- Function that applies the degradations for the current usage. It
+	  returns FALSE when parsing is abandoned. */
+
+bool memory_budget_check(parser_p parser)
+{
+	memory_budget_p budget = parser->budget;
+	if ((budget->degradations & md_abandon) != 0)
+		return FALSE;
+	size_t used = budget->used;
+	if (used > budget->peak)
+		budget->peak = used;
+	if (used < budget->evict_level * budget->limit)
+		return TRUE;
+
+	if (used >= budget->limit)
 	{
-		case rk_nt:
-			{
-				/* Parse the non-terminal */
-				DECL_RESULT(nt_result)
-				if (!parse_nt(parser, element->info.non_terminal, &nt_result))
-				{
-					DISP_RESULT(nt_result)
-					EXIT_RESULT_CONTEXT
-					DEBUG_EXIT("parse_element failed due to add skip function"); DEBUG_NL;
-					return FALSE;
-				}
-				
-				/* If there is a condition, evaluate the result */
-				if (element->condition != 0 && !(*element->condition)(&nt_result, element->condition_argument))
-				{
-					DISP_RESULT(nt_result)
-					text_buffer_set_pos(parser->text_buffer, &sp);
-					EXIT_RESULT_CONTEXT
-					DEBUG_EXIT("parse_element failed due to condition function"); DEBUG_NL;
-					return FALSE;
-				}
-				
-				/* Combine the result with the previous result */
-				if (element->add_function == 0)
-					result_assign(result, prev_result);
-				else if (!(*element->add_function)(prev_result, &nt_result, result))
-				{
-					DISP_RESULT(nt_result)
-					text_buffer_set_pos(parser->text_buffer, &sp);
-					EXIT_RESULT_CONTEXT
-					DEBUG_EXIT("parse_element failed due to add function"); DEBUG_NL;
-					return FALSE;
-				}
-				DISP_RESULT(nt_result)
-			}
-			break;
-		case rk_grouping:
-			{
-				/* Try all rules in the grouping */
-				DECL_RESULT(rule_result);
-				rule_p rule = element->info.rules;
-				for ( ; rule != NULL; rule = rule->next )
-				{
-					DECL_RESULT(start);
-					if (element->add_function == 0)
-						result_assign(&start, prev_result);
-					if (parse_rule(parser, rule->elements, &start, rule, &rule_result))
-					{
-						DISP_RESULT(start);
-						break;
-					}
-					DISP_RESULT(start);
-				}
-				if (rule == NULL)
-				{
-					/* Non of the rules worked */
-					DISP_RESULT(rule_result)
-					EXIT_RESULT_CONTEXT
-					DEBUG_EXIT("parse_element failed due to no rules parsed"); DEBUG_NL;
-					return FALSE;
-				}
-				
-				/* Combine the result of the rule with the previous result */
-				if (element->add_function == 0)
-					result_assign(result, &rule_result);
-				else if (!(*element->add_function)(prev_result, &rule_result, result))
-				{
-					DISP_RESULT(rule_result)
-					text_buffer_set_pos(parser->text_buffer, &sp);
-					EXIT_RESULT_CONTEXT
-					DEBUG_EXIT("parse_element failed due to add function"); DEBUG_NL;
-					return FALSE;
-				}
-				DISP_RESULT(rule_result)
-			}
-			break;
-		case rk_end:
-			/* Check if the end of the buffer is reached */
-			if (!text_buffer_end(parser->text_buffer))
-			{
-				expect_element(parser, element);
-				EXIT_RESULT_CONTEXT
-				DEBUG_EXIT("parse_element failed due to accept end"); DEBUG_NL;
-				return FALSE;
-			}
-			result_assign(result, prev_result);
-			break;
-		case rk_char:
-			/* Check if the specified character is found at the current position in the text buffer */
-			if (*parser->text_buffer->info != element->info.ch)
-			{
-				expect_element(parser, element);
-				EXIT_RESULT_CONTEXT
-				DEBUG_EXIT_P1("parse_element failed due to accept char '%c'", element->info.ch); DEBUG_NL;
-				return FALSE;
-			}
-			/* Advance the current position of the text buffer */
-			text_buffer_next(parser->text_buffer);
-			/* Process the character */
-			if (element->add_char_function == 0)
-				result_assign(result, prev_result);
-			else if (!(*element->add_char_function)(prev_result, element->info.ch, result))
+		budget->degradations |= md_abandon;
+		return FALSE;
+	}
+	if (used >= budget->next_evict && parser->cache_evict_function != NULL)
+	{
+		parser->cache_evict_function(parser->cache, parser->text_buffer->pos.pos, parser->nt_stack);
+		if (budget->used < used)
+			budget->evicted += used - budget->used;
+		budget->nr_evictions++;
+		budget->degradations |= md_evict;
+		budget->next_evict = budget->used + budget->limit / 16;
+	}
+	if (used >= budget->no_memo_level * budget->limit && parser->memo_cheap)
+	{
+		parser->memo_cheap = FALSE;
+		budget->degradations |= md_no_memo;
+	}
+	if (used >= budget->recognize_level * budget->limit && (budget->degradations & md_recognize_only) == 0)
+	{
+		parser->recognize_only++;
+		budget->degradations |= md_recognize_only;
+	}
+	return TRUE;
+}
+
+void memory_budget_write_report(memory_budget_p budget, ostream_p ostream)
+{
+	char buffer[200];
+	snprintf(buffer, 200, "memory budget: limit %lu bytes, peak %lu bytes, degradations:",
+			 (unsigned long)budget->limit, (unsigned long)budget->peak);
+	ostream_puts(ostream, buffer);
+	if (budget->degradations == 0)
+		ostream_puts(ostream, " none");
+	if ((budget->degradations & md_evict) != 0)
+	{
+		snprintf(buffer, 200, " evicted cache (%lu times, %lu bytes)", budget->nr_evictions, (unsigned long)budget->evicted);
+		ostream_puts(ostream, buffer);
+	}
+	if ((budget->degradations & md_no_memo) != 0)
+		ostream_puts(ostream, " no-memo-cheap");
+	if ((budget->degradations & md_recognize_only) != 0)
+		ostream_puts(ostream, " recognize-only");
+	if ((budget->degradations & md_abandon) != 0)
+		ostream_puts(ostream, " abandoned");
+	ostream_put(ostream, '\n');
+}
+
+/*	- Function to evict the solutions of the brute force cache at positions
+	  before the given position, except for those of the non-terminals that
+	  are being parsed, because their cache items are still in use */
+
+void solutions_evict(void *cache, size_t pos, nt_stack_p nt_stack)
+{
+	solutions_p solutions = (solutions_p)cache;
+	if (pos > solutions->len)
+		pos = solutions->len;
+	for (size_t i = 0; i < pos; i++)
+	{
+		solution_p *ref_sol = &solutions->sols[i];
+		while (*ref_sol != NULL)
+		{
+			solution_p sol = *ref_sol;
+			bool in_use = FALSE;
+			for (nt_stack_p entry = nt_stack; entry != NULL && !in_use; entry = entry->parent)
+				in_use = entry->pos.pos == i && entry->name == sol->nt;
+			if (in_use)
+				ref_sol = &sol->next;
+			else
 			{
-				EXIT_RESULT_CONTEXT
-				DEBUG_EXIT("parse_element failed due to add char function"); DEBUG_NL;
-				return FALSE;
+				*ref_sol = sol->next;
+				cache_item_release(&sol->cache_item);
+				solutions->stats.nr_items--;
+				solutions->stats.evictions++;
+				ALLOC_FREE(sol)
+				FREE(sol);
 			}
-			break;
-		case rk_charset:
-			/* Check if the character at the current position in the text buffer is found in the character set */
-			if (!char_set_contains(element->info.char_set, *parser->text_buffer->info))
+		}
+	}
+}
+
+/*	- Function to evict the successes of the compact cache at positions
+	  before the given position. (The non-terminals that are being parsed
+	  have no successes at their positions yet.) The hash tables shrink
+	  to the size needed for the remaining successes. The failure bits are
+	  kept, because they take a fixed amount of memory. */
+
+void compact_memo_evict(void *cache, size_t pos, nt_stack_p nt_stack)
+{
+	(void)nt_stack;
+	compact_memo_p memo = (compact_memo_p)cache;
+	for (size_t i = 0; i < memo->nts_size; i++)
+	{
+		compact_memo_nt_p memo_nt = &memo->nts[i];
+		if (memo_nt->nt == NULL || memo_nt->nr_successes == 0)
+			continue;
+		size_t nr_kept = 0;
+		for (size_t j = 0; j < memo_nt->size; j++)
+			if (memo_nt->successes[j].pos > pos)
+				nr_kept++;
+		if (nr_kept == memo_nt->nr_successes)
+			continue;
+
+		compact_success_p old_successes = memo_nt->successes;
+		size_t old_size = memo_nt->size;
+		memo_nt->size = 16;
+		while (2 * (nr_kept + 1) > memo_nt->size)
+			memo_nt->size *= 2;
+		memo_nt->successes = MALLOC_N(memo_nt->size, struct compact_success);
+		for (size_t j = 0; j < memo_nt->size; j++)
+			memo_nt->successes[j].pos = 0;
+		for (size_t j = 0; j < old_size; j++)
+			if (old_successes[j].pos > pos)
+				*compact_memo_nt_find_success(memo_nt, old_successes[j].pos - 1) = old_successes[j];
+			else if (old_successes[j].pos != 0)
 			{
-				expect_element(parser, element);
-				EXIT_RESULT_CONTEXT
-				DEBUG_EXIT("parse_element failed due to add charset"); DEBUG_NL;
-				return FALSE;
+				RESULT_RELEASE(&old_successes[j].result);
+				parse_error_list_free(old_successes[j].errors);
+				memo->stats.nr_items--;
+				memo->stats.evictions++;
 			}
+		memo_nt->nr_successes = nr_kept;
+		ALLOC_FREE_SEQ(memo_nt->successes_seq)
+		ALLOC_ATTRIBUTE_ARRAY("successes", memo_nt->nt, memo_nt->successes_seq, memo_nt->successes, memo_nt->size)
+		FREE(old_successes);
+	}
+}
+
+/*
+	Generating random sentences
+	~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+	To measure the performance of the parser on large inputs for any
+	grammar, the generator below produces random sentences by walking the
+	grammar, using a xorshift random number generator with a given seed,
+	such that the same sentences are produced on every machine. Rules are
+	chosen with weights (given by an optional function), optional elements
+	are included and sequences are continued with given probabilities, and
+	left-recursive rules are applied with a given probability. The
+	sequences in the rules of the start non-terminal are continued until
+	the text has the requested size. When an element of such a sequence
+	is larger than the element size (or the text is larger than the size)
+	or the maximum depth is reached, the generator closes the element by
+	choosing the rules with the shortest derivation (as calculated by
+	generator_init), and by skipping optional elements.
+
+	Because the parser is greedy, not every derivation is parsed as
+	intended. For example, an identifier immediately followed by another
+	identifier, is parsed as one identifier. Hence, when a sequence ends
+	or an optional element is skipped, the next character may not be a
+	character with which the element could continue. The same holds for
+	the not predicates (such as those following a keyword), while the and
+	predicates require that the next character could start them. When a
+	character is generated that violates this, the generator tries another
+	rule (at most GEN_ATTEMPTS times at each choice). When such a check
+	is pending, optional elements are included, to separate the tokens.
+	Elements with a condition (such as the one that an identifier is not a
+	keyword) are generated and then parsed to check the condition. In the
+	same way, each element of a sequence of the start non-terminal is
+	parsed, and generated again when it fails. Finally, the sentence is
+	parsed, and when it fails, a new sentence is generated (at most
+	max_tries times). User defined terminal scan functions cannot be
+	generated.
+*/
+
+#define GEN_ATTEMPTS 3
+#define GEN_MAX_PENDING 8
+#define GEN_INFINITE_DEPTH 1000000
+
+typedef struct
+{
+	unsigned long long seed;
+	size_t size;             /* The size of the text to aim for */
+	size_t element_size;     /* The size to aim for of each element filling it */
+	int max_depth;           /* Depth of non-terminals from which to close */
+	double opt_probability;  /* Probability of including an optional element */
+	double seq_continue;     /* Probability of continuing a sequence */
+	int max_seq_len;
+	double rec_probability;  /* Probability of applying a left-recursive rule */
+	unsigned int (*rule_weight)(non_terminal_p nt, rule_p rule, void *data);
+	void *rule_weight_data;
+	int max_tries;           /* Number of sentences to try before giving up */
+	unsigned long max_steps; /* Number of elements to generate for a sentence */
+} generator_options_t, *generator_options_p;
+
+void generator_options_init(generator_options_p options)
+{
+	options->seed = 1;
+	options->size = 0;
+	options->element_size = 200;
+	options->max_depth = 40;
+	options->opt_probability = 0.5;
+	options->seq_continue = 0.5;
+	options->max_seq_len = 5;
+	options->rec_probability = 0.3;
+	options->rule_weight = 0;
+	options->rule_weight_data = NULL;
+	options->max_tries = 20;
+	options->max_steps = 10000000;
+}
+
+enum gen_check_t { gen_cannot_start, gen_must_start };
+
+typedef struct
+{
+	element_p element;
+	enum gen_check_t check;
+} gen_pending_t;
+
+typedef struct
+{
+	size_t len;
+	bool ended;              /* Whether the end of input element was generated */
+	size_t pending_pos;      /* The position to which the pending checks apply */
+	int nr_pending;
+	gen_pending_t pending[GEN_MAX_PENDING];
+} gen_state_t;
+
+typedef struct
+{
+	generator_options_t options;
+	unsigned long long random;
+	char *text;              /* The generated text (terminated with a null character) */
+	size_t allocated;
+	gen_state_t state;
+	size_t close_pos;        /* The length from which the generator closes */
+	int depth;
+	unsigned long steps;
+	int nr_tries;            /* The number of sentences tried for the last call */
+} generator_t, *generator_p;
+
+/*	- Function to calculate the minimal depth of the derivations */
+
+int gen_rules_min_depth(rule_p rules);
+
+int gen_element_min_depth(element_p element)
+{
+	if (element->optional)
+		return 0;
+	if (element->kind == rk_nt)
+		return element->info.non_terminal->min_depth + 1;
+	if (element->kind == rk_grouping)
+		return gen_rules_min_depth(element->info.rules);
+	return 0;
+}
+
+int gen_rule_min_depth(rule_p rule)
+{
+	int depth = 0;
+	for (element_p element = rule->elements; element != NULL; element = element->next)
+	{
+		int element_depth = gen_element_min_depth(element);
+		if (element_depth > depth)
+			depth = element_depth;
+	}
+	return depth < GEN_INFINITE_DEPTH ? depth : GEN_INFINITE_DEPTH;
+}
+
+int gen_rules_min_depth(rule_p rules)
+{
+	int depth = GEN_INFINITE_DEPTH;
+	for (rule_p rule = rules; rule != NULL; rule = rule->next)
+	{
+		int rule_depth = gen_rule_min_depth(rule);
+		if (rule_depth < depth)
+			depth = rule_depth;
+	}
+	return depth;
+}
+
+void generator_init(generator_p gen, non_terminal_dict_p all_nt, generator_options_p options)
+{
+	gen->options = *options;
+	gen->random = options->seed != 0 ? options->seed : 1;
+	gen->allocated = 1000;
+	gen->text = MALLOC_N(gen->allocated, char);
+	gen->text[0] = '\0';
+	gen->state.len = 0;
+	gen->nr_tries = 0;
+
+	for (non_terminal_dict_p nt_dict = all_nt; nt_dict != NULL; nt_dict = nt_dict->next)
+		nt_dict->elem.min_depth = GEN_INFINITE_DEPTH;
+	for (bool changed = TRUE; changed;)
+	{
+		changed = FALSE;
+		for (non_terminal_dict_p nt_dict = all_nt; nt_dict != NULL; nt_dict = nt_dict->next)
+		{
+			int depth = gen_rules_min_depth(nt_dict->elem.normal);
+			if (depth < nt_dict->elem.min_depth)
 			{
-				/* Remember the character and advance the current position of the text buffer */
-				char ch = *parser->text_buffer->info;
-				text_buffer_next(parser->text_buffer);
-				/* Process the character */
-				if (element->add_char_function == 0)
-					result_assign(result, prev_result);
-				else if (!(*element->add_char_function)(prev_result, ch, result))
-				{
-					EXIT_RESULT_CONTEXT
-					DEBUG_EXIT("parse_element failed due to add char function"); DEBUG_NL;
-					return FALSE;
-				}
+				nt_dict->elem.min_depth = depth;
+				changed = TRUE;
 			}
-			break;
-		case rk_term:
-			/* Call the terminal parse function and see if it has parsed something */
+		}
+	}
+}
+
+void generator_free(generator_p gen)
+{
+	FREE(gen->text);
+}
+
+/*	- Functions for random numbers (xorshift64*) */
+
+unsigned long long gen_random(generator_p gen)
+{
+	gen->random ^= gen->random >> 12;
+	gen->random ^= gen->random << 25;
+	gen->random ^= gen->random >> 27;
+	return gen->random * 0x2545F4914F6CDD1DULL;
+}
+
+unsigned long gen_random_below(generator_p gen, unsigned long n)
+{
+	return n > 0 ? (unsigned long)((gen_random(gen) >> 11) % n) : 0;
+}
+
+bool gen_chance(generator_p gen, double probability)
+{
+	return (double)(gen_random(gen) >> 11) < probability * (double)(1ULL << 53);
+}
+
+bool gen_closing(generator_p gen)
+{
+	return gen->state.len >= gen->close_pos || gen->depth >= gen->options.max_depth;
+}
+
+/*	- Functions for the checks on the next character */
+
+enum gen_starts_t { gen_no, gen_yes, gen_unknown };
+
+enum gen_starts_t gen_element_starts(element_p element, byte ch);
+
+enum gen_starts_t gen_rules_start(rule_p rules, byte ch)
+{
+	enum gen_starts_t result = gen_no;
+	for (rule_p rule = rules; rule != NULL; rule = rule->next)
+		for (element_p element = rule->elements; element != NULL; element = element->next)
+		{
+			enum gen_starts_t starts = gen_element_starts(element, ch);
+			if (starts == gen_yes)
+				return gen_yes;
+			if (starts == gen_unknown)
+				result = gen_unknown;
+			if (!element->optional)
+				break;
+		}
+	return result;
+}
+
+enum gen_starts_t gen_element_starts(element_p element, byte ch)
+{
+	switch (element->kind)
+	{
+		case rk_char:
+			return (byte)element->info.ch == ch ? gen_yes : gen_no;
+		case rk_charset:
+			return char_set_contains(element->info.char_set, ch) ? gen_yes : gen_no;
+		case rk_cpset:
+			if (ch < 128)
+				return char_set_contains(&element->info.code_point_set->ascii, ch) ? gen_yes : gen_no;
+			return element->info.code_point_set->nr_ranges > 0 ? gen_unknown : gen_no;
+		case rk_nt:
 			{
-				const char *next_pos = element->info.terminal_function(parser->text_buffer->info, result);
-				/* If the start position is returned, assume that it failed. */
-				if (next_pos <= parser->text_buffer->info)
-				{
-					expect_element(parser, element);
-					EXIT_RESULT_CONTEXT
-					DEBUG_EXIT("parse_element failed due to parse terminal function"); DEBUG_NL;
-					return FALSE;
-				}
-				/* Increment the buffer till the returned position */
-				while (parser->text_buffer->info < next_pos)
-					text_buffer_next(parser->text_buffer);
+				non_terminal_p nt = element->info.non_terminal;
+				if (nt->first == NULL || nt->nullable)
+					return gen_rules_start(nt->normal, ch);
+				return char_set_contains(nt->first, ch) ? gen_yes : gen_no;
 			}
-			break;
+		case rk_grouping:
+		case rk_and:
+		case rk_not:
+			return gen_rules_start(element->info.rules, ch);
+		case rk_end:
+			return gen_no;
 		default:
-			EXIT_RESULT_CONTEXT
-			DEBUG_EXIT("parse_element failed due to unknown element"); DEBUG_NL;
-			return FALSE;
-			break;
+			return gen_unknown;
 	}
-	
-	/* Set the position on the result */
-	if (element->set_pos != NULL)
-		element->set_pos(result, &sp);
+}
 
-	EXIT_RESULT_CONTEXT
-	DEBUG_EXIT("parse_element succeeded "); /*print_result(result);*/ DEBUG_NL;
-	return TRUE;
+void gen_add_check(generator_p gen, element_p element, enum gen_check_t check)
+{
+	gen_state_t *state = &gen->state;
+	if (state->pending_pos != state->len)
+	{
+		state->pending_pos = state->len;
+		state->nr_pending = 0;
+	}
+	if (state->nr_pending < GEN_MAX_PENDING)
+	{
+		state->pending[state->nr_pending].element = element;
+		state->pending[state->nr_pending].check = check;
+		state->nr_pending++;
+	}
 }
 
+bool gen_checks_pending(generator_p gen)
+{
+	return gen->state.nr_pending > 0 && gen->state.pending_pos == gen->state.len;
+}
 
-/*
-	Brute force cache
-	~~~~~~~~~~~~~~~~~
-	
-	A simple cache implementation, is one that simply stores all results for
-	all positions in the input text.
+/*	- Function to add a character to the text. Returns FALSE if it
+	  violates one of the pending checks */
 
-*/
+bool gen_put(generator_p gen, char ch)
+{
+	gen_state_t *state = &gen->state;
+	if (state->ended)
+		return FALSE;
+	if (gen_checks_pending(gen))
+	{
+		for (int i = 0; i < state->nr_pending; i++)
+		{
+			enum gen_starts_t starts = gen_element_starts(state->pending[i].element, ch);
+			if (state->pending[i].check == gen_cannot_start ? starts == gen_yes : starts == gen_no)
+				return FALSE;
+		}
+		state->nr_pending = 0;
+	}
+	if (state->len + 2 > gen->allocated)
+	{
+		size_t new_allocated = 2 * gen->allocated;
+		char *new_text = MALLOC_N(new_allocated, char);
+		for (size_t i = 0; i < state->len; i++)
+			new_text[i] = gen->text[i];
+		FREE(gen->text);
+		gen->text = new_text;
+		gen->allocated = new_allocated;
+	}
+	gen->text[state->len++] = ch;
+	gen->text[state->len] = '\0';
+	return TRUE;
+}
 
-typedef struct solution *solution_p;
-struct solution
+void gen_restore(generator_p gen, gen_state_t *state)
 {
-	cache_item_t cache_item;
-	const char *nt;
-	solution_p next;
-};
-typedef struct
+	gen->state = *state;
+	gen->text[state->len] = '\0';
+}
+
+/*	- Function to choose a printable character (if possible) from a set */
+
+bool gen_put_from_char_set(generator_p gen, char_set_p char_set)
 {
-	solution_p *sols;        /* Array of solutions at locations */
-	size_t len;              /* Length of array (equal to length of input) */
-} solutions_t, *solutions_p;
+	byte chars[256];
+	int nr_chars = 0;
+	for (int ch = ' '; ch < 127; ch++)
+		if (char_set_contains(char_set, ch))
+			chars[nr_chars++] = ch;
+	if (nr_chars == 0)
+		for (int ch = 1; ch < 256; ch++)
+			if (char_set_contains(char_set, ch))
+				chars[nr_chars++] = ch;
+	if (nr_chars == 0)
+		return FALSE;
+	return gen_put(gen, chars[gen_random_below(gen, nr_chars)]);
+}
 
+bool gen_put_code_point(generator_p gen, unsigned long cp)
+{
+	if (cp < 0x80)
+		return gen_put(gen, (char)cp);
+	if (cp < 0x800)
+		return gen_put(gen, (char)(0xC0 | (cp >> 6))) && gen_put(gen, (char)(0x80 | (cp & 0x3F)));
+	if (cp < 0x10000)
+		return    gen_put(gen, (char)(0xE0 | (cp >> 12))) && gen_put(gen, (char)(0x80 | ((cp >> 6) & 0x3F)))
+			   && gen_put(gen, (char)(0x80 | (cp & 0x3F)));
+	return    gen_put(gen, (char)(0xF0 | (cp >> 18))) && gen_put(gen, (char)(0x80 | ((cp >> 12) & 0x3F)))
+		   && gen_put(gen, (char)(0x80 | ((cp >> 6) & 0x3F))) && gen_put(gen, (char)(0x80 | (cp & 0x3F)));
+}
 
-void solutions_init(solutions_p solutions, text_buffer_p text_buffer)
+bool gen_put_from_code_point_set(generator_p gen, code_point_set_p code_point_set)
 {
-    solutions->len = text_buffer->buffer_len;
-	solutions->sols = MALLOC_N(solutions->len+1, solution_p);
-	size_t i;
-	for (i = 0; i < solutions->len+1; i++)
-		solutions->sols[i] = NULL;
+	/* Mostly ASCII characters, as most texts consist of these */
+	bool has_ascii = FALSE;
+	for (int i = 0; i < 16; i++)
+		if (code_point_set->ascii.bitvec[i] != 0)
+			has_ascii = TRUE;
+	if (has_ascii && (code_point_set->nr_ranges == 0 || gen_random_below(gen, 8) != 0))
+		return gen_put_from_char_set(gen, &code_point_set->ascii);
+	if (code_point_set->nr_ranges == 0)
+		return FALSE;
+	code_point_range_p range = &code_point_set->ranges[gen_random_below(gen, code_point_set->nr_ranges)];
+	unsigned long cp = range->from + gen_random_below(gen, range->to - range->from + 1);
+	if (0xD800 <= cp && cp <= 0xDFFF)
+		cp = range->from;
+	return gen_put_code_point(gen, cp);
 }
 
-void solutions_free(solutions_p solutions)
+/*	- Function to check the condition of an element on the generated text
+	  from the given position */
+
+bool gen_check_condition(generator_p gen, element_p element, size_t start)
 {
-	size_t i;
-	for (i = 0; i < solutions->len+1; i++)
-	{	solution_p sol = solutions->sols[i];
+	ENTER_RESULT_CONTEXT
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, gen->text + start);
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	DECL_RESULT(result)
+	bool holds =    parse_nt(&parser, element->info.non_terminal, &result)
+				 && text_buffer_end(&text_buffer)
+				 && (*element->condition)(&result, element->condition_argument);
+	DISP_RESULT(result)
+	EXIT_RESULT_CONTEXT
+	return holds;
+}
 
-		while (sol != NULL)
-		{	if (sol->cache_item.result.dec != 0)
-		    	sol->cache_item.result.dec(sol->cache_item.result.data);
-			solution_p next_sol = sol->next;
-		    FREE(sol);
-			sol = next_sol;
+/*	- Function to check that an element generated from the given position
+	  is parsed on its own */
+
+bool gen_check_element(element_p element, const char *text)
+{
+	if (element->kind != rk_nt && element->kind != rk_grouping)
+		return TRUE;
+	ENTER_RESULT_CONTEXT
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, text);
+	solutions_t solutions;
+	solutions_init(&solutions, &text_buffer);
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	parser.cache_hit_function = solutions_find;
+	parser.cache = &solutions;
+	DECL_RESULT(result)
+	bool parsed = FALSE;
+	if (element->kind == rk_nt)
+		parsed = parse_nt(&parser, element->info.non_terminal, &result);
+	else
+		for (rule_p rule = element->info.rules; rule != NULL && !parsed; rule = rule->next)
+		{
+			DECL_RESULT(start)
+			parsed = parse_rule(&parser, rule->elements, &start, rule, &result);
+			DISP_RESULT(start)
 		}
-  	}
-	FREE(solutions->sols);
+	parsed = parsed && text_buffer_end(&text_buffer);
+	DISP_RESULT(result)
+	EXIT_RESULT_CONTEXT
+	solutions_free(&solutions);
+	return parsed;
+}
+
+/*	- Functions to generate derivations */
+
+bool gen_nt(generator_p gen, non_terminal_p nt);
+bool gen_rules(generator_p gen, rule_p rules, non_terminal_p nt);
+bool gen_elements(generator_p gen, element_p element, non_terminal_p nt);
+
+bool gen_element_once(generator_p gen, element_p element, non_terminal_p nt)
+{
+	if (++gen->steps > gen->options.max_steps)
+		return FALSE;
+	switch (element->kind)
+	{
+		case rk_nt:
+			{
+				size_t start = gen->state.len;
+				if (!gen_nt(gen, element->info.non_terminal))
+					return FALSE;
+				return element->condition == 0 || gen_check_condition(gen, element, start);
+			}
+		case rk_grouping:
+			return gen_rules(gen, element->info.rules, nt);
+		case rk_char:
+			return gen_put(gen, element->info.ch);
+		case rk_charset:
+			return gen_put_from_char_set(gen, element->info.char_set);
+		case rk_cpset:
+			return gen_put_from_code_point_set(gen, element->info.code_point_set);
+		case rk_end:
+			gen->state.ended = TRUE;
+			return TRUE;
+		case rk_until:
+			{
+				/* Some letters and spaces, which do not contain the delimiter */
+				int len = gen_closing(gen) ? 0 : gen_random_below(gen, 10);
+				for (int i = 0; i < len; i++)
+				{
+					char ch = gen_random_below(gen, 4) == 0 ? ' ' : 'a' + gen_random_below(gen, 26);
+					if (ch == element->info.until.delimiter[0] || ch == element->info.until.escape)
+						ch = ' ';
+					if (!gen_put(gen, ch))
+						return FALSE;
+				}
+				return TRUE;
+			}
+		case rk_and:
+			gen_add_check(gen, element, gen_must_start);
+			return TRUE;
+		case rk_not:
+			gen_add_check(gen, element, gen_cannot_start);
+			return TRUE;
+		default:
+			return FALSE;
+	}
 }
 
-cache_item_p solutions_find(void *cache, size_t pos, const char *nt)
-{
-	solutions_p solutions = (solutions_p)cache;
-	solution_p sol;
-
-	if (pos > solutions->len)
-		pos = solutions->len;
-
-	for (sol = solutions->sols[pos]; sol != NULL; sol = sol->next)
-		if (sol->nt == nt)
-		 	return &sol->cache_item;
+/*	- Function to continue a sequence of the start non-terminal up to the
+	  size. Each element is checked on its own, and generated again when
+	  it fails, such that a large sentence is not lost due to one element
+	  that is not parsed as intended. Returns the number of elements. */
 
-	sol = MALLOC(struct solution);
-	sol->next = solutions->sols[pos];
-	sol->nt = nt;
-	sol->cache_item.success = s_unknown;
-	RESULT_INIT(&sol->cache_item.result);
-	solutions->sols[pos] = sol;
-	return &sol->cache_item;
+int gen_fill(generator_p gen, element_p element, non_terminal_p nt)
+{
+	int nr = 0;
+	for (int failures = 0; failures < (nr == 0 ? gen->options.max_tries : GEN_ATTEMPTS) && gen->steps <= gen->options.max_steps;)
+	{
+		if (nr > 0 && gen->state.len >= gen->options.size)
+			break;
+		gen_state_t state = gen->state;
+		gen->close_pos = gen->state.len + gen->options.element_size;
+		if (gen->close_pos > gen->options.size)
+			gen->close_pos = gen->options.size;
+		bool generated = nr == 0 || element->chain_rule == NULL || gen_elements(gen, element->chain_rule, nt);
+		size_t start = gen->state.len;
+		if (   generated && gen_element_once(gen, element, nt) && gen->state.len > start
+			&& gen_check_element(element, gen->text + start))
+		{
+			nr++;
+			failures = 0;
+		}
+		else
+		{
+			gen_restore(gen, &state);
+			failures++;
+		}
+	}
+	gen->close_pos = gen->options.size;
+	return nr;
 }
 
-/*
-	White space tests
-	~~~~~~~~~~~~~~~~~
-*/
-
-void test_parse_white_space(non_terminal_dict_p *all_nt, const char *input)
+bool gen_element(generator_p gen, element_p element, non_terminal_p nt)
 {
-	ENTER_RESULT_CONTEXT
-
-	text_buffer_t text_buffer;
-	text_buffer_assign_string(&text_buffer, input);
-	
-	solutions_t solutions;
-	solutions_init(&solutions, &text_buffer);
-	
-	parser_t parser;
-	parser_init(&parser, &text_buffer);
-	parser.cache_hit_function = solutions_find;
-	parser.cache = &solutions;
-	
-	DECL_RESULT(result);
-	if (parse_nt(&parser, find_nt("white_space", all_nt), &result) && text_buffer_end(&text_buffer))
+	int nr = 1;
+	if (element->sequence && gen->depth == 1 && gen->options.size > 0)
 	{
-		fprintf(stderr, "OK: parsed white space\n");
+		nr = gen_fill(gen, element, nt);
+		if (nr == 0 && !element->optional)
+			return FALSE;
 	}
 	else
 	{
-		fprintf(stderr, "ERROR: failed to parse white space from '%s'\n", input);
+		if (element->optional)
+			nr = (gen_checks_pending(gen) || gen_chance(gen, gen->options.opt_probability)) && !gen_closing(gen) ? 1 : 0;
+		if (element->sequence && nr > 0)
+			while (nr < gen->options.max_seq_len && !gen_closing(gen) && gen_chance(gen, gen->options.seq_continue))
+				nr++;
+		for (int i = 0; i < nr; i++)
+		{
+			if (i > 0 && element->chain_rule != NULL && !gen_elements(gen, element->chain_rule, nt))
+				return FALSE;
+			size_t start = gen->state.len;
+			if (!gen_element_once(gen, element, nt))
+				return FALSE;
+			/* An empty element does not continue a sequence */
+			if (element->sequence && gen->state.len == start)
+				return FALSE;
+		}
 	}
-	DISP_RESULT(result);
-
-	solutions_free(&solutions);
 
-	EXIT_RESULT_CONTEXT
+	/* The parser continues with a sequence or an optional element, when it can */
+	if ((element->sequence && !element->back_tracking) || (element->optional && nr == 0 && !element->avoid))
+		gen_add_check(gen, element, gen_cannot_start);
+	return TRUE;
 }
 
-void test_white_space_grammar(non_terminal_dict_p *all_nt)
+bool gen_elements(generator_p gen, element_p element, non_terminal_p nt)
 {
-	test_parse_white_space(all_nt, " ");
-	test_parse_white_space(all_nt, "/* */");
+	for (; element != NULL; element = element->next)
+		if (!gen_element(gen, element, nt))
+			return FALSE;
+	return TRUE;
 }
 
-/*
-	Number tests
-	~~~~~~~~~~~~
-*/
+rule_p gen_choose_rule(generator_p gen, rule_p rules, non_terminal_p nt)
+{
+	if (gen_closing(gen))
+	{
+		rule_p shortest = NULL;
+		int shortest_depth = GEN_INFINITE_DEPTH + 1;
+		for (rule_p rule = rules; rule != NULL; rule = rule->next)
+		{
+			int depth = gen_rule_min_depth(rule);
+			if (depth < shortest_depth || (depth == shortest_depth && gen_random_below(gen, 2) == 0))
+			{
+				shortest = rule;
+				shortest_depth = depth;
+			}
+		}
+		return shortest;
+	}
+	unsigned long total = 0;
+	for (rule_p rule = rules; rule != NULL; rule = rule->next)
+		total += gen->options.rule_weight != 0 ? gen->options.rule_weight(nt, rule, gen->options.rule_weight_data) : 1;
+	if (total == 0)
+		return NULL;
+	unsigned long choice = gen_random_below(gen, total);
+	for (rule_p rule = rules; rule != NULL; rule = rule->next)
+	{
+		unsigned long weight = gen->options.rule_weight != 0 ? gen->options.rule_weight(nt, rule, gen->options.rule_weight_data) : 1;
+		if (choice < weight)
+			return rule;
+		choice -= weight;
+	}
+	return NULL;
+}
 
-void test_parse_number(non_terminal_dict_p *all_nt, const char *input, int num)
+bool gen_rules(generator_p gen, rule_p rules, non_terminal_p nt)
 {
-	ENTER_RESULT_CONTEXT
-	text_buffer_t text_buffer;
-	text_buffer_assign_string(&text_buffer, input);
-	
-	solutions_t solutions;
-	solutions_init(&solutions, &text_buffer);
-	
-	parser_t parser;
-	parser_init(&parser, &text_buffer);
-	parser.cache_hit_function = solutions_find;
-	parser.cache = &solutions;
-	
-	DECL_RESULT(result);
-	if (parse_nt(&parser, find_nt("number", all_nt), &result) && text_buffer_end(&text_buffer))
+	gen_state_t state = gen->state;
+	for (int attempt = 0; attempt < GEN_ATTEMPTS; attempt++)
 	{
-		if (result.data == NULL)
-			fprintf(stderr, "ERROR: parsing '%s' did not return result\n", input);
-		else if (CAST(number_data_p, result.data)->num != num)
-			fprintf(stderr, "ERROR: parsed value %ld from '%s' instead of expected %d\n",
-				CAST(number_data_p, result.data)->num, input, num);
-		else
-			fprintf(stderr, "OK: parsed value %ld from '%s'\n", CAST(number_data_p, result.data)->num, input);
+		rule_p rule = gen_choose_rule(gen, rules, nt);
+		if (rule == NULL)
+			return FALSE;
+		if (gen_elements(gen, rule->elements, nt))
+			return TRUE;
+		gen_restore(gen, &state);
 	}
-	else
-		fprintf(stderr, "ERROR: failed to parse number from '%s'\n", input);
-	DISP_RESULT(result);
+	return FALSE;
+}
 
-	solutions_free(&solutions);
-	EXIT_RESULT_CONTEXT
+bool gen_nt(generator_p gen, non_terminal_p nt)
+{
+	gen->depth++;
+	bool generated = gen_rules(gen, nt->normal, nt);
+	while (generated && nt->recursive != NULL && !gen_closing(gen) && gen_chance(gen, gen->options.rec_probability))
+	{
+		gen_state_t state = gen->state;
+		if (!gen_rules(gen, nt->recursive, nt))
+		{
+			gen_restore(gen, &state);
+			break;
+		}
+	}
+	gen->depth--;
+	return generated;
 }
 
-void test_number_grammar(non_terminal_dict_p *all_nt)
+/*	- Function to generate a sentence that is parsed by the non-terminal.
+	  Returns FALSE if none was found in the maximum number of tries. */
+
+bool generate_sentence(generator_p gen, non_terminal_p nt)
 {
-	test_parse_number(all_nt, "0", 0);
-	test_parse_number(all_nt, "123", 123);
+	for (gen->nr_tries = 1; gen->nr_tries <= gen->options.max_tries; gen->nr_tries++)
+	{
+		gen->state.len = 0;
+		gen->state.ended = FALSE;
+		gen->state.nr_pending = 0;
+		gen->state.pending_pos = 0;
+		gen->text[0] = '\0';
+		gen->close_pos = gen->options.size;
+		gen->depth = 0;
+		gen->steps = 0;
+		if (!gen_nt(gen, nt))
+			continue;
+
+		text_buffer_t text_buffer;
+		text_buffer_assign_string(&text_buffer, gen->text);
+		solutions_t solutions;
+		solutions_init(&solutions, &text_buffer);
+		parser_t parser;
+		parser_init(&parser, &text_buffer);
+		parser.cache_hit_function = solutions_find;
+		parser.cache = &solutions;
+		ENTER_RESULT_CONTEXT
+		DECL_RESULT(result)
+		bool parsed = parse_nt(&parser, nt, &result) && text_buffer_end(&text_buffer);
+		DISP_RESULT(result)
+		EXIT_RESULT_CONTEXT
+		solutions_free(&solutions);
+		if (parsed)
+			return TRUE;
+	}
+	return FALSE;
 }
 
 /*
-	Abstract Syntax Tree
-	~~~~~~~~~~~~~~~~~~~~
-	The following section of the code implements a representation for
-	Abstract Syntax Trees.
+	Searching for slow inputs
+	~~~~~~~~~~~~~~~~~~~~~~~~~
+
+	Some inputs make a back-tracking parser explode, for example nested
+	brackets that could both be a cast and an expression. To find these
+	before they are encountered in production, the search below mutates
+	inputs to maximize the number of examinations (the calls of
+	parse_element counted by the heatmap) per byte of input. It starts
+	with a number of small sentences from the generator and repeatedly
+	mutates an input from its corpus: inserting or replacing the tokens
+	that occur in the grammar (the characters of the rules, with the
+	keywords as one token), deleting or duplicating a part, or inserting
+	a part of another input. A mutated input is added to the corpus when
+	it is slower per byte than the slowest input so far, or when it covers
+	a new feature: a non-terminal together with the logarithm of the
+	number of examinations in it. Each parse has a budget of examinations,
+	such that an exploding input ends quickly (and scores the budget). At
+	the end, the slowest input is minimized by deleting parts of it, as
+	long as that does not make it faster per byte. The report gives the
+	minimized input with the non-terminals in which most examinations
+	took place.
 */
 
+#define SLOW_MAX_TOKENS 256
+#define SLOW_MAX_TOKEN_LEN 15
+#define SLOW_MAX_CORPUS 256
+#define SLOW_FEATURES_SIZE 4096
+#define SLOW_NR_NTS 5
+
 typedef struct
 {
-	ref_counted_base_t _base;
-	const char *type_name;
-	unsigned int line;
-	unsigned int column;
-} tree_node_t, *tree_node_p;
+	unsigned long long seed;
+	int nr_seeds;                    /* Number of sentences to start with */
+	size_t seed_size;                /* Size of these sentences */
+	size_t max_len;                  /* Maximum length of the inputs */
+	unsigned long nr_runs;           /* Number of mutated inputs to try */
+	unsigned long max_examinations;  /* Budget for parsing one input */
+	bool use_cache;                  /* Whether to parse with the brute force cache */
+} slow_search_options_t, *slow_search_options_p;
+
+void slow_search_options_init(slow_search_options_p options)
+{
+	options->seed = 1;
+	options->nr_seeds = 10;
+	options->seed_size = 20;
+	options->max_len = 64;
+	options->nr_runs = 2000;
+	options->max_examinations = 100000;
+	options->use_cache = FALSE;
+}
 
-void init_tree_node(tree_node_p tree_node, const char *type_name, void (*release_node)(void *))
+typedef struct
 {
-	tree_node->_base.cnt = 1;
-	tree_node->_base.release = release_node;
-	tree_node->type_name = type_name;
-	tree_node->line = 0;
-	tree_node->column = 0;
-}
+	char *text;
+	size_t len;
+	unsigned long examinations;
+} slow_input_t, *slow_input_p;
 
-void tree_node_set_pos(tree_node_p tree_node, text_pos_p ps)
+typedef struct
 {
-	tree_node->line = ps->cur_line;
-	tree_node->column = ps->cur_column;
-}
+	const char *name;                /* NULL, when not used */
+	unsigned long count;
+} slow_nt_t, *slow_nt_p;
 
-typedef struct tree_t *tree_p;
-struct tree_t
+typedef struct
 {
-	tree_node_t _node;
-	const char *tree_name;
-	unsigned int nr_children;
-	result_t *children;
-};
+	slow_search_options_t options;
+	non_terminal_p nt;
+	generator_t generator;           /* For the seeds and the random numbers */
+	char *tokens[SLOW_MAX_TOKENS];
+	int nr_tokens;
+	slow_input_t corpus[SLOW_MAX_CORPUS];
+	int nr_corpus;
+	struct { const char *name; int bucket; } features[SLOW_FEATURES_SIZE];
+	int nr_features;
+	slow_input_t slowest;
+	slow_nt_t nts[SLOW_NR_NTS];      /* The non-terminals of the slowest input */
+	unsigned long nr_runs;
+} slow_search_t, *slow_search_p;
+
+double slow_input_ratio(slow_input_p input)
+{
+	return (double)input->examinations / (double)(input->len > 0 ? input->len : 1);
+}
 
-tree_p old_trees = NULL;
-long alloced_trees = 0L;
+/*	- Functions to collect the tokens from the rules */
 
-void release_tree(void *data)
+void slow_search_add_token(slow_search_p search, const char *token, int len)
 {
-	tree_p tree = CAST(tree_p, data);
+	for (int i = 0; i < search->nr_tokens; i++)
+		if (strncmp(search->tokens[i], token, len) == 0 && search->tokens[i][len] == '\0')
+			return;
+	if (search->nr_tokens == SLOW_MAX_TOKENS)
+		return;
+	char *new_token = MALLOC_N(len + 1, char);
+	strncpy(new_token, token, len);
+	new_token[len] = '\0';
+	search->tokens[search->nr_tokens++] = new_token;
+}
 
-	alloced_trees--;
+void slow_search_add_tokens_of_rules(slow_search_p search, rule_p rules);
 
-	if (tree->nr_children > 0)
+void slow_search_add_tokens_of_elements(slow_search_p search, element_p element)
+{
+	char token[SLOW_MAX_TOKEN_LEN];
+	int len = 0;
+	for (; element != NULL; element = element->next)
 	{
-		for (int i = 0; i < tree->nr_children; i++)
-			RESULT_RELEASE(&tree->children[i]);
-		FREE(tree->children);
+		if (element->kind == rk_char && element->info.ch != '\0' && !element->optional && !element->sequence)
+		{
+			if (len == SLOW_MAX_TOKEN_LEN)
+			{
+				slow_search_add_token(search, token, len);
+				len = 0;
+			}
+			token[len++] = element->info.ch;
+			continue;
+		}
+		if (len > 0)
+			slow_search_add_token(search, token, len);
+		len = 0;
+		if (element->kind == rk_char && element->info.ch != '\0')
+			slow_search_add_token(search, &element->info.ch, 1);
+		else if (element->kind == rk_grouping || element->kind == rk_and || element->kind == rk_not)
+			slow_search_add_tokens_of_rules(search, element->info.rules);
+		if (element->chain_rule != NULL)
+			slow_search_add_tokens_of_elements(search, element->chain_rule);
 	}
-	*(tree_p*)tree = old_trees;
-	old_trees = tree;
+	if (len > 0)
+		slow_search_add_token(search, token, len);
 }
 
-const char *tree_node_type = "tree_node_type";
-
-tree_p malloc_tree(const char *name)
+void slow_search_add_tokens_of_rules(slow_search_p search, rule_p rules)
 {
-	tree_p new_tree;
+	for (rule_p rule = rules; rule != NULL; rule = rule->next)
+		slow_search_add_tokens_of_elements(search, rule->elements);
+}
 
-	if (old_trees)
-	{   new_tree = old_trees;
-		old_trees = *(tree_p*)old_trees;
+void slow_search_init(slow_search_p search, non_terminal_dict_p all_nt, non_terminal_p nt, slow_search_options_p options)
+{
+	search->options = *options;
+	search->nt = nt;
+	generator_options_t generator_options;
+	generator_options_init(&generator_options);
+	generator_options.seed = options->seed;
+	generator_options.size = options->seed_size;
+	generator_options.max_tries = 5;
+	generator_init(&search->generator, all_nt, &generator_options);
+	search->nr_tokens = 0;
+	for (non_terminal_dict_p nt_dict = all_nt; nt_dict != NULL; nt_dict = nt_dict->next)
+	{
+		slow_search_add_tokens_of_rules(search, nt_dict->elem.normal);
+		slow_search_add_tokens_of_rules(search, nt_dict->elem.recursive);
 	}
-	else
-		new_tree = MALLOC(struct tree_t);
-
-	init_tree_node(&new_tree->_node, tree_node_type, release_tree);
-	new_tree->tree_name = name;
-	new_tree->nr_children = 0;
-	new_tree->children = NULL;
-	
-	alloced_trees++;
-
-	return new_tree;
+	search->nr_corpus = 0;
+	for (int i = 0; i < SLOW_FEATURES_SIZE; i++)
+		search->features[i].name = NULL;
+	search->nr_features = 0;
+	search->slowest.text = NULL;
+	search->slowest.len = 0;
+	search->slowest.examinations = 0;
+	for (int i = 0; i < SLOW_NR_NTS; i++)
+		search->nts[i].name = NULL;
+	search->nr_runs = 0;
 }
 
-typedef struct prev_child_t *prev_child_p;
-struct prev_child_t
+void slow_search_free(slow_search_p search)
 {
-	ref_counted_base_t _base;
-	prev_child_p prev;
-	result_t child;
-};
+	generator_free(&search->generator);
+	for (int i = 0; i < search->nr_tokens; i++)
+		FREE(search->tokens[i]);
+	for (int i = 0; i < search->nr_corpus; i++)
+		FREE(search->corpus[i].text);
+	FREE(search->slowest.text);
+}
 
-prev_child_p old_prev_child = NULL;
+/*	- Function to add a feature. Returns whether it is new */
 
-void release_prev_child( void *data )
+bool slow_search_add_feature(slow_search_p search, const char *name, int bucket)
 {
-	prev_child_p prev_child = CAST(prev_child_p, data);
-	RESULT_RELEASE(&prev_child->child);
-	if (prev_child != NULL)
-		ref_counted_base_dec(prev_child);
-	FREE(prev_child);
+	size_t i = ((size_t)name * 0x9E3779B1UL + bucket) & (SLOW_FEATURES_SIZE - 1);
+	while (search->features[i].name != NULL)
+	{
+		if (search->features[i].name == name && search->features[i].bucket == bucket)
+			return FALSE;
+		i = (i + 1) & (SLOW_FEATURES_SIZE - 1);
+	}
+	/* Keep the table at most three quarters full */
+	if (4 * (search->nr_features + 1) > 3 * SLOW_FEATURES_SIZE)
+		return FALSE;
+	search->features[i].name = name;
+	search->features[i].bucket = bucket;
+	search->nr_features++;
+	return TRUE;
 }
 
-prev_child_p malloc_prev_child()
+/*	- Function to parse an input (terminated with a null character) with
+	  the heatmap. Returns the number of examinations. When nts is not
+	  NULL, the non-terminals with the most examinations are returned in
+	  it. When new_feature is not NULL, it is set to whether a new feature
+	  was covered. */
+
+unsigned long slow_search_parse(slow_search_p search, const char *text, slow_nt_p nts, bool *new_feature)
 {
-	prev_child_p new_prev_child = MALLOC(struct prev_child_t);
-	new_prev_child->_base.cnt = 1;
-	new_prev_child->_base.release = release_prev_child;
-	RESULT_INIT(&new_prev_child->child);
-	new_prev_child->prev = NULL;
-	return new_prev_child;
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, text);
+	solutions_t solutions;
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	if (search->options.use_cache)
+	{
+		solutions_init(&solutions, &text_buffer);
+		parser.cache_hit_function = solutions_find;
+		parser.cache = &solutions;
+	}
+	heatmap_t heatmap;
+	heatmap_init(&heatmap, &text_buffer);
+	heatmap.max_examinations = search->options.max_examinations;
+	heatmap_p prev_heatmap = parse_heatmap;
+	parse_heatmap = &heatmap;
+	ENTER_RESULT_CONTEXT
+	DECL_RESULT(result)
+	parse_nt(&parser, search->nt, &result);
+	DISP_RESULT(result)
+	EXIT_RESULT_CONTEXT
+	parse_heatmap = prev_heatmap;
+	if (search->options.use_cache)
+		solutions_free(&solutions);
+
+	/* Total the examinations over the regions for each non-terminal */
+	slow_nt_p totals = MALLOC_N(heatmap.nr_nts + 1, slow_nt_t);
+	size_t nr_totals = 0;
+	for (size_t i = 0; i < heatmap.allocated_nts; i++)
+		if (heatmap.nts[i].name != NULL)
+		{
+			size_t j = 0;
+			while (j < nr_totals && totals[j].name != heatmap.nts[i].name)
+				j++;
+			if (j == nr_totals)
+			{
+				totals[nr_totals].name = heatmap.nts[i].name;
+				totals[nr_totals++].count = 0;
+			}
+			totals[j].count += heatmap.nts[i].count;
+		}
+	if (new_feature != NULL)
+	{
+		*new_feature = FALSE;
+		for (size_t j = 0; j < nr_totals; j++)
+		{
+			int bucket = 0;
+			while ((totals[j].count >> bucket) > 1)
+				bucket++;
+			if (slow_search_add_feature(search, totals[j].name, bucket))
+				*new_feature = TRUE;
+		}
+	}
+	if (nts != NULL)
+		for (int i = 0; i < SLOW_NR_NTS; i++)
+		{
+			size_t max = 0;
+			for (size_t j = 1; j < nr_totals; j++)
+				if (totals[j].count > totals[max].count)
+					max = j;
+			nts[i].name = NULL;
+			if (max < nr_totals && totals[max].count > 0)
+			{
+				nts[i] = totals[max];
+				totals[max].count = 0;
+			}
+		}
+	FREE(totals);
+
+	unsigned long examinations = heatmap.nr_examinations;
+	heatmap_release(&heatmap);
+	return examinations;
 }
 
-void prev_child_print(void *data, ostream_p ostream)
+/*	- Function to add a copy of an input to the corpus (replacing a random
+	  one when it is full) */
+
+void slow_search_add_to_corpus(slow_search_p search, const char *text, size_t len, unsigned long examinations)
 {
-	ostream_puts(ostream, "prev_child[ ");
-	prev_child_p prev_child = prev_child != NULL ? CAST(prev_child_p, data) : NULL;
-	for (; prev_child != NULL; prev_child = prev_child->prev)
-	{
-		if (prev_child->child.data == NULL || prev_child->child.print == NULL)
-			ostream_puts(ostream, "NULL");
-		else
-			prev_child->child.print(prev_child->child.data, ostream);
-		printf(" ");
+	int i = search->nr_corpus;
+	if (search->nr_corpus < SLOW_MAX_CORPUS)
+		search->nr_corpus++;
+	else
+	{
+		i = gen_random_below(&search->generator, SLOW_MAX_CORPUS);
+		FREE(search->corpus[i].text);
 	}
-	ostream_puts(ostream, "]");
+	search->corpus[i].text = MALLOC_N(len + 1, char);
+	strcpy(search->corpus[i].text, text);
+	search->corpus[i].len = len;
+	search->corpus[i].examinations = examinations;
 }
 
+/*	- Function to parse an input and add it to the corpus when it is
+	  interesting */
 
-bool add_child(result_p prev, result_p elem, result_p result)
+void slow_search_try(slow_search_p search, const char *text, size_t len)
 {
-	prev_child_p prev_child = CAST(prev_child_p, prev->data);
-	if (prev_child != NULL)
-		ref_counted_base_inc(prev_child);
-	prev_child_p new_prev_child = malloc_prev_child();
-	new_prev_child->prev = prev_child;
-	result_assign(&new_prev_child->child, elem);
-	result_assign_ref_counted(result, new_prev_child, prev_child_print);
-	SET_TYPE("prev_child_p", new_prev_child);
-	return TRUE;
+	search->nr_runs++;
+	bool new_feature;
+	slow_input_t input;
+	input.len = len;
+	input.examinations = slow_search_parse(search, text, NULL, &new_feature);
+	bool slowest = search->slowest.text == NULL || slow_input_ratio(&input) > slow_input_ratio(&search->slowest);
+	if (slowest)
+	{
+		FREE(search->slowest.text);
+		search->slowest.text = MALLOC_N(len + 1, char);
+		strcpy(search->slowest.text, text);
+		search->slowest.len = len;
+		search->slowest.examinations = input.examinations;
+	}
+	if (slowest || new_feature)
+		slow_search_add_to_corpus(search, text, len, input.examinations);
 }
 
-bool rec_add_child(result_p rec_result, result_p result)
+/*	- Function to mutate an input into the buffer (of at least max_len + 1
+	  characters). Returns the new length. */
+
+size_t slow_search_mutate(slow_search_p search, const char *text, size_t len, char *buffer)
 {
-	prev_child_p new_prev_child = malloc_prev_child();
-	new_prev_child->prev = NULL;
-	result_assign(&new_prev_child->child, rec_result);
-	result_assign_ref_counted(result, new_prev_child, prev_child_print);
-	SET_TYPE("prev_child_p", new_prev_child);
-	return TRUE;
+	generator_p gen = &search->generator;
+	size_t max_len = search->options.max_len;
+	if (len > max_len)
+		len = max_len;
+	strncpy(buffer, text, len);
+	int nr_mutations = 1 + gen_random_below(gen, 4);
+	for (int m = 0; m < nr_mutations; m++)
+	{
+		size_t pos = gen_random_below(gen, len + 1);
+		const char *part = NULL;
+		size_t part_len = 0;
+		switch (gen_random_below(gen, 5))
+		{
+			case 0:
+				/* Insert a token */
+				if (search->nr_tokens > 0)
+				{
+					part = search->tokens[gen_random_below(gen, search->nr_tokens)];
+					part_len = strlen(part);
+				}
+				break;
+			case 1:
+				/* Replace a character by a token */
+				if (pos < len && search->nr_tokens > 0)
+					buffer[pos] = search->tokens[gen_random_below(gen, search->nr_tokens)][0];
+				break;
+			case 2:
+				/* Delete a part */
+				if (pos < len)
+				{
+					size_t del_len = 1 + gen_random_below(gen, len - pos < 4 ? len - pos : 4);
+					for (size_t i = pos; i + del_len < len; i++)
+						buffer[i] = buffer[i + del_len];
+					len -= del_len;
+				}
+				break;
+			case 3:
+				/* Duplicate a part (which nests brackets deeper) */
+				if (pos < len)
+				{
+					part = buffer + pos;
+					part_len = 1 + gen_random_below(gen, len - pos < 8 ? len - pos : 8);
+				}
+				break;
+			case 4:
+				/* Insert a part of another input */
+				{
+					slow_input_p other = &search->corpus[gen_random_below(gen, search->nr_corpus)];
+					if (other->len > 0)
+					{
+						size_t from = gen_random_below(gen, other->len);
+						part = other->text + from;
+						part_len = 1 + gen_random_below(gen, other->len - from);
+					}
+				}
+				break;
+		}
+		if (part != NULL && len + part_len <= max_len)
+		{
+			char copy[8];
+			if (part >= buffer && part < buffer + max_len + 1)
+			{
+				/* A duplicated part is copied, because the insertion moves it */
+				for (size_t i = 0; i < part_len; i++)
+					copy[i] = part[i];
+				part = copy;
+			}
+			for (size_t i = len; i > pos; i--)
+				buffer[i - 1 + part_len] = buffer[i - 1];
+			for (size_t i = 0; i < part_len; i++)
+				buffer[pos + i] = part[i];
+			len += part_len;
+		}
+	}
+	buffer[len] = '\0';
+	return len;
 }
 
-bool take_child(result_p prev, result_p elem, result_p result)
+/*	- Function to minimize the slowest input, by deleting parts (from
+	  large to single characters) as long as the examinations per byte do
+	  not decrease */
+
+void slow_search_minimize(slow_search_p search)
 {
-	result_assign(result, elem);
-	return TRUE;
+	slow_input_p slowest = &search->slowest;
+	char *buffer = MALLOC_N(slowest->len + 1, char);
+	for (size_t del_len = slowest->len / 2; del_len > 0; del_len /= 2)
+		for (size_t pos = 0; pos + del_len <= slowest->len;)
+		{
+			size_t len = 0;
+			for (size_t i = 0; i < slowest->len; i++)
+				if (i < pos || i >= pos + del_len)
+					buffer[len++] = slowest->text[i];
+			buffer[len] = '\0';
+			slow_input_t input;
+			input.len = len;
+			input.examinations = slow_search_parse(search, buffer, NULL, NULL);
+			if (len > 0 && slow_input_ratio(&input) >= slow_input_ratio(slowest))
+			{
+				strcpy(slowest->text, buffer);
+				slowest->len = len;
+				slowest->examinations = input.examinations;
+			}
+			else
+				pos++;
+		}
+	FREE(buffer);
+	slow_search_parse(search, slowest->text, search->nts, NULL);
 }
 
-tree_p make_tree_with_children(const char* name, prev_child_p children)
+/*	- Function to search for the slowest input. Returns FALSE if no
+	  input could be generated to start with. */
+
+bool slow_search(slow_search_p search)
 {
-	tree_p tree = malloc_tree(name);
-	prev_child_p child;
-	int i = 0;
-	for (child = children; child != NULL; child = child->prev)
-		i++;
-	tree->nr_children = i;
-	tree->children = MALLOC_N(tree->nr_children, result_t);
-	for (child = children; child != NULL; child = child->prev)
+	for (int i = 0; i < search->options.nr_seeds; i++)
+		if (generate_sentence(&search->generator, search->nt) && search->generator.state.len <= search->options.max_len)
+			slow_search_try(search, search->generator.text, search->generator.state.len);
+	if (search->nr_corpus == 0)
+		return FALSE;
+
+	char *buffer = MALLOC_N(search->options.max_len + 1, char);
+	for (unsigned long run = 0; run < search->options.nr_runs; run++)
 	{
-		i--;
-		RESULT_INIT(&tree->children[i]);
-		result_assign(&tree->children[i], &child->child);
+		/* Mutate the slowest input half of the time */
+		slow_input_p input = gen_random_below(&search->generator, 2) == 0
+						   ? &search->slowest
+						   : &search->corpus[gen_random_below(&search->generator, search->nr_corpus)];
+		size_t len = slow_search_mutate(search, input->text, input->len, buffer);
+		slow_search_try(search, buffer, len);
 	}
-	return tree;
+	FREE(buffer);
+	slow_search_minimize(search);
+	return TRUE;
 }
 
-void tree_print(void *data, ostream_p ostream)
+/*	- Function to write a text as the contents of a C string */
+
+void ostream_put_c_string(ostream_p ostream, const char *text, size_t len)
 {
-	tree_p tree = CAST(tree_p, data);
-	if (tree->_node.type_name != NULL)
-		ostream_puts(ostream, tree->tree_name);
-	ostream_put(ostream, '(');
-	for (int i = 0; i < tree->nr_children; i++)
+	char buffer[10];
+	for (size_t i = 0; i < len; i++)
 	{
-		if (i > 0)
-			ostream_put(ostream, ',');
-		result_print(&tree->children[i], ostream);
+		char ch = text[i];
+		if (ch == '"' || ch == '\\')
+			ostream_put(ostream, '\\');
+		if (ch == '\n')
+			ostream_puts(ostream, "\\n");
+		else if (ch == '\t')
+			ostream_puts(ostream, "\\t");
+		else if ((byte)ch < ' ')
+		{
+			snprintf(buffer, 10, "\\%03o", (byte)ch);
+			ostream_puts(ostream, buffer);
+		}
+		else
+			ostream_put(ostream, ch);
 	}
-	ostream_put(ostream, ')');
 }
 
-bool make_tree(const result_p rule_result, void* data, result_p result)
-{
-	prev_child_p children = CAST(prev_child_p, rule_result->data);
-	const char *name = (const char*)data;
-	tree_p tree = make_tree_with_children(name, children);
-	result_assign_ref_counted(result, tree, tree_print);
-	SET_TYPE("tree_p", tree);
-	return TRUE;
-}
+/*	- Function to write the slowest input (as a C string) and the
+	  non-terminals in which most examinations took place */
 
-bool pass_tree(const result_p rule_result, void* data, result_p result)
+void slow_search_write_report(slow_search_p search, ostream_p ostream)
 {
-	prev_child_p child = CAST(prev_child_p, rule_result->data);
-	result_transfer(result, &child->child);
-	return TRUE;
+	char buffer[200];
+	slow_input_p slowest = &search->slowest;
+	snprintf(buffer, 200, "slowest input (%lu bytes, %lu examinations, %.2f per byte%s, %lu runs): \"",
+			 (unsigned long)slowest->len, slowest->examinations, slow_input_ratio(slowest),
+			 slowest->examinations >= search->options.max_examinations ? ", budget exhausted" : "",
+			 search->nr_runs);
+	ostream_puts(ostream, buffer);
+	ostream_put_c_string(ostream, slowest->text, slowest->len);
+	ostream_puts(ostream, "\"\nnon-terminals:");
+	for (int i = 0; i < SLOW_NR_NTS && search->nts[i].name != NULL; i++)
+	{
+		snprintf(buffer, 200, "%s %s %lu", i == 0 ? "" : ",", search->nts[i].name, search->nts[i].count);
+		ostream_puts(ostream, buffer);
+	}
+	ostream_put(ostream, '\n');
 }
 
-
 /*
-	Keywords
-	~~~~~~~~
-	Many programming languages have keywords, which have the same lexical
-	catagory as identifiers. This means we need some function to test
-	whether an identifier is equal to one of the keywords. One way to
-	do this is to use hexadecimal hash tree. This can also be used to map
-	every identifier to a unique pointer, such that comparing two identifiers
-	can simply be done by comparing the two pointers.
+	Grammar linter
+	~~~~~~~~~~~~~~
 
-	A hexadecimal hash tree
-	~~~~~~~~~~~~~~~~~~~~~~~	
-	The following structure implements a mapping of strings to an integer
-	value in the range [0..254]. It is a tree of hashs in combination with
-	a very fast incremental hash function. In this way, it tries to combine
-	the benefits of trees and hashs. The incremental hash function will first
-	return the lower 4 bits of the characters in the string, and following
-	this the higher 4 bits of the characters.
+	Some performance hazards can be seen in the grammar itself, without
+	parsing any input. The linter walks over all rules and reports them
+	with their location (the non-terminal, and the numbers of the rules
+	and the elements within it) and an estimate of what they may cost:
+	- A sequence of an element that can be parsed from the empty string
+	  (without a chain rule that consumes characters) never terminates,
+	  because the parser does not check that the position advanced.
+	- A back-tracking sequence tries the remainder of the rule after every
+	  number of elements. When its elements contain another back-tracking
+	  sequence, the number of attempts multiplies with each level of
+	  nesting. Nesting through recursion is unbounded.
+	- A rule is never used when an earlier rule of the same non-terminal
+	  or grouping always succeeds, or when the elements of an earlier rule
+	  are a prefix of its elements. (End functions are assumed to succeed.)
+	- An element that should be avoided, is first skipped and only parsed
+	  when the remainder of the rule fails. When it starts with the same
+	  characters as the remainder, the remainder is often partially parsed
+	  in vain. Only the FIRST set of the remainder of the rule is used, not
+	  the FOLLOW set of the non-terminal: when the remainder can be empty,
+	  an overlap with what follows the non-terminal is not reported.
+	- A non-terminal that can only be reached from the start non-terminal
+	  through back-tracking sequences or avoided elements, is parsed again
+	  for every attempt these make.
+	Like the grammar analysis, it over-approximates: conditions and
+	functions that make parsing fail are not taken into account.
 */
 
-typedef struct hexa_hash_tree_t hexa_hash_tree_t, *hexa_hash_tree_p;
-
-struct hexa_hash_tree_t
-{	byte state;
-	union
-	{	char *string;
-		hexa_hash_tree_p *children;
-	} data;
+enum lint_hazard_t
+{
+	lint_nullable_sequence,
+	lint_nested_back_tracking,
+	lint_shadowed_rule,
+	lint_avoid_overlap,
+	lint_expensive_path,
+	lint_nr_hazards
 };
 
-byte *keyword_state = NULL;
-
-char *ident_string(char *s)
-/*  Returns a unique address representing the string. the global
-    keyword_state will point to the integer value in the range [0..254].
-	If the string does not occure in the store, it is added and the state
-	is initialized with 0.
-*/
+const char *lint_hazard_names[lint_nr_hazards] =
 {
-	static hexa_hash_tree_p hash_tree = NULL;
-	hexa_hash_tree_p *r_node = &hash_tree;
-	char *vs = s;
-	int depth;
-	int mode = 0;
-
-	for (depth = 0; ; depth++)
-	{   hexa_hash_tree_p node = *r_node;
+	"nullable sequence",
+	"nested back-tracking",
+	"shadowed rule",
+	"avoid overlap",
+	"expensive path"
+};
 
-		if (node == NULL)
-		{   node = MALLOC(hexa_hash_tree_t);
-			node->state = 0;
-			STRCPY(node->data.string, s);
-			*r_node = node;
-			keyword_state = &node->state;
-			return node->data.string;
-		}
+/* Depths above this are reported as unbounded */
+#define LINT_MAX_DEPTH 8
 
-		if (node->state != 255)
-		{   char *cs = node->data.string;
-			hexa_hash_tree_p *children;
-			unsigned short i, v = 0;
+typedef struct lint *lint_p;
+typedef struct lint lint_t;
+struct lint
+{
+	ostream_p ostream;
+	int nr_nts;
+	non_terminal_p *nts;
+	int *depth;         /* Per non-terminal: nesting of back-tracking sequences */
+	int *cost;          /* Per non-terminal: back-tracking constructs on the cheapest path from start (or -1) */
+	bool changed;
+	int nr_hazards[lint_nr_hazards];
+};
 
-			if (*cs == *s && strcmp(cs+1, s+1) == 0)
-			{   keyword_state = &node->state;
-				return node->data.string;
-			}
+int lint_nt_index(lint_p lint, non_terminal_p nt)
+{
+	for (int i = 0; i < lint->nr_nts; i++)
+		if (lint->nts[i] == nt)
+			return i;
+	return -1;
+}
 
-			children = MALLOC_N(16, hexa_hash_tree_t*);
-			for (i = 0; i < 16; i++)
-				children[i] = NULL;
+void lint_report(lint_p lint, enum lint_hazard_t hazard, const char *location, const char *description, const char *estimate)
+{
+	lint->nr_hazards[hazard]++;
+	if (lint->ostream == NULL)
+		return;
+	ostream_puts(lint->ostream, lint_hazard_names[hazard]);
+	ostream_puts(lint->ostream, ": ");
+	ostream_puts(lint->ostream, location);
+	ostream_puts(lint->ostream, ": ");
+	ostream_puts(lint->ostream, description);
+	ostream_puts(lint->ostream, " [");
+	ostream_puts(lint->ostream, estimate);
+	ostream_puts(lint->ostream, "]\n");
+}
 
-			i = strlen(cs);
-			if (depth <= i)
-				v = ((byte)cs[depth]) & 15;
-			else if (depth <= i*2)
-				v = ((byte)cs[depth-i-1]) >> 4;
+/*	- Function that adds the first characters of a single element (ignoring
+	  whether it is optional or a sequence) and returns whether it can be
+	  empty */
 
-			children[v] = node;
+bool lint_element_first(element_p element, char_set_p first)
+{
+	struct element single = *element;
+	single.optional = FALSE;
+	single.next = NULL;
+	return element_add_first(&single, first);
+}
 
-			node = MALLOC(hexa_hash_tree_t);
-			node->state = 255;
-			node->data.children = children;
-			*r_node = node;
-		}
-		{   unsigned short v;
-			if (*vs == '\0')
-			{   v = 0;
-				if (mode == 0)
-				{   mode = 1;
-					vs = s;
-				}
-			}
-			else if (mode == 0)
-				v = ((unsigned short)*vs++) & 15;
-			else
-				v = ((unsigned short)*vs++) >> 4;
+void lint_char_set_clear(char_set_p char_set)
+{
+	for (int i = 0; i < 32; i++)
+		char_set->bitvec[i] = 0;
+}
 
-			r_node = &node->data.children[v];
-		}
-	}
+bool lint_char_sets_overlap(char_set_p char_set, char_set_p other)
+{
+	for (int i = 0; i < 32; i++)
+		if ((char_set->bitvec[i] & other->bitvec[i]) != 0)
+			return TRUE;
+	return FALSE;
 }
 
-/*  Parsing an identifier  */
+/*	- Functions for comparing the structure of elements and rules */
 
-/*  Data structure needed during parsing.
-    Only the first 64 characters of the identifier will be significant. */
+bool lint_rules_equal(rule_p rule, rule_p other);
 
-typedef struct ident_data
-{
-	ref_counted_base_t _base;
-	char ident[65];
-	int len;
-	text_pos_t ps;
-} *ident_data_p;
+bool lint_elements_equal(element_p element, element_p other);
 
-bool ident_add_char(result_p prev, char ch, result_p result)
+bool lint_element_equal(element_p element, element_p other)
 {
-	if (prev->data == NULL)
-	{
-		ident_data_p ident_data = MALLOC(struct ident_data);
-		ident_data->_base.release = NULL;
-		result_assign_ref_counted(result, ident_data, NULL);
-		SET_TYPE("ident_data_p", ident_data);
-		ident_data->ident[0] = ch;
-		ident_data->len = 1;
-	}
-	else
+	if (   element->kind != other->kind || element->optional != other->optional
+		|| element->sequence != other->sequence || element->back_tracking != other->back_tracking
+		|| element->avoid != other->avoid || element->condition != other->condition
+		|| (element->chain_rule == NULL) != (other->chain_rule == NULL)
+		|| (element->chain_rule != NULL && !lint_elements_equal(element->chain_rule, other->chain_rule)))
+		return FALSE;
+	switch (element->kind)
 	{
-		result_assign(result, prev);
-		ident_data_p ident_data = CAST(ident_data_p, result->data);
-		if (ident_data->len < 64)
-			ident_data->ident[ident_data->len++] = ch;
+		case rk_nt:
+			if (element->info.non_terminal != other->info.non_terminal)
+				return FALSE;
+			break;
+		case rk_grouping:
+		case rk_and:
+		case rk_not:
+			if (!lint_rules_equal(element->info.rules, other->info.rules))
+				return FALSE;
+			break;
+		case rk_char:
+			if (element->info.ch != other->info.ch)
+				return FALSE;
+			break;
+		case rk_charset:
+			if (!char_set_equal(element->info.char_set, other->info.char_set))
+				return FALSE;
+			break;
+		case rk_cpset:
+			if (element->info.code_point_set != other->info.code_point_set)
+				return FALSE;
+			break;
+		case rk_end:
+			break;
+		case rk_term:
+			if (element->info.terminal_function != other->info.terminal_function)
+				return FALSE;
+			break;
+		case rk_until:
+			if (   strcmp(element->info.until.delimiter, other->info.until.delimiter) != 0
+				|| element->info.until.escape != other->info.until.escape)
+				return FALSE;
+			break;
 	}
 	return TRUE;
 }
 
-void ident_set_pos(result_p result, text_pos_p ps)
-{
-	if (result->data != 0)
-		(CAST(ident_data_p, result->data))->ps = *ps;
-}
-
-void pass_to_sequence(result_p prev, result_p seq)
-{
-	result_assign(seq, prev);
-}
-
-/*  Ident tree node structure */
-
-typedef struct ident_t *ident_p;
-struct ident_t
+bool lint_elements_equal(element_p element, element_p other)
 {
-	tree_node_t _node;
-	const char *name;
-	bool is_keyword;
-};
+	for (; element != NULL && other != NULL; element = element->next, other = other->next)
+		if (!lint_element_equal(element, other))
+			return FALSE;
+	return element == NULL && other == NULL;
+}
 
-void ident_print(void *data, ostream_p ostream)
+bool lint_rules_equal(rule_p rule, rule_p other)
 {
-	ostream_puts(ostream, CAST(ident_p, data)->name);
+	for (; rule != NULL && other != NULL; rule = rule->next, other = other->next)
+		if (!lint_elements_equal(rule->elements, other->elements))
+			return FALSE;
+	return rule == NULL && other == NULL;
 }
-const char *ident_node_type = "ident_node_type";
 
-bool create_ident_tree(const result_p rule_result, void* data, result_p result)
+/*	- Function that returns whether the rule shadows a later rule */
+
+bool lint_rule_shadows(rule_p rule, rule_p later)
 {
-	ident_data_p ident_data = CAST(ident_data_p, rule_result->data);
-	if (ident_data == 0)
-	{
-		fprintf(stderr, "NULL\n");
+	bool always_succeeds = TRUE;
+	for (element_p element = rule->elements; element != NULL; element = element->next)
+		if (!element->optional)
+			always_succeeds = FALSE;
+	if (always_succeeds)
 		return TRUE;
+
+	element_p element = rule->elements;
+	element_p other = later->elements;
+	for (; element != NULL; element = element->next, other = other->next)
+	{
+		if (other == NULL || !lint_element_equal(element, other))
+			return FALSE;
 	}
-	ident_data->ident[ident_data->len] = '\0';
-	ident_p ident = MALLOC(struct ident_t);
-	init_tree_node(&ident->_node, ident_node_type, NULL);
-	tree_node_set_pos(&ident->_node, &ident_data->ps);
-	ident->name = ident_string(ident_data->ident);
-	ident->is_keyword = *keyword_state == 1;
-	result_assign_ref_counted(result, ident, ident_print);
-	SET_TYPE("ident_p", ident);
 	return TRUE;
 }
 
-/*  Ident grammar  */
-
-void ident_grammar(non_terminal_dict_p *all_nt)
-{
-	HEADER(all_nt)
-	
-	NT_DEF("ident")
-		RULE
-			CHARSET(ident_add_char) ADD_RANGE('a', 'z') ADD_RANGE('A', 'Z') ADD_CHAR('_') SET_PS(ident_set_pos)
-			CHARSET(ident_add_char) ADD_RANGE('a', 'z') ADD_RANGE('A', 'Z') ADD_CHAR('_') ADD_RANGE('0', '9') SEQ(pass_to_sequence, use_sequence_result) OPT(0)
-			END_FUNCTION(create_ident_tree)
-}
+/*	- Functions for calculating the nesting of back-tracking sequences */
 
-/*
-	Ident tests
-	~~~~~~~~~~~
-*/
+int lint_elements_depth(lint_p lint, element_p element);
 
-void test_parse_ident(non_terminal_dict_p *all_nt, const char *input)
+int lint_content_depth(lint_p lint, element_p element)
 {
-	ENTER_RESULT_CONTEXT
-	text_buffer_t text_buffer;
-	text_buffer_assign_string(&text_buffer, input);
-	
-	solutions_t solutions;
-	solutions_init(&solutions, &text_buffer);
-	
-	parser_t parser;
-	parser_init(&parser, &text_buffer);
-	parser.cache_hit_function = solutions_find;
-	parser.cache = &solutions;
-	
-	DECL_RESULT(result);
-	if (parse_nt(&parser, find_nt("ident", all_nt), &result) && text_buffer_end(&text_buffer))
+	int depth = 0;
+	if (element->kind == rk_nt)
 	{
-		if (result.data == NULL)
-			fprintf(stderr, "ERROR: parsing '%s' did not return result\n", input);
-		else
+		int nr = lint_nt_index(lint, element->info.non_terminal);
+		if (nr >= 0)
+			depth = lint->depth[nr];
+	}
+	else if (element->kind == rk_grouping || element->kind == rk_and || element->kind == rk_not)
+		for (rule_p rule = element->info.rules; rule != NULL; rule = rule->next)
 		{
-			tree_node_p tree_node = (tree_node_p)result.data;
-			if (tree_node->line != 1 && tree_node->column != 1)
-				fprintf(stderr, "WARNING: tree node position %d:%d is not 1:1\n", tree_node->line, tree_node->column);
-			if (tree_node->type_name != ident_node_type)
-				fprintf(stderr, "ERROR: tree node is not of type ident_node_type\n");
-			else
-			{
-				ident_p ident = CAST(ident_p, tree_node);
-				if (strcmp(ident->name, input) != 0)
-					fprintf(stderr, "ERROR: parsed value '%s' from '%s' instead of expected '%s'\n",
-					ident->name, input, input);
-				else
-					fprintf(stderr, "OK: parsed ident '%s' from '%s'\n", ident->name, input);
-			}
+			int rule_depth = lint_elements_depth(lint, rule->elements);
+			if (rule_depth > depth)
+				depth = rule_depth;
 		}
-	}
-	else
+	if (element->chain_rule != NULL)
 	{
-		fprintf(stderr, "ERROR: failed to parse ident from '%s'\n", input);
+		int chain_depth = lint_elements_depth(lint, element->chain_rule);
+		if (chain_depth > depth)
+			depth = chain_depth;
 	}
-	DISP_RESULT(result);
-	
-	solutions_free(&solutions);
-	EXIT_RESULT_CONTEXT
+	return depth;
 }
 
-void test_ident_grammar(non_terminal_dict_p *all_nt)
+int lint_elements_depth(lint_p lint, element_p element)
 {
-	test_parse_ident(all_nt, "aBc");
-	test_parse_ident(all_nt, "_123");
+	int depth = 0;
+	for (; element != NULL; element = element->next)
+	{
+		int element_depth = lint_content_depth(lint, element);
+		if (element->sequence && element->back_tracking)
+			element_depth++;
+		if (element_depth > depth)
+			depth = element_depth;
+	}
+	return depth > LINT_MAX_DEPTH ? LINT_MAX_DEPTH : depth;
 }
 
-/*
-	Char result
-	~~~~~~~~~~~
-
-	The struct for representing the char has but two members,
-	one for the character and one for the start position.
-	(besides the member for the reference counting base).
-*/
+/*	- Function for propagating the number of back-tracking constructs
+	  on the cheapest path from the start non-terminal */
 
-typedef struct char_data
-{
-	ref_counted_base_t _base;
-	char ch;
-	text_pos_t ps;
-} *char_data_p;
+void lint_rules_cost(lint_p lint, rule_p rules, int cost);
 
-void print_single_char(char ch, char del, ostream_p ostream)
+void lint_elements_cost(lint_p lint, element_p element, int cost)
 {
-	if (ch == '\0')
-		ostream_puts(ostream, "\\0");
-	else if (ch == del)
+	for (; element != NULL; element = element->next)
 	{
-		ostream_put(ostream, '\\');
-		ostream_put(ostream, del);
+		int element_cost = cost;
+		if ((element->sequence && element->back_tracking) || element->avoid)
+			element_cost++;
+		if (element_cost > LINT_MAX_DEPTH)
+			element_cost = LINT_MAX_DEPTH;
+		if (element->kind == rk_nt)
+		{
+			int nr = lint_nt_index(lint, element->info.non_terminal);
+			if (nr >= 0 && (lint->cost[nr] == -1 || element_cost < lint->cost[nr]))
+			{
+				lint->cost[nr] = element_cost;
+				lint->changed = TRUE;
+			}
+		}
+		else if (element->kind == rk_grouping || element->kind == rk_and || element->kind == rk_not)
+			lint_rules_cost(lint, element->info.rules, element_cost);
+		if (element->chain_rule != NULL)
+			lint_elements_cost(lint, element->chain_rule, element_cost);
 	}
-	else if (ch == '\n')
-		ostream_puts(ostream, "\\n");
-	else if (ch == '\r')
-		ostream_puts(ostream, "\\r");
-	else if (ch == '\\')
-		ostream_puts(ostream, "\\\\");
-	else
-		ostream_put(ostream, ch);
 }
 
-void char_data_print(void *data, ostream_p ostream)
+void lint_rules_cost(lint_p lint, rule_p rules, int cost)
 {
-	ostream_puts(ostream, "char '");
-	print_single_char(CAST(char_data_p, data)->ch, '\'', ostream);
-	ostream_puts(ostream, "'");
+	for (rule_p rule = rules; rule != NULL; rule = rule->next)
+		lint_elements_cost(lint, rule->elements, cost);
 }
 
-void char_set_pos(result_p result, text_pos_p ps)
+/*	- Functions for checking the rules and their elements */
+
+void lint_rules(lint_p lint, rule_p rules, const char *location, const char *rule_kind);
+
+void lint_elements(lint_p lint, element_p elements, const char *location)
 {
-	char_data_p char_data = MALLOC(struct char_data);
-	char_data->ps = *ps;
-	char_data->_base.release = 0;
-	result_assign_ref_counted(result, char_data, char_data_print);
-	SET_TYPE("char_data_p", char_data);
+	char element_location[300];
+	char description[100];
+	char estimate[100];
+	int nr = 1;
+	for (element_p element = elements; element != NULL; element = element->next, nr++)
+	{
+		snprintf(element_location, 300, "%s, element %d", location, nr);
+
+		if (element->sequence)
+		{
+			struct char_set first;
+			lint_char_set_clear(&first);
+			bool nullable = lint_element_first(element, &first);
+			if (nullable && element->chain_rule != NULL)
+			{
+				lint_char_set_clear(&first);
+				nullable = element_add_first(element->chain_rule, &first);
+			}
+			if (nullable)
+				lint_report(lint, lint_nullable_sequence, element_location,
+							"sequence of an element that can be empty", "does not terminate");
+		}
+
+		if (element->sequence && element->back_tracking)
+		{
+			int depth = lint_content_depth(lint, element);
+			if (depth > 0)
+			{
+				snprintf(description, 100, "back-tracking sequence with %s%d nested back-tracking sequence%s",
+						 depth == LINT_MAX_DEPTH ? "at least " : "", depth, depth == 1 ? "" : "s");
+				if (depth == LINT_MAX_DEPTH)
+					snprintf(estimate, 100, "exponential without a cache");
+				else
+					snprintf(estimate, 100, "O(n^%d) without a cache", depth + 2);
+				lint_report(lint, lint_nested_back_tracking, element_location, description, estimate);
+			}
+		}
+
+		if (element->avoid && (element->optional || element->sequence))
+		{
+			struct char_set first;
+			lint_char_set_clear(&first);
+			lint_element_first(element, &first);
+			struct char_set rest;
+			lint_char_set_clear(&rest);
+			element_add_first(element->next, &rest);
+			if (lint_char_sets_overlap(&first, &rest))
+				lint_report(lint, lint_avoid_overlap, element_location,
+							"avoided element starts with the same characters as the rest of the rule",
+							element->sequence ? "O(n^2) for the sequence" : "remainder parsed twice");
+		}
+
+		if (element->kind == rk_grouping || element->kind == rk_and || element->kind == rk_not)
+			lint_rules(lint, element->info.rules, element_location, "rule");
+		if (element->chain_rule != NULL)
+		{
+			char chain_location[320];
+			snprintf(chain_location, 320, "%s, chain rule", element_location);
+			lint_elements(lint, element->chain_rule, chain_location);
+		}
+	}
 }
 
-bool normal_char(result_p prev, char ch, result_p result)
+void lint_rules(lint_p lint, rule_p rules, const char *location, const char *rule_kind)
 {
-	result_assign(result, prev);
-	CAST(char_data_p, result->data)->ch = ch;
-	return TRUE;
+	char rule_location[300];
+	char description[100];
+	int nr = 1;
+	for (rule_p rule = rules; rule != NULL; rule = rule->next, nr++)
+	{
+		snprintf(rule_location, 300, "%s, %s %d", location, rule_kind, nr);
+		int earlier_nr = 1;
+		for (rule_p earlier = rules; earlier != rule; earlier = earlier->next, earlier_nr++)
+			if (lint_rule_shadows(earlier, rule))
+			{
+				snprintf(description, 100, "rule is shadowed by %s %d", rule_kind, earlier_nr);
+				lint_report(lint, lint_shadowed_rule, rule_location, description, "never used");
+				break;
+			}
+		lint_elements(lint, rule->elements, rule_location);
+	}
 }
 
-bool escaped_char(result_p prev, char ch, result_p result)
-{
-	return normal_char(prev,
-		ch == '0' ? '\0' :
-		ch == 'a' ? '\a' :
-		ch == 'b' ? '\b' :
-		ch == 'f' ? '\f' :
-		ch == 'n' ? '\n' :
-		ch == 'r' ? '\r' :
-		ch == 't' ? '\t' :
-		ch == 'v' ? '\v' : ch, result);
+/*	- Function that writes the hazards of all non-terminals to the output
+	  stream (if not NULL) and returns the number of hazards. Expensive paths
+	  are only checked when a start non-terminal is given. The grammar is
+	  analysed (with grammar_analyse) for the FIRST sets, which also changes
+	  how it is parsed afterwards (see parse_nt). */
+
+int lint_grammar(lint_p lint, non_terminal_dict_p all_nt, non_terminal_p start, ostream_p ostream)
+{
+	lint->ostream = ostream;
+	for (int i = 0; i < lint_nr_hazards; i++)
+		lint->nr_hazards[i] = 0;
+	grammar_analyse(all_nt);
+
+	lint->nr_nts = 0;
+	for (non_terminal_dict_p nt_dict = all_nt; nt_dict != NULL; nt_dict = nt_dict->next)
+		lint->nr_nts++;
+	lint->nts = MALLOC_N(lint->nr_nts, non_terminal_p);
+	lint->depth = MALLOC_N(lint->nr_nts, int);
+	lint->cost = MALLOC_N(lint->nr_nts, int);
+	int nr = 0;
+	for (non_terminal_dict_p nt_dict = all_nt; nt_dict != NULL; nt_dict = nt_dict->next, nr++)
+	{
+		lint->nts[nr] = &nt_dict->elem;
+		lint->depth[nr] = 0;
+		lint->cost[nr] = -1;
+	}
+
+	/* The depths only increase and are limited, thus this terminates */
+	lint->changed = TRUE;
+	while (lint->changed)
+	{
+		lint->changed = FALSE;
+		for (int i = 0; i < lint->nr_nts; i++)
+		{
+			int depth = 0;
+			for (rule_p rule = lint->nts[i]->normal; rule != NULL; rule = rule->next)
+			{
+				int rule_depth = lint_elements_depth(lint, rule->elements);
+				if (rule_depth > depth)
+					depth = rule_depth;
+			}
+			for (rule_p rule = lint->nts[i]->recursive; rule != NULL; rule = rule->next)
+			{
+				int rule_depth = lint_elements_depth(lint, rule->elements);
+				if (rule_depth > depth)
+					depth = rule_depth;
+			}
+			if (depth > lint->depth[i])
+			{
+				lint->depth[i] = depth;
+				lint->changed = TRUE;
+			}
+		}
+	}
+
+	char location[300];
+	for (int i = 0; i < lint->nr_nts; i++)
+	{
+		snprintf(location, 300, "%s", lint->nts[i]->name);
+		lint_rules(lint, lint->nts[i]->normal, location, "rule");
+		lint_rules(lint, lint->nts[i]->recursive, location, "recursive rule");
+	}
+
+	if (start != NULL)
+	{
+		/* The costs only decrease, thus this terminates */
+		lint->cost[lint_nt_index(lint, start)] = 0;
+		lint->changed = TRUE;
+		while (lint->changed)
+		{
+			lint->changed = FALSE;
+			for (int i = 0; i < lint->nr_nts; i++)
+				if (lint->cost[i] != -1)
+				{
+					lint_rules_cost(lint, lint->nts[i]->normal, lint->cost[i]);
+					lint_rules_cost(lint, lint->nts[i]->recursive, lint->cost[i]);
+				}
+		}
+		char description[100];
+		char estimate[100];
+		for (int i = 0; i < lint->nr_nts; i++)
+			if (lint->cost[i] > 0)
+			{
+				snprintf(description, 100, "only reached through %s%d back-tracking construct%s",
+						 lint->cost[i] == LINT_MAX_DEPTH ? "at least " : "", lint->cost[i], lint->cost[i] == 1 ? "" : "s");
+				if (lint->cost[i] == 1)
+					snprintf(estimate, 100, "parsed O(n) times without a cache");
+				else
+					snprintf(estimate, 100, "parsed O(n^%d) times without a cache", lint->cost[i]);
+				lint_report(lint, lint_expensive_path, lint->nts[i]->name, description, estimate);
+			}
+	}
+
+	FREE(lint->nts);
+	FREE(lint->depth);
+	FREE(lint->cost);
+
+	int nr_hazards = 0;
+	for (int i = 0; i < lint_nr_hazards; i++)
+		nr_hazards += lint->nr_hazards[i];
+	return nr_hazards;
 }
 
-/*	Char tree node structure */
+/*
+	Typed abstract syntax trees
+	~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+	A tree (see 'Abstract Syntax Tree') has an array of results for its
+	children, which are accessed by index. For most tree names, however,
+	the grammar fixes the number of children and the non-terminals they
+	are parsed from. A schema is derived from the rules that end with
+	TREE. It has a kind for each tree name with the number of children
+	(or -1 when this differs between rules or depends on the input) and
+	for each child the name of the non-terminal it is parsed from ("list"
+	for a sequence added with SEQL). The name is NULL when it differs
+	between rules or when the child is a grouping. Note that a skipped
+	optional element still adds an (empty) child.
+
+	Binding the schema replaces make_tree in the rules of the kinds with
+	a fixed number of children, such that these construct typed trees: a
+	single block with a pointer to the kind and a pointer to each child,
+	instead of a separate array of results. When a child is not a tree
+	node, a generic tree is constructed instead. The other rules with TREE
+	construct generic trees that also point to their kind, such that it
+	does not have to be looked up by name. The index of the kind can be
+	used for dispatching to visitor functions. From the schema,
+	C code can be generated with a struct for each kind with the layout
+	of a typed tree, a builder, and a visitor with a dispatch function.
+*/
 
-typedef struct char_node_t *char_node_p;
-struct char_node_t
+typedef struct ast_kind *ast_kind_p;
+struct ast_kind
 {
-	tree_node_t _node;
-	char ch;
+	const char *name;          /* The name given with TREE */
+	int index;                 /* Index in the schema and in dispatch tables */
+	int nr_children;           /* The fixed number of children, or -1 */
+	const char **child_types;  /* For each child the name of the non-terminal (or NULL) */
 };
 
-const char *char_node_type = "char_node_type";
-
-void char_node_print(void *data, ostream_p ostream)
+typedef struct
 {
-	ostream_puts(ostream, "char '");
-	print_single_char(((char_node_p)data)->ch, '\'', ostream);
-	ostream_puts(ostream, "'");
-}
+	rule_p rule;
+	non_terminal_p rec_nt;     /* For a left-recursive rule, its non-terminal */
+	ast_kind_p kind;
+} ast_tree_rule_t, *ast_tree_rule_p;
 
-bool create_char_tree(const result_p rule_result, void* data, result_p result)
+typedef struct ast_schema *ast_schema_p;
+typedef struct ast_schema ast_schema_t;
+struct ast_schema
 {
-	char_data_p char_data = CAST(char_data_p, rule_result->data);
+	int nr_kinds;
+	ast_kind_p kinds;
+	int nr_tree_rules;
+	int allocated_tree_rules;
+	ast_tree_rule_p tree_rules;
+};
 
-	char_node_p char_node = MALLOC(struct char_node_t);
-	init_tree_node(&char_node->_node, char_node_type, NULL);
-	tree_node_set_pos(&char_node->_node, &char_data->ps);
-	char_node->ch = char_data->ch;
-	result_assign_ref_counted(result, char_node, char_node_print);
-	SET_TYPE("char_data_p", char_data);
-	return TRUE;
+void ast_schema_init(ast_schema_p schema)
+{
+	schema->nr_kinds = 0;
+	schema->kinds = NULL;
+	schema->nr_tree_rules = 0;
+	schema->allocated_tree_rules = 0;
+	schema->tree_rules = NULL;
 }
 
-/*  Char grammar  */
-
-void char_grammar(non_terminal_dict_p *all_nt)
+ast_kind_p ast_schema_find(ast_schema_p schema, const char *name)
 {
-	HEADER(all_nt)
-	
-	NT_DEF("char")
-		RULE
-			CHAR('\'') SET_PS(char_set_pos)
-			{ GROUPING
-				RULE // Escaped character
-					CHAR('\\') CHARSET(escaped_char) ADD_CHAR('0') ADD_CHAR('\"') ADD_CHAR('\'') ADD_CHAR('\\') ADD_CHAR('a') ADD_CHAR('b') ADD_CHAR('f') ADD_CHAR('n') ADD_CHAR('r') ADD_CHAR('t') ADD_CHAR('v')
-				RULE // Normal character
-					CHARSET(normal_char) ADD_RANGE(' ', 126) REMOVE_CHAR('\\') REMOVE_CHAR('\'')
-			}
-			CHAR('\'')
-			END_FUNCTION(create_char_tree)
+	for (int i = 0; i < schema->nr_kinds; i++)
+		if (schema->kinds[i].name == name || strcmp(schema->kinds[i].name, name) == 0)
+			return &schema->kinds[i];
+	return NULL;
 }
 
-/*
-	Char tests
-	~~~~~~~~~~
-*/
+/*	- Function that collects the rules that end with TREE (including the
+	  rules of groupings) */
 
-void test_parse_char(non_terminal_dict_p *all_nt, const char *input, char ch)
+void ast_schema_add_rules(ast_schema_p schema, rule_p rules, non_terminal_p rec_nt)
 {
-	ENTER_RESULT_CONTEXT
-	text_buffer_t text_buffer;
-	text_buffer_assign_string(&text_buffer, input);
-	
-	solutions_t solutions;
-	solutions_init(&solutions, &text_buffer);
-	
-	parser_t parser;
-	parser_init(&parser, &text_buffer);
-	parser.cache_hit_function = solutions_find;
-	parser.cache = &solutions;
-	
-	DECL_RESULT(result);
-	if (parse_nt(&parser, find_nt("char", all_nt), &result) && text_buffer_end(&text_buffer))
+	for (rule_p rule = rules; rule != NULL; rule = rule->next)
 	{
-		if (result.data == NULL)
-			fprintf(stderr, "ERROR: parsing '%s' did not return result\n", input);
-		else
-		{
-			tree_node_p tree_node = (tree_node_p)result.data;
-			if (tree_node->line != 1 && tree_node->column != 1)
-				fprintf(stderr, "WARNING: tree node position %d:%d is not 1:1\n", tree_node->line, tree_node->column);
-			if (tree_node->type_name != char_node_type)
-				fprintf(stderr, "ERROR: tree node is not of type char_node_type\n");
-			else
+		if (rule->end_function == make_tree)
+		{
+			if (schema->nr_tree_rules == schema->allocated_tree_rules)
 			{
-				char_node_p char_node = (char_node_p)tree_node;
-				if (char_node->ch != ch)
-					fprintf(stderr, "ERROR: parsed value '%c' from '%s' instead of expected '%c'\n",
-					char_node->ch, input, ch);
-				else
-					fprintf(stderr, "OK: parsed char %d from '%s'\n", char_node->ch, input);
+				int allocated = 2 * schema->allocated_tree_rules + 16;
+				ast_tree_rule_p tree_rules = MALLOC_N(allocated, ast_tree_rule_t);
+				if (schema->tree_rules != NULL)
+				{
+					memcpy(tree_rules, schema->tree_rules, schema->nr_tree_rules * sizeof(ast_tree_rule_t));
+					FREE(schema->tree_rules);
+				}
+				schema->tree_rules = tree_rules;
+				schema->allocated_tree_rules = allocated;
 			}
+			ast_tree_rule_p tree_rule = &schema->tree_rules[schema->nr_tree_rules++];
+			tree_rule->rule = rule;
+			tree_rule->rec_nt = rec_nt;
+			tree_rule->kind = NULL;
 		}
+		for (element_p element = rule->elements; element != NULL; element = element->next)
+			if (element->kind == rk_grouping)
+				ast_schema_add_rules(schema, element->info.rules, NULL);
 	}
-	else
+}
+
+/*	- Function that returns the number of children that the elements add
+	  to the result of the rule, or -1 when this depends on the input.
+	  When types is not NULL, the types of the children are stored in it. */
+
+int ast_elements_children(element_p element, const char **types)
+{
+	int nr = 0;
+	for (; element != NULL; element = element->next)
 	{
-		fprintf(stderr, "ERROR: failed to parse char from '%s'\n", input);
+		if (   element->add_char_function != NULL || element->add_span_function != NULL
+			|| (element->optional && element->add_skip_function != NULL))
+			return -1;
+		const char *type;
+		if (element->sequence)
+		{
+			/* Without add_seq_function the result of the previous elements
+			   is discarded, and when a skipped sequence has no add_function
+			   it does not add a child */
+			if (   element->begin_seq_function != NULL || element->add_seq_function != add_seq_as_list
+				|| (element->optional && element->add_function != add_child))
+				return -1;
+			type = list_type;
+		}
+		else if (element->recover != NULL)
+			return -1;
+		else if (element->add_function == NULL)
+			continue;
+		else if (element->add_function == add_child)
+			type = element->kind == rk_nt ? element->info.non_terminal->name : NULL;
+		else
+			return -1;
+		if (types != NULL)
+			types[nr] = type;
+		nr++;
 	}
-	DISP_RESULT(result);
-	
-	solutions_free(&solutions);
+	return nr;
+}
 
-	EXIT_RESULT_CONTEXT
+int ast_rule_children(ast_tree_rule_p tree_rule, const char **types)
+{
+	int nr = 0;
+	if (tree_rule->rec_nt != NULL && tree_rule->rule->rec_start_function != NULL)
+	{
+		if (tree_rule->rule->rec_start_function != rec_add_child)
+			return -1;
+		if (types != NULL)
+			types[0] = tree_rule->rec_nt->name;
+		nr = 1;
+	}
+	int nr_elements = ast_elements_children(tree_rule->rule->elements, types == NULL ? NULL : types + nr);
+	return nr_elements < 0 ? -1 : nr + nr_elements;
 }
 
-void test_char_grammar(non_terminal_dict_p *all_nt)
+/*	- Function that derives the schema from the grammar (before it is bound) */
+
+void ast_schema_derive(ast_schema_p schema, non_terminal_dict_p all_nt)
 {
-	test_parse_char(all_nt, "'c'", 'c');
-	test_parse_char(all_nt, "'\\0'", '\0');
-	test_parse_char(all_nt, "'\\''", '\'');
-	test_parse_char(all_nt, "'\\\\'", '\\');
-	test_parse_char(all_nt, "'\\n'", '\n');
+	for (non_terminal_dict_p nt_dict = all_nt; nt_dict != NULL; nt_dict = nt_dict->next)
+	{
+		ast_schema_add_rules(schema, nt_dict->elem.normal, NULL);
+		ast_schema_add_rules(schema, nt_dict->elem.recursive, &nt_dict->elem);
+	}
+
+	/* There are at most as many kinds as rules */
+	schema->kinds = MALLOC_N(schema->nr_tree_rules + 1, struct ast_kind);
+	for (int i = 0; i < schema->nr_tree_rules; i++)
+	{
+		ast_tree_rule_p tree_rule = &schema->tree_rules[i];
+		const char *name = (const char*)tree_rule->rule->end_function_data;
+		int nr_children = ast_rule_children(tree_rule, NULL);
+		const char **types = nr_children > 0 ? MALLOC_N(nr_children, const char*) : NULL;
+		if (types != NULL)
+			ast_rule_children(tree_rule, types);
+
+		ast_kind_p kind = ast_schema_find(schema, name);
+		if (kind == NULL)
+		{
+			kind = &schema->kinds[schema->nr_kinds];
+			kind->name = name;
+			kind->index = schema->nr_kinds++;
+			kind->nr_children = nr_children;
+			kind->child_types = types;
+			types = NULL;
+		}
+		else if (kind->nr_children >= 0 && nr_children != kind->nr_children)
+		{
+			kind->nr_children = -1;
+			if (kind->child_types != NULL)
+				FREE(kind->child_types);
+			kind->child_types = NULL;
+		}
+		else if (kind->nr_children > 0)
+		{
+			for (int j = 0; j < kind->nr_children; j++)
+				if (   kind->child_types[j] != NULL
+					&& (types[j] == NULL || strcmp(kind->child_types[j], types[j]) != 0))
+					kind->child_types[j] = NULL;
+		}
+		if (types != NULL)
+			FREE(types);
+		tree_rule->kind = kind;
+	}
 }
 
-/*
-	String result
-	~~~~~~~~~~~~~
-	
-	The struct representing the string has several members.
-	But we first need to define a string buffer type that is
-	needed as a temporary storage while the string is parsed
-	before memory is allocated to contain the whole string.
-*/
+void ast_schema_free(ast_schema_p schema)
+{
+	for (int i = 0; i < schema->nr_kinds; i++)
+		if (schema->kinds[i].child_types != NULL)
+			FREE(schema->kinds[i].child_types);
+	if (schema->kinds != NULL)
+		FREE(schema->kinds);
+	if (schema->tree_rules != NULL)
+		FREE(schema->tree_rules);
+	ast_schema_init(schema);
+}
 
-typedef struct string_buffer *string_buffer_p;
-struct string_buffer
+/*	- Typed trees */
+
+typedef struct typed_tree_t *typed_tree_p;
+DEFINE_TYPE(typed_tree_p)
+struct typed_tree_t
 {
-	char buf[100];
-	string_buffer_p next;
+	tree_node_t _node;
+	ast_kind_p kind;
+	tree_node_p children[];
 };
-string_buffer_p global_string_buffer = NULL;
 
-string_buffer_p new_string_buffer()
+const char *typed_tree_node_type = "typed_tree_node_type";
+
+void typed_tree_print(void *data, ostream_p ostream);
+
+/*  The kinds of tree nodes that can be children of a typed tree, with
+	the function to print them */
+
+typedef void (*ast_print_function)(void *data, ostream_p ostream);
+struct
 {
-	string_buffer_p string_buffer = MALLOC(struct string_buffer);
-	string_buffer->next = NULL;
-	return string_buffer;
+	const char **type_name;
+	ast_print_function print;
+} ast_node_prints[] =
+{
+	{ &tree_node_type, tree_print },
+	{ &typed_tree_node_type, typed_tree_print },
+	{ &ident_node_type, ident_print },
+	{ &char_node_type, char_node_print },
+	{ &string_node_type, string_node_print },
+	{ &int_node_type, int_node_print },
+};
+#define AST_NR_NODE_PRINTS (sizeof(ast_node_prints) / sizeof(ast_node_prints[0]))
+
+bool typed_tree_child_supported(result_p child)
+{
+	if (child->data == NULL)
+		return TRUE;
+	if (child->inc != ref_counted_base_inc)
+		return FALSE;
+	for (size_t i = 0; i < AST_NR_NODE_PRINTS; i++)
+		if (child->print == ast_node_prints[i].print)
+			return TRUE;
+	return FALSE;
 }
 
-typedef struct string_data
+void ast_node_print(tree_node_p node, ostream_p ostream)
 {
-	ref_counted_base_t _base;
-	string_buffer_p buffer;
-	size_t length;
-	char octal_char;
-	text_pos_t ps;
-} *string_data_p;
+	if (node != NULL)
+		for (size_t i = 0; i < AST_NR_NODE_PRINTS; i++)
+			if (node->type_name == *ast_node_prints[i].type_name)
+			{
+				ast_node_prints[i].print(node, ostream);
+				return;
+			}
+	ostream_puts(ostream, "<>");
+}
 
-void string_data_print(void *data, ostream_p ostream)
+void release_typed_tree(void *data)
 {
-	string_data_p string_data = CAST(string_data_p, data);
-	ostream_puts(ostream, "char \"");
-	string_buffer_p string_buffer = global_string_buffer;
-	int j = 0;
-	for (size_t i = 0; i < string_data->length; i++)
+	typed_tree_p tree = CAST(typed_tree_p, data);
+	for (int i = 0; i < tree->kind->nr_children; i++)
+		if (tree->children[i] != NULL)
+			ref_counted_base_dec(tree->children[i]);
+	FREE(tree);
+}
+
+typed_tree_p malloc_typed_tree(ast_kind_p kind)
+{
+	typed_tree_p tree = (typed_tree_p)my_malloc(sizeof(struct typed_tree_t) + kind->nr_children * sizeof(tree_node_p), __LINE__);
+	init_tree_node(&tree->_node, typed_tree_node_type, release_typed_tree);
+	tree->kind = kind;
+	return tree;
+}
+
+void typed_tree_print(void *data, ostream_p ostream)
+{
+	typed_tree_p tree = CAST(typed_tree_p, data);
+	ostream_puts(ostream, tree->kind->name);
+	ostream_put(ostream, '(');
+	for (int i = 0; i < tree->kind->nr_children; i++)
 	{
-		print_single_char(string_buffer->buf[j], '"', ostream);
-		if (++j == 100)
-		{
-			string_buffer = string_buffer->next;
-			if (string_buffer == NULL)
-				break;
-			j = 0;
-		}
+		if (i > 0)
+			ostream_put(ostream, ',');
+		ast_node_print(tree->children[i], ostream);
 	}
-	ostream_puts(ostream, "\"");
+	ostream_put(ostream, ')');
 }
 
-void string_set_pos(result_p result, text_pos_p ps)
+/*	- Function for building a typed tree from the given children (which
+	  reference counts are incremented) */
+
+typed_tree_p typed_tree_make(ast_kind_p kind, tree_node_p *children)
 {
-	if (result->data == NULL)
+	typed_tree_p tree = malloc_typed_tree(kind);
+	for (int i = 0; i < kind->nr_children; i++)
 	{
-		string_data_p string_data = MALLOC(struct string_data);
-		string_data->ps = *ps;
-		string_data->buffer = NULL;
-		string_data->length = 0;
-		string_data->_base.release = 0;
-		result_assign_ref_counted(result, string_data, string_data_print);
-		SET_TYPE("string_data_p", string_data);
+		tree->children[i] = children[i];
+		if (children[i] != NULL)
+			ref_counted_base_inc(children[i]);
 	}
+	SET_TYPE(typed_tree_p, tree);
+	return tree;
 }
 
-bool string_data_add_normal_char(result_p prev, char ch, result_p result)
+/*	- The end functions that replace make_tree when the schema is bound:
+	  one for a generic tree that points to its kind, and one for a typed
+	  tree (which falls back to a generic tree) */
+
+bool make_kind_tree(const result_p rule_result, void* data, result_p result)
 {
-	result_assign(result, prev);
-	string_data_p string_data = CAST(string_data_p, result->data);
-	int j = string_data->length % 100;
-	if (j == 0)
+	ast_kind_p kind = (ast_kind_p)data;
+	make_tree(rule_result, (void*)kind->name, result);
+	CAST(tree_p, result->data)->kind = kind;
+	return TRUE;
+}
+
+bool make_typed_tree(const result_p rule_result, void* data, result_p result)
+{
+	ast_kind_p kind = (ast_kind_p)data;
+	prev_child_p children = CAST(prev_child_p, rule_result->data);
+	int nr = 0;
+	for (prev_child_p child = children; child != NULL; child = child->prev, nr++)
+		if (!typed_tree_child_supported(&child->child))
+			return make_kind_tree(rule_result, data, result);
+	if (nr != kind->nr_children)
+		return make_kind_tree(rule_result, data, result);
+
+	typed_tree_p tree = malloc_typed_tree(kind);
+	for (prev_child_p child = children; child != NULL; child = child->prev)
 	{
-		string_buffer_p *ref_string_buffer = string_data->length == 0 ? &global_string_buffer : &string_data->buffer->next;
-		if (*ref_string_buffer == NULL)
-			*ref_string_buffer = new_string_buffer();
-		string_data->buffer = *ref_string_buffer;
+		tree_node_p node = (tree_node_p)child->child.data;
+		if (node != NULL)
+			ref_counted_base_inc(node);
+		tree->children[--nr] = node;
 	}
-	string_data->buffer->buf[j] = ch;
-	string_data->length++;
+	result_assign_ref_counted(result, tree, typed_tree_print);
+	SET_TYPE(typed_tree_p, tree);
 	return TRUE;
 }
 
-bool string_data_add_escaped_char(result_p prev, char ch, result_p result)
+/*	- Function that binds the schema to the grammar it was derived from,
+	  and returns the number of rules that construct typed trees. (The
+	  schema should not be freed while the grammar is used.) */
+
+int ast_schema_bind(ast_schema_p schema)
 {
-	return string_data_add_normal_char(prev, ch == '0' ? '\0' : ch == 'n' ? '\n' : ch == 'r' ? '\r' : ch, result);
+	int nr_bound = 0;
+	for (int i = 0; i < schema->nr_tree_rules; i++)
+	{
+		ast_tree_rule_p tree_rule = &schema->tree_rules[i];
+		tree_rule->rule->end_function_data = tree_rule->kind;
+		if (tree_rule->kind->nr_children >= 0)
+		{
+			tree_rule->rule->end_function = make_typed_tree;
+			nr_bound++;
+		}
+		else
+			tree_rule->rule->end_function = make_kind_tree;
+	}
+	return nr_bound;
 }
 
-bool string_data_add_first_octal(result_p prev, char ch, result_p result)
+/*	- Functions for accessing typed and generic trees alike. (Only the
+	  kind of a generic tree that was not built by a bound rule, is looked
+	  up by its name.) */
+
+ast_kind_p ast_node_kind(ast_schema_p schema, tree_node_p node)
 {
-	result_assign(result, prev);
-	string_data_p string_data = CAST(string_data_p, result->data);
-	string_data->octal_char = (ch - '0') << 6;
-	return TRUE;
+	if (node == NULL)
+		return NULL;
+	if (node->type_name == typed_tree_node_type)
+		return CAST(typed_tree_p, node)->kind;
+	if (node->type_name == tree_node_type)
+	{
+		tree_p tree = CAST(tree_p, node);
+		return tree->kind != NULL ? tree->kind : ast_schema_find(schema, tree->tree_name);
+	}
+	return NULL;
 }
 
-bool string_data_add_second_octal(result_p prev, char ch, result_p result)
+int ast_nr_children(tree_node_p node)
 {
-	result_assign(result, prev);
-	string_data_p string_data = CAST(string_data_p, result->data);
-	string_data->octal_char |= (ch - '0') << 3;
-	return TRUE;
+	if (node == NULL)
+		return 0;
+	if (node->type_name == typed_tree_node_type)
+		return CAST(typed_tree_p, node)->kind->nr_children;
+	if (node->type_name == tree_node_type)
+		return CAST(tree_p, node)->nr_children;
+	return 0;
 }
 
-bool string_data_add_third_octal(result_p prev, char ch, result_p result)
+/*  (The child of a generic tree is assumed to be a tree node.) */
+tree_node_p ast_child(tree_node_p node, int i)
 {
-	string_data_p string_data = CAST(string_data_p, prev->data);
-	return string_data_add_normal_char(prev, string_data->octal_char | (ch - '0'), result);
+	if (node->type_name == typed_tree_node_type)
+		return CAST(typed_tree_p, node)->children[i];
+	return (tree_node_p)CAST(tree_p, node)->children[i].data;
 }
 
-/*	String tree node structure */
+/*	- Dispatching on the index of the kind. Generic trees without a kind,
+	  such as lists, are not dispatched. */
 
-typedef struct string_node_t *string_node_p;
-struct string_node_t
+typedef void (*ast_visit_function)(tree_node_p node, void *data);
+
+bool ast_dispatch(ast_schema_p schema, ast_visit_function *table, tree_node_p node, void *data)
 {
-	tree_node_t _node;
-	const char *str;
-	size_t length;
+	ast_kind_p kind = ast_node_kind(schema, node);
+	if (kind == NULL || table[kind->index] == NULL)
+		return FALSE;
+	table[kind->index](node, data);
+	return TRUE;
+}
+
+/*	- Generating C code from the schema. The names are prefixed with the
+	  given prefix. The generated code should be compiled together with
+	  this file, and the builders and dispatch function should be given
+	  a schema derived from the same grammar. A tree of a kind with a
+	  fixed number of children that was constructed as a generic tree
+	  (see make_typed_tree), is dispatched to visit_generic_form. */
+
+const char *ast_c_keywords[] =
+{
+	"auto", "break", "case", "char", "const", "continue", "default", "do", "double",
+	"else", "enum", "extern", "float", "for", "goto", "if", "inline", "int", "long",
+	"register", "restrict", "return", "short", "signed", "sizeof", "static", "struct",
+	"switch", "typedef", "union", "unsigned", "void", "volatile", "while", NULL
 };
 
-const char *string_node_type = "string_node_type";
+void ast_put_identifier(ostream_p ostream, const char *name)
+{
+	for (const char *s = name; *s != '\0'; s++)
+		ostream_put(ostream, ('a' <= *s && *s <= 'z') || ('A' <= *s && *s <= 'Z') || ('0' <= *s && *s <= '9') ? *s : '_');
+}
 
-void string_node_print(void *data, ostream_p ostream)
+void ast_put_name(ostream_p ostream, const char *prefix, const char *name, const char *postfix)
 {
-	string_node_p string_node = CAST(string_node_p, data);
-	ostream_puts(ostream, "string \"");
-	for (size_t i = 0; i < string_node->length - 1; i++)
-		print_single_char(string_node->str[i], '"', ostream);
-	ostream_puts(ostream, "\"");
+	ostream_puts(ostream, prefix);
+	ostream_put(ostream, '_');
+	ast_put_identifier(ostream, name);
+	ostream_puts(ostream, postfix);
 }
 
-bool create_string_tree(const result_p rule_result, void* data, result_p result)
+/*  The name of a field is the name of the non-terminal, numbered when
+	it occurs more than once (and followed by an underscore when it is
+	a keyword) */
+void ast_put_field(ostream_p ostream, ast_kind_p kind, int i)
 {
-	string_data_p string_data = CAST(string_data_p, rule_result->data);
-	
-	string_node_p string_node = MALLOC(struct string_node_t);
-	init_tree_node(&string_node->_node, string_node_type, NULL);
-	tree_node_set_pos(&string_node->_node, &string_data->ps);
-	char *s = MALLOC_N(string_data->length + 1, char);
-	string_node->str = s;
-	string_node->length = string_data->length + 1;
-	string_buffer_p string_buffer = global_string_buffer;
-	int j = 0;
-	for (size_t i = 0; i < string_data->length; i++)
+	const char *type = kind->child_types[i];
+	char number[20];
+	if (type == NULL)
 	{
-		*s++ = string_buffer->buf[j++];
-		if (j == 100)
+		snprintf(number, 20, "child%d", i + 1);
+		ostream_puts(ostream, number);
+		return;
+	}
+	int nr_same = 0;
+	int nr_before = 0;
+	for (int j = 0; j < kind->nr_children; j++)
+		if (kind->child_types[j] != NULL && strcmp(kind->child_types[j], type) == 0)
 		{
-			string_buffer = string_buffer->next;
-			j = 0;
+			nr_same++;
+			if (j < i)
+				nr_before++;
 		}
+	ast_put_identifier(ostream, type);
+	if (nr_same > 1)
+	{
+		snprintf(number, 20, "_%d", nr_before + 1);
+		ostream_puts(ostream, number);
 	}
-	*s = '\0';
-	result_assign_ref_counted(result, string_node, string_node_print);
-	SET_TYPE("string_node_p", string_node);
-	return TRUE;
-}
-		
-/*	String grammar */
-
-void string_grammar(non_terminal_dict_p *all_nt)
-{
-	HEADER(all_nt)
-	
-	NT_DEF("string")
-		RULE
-			{ GROUPING
-				RULE
-					CHAR('"') SET_PS(string_set_pos)
-					{ GROUPING
-						RULE // Octal character
-							CHAR('\\')
-							CHARSET(string_data_add_first_octal) ADD_CHAR('0') ADD_CHAR('1')
-							CHARSET(string_data_add_second_octal) ADD_RANGE('0','7')
-							CHARSET(string_data_add_third_octal) ADD_RANGE('0','7')
-						RULE // Escaped character
-							CHAR('\\') CHARSET(string_data_add_escaped_char) ADD_CHAR('0') ADD_CHAR('\'') ADD_CHAR('"') ADD_CHAR('\\') ADD_CHAR('n') ADD_CHAR('r')
-						RULE // Normal character
-							CHARSET(string_data_add_normal_char) ADD_RANGE(' ', 126) REMOVE_CHAR('\\') REMOVE_CHAR('"')
-					} SEQ(pass_to_sequence, use_sequence_result) OPT(0)
-					CHAR('"')
-			} SEQ(pass_to_sequence, use_sequence_result) { CHAIN NTF("white_space", 0) }
-			END_FUNCTION(create_string_tree)
+	else
+		for (int j = 0; ast_c_keywords[j] != NULL; j++)
+			if (strcmp(type, ast_c_keywords[j]) == 0)
+				ostream_put(ostream, '_');
 }
 
-void test_parse_string(non_terminal_dict_p *all_nt, const char *input, const char *str)
+void ast_schema_write_c(ast_schema_p schema, const char *prefix, ostream_p ostream)
 {
-	ENTER_RESULT_CONTEXT
+	ostream_puts(ostream, "/* Generated from the TREE rules of the grammar */\n\nenum ");
+	ast_put_name(ostream, prefix, "kind", "\n{\n");
+	for (int i = 0; i < schema->nr_kinds; i++)
+	{
+		ostream_put(ostream, '\t');
+		ast_put_name(ostream, prefix, schema->kinds[i].name, ",\n");
+	}
+	ostream_put(ostream, '\t');
+	ast_put_name(ostream, prefix, "nr_kinds", "\n};\n");
 
-	text_buffer_t text_buffer;
-	text_buffer_assign_string(&text_buffer, input);
-	
-	solutions_t solutions;
-	solutions_init(&solutions, &text_buffer);
-	
-	parser_t parser;
-	parser_init(&parser, &text_buffer);
-	parser.cache_hit_function = solutions_find;
-	parser.cache = &solutions;
-	
-	DECL_RESULT(result);
-	if (parse_nt(&parser, find_nt("string", all_nt), &result) && text_buffer_end(&text_buffer))
+	for (int i = 0; i < schema->nr_kinds; i++)
 	{
-		if (result.data == NULL)
-			fprintf(stderr, "ERROR: parsing '%s' did not return result\n", input);
-		else
+		ast_kind_p kind = &schema->kinds[i];
+		if (kind->nr_children < 0)
+			continue;
+
+		ostream_puts(ostream, "\ntypedef struct ");
+		ast_put_name(ostream, prefix, kind->name, "_t *");
+		ast_put_name(ostream, prefix, kind->name, "_p;\nstruct ");
+		ast_put_name(ostream, prefix, kind->name, "_t\n{\n\ttree_node_t _node;\n\tast_kind_p kind;\n");
+		for (int j = 0; j < kind->nr_children; j++)
 		{
-			tree_node_p tree_node = (tree_node_p)result.data;
-			if (tree_node->line != 1 && tree_node->column != 1)
-				fprintf(stderr, "WARNING: tree node position %d:%d is not 1:1\n", tree_node->line, tree_node->column);
-			if (tree_node->type_name != string_node_type)
-				fprintf(stderr, "ERROR: tree node is not of type string_node_type\n");
-			else
+			ostream_puts(ostream, "\ttree_node_p ");
+			ast_put_field(ostream, kind, j);
+			ostream_puts(ostream, ";\n");
+		}
+		ostream_puts(ostream, "};\n\n");
+
+		ast_put_name(ostream, prefix, kind->name, "_p ");
+		ast_put_name(ostream, prefix, "make", "_");
+		ast_put_identifier(ostream, kind->name);
+		ostream_puts(ostream, "(ast_schema_p schema");
+		for (int j = 0; j < kind->nr_children; j++)
+		{
+			ostream_puts(ostream, ", tree_node_p ");
+			ast_put_field(ostream, kind, j);
+		}
+		ostream_puts(ostream, ")\n{\n");
+		if (kind->nr_children > 0)
+		{
+			char number[20];
+			snprintf(number, 20, "%d", kind->nr_children);
+			ostream_puts(ostream, "\ttree_node_p children[");
+			ostream_puts(ostream, number);
+			ostream_puts(ostream, "] = { ");
+			for (int j = 0; j < kind->nr_children; j++)
 			{
-				string_node_p string_node = CAST(string_node_p, tree_node);
-				if (strcmp(string_node->str, str) != 0)
-					fprintf(stderr, "ERROR: parsed value '%s' from '%s' instead of expected '%s'\n",
-					string_node->str, input, str);
-				else
-					fprintf(stderr, "OK: parsed string \"%s\" from \"%s\"\n", string_node->str, input);
+				if (j > 0)
+					ostream_puts(ostream, ", ");
+				ast_put_field(ostream, kind, j);
 			}
+			ostream_puts(ostream, " };\n");
 		}
+		ostream_puts(ostream, "\treturn (");
+		ast_put_name(ostream, prefix, kind->name, "_p)typed_tree_make(&schema->kinds[");
+		ast_put_name(ostream, prefix, kind->name, kind->nr_children > 0 ? "], children);\n}\n" : "], NULL);\n}\n");
+	}
+
+	ostream_puts(ostream, "\ntypedef struct ");
+	ast_put_name(ostream, prefix, "visitor", " ");
+	ast_put_name(ostream, prefix, "visitor", "_t;\nstruct ");
+	ast_put_name(ostream, prefix, "visitor", "\n{\n");
+	for (int i = 0; i < schema->nr_kinds; i++)
+	{
+		ast_kind_p kind = &schema->kinds[i];
+		ostream_puts(ostream, "\tvoid (*visit_");
+		ast_put_identifier(ostream, kind->name);
+		ostream_puts(ostream, ")(");
+		if (kind->nr_children < 0)
+			ostream_puts(ostream, "tree_p");
+		else
+			ast_put_name(ostream, prefix, kind->name, "_p");
+		ostream_puts(ostream, " node, void *data);\n");
 	}
-	else
+	ostream_puts(ostream, "\tvoid (*visit_generic_form)(tree_p node, ast_kind_p kind, void *data);\n");
+	ostream_puts(ostream, "};\n\nbool ");
+	ast_put_name(ostream, prefix, "dispatch", "(ast_schema_p schema, ");
+	ast_put_name(ostream, prefix, "visitor", "_t *visitor, tree_node_p node, void *data)\n{\n");
+	ostream_puts(ostream, "\tast_kind_p kind = ast_node_kind(schema, node);\n");
+	ostream_puts(ostream, "\tif (kind == NULL)\n\t\treturn FALSE;\n");
+	ostream_puts(ostream, "\tif (kind->nr_children >= 0 && node->type_name != typed_tree_node_type)\n\t{\n");
+	ostream_puts(ostream, "\t\tif (visitor->visit_generic_form == NULL)\n\t\t\treturn FALSE;\n");
+	ostream_puts(ostream, "\t\tvisitor->visit_generic_form((tree_p)node, kind, data);\n\t\treturn TRUE;\n\t}\n");
+	ostream_puts(ostream, "\tswitch (kind->index)\n\t{\n");
+	for (int i = 0; i < schema->nr_kinds; i++)
 	{
-		fprintf(stderr, "ERROR: failed to parse string from '%s'\n", input);
+		ast_kind_p kind = &schema->kinds[i];
+		ostream_puts(ostream, "\t\tcase ");
+		ast_put_name(ostream, prefix, kind->name, ":\n");
+		ostream_puts(ostream, "\t\t\tif (visitor->visit_");
+		ast_put_identifier(ostream, kind->name);
+		ostream_puts(ostream, " == NULL)\n\t\t\t\treturn FALSE;\n\t\t\tvisitor->visit_");
+		ast_put_identifier(ostream, kind->name);
+		ostream_puts(ostream, "((");
+		if (kind->nr_children < 0)
+			ostream_puts(ostream, "tree_p");
+		else
+			ast_put_name(ostream, prefix, kind->name, "_p");
+		ostream_puts(ostream, ")node, data);\n\t\t\treturn TRUE;\n");
 	}
-	DISP_RESULT(result);
-	
-	solutions_free(&solutions);
-
-	EXIT_RESULT_CONTEXT
-}
-
-void test_string_grammar(non_terminal_dict_p *all_nt)
-{
-	test_parse_string(all_nt, "\"abc\"", "abc");
-	test_parse_string(all_nt, "\"\\0\"", "");
-	test_parse_string(all_nt, "\"\\'\"", "\'");
-	test_parse_string(all_nt, "\"abc\" /* */ \"def\"", "abcdef");
-	test_parse_string(all_nt, "\"\\n\"", "\n");
+	ostream_puts(ostream, "\t}\n\treturn FALSE;\n}\n");
 }
 
 /*
-	Int result
-	~~~~~~~~~~
+	Recovering from errors
+	~~~~~~~~~~~~~~~~~~~~~~
 	
-	For parsing an integer value a single function will used,
-	which will implement a co-routine for processing the
-	characters.
+	When a sequence with synchronization characters stops at a character that
+	cannot follow it, the error is recorded together with the expected
+	elements at the highest position that was reached. The scan for the
+	synchronization character starts at this position, because the start of
+	the failing element (for example the keyword of a statement) is often
+	followed by synchronization characters that belong to it. After the
+	error has been recorded, the expected elements are reset, such that
+	the next error is reported independently.
+	When the scan has to stop before a non-terminal, the non-terminal is
+	recognized at the positions where it can start according to its FIRST
+	set (see grammar_analyse), or at all positions when the grammar was
+	not analysed. The results of these attempts are cached like any other.
+	Errors are recorded while parsing, also inside alternatives that fail
+	later on. When a rule or a sequence fails, the errors recorded since
+	it started are removed again (see parse_errors_truncate), such that
+	only the errors of the parse that was accepted remain. When a
+	non-terminal is parsed, a copy of the errors recorded while parsing it
+	is stored with its cache item, and added to the errors again when the
+	result of the cache item is used.
 */
 
-typedef struct int_data
+struct parse_error
 {
-	ref_counted_base_t _base;
-	long long int value;
-	int state;
-	int sign;
-	text_pos_t ps;
-} *int_data_p;
+	text_pos_t pos;             /* Highest position reached */
+	text_pos_t start;           /* Start of the skipped text */
+	text_pos_t resume;          /* Position where parsing resumed */
+	int nr_expected;
+	expect_t *expected;         /* The expected elements at pos */
+	parse_error_p next;
+};
 
-void int_data_print(void *data, ostream_p ostream)
+void parse_error_list_free(parse_error_p errors)
 {
-	int_data_p int_data = CAST(int_data_p, data);
-	char buffer[51];
-	snprintf(buffer, 50, "int %lld", int_data->sign * int_data->value);
-	buffer[50] = '\0';
-	ostream_puts(ostream, buffer);
+	while (errors != NULL)
+	{
+		parse_error_p error = errors;
+		errors = error->next;
+		for (int i = 0; i < error->nr_expected; i++)
+			nt_stack_dispose(error->expected[i].nt_stack);
+		if (error->expected != NULL)
+			FREE(error->expected);
+		FREE(error);
+	}
 }
 
-void int_set_pos(result_p result, text_pos_p ps)
+/*	- Function to copy a list of errors (and to return the last copy) */
+
+parse_error_p parse_error_list_copy(parse_error_p errors, parse_error_p *ref_last)
 {
-	if (result->data != NULL && CAST(int_data_p, result->data)->ps.cur_line == -1)
-		CAST(int_data_p, result->data)->ps = *ps;
+	parse_error_p copies = NULL;
+	parse_error_p *ref_copy = &copies;
+	*ref_last = NULL;
+	for (; errors != NULL; errors = errors->next)
+	{
+		parse_error_p copy = MALLOC(struct parse_error);
+		*copy = *errors;
+		copy->expected = copy->nr_expected > 0 ? MALLOC_N(copy->nr_expected, expect_t) : NULL;
+		for (int i = 0; i < copy->nr_expected; i++)
+		{
+			copy->expected[i] = errors->expected[i];
+			copy->expected[i].nt_stack->ref_count++;
+		}
+		copy->next = NULL;
+		*ref_copy = copy;
+		ref_copy = &copy->next;
+		*ref_last = copy;
+	}
+	return copies;
 }
 
-#define INT_DATA_WAIT_NEXT_CHAR(X)  int_data->state = X; return TRUE; L##X:
+/*	- Functions to add (a copy of) errors, and to remove the errors after
+	  a mark, which is the last error at the moment the mark was taken */
 
-bool int_data_add_char(result_p prev, char ch, result_p result)
+void parse_errors_append(parser_p parser, parse_error_p errors, parse_error_p last)
 {
-	if (prev->data == NULL)
+	if (errors == NULL)
+		return;
+	if (parser->last_error == NULL)
+		parser->errors = errors;
+	else
+		parser->last_error->next = errors;
+	parser->last_error = last;
+}
+
+parse_error_p parse_errors_copy_after(parser_p parser, parse_error_p mark)
+{
+	if (parser->last_error == mark)
+		return NULL;
+	parse_error_p last;
+	return parse_error_list_copy(mark == NULL ? parser->errors : mark->next, &last);
+}
+
+void parse_errors_truncate(parser_p parser, parse_error_p mark)
+{
+	if (parser->last_error == mark)
+		return;
+	if (mark == NULL)
 	{
-		int_data_p int_data = MALLOC(struct int_data);
-		int_data->value = 0;
-		int_data->state = 0;
-		int_data->sign = 1;
-		int_data->_base.release = 0;
-		int_data->ps.cur_line = -1;
-		result_assign_ref_counted(result, int_data, int_data_print);
-		SET_TYPE("int_data_p", int_data);
+		parse_error_list_free(parser->errors);
+		parser->errors = NULL;
 	}
 	else
-		result_assign(result, prev);
-	int_data_p int_data = CAST(int_data_p, result->data);
-	
-	switch (int_data->state)
 	{
-		case 0: goto L0;
-		case 1: goto L1;
-		case 2: goto L2;
-		case 3: goto L3;
-		case 4: goto L4;
-		case 5: goto L5;
-		case 6: goto L6;
+		parse_error_list_free(mark->next);
+		mark->next = NULL;
 	}
-	L0:
+	parser->last_error = mark;
+}
+
+void parse_error_add(parser_p parser, text_pos_p start, text_pos_p resume)
+{
+	parse_error_p error = MALLOC(struct parse_error);
+	error->pos = highest_pos.pos > start->pos ? highest_pos : *start;
+	error->start = *start;
+	error->resume = *resume;
+	/* The references to the non-terminal stacks are moved to the error */
+	error->nr_expected = highest_pos.pos >= start->pos ? nr_expected : 0;
+	error->expected = error->nr_expected > 0 ? MALLOC_N(error->nr_expected, expect_t) : NULL;
+	for (int i = 0; i < error->nr_expected; i++)
+		error->expected[i] = expected[i];
+	error->next = NULL;
+	parse_errors_append(parser, error, error);
+
+	highest_pos = *resume;
+	nr_expected = 0;
+}
+
+/*	- Function to check whether the non-terminal to resume at can be
+	  recognized at a position */
+
+bool parse_recover_resume_at(parser_p parser, non_terminal_p non_term, const char *s)
+{
+	if (non_term->first != NULL && !non_term->nullable && !char_set_contains(non_term->first, *s))
+		return FALSE;
+	text_buffer_p text_buffer = parser->text_buffer;
+	text_buffer_advance_to(text_buffer, s - text_buffer->buffer);
+	text_pos_t pos = text_buffer->pos;
+	ENTER_RESULT_CONTEXT
+	DECL_RESULT(result);
+	parser->recognize_only++;
+	bool recognized = parse_nt(parser, non_term, &result);
+	parser->recognize_only--;
+	DISP_RESULT(result);
+	EXIT_RESULT_CONTEXT
+	text_buffer_set_pos(text_buffer, &pos);
+	return recognized;
+}
+
+bool parse_recover(parser_p parser, element_p element, const result_p prev_seq, result_p result)
+{
+	recover_p recover = element->recover;
+	if (recover == NULL || !parser->recover || parser->recognize_only > 0 || element->back_tracking)
+		return FALSE;
+	text_buffer_p text_buffer = parser->text_buffer;
+	if (text_buffer_end(text_buffer) || char_set_contains(recover->stop_before, *text_buffer->info))
+		return FALSE;
 	
-	if (ch == '-')
+	/* Skip to the synchronization point, which is always beyond the start */
+	text_pos_t start = text_buffer->pos;
+	const char *s = text_buffer->buffer + (highest_pos.pos > start.pos ? highest_pos.pos : start.pos);
+	const char *end = text_buffer->buffer + text_buffer->buffer_len;
+	for (; s < end; s++)
+		if (char_set_contains(recover->skip_past, *s))
+		{
+			s++;
+			break;
+		}
+		else if (char_set_contains(recover->stop_before, *s))
+			break;
+		else if (   recover->resume_at != NULL && s > text_buffer->buffer + start.pos
+				 && parse_recover_resume_at(parser, recover->resume_at, s))
+			break;
+	text_buffer_advance_to(text_buffer, s - text_buffer->buffer);
+	if (recover->after != NULL)
 	{
-		int_data->sign = -1;
-		INT_DATA_WAIT_NEXT_CHAR(1)
+		ENTER_RESULT_CONTEXT
+		DECL_RESULT(after);
+		parser->recognize_only++;
+		parse_nt(parser, recover->after, &after);
+		parser->recognize_only--;
+		DISP_RESULT(after);
+		EXIT_RESULT_CONTEXT
 	}
-	if (ch == '0')
+	text_pos_t resume = text_buffer->pos;
+
+	if (recover->add_error_function == NULL)
+		result_assign(result, prev_seq);
+	else if (!recover->add_error_function(prev_seq, &start, result))
 	{
-		INT_DATA_WAIT_NEXT_CHAR(2)
-		if (ch == 'x')
-		{
-			// Process hexa decimal number
-			INT_DATA_WAIT_NEXT_CHAR(3)
-			for (;;)
-			{
-				if ('0' <= ch && ch <= '9')
-					int_data->value = 16 * int_data->value + ch - '0';
-				else if ('A' <= ch && ch <= 'F')
-					int_data->value = 16 * int_data->value + ch + (10 - 'A');
-				else if ('a' <= ch && ch <= 'f')
-					int_data->value = 16 * int_data->value + ch + (10 - 'a');
-				else
-					break;
-				INT_DATA_WAIT_NEXT_CHAR(4)
-			}
-		}
-		else
-		{
-			// Process octal number
-			while ('0' <= ch && ch <= '7')
-			{
-				int_data->value = 8 * int_data->value +  ch - '0';
-				INT_DATA_WAIT_NEXT_CHAR(5)
-			}
-		}
+		text_buffer_set_pos(text_buffer, &start);
+		return FALSE;
 	}
-	else
+	parse_error_add(parser, &start, &resume);
+	return TRUE;
+}
+
+void print_parse_errors(FILE *fout, parser_p parser)
+{
+	for (parse_error_p error = parser->errors; error != NULL; error = error->next)
 	{
-		// Process decimal number
-		while ('0' <= ch && ch <= '9')
+		fprintf(fout, "Error at %d.%d (skipped from %d.%d to %d.%d)\n",
+				error->pos.cur_line, error->pos.cur_column, error->start.cur_line, error->start.cur_column,
+				error->resume.cur_line, error->resume.cur_column);
+		for (int i = 0; i < error->nr_expected; i++)
 		{
-			int_data->value = 10 * int_data->value + ch - '0';
-			INT_DATA_WAIT_NEXT_CHAR(6)
+			fprintf(fout, "- expect ");
+			element_print(fout, error->expected[i].element);
+			fprintf(fout, "\n");
 		}
 	}
-	return FALSE;
 }
 
-/*	Int tree node structure */
-
-typedef struct int_node_t *int_node_p;
-struct int_node_t
+void parse_errors_free(parser_p parser)
 {
-	tree_node_t _node;
-	long long int value;
-};
+	parse_errors_truncate(parser, NULL);
+}
 
-const char *int_node_type = "int_node_type";
 
-void int_node_print(void *data, ostream_p ostream)
+/*
+	Shadow verification
+	~~~~~~~~~~~~~~~~~~~
+
+	Caches, compiled functions and the predictions for LL(1) non-terminals
+	should not change the outcome of parsing. To gain confidence in this on
+	real input, and not only on the tests, a fraction of the parses can be
+	verified in shadow mode: the input is copied and parsed again by the
+	reference parser, which uses none of these, on a background thread.
+	(The reference parser only uses the brute force cache, because without
+	a cache parsing can take exponential time.) The success, the end
+	position and the printed result are compared. When a printed result
+	does not fit in max_output, the parse is counted as too long instead of
+	as verified, unless a difference was found.
+	The primary parse only pays for copying the input and printing its
+	result, and only when it is sampled. When the background thread falls
+	behind, samples are dropped instead of waiting for it. The input of a
+	mismatch is minimized, by removing parts of it as long as the mismatch
+	remains, and recorded. (Without threads, the samples are verified
+	right after the primary parse.)
+*/
+
+typedef struct
 {
-	int_node_p int_node = (int_node_p)data;
-	char buffer[51];
-	snprintf(buffer, 50, "int %lld", int_node->value);
-	buffer[50] = '\0';
-	ostream_puts(ostream, buffer);
+	double fraction;          /* The fraction of the parses that is verified */
+	unsigned long long seed;  /* For selecting the parses */
+	int max_pending;          /* Samples waiting for verification, above which samples are dropped */
+	unsigned int max_output;  /* Size of the buffer for the printed result */
+	int max_minimize_runs;    /* Parses of reduced inputs when minimizing a mismatch */
+	int max_mismatches;       /* Mismatches that are recorded */
+} shadow_options_t, *shadow_options_p;
+
+void shadow_options_init(shadow_options_p options)
+{
+	options->fraction = 0.01;
+	options->seed = 1;
+	options->max_pending = 16;
+	options->max_output = 100000;
+	options->max_minimize_runs = 1000;
+	options->max_mismatches = 10;
 }
 
-bool create_int_tree(const result_p rule_result, void* data, result_p result)
+/*	- The primary engine is described by how a parser is set up for a
+	  text buffer. When cache_new is not NULL, it is called to create the
+	  cache, which is freed with cache_free after parsing. */
+
+typedef struct
 {
-	int_data_p int_data = CAST(int_data_p, rule_result->data);
-	
-	int_node_p int_node = MALLOC(struct int_node_t);
-	init_tree_node(&int_node->_node, int_node_type, NULL);
-	tree_node_set_pos(&int_node->_node, &int_data->ps);
-	int_node->value = int_data->sign * int_data->value;
-	result_assign_ref_counted(result, int_node, int_node_print);
-	SET_TYPE("int_data_p", int_data);
-	return TRUE;
-}
-		
-/*	Int grammar */
+	void *(*cache_new)(text_buffer_p text_buffer);
+	void (*cache_free)(void *cache);
+	cache_item_p (*cache_hit_function)(void *cache, size_t pos, const char *nt);
+	void (*cache_set_result_function)(void *cache, size_t pos, const char *nt, cache_item_p cache_item);
+	bool recover;
+} shadow_engine_t, *shadow_engine_p;
 
-void int_grammar(non_terminal_dict_p *all_nt)
+typedef struct
 {
-	HEADER(all_nt)
-	
-	NT_DEF("int")
-		RULE
-			CHARF('-', int_data_add_char) OPT(0) SET_PS(int_set_pos)
-			{ GROUPING
-				RULE // hexadecimal representaion
-					CHARF('0', int_data_add_char) SET_PS(int_set_pos) 
-					CHARF('x', int_data_add_char)
-					CHARSET(int_data_add_char) ADD_RANGE('0','9') ADD_RANGE('A','F') ADD_RANGE('a','f') SEQ(pass_to_sequence, use_sequence_result)
-				RULE // octal representation
-					CHARF('0', int_data_add_char) SET_PS(int_set_pos) 
-					CHARSET(int_data_add_char) ADD_RANGE('0','7') SEQ(pass_to_sequence, use_sequence_result) OPT(0)
-				RULE // decimal representation
-					CHARSET(int_data_add_char) ADD_RANGE('1','9') SET_PS(int_set_pos) 
-					CHARSET(int_data_add_char) ADD_RANGE('0','9') SEQ(pass_to_sequence, use_sequence_result) OPT(0)
- 			}
-			CHAR('U') OPT(0)
-			CHAR('L') OPT(0)
-			CHAR('L') OPT(0)
-			END_FUNCTION(create_int_tree)
-}
+	bool parsed;
+	size_t end_pos;
+	char *output;             /* The printed result (when parsed) */
+	bool truncated;           /* Whether the printed result did not fit */
+} shadow_outcome_t, *shadow_outcome_p;
 
-void test_parse_int(non_terminal_dict_p *all_nt, const char *input, long long int value)
+typedef struct
 {
-	ENTER_RESULT_CONTEXT
+	non_terminal_p nt;
+	char *text;
+	size_t len;
+	shadow_outcome_t primary;
+} shadow_job_t, *shadow_job_p;
 
-	text_buffer_t text_buffer;
-	text_buffer_assign_string(&text_buffer, input);
-	
-	solutions_t solutions;
-	solutions_init(&solutions, &text_buffer);
-	
+typedef struct shadow_mismatch *shadow_mismatch_p;
+struct shadow_mismatch
+{
+	const char *nt;
+	const char *difference;   /* What is different */
+	char *input;              /* The minimized input */
+	size_t len;
+	size_t original_len;
+	shadow_mismatch_p next;
+};
+
+typedef struct
+{
+	shadow_options_t options;
+	shadow_engine_t engine;
+	unsigned long long random;
+	unsigned long nr_parses;
+	unsigned long nr_sampled;
+	unsigned long nr_dropped;
+	/* Shared with the background thread */
+	shadow_job_p jobs;        /* Circular buffer with the samples to verify */
+	int first_job;
+	int nr_jobs;
+	bool verifying;
+	unsigned long nr_verified;
+	unsigned long nr_too_long;
+	unsigned long nr_mismatches;
+	shadow_mismatch_p mismatches;
+	shadow_mismatch_p *ref_last_mismatch;
+	bool on_thread;
+#ifdef USE_THREADS
+	bool stop;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+#endif
+} shadow_t, *shadow_p;
+
+/*	- Function to parse with the primary engine or the reference parser */
+
+bool shadow_engine_parse(shadow_p shadow, bool reference, non_terminal_p nt, text_buffer_p text_buffer, result_p result)
+{
 	parser_t parser;
-	parser_init(&parser, &text_buffer);
-	parser.cache_hit_function = solutions_find;
-	parser.cache = &solutions;
-	
-	DECL_RESULT(result);
-	if (parse_nt(&parser, find_nt("int", all_nt), &result) && text_buffer_end(&text_buffer))
+	parser_init(&parser, text_buffer);
+	parser.recover = shadow->engine.recover;
+	parser.reference = reference;
+	void *cache = NULL;
+	solutions_t solutions;
+	if (reference)
 	{
-		if (result.data == NULL)
-			fprintf(stderr, "ERROR: parsing '%s' did not return result\n", input);
-		else
-		{
-			tree_node_p tree_node = (tree_node_p)result.data;
-			if (tree_node->line != 1 && tree_node->column != 1)
-				fprintf(stderr, "WARNING: tree node position %d:%d is not 1:1\n", tree_node->line, tree_node->column);
-			if (tree_node->type_name != int_node_type)
-				fprintf(stderr, "ERROR: tree node is not of type int_node_type\n");
-			else
-			{
-				int_node_p int_node = (int_node_p)tree_node;
-				if (int_node->value != value)
-					fprintf(stderr, "ERROR: parsed value %lld from '%s' instead of expected %lld\n",
-					int_node->value, input, value);
-				else
-					fprintf(stderr, "OK: parsed integer %lld from \"%s\"\n", int_node->value, input);
-			}
-		}
+		solutions_init(&solutions, text_buffer);
+		parser.cache_hit_function = solutions_find;
+		parser.cache = &solutions;
 	}
 	else
 	{
-		fprintf(stderr, "ERROR: failed to parse int from '%s'\n", input);
+		if (shadow->engine.cache_new != NULL)
+			cache = shadow->engine.cache_new(text_buffer);
+		parser.cache_hit_function = shadow->engine.cache_hit_function;
+		parser.cache_set_result_function = shadow->engine.cache_set_result_function;
+		parser.cache = cache;
 	}
-	DISP_RESULT(result);
-	
-	solutions_free(&solutions);
+	bool parsed = parse_nt(&parser, nt, result);
+	if (reference)
+		solutions_free(&solutions);
+	else if (cache != NULL)
+		shadow->engine.cache_free(cache);
+	parse_errors_free(&parser);
+	return parsed;
+}
+
+void shadow_outcome_init(shadow_p shadow, shadow_outcome_p outcome, bool parsed, size_t end_pos, result_p result)
+{
+	outcome->parsed = parsed;
+	outcome->end_pos = end_pos;
+	outcome->output = NULL;
+	outcome->truncated = FALSE;
+	if (parsed)
+	{
+		outcome->output = MALLOC_N(shadow->options.max_output, char);
+		fixed_string_ostream_t fixed_string_ostream;
+		fixed_string_ostream_init(&fixed_string_ostream, outcome->output, shadow->options.max_output);
+		result_print(result, &fixed_string_ostream.ostream);
+		outcome->truncated = fixed_string_ostream.i == fixed_string_ostream.len;
+		fixed_string_ostream_finish(&fixed_string_ostream);
+	}
+}
 
-	EXIT_RESULT_CONTEXT
+void shadow_outcome_release(shadow_outcome_p outcome)
+{
+	if (outcome->output != NULL)
+		FREE(outcome->output);
 }
 
-void test_int_grammar(non_terminal_dict_p *all_nt)
+/*	- Function to parse a text (that can contain null characters) */
+
+void shadow_run(shadow_p shadow, bool reference, non_terminal_p nt, const char *text, size_t len, shadow_outcome_p outcome)
 {
-	test_parse_int(all_nt, "0", 0);
-	test_parse_int(all_nt, "1", 1);
-	test_parse_int(all_nt, "-1", -1);
-	test_parse_int(all_nt, "077", 077);
-	test_parse_int(all_nt, "0xAbc", 0xAbc);
-	test_parse_int(all_nt, "1234L", 1234);
-	test_parse_int(all_nt, "-23", -23);
-	test_parse_int(all_nt, "46464664", 46464664);
+	ENTER_RESULT_CONTEXT
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, text);
+	text_buffer.buffer_len = len;
+	DECL_RESULT(result);
+	bool parsed = shadow_engine_parse(shadow, reference, nt, &text_buffer, &result);
+	shadow_outcome_init(shadow, outcome, parsed, text_buffer.pos.pos, &result);
+	DISP_RESULT(result);
+	EXIT_RESULT_CONTEXT
 }
 
+/*	- Function that returns what is different (or NULL) */
 
-bool equal_string(result_p result, const void *argument)
+const char *shadow_compare(shadow_outcome_p primary, shadow_outcome_p reference)
 {
-	const char *keyword_name = (const char*)argument;
-	return    result->data != NULL
-		   && ((tree_node_p)result->data)->type_name == ident_node_type
-		   && strcmp(CAST(ident_p, result->data)->name, keyword_name) == 0;
+	if (primary->parsed != reference->parsed)
+		return "success";
+	if (!primary->parsed)
+		return NULL;
+	if (primary->end_pos != reference->end_pos)
+		return "end position";
+	if (strcmp(primary->output, reference->output) != 0)
+		return "result";
+	return NULL;
 }
 
-bool not_a_keyword(result_p result, const void *argument)
+const char *shadow_run_both(shadow_p shadow, non_terminal_p nt, const char *text, size_t len)
 {
-	ident_p ident = CAST(ident_p, result->data);
-	return !ident->is_keyword;
+	shadow_outcome_t primary;
+	shadow_run(shadow, FALSE, nt, text, len, &primary);
+	shadow_outcome_t reference;
+	shadow_run(shadow, TRUE, nt, text, len, &reference);
+	const char *difference = shadow_compare(&primary, &reference);
+	shadow_outcome_release(&primary);
+	shadow_outcome_release(&reference);
+	return difference;
 }
 
-const char* list_type = "list";
+/*	- Function to remove parts of the text as long as the mismatch remains
+	  (with the same difference). Returns the new length. */
 
-bool add_seq_as_list(result_p prev, result_p seq, result_p result)
+size_t shadow_minimize(shadow_p shadow, non_terminal_p nt, char *text, size_t len, const char *difference)
 {
-	prev_child_p prev_child = CAST(prev_child_p, prev->data);
-	if (prev_child != NULL)
-		ref_counted_base_inc(prev_child);
-	prev_child_p new_prev_child = malloc_prev_child();
-	new_prev_child->prev = prev_child;
-	tree_p list = make_tree_with_children(list_type, CAST(prev_child_p, seq->data));
-	result_assign_ref_counted(&new_prev_child->child, list, tree_print);
-	SET_TYPE("tree_p", list);
-	result_assign_ref_counted(result, new_prev_child, NULL);
-	SET_TYPE("prev_child_p", new_prev_child);
-	return TRUE;
+	char *buffer = MALLOC_N(len + 1, char);
+	int nr_runs = 0;
+	for (size_t del_len = len / 2; del_len > 0 && nr_runs < shadow->options.max_minimize_runs; del_len /= 2)
+		for (size_t pos = 0; pos + del_len <= len && nr_runs < shadow->options.max_minimize_runs; nr_runs++)
+		{
+			size_t new_len = 0;
+			for (size_t i = 0; i < len; i++)
+				if (i < pos || i >= pos + del_len)
+					buffer[new_len++] = text[i];
+			buffer[new_len] = '\0';
+			if (shadow_run_both(shadow, nt, buffer, new_len) == difference)
+			{
+				memcpy(text, buffer, new_len + 1);
+				len = new_len;
+			}
+			else
+				pos++;
+		}
+	FREE(buffer);
+	return len;
 }
 
-#define ADD_CHILD element->add_function = add_child;
-#define NT(S) NTF(S, add_child)
-#define NTP(S) NTF(S, take_child)
-#define WS NTF("white_space", 0)
-#define PASS rules->end_function = pass_tree;
-#define TREE(N) rules->end_function = make_tree; rules->end_function_data = N;
-#define KEYWORD(K) NTF("ident", 0) element->condition = equal_string; element->condition_argument = ident_string(K); *keyword_state = 1; WS
-#define OPTN OPT(0)
-#define IDENT NTF("ident", add_child) element->condition = not_a_keyword; WS
-#define IDENT_OPT NTF("ident", add_child) element->condition = not_a_keyword; OPTN WS
-#define SEQL SEQ(0, add_seq_as_list)
-#define REC_RULEC REC_RULE(rec_add_child);
-#define CHAR_WS(C) CHAR(C) WS
+/*	- Function to verify a sample with the reference parser */
 
-void c_grammar(non_terminal_dict_p *all_nt)
+void shadow_verify(shadow_p shadow, shadow_job_p job)
 {
-	white_space_grammar(all_nt);
-	ident_grammar(all_nt);
-	
-	HEADER(all_nt)
-	
-	NT_DEF("primary_expr")
-		RULE IDENT PASS
-		RULE NTP("int") WS
-		RULE NTP("double") WS
-		RULE NTP("char") WS
-		RULE NTP("string") WS
-		RULE CHAR_WS('(') NTP("expr") CHAR_WS(')')
+	shadow_outcome_t reference;
+	shadow_run(shadow, TRUE, job->nt, job->text, job->len, &reference);
+	const char *difference = shadow_compare(&job->primary, &reference);
+	bool too_long = difference == NULL && (job->primary.truncated || reference.truncated);
+	shadow_outcome_release(&reference);
+	shadow_outcome_release(&job->primary);
 
-	NT_DEF("postfix_expr")
-		RULE NTP("primary_expr")
-		REC_RULEC CHAR_WS('[') NT("expr") CHAR_WS(']') TREE("arrayexp")
-		REC_RULEC CHAR_WS('(') NT("assignment_expr") SEQL { CHAIN CHAR_WS(',') } OPTN CHAR_WS(')') TREE("call")
-		REC_RULEC CHAR_WS('.') IDENT TREE("field")
-		REC_RULEC CHAR('-') CHAR_WS('>') IDENT TREE("fieldderef")
-		REC_RULEC CHAR('+') CHAR_WS('+') TREE("post_inc")
-		REC_RULEC CHAR('-') CHAR_WS('-') TREE("post_dec")
+	shadow_mismatch_p mismatch = NULL;
+	if (difference != NULL)
+	{
+		mismatch = MALLOC(struct shadow_mismatch);
+		mismatch->nt = job->nt->name;
+		mismatch->difference = difference;
+		mismatch->original_len = job->len;
+		mismatch->len = shadow_minimize(shadow, job->nt, job->text, job->len, difference);
+		mismatch->input = job->text;
+		mismatch->next = NULL;
+	}
+	else
+		FREE(job->text);
 
-	NT_DEF("unary_expr")
-		RULE CHAR('+') CHAR_WS('+') NT("unary_expr") TREE("pre_inc")
-		RULE CHAR('-') CHAR_WS('-') NT("unary_expr") TREE("pre_dec")
-		RULE CHAR_WS('&') NT("cast_expr") TREE("address_of")
-		RULE CHAR_WS('*') NT("cast_expr") TREE("deref")
-		RULE CHAR_WS('+') NT("cast_expr") TREE("plus")
-		RULE CHAR_WS('-') NT("cast_expr") TREE("min")
-		RULE CHAR_WS('~') NT("cast_expr") TREE("invert")
-		RULE CHAR_WS('!') NT("cast_expr") TREE("not")
-		RULE KEYWORD("sizeof") CHAR_WS('(') NT("sizeof_type") CHAR_WS(')') TREE("sizeof")
-		RULE KEYWORD("sizeof") NT("unary_expr") TREE("sizeof_expr")
-		RULE NTP("postfix_expr")
+#ifdef USE_THREADS
+	if (shadow->on_thread)
+		pthread_mutex_lock(&shadow->mutex);
+#endif
+	if (too_long)
+		shadow->nr_too_long++;
+	else
+		shadow->nr_verified++;
+	if (mismatch != NULL)
+	{
+		if (shadow->nr_mismatches++ < (unsigned long)shadow->options.max_mismatches)
+		{
+			*shadow->ref_last_mismatch = mismatch;
+			shadow->ref_last_mismatch = &mismatch->next;
+			mismatch = NULL;
+		}
+	}
+#ifdef USE_THREADS
+	if (shadow->on_thread)
+		pthread_mutex_unlock(&shadow->mutex);
+#endif
+	if (mismatch != NULL)
+	{
+		FREE(mismatch->input);
+		FREE(mismatch);
+	}
+}
 
-	NT_DEF("sizeof_type")
-		RULE KEYWORD("char") TREE("char")
-		RULE KEYWORD("short") TREE("short")
-		RULE KEYWORD("int") TREE("int")
-		RULE KEYWORD("long") TREE("long")
-		RULE KEYWORD("signed") NT("sizeof_type") TREE("signed")
-		RULE KEYWORD("unsigned") NT("sizeof_type") TREE("unsigned")
-		RULE KEYWORD("float") TREE("float")
-		RULE KEYWORD("double") NT("sizeof_type") OPTN TREE("double")
-		RULE KEYWORD("const") NT("sizeof_type") TREE("const")
-		RULE KEYWORD("volatile") NT("sizeof_type") TREE("volatile")
-		RULE KEYWORD("void") TREE("void")
-		RULE KEYWORD("struct") IDENT TREE("structdecl")
-		RULE IDENT PASS
-		REC_RULEC WS CHAR_WS('*') TREE("pointdecl")
+#ifdef USE_THREADS
 
-	NT_DEF("cast_expr")
-		RULE CHAR_WS('(') NT("abstract_declaration") CHAR_WS(')') NT("cast_expr") TREE("cast")
-		RULE NTP("unary_expr")
+void *shadow_thread(void *data)
+{
+	shadow_p shadow = (shadow_p)data;
+	pthread_mutex_lock(&shadow->mutex);
+	for (;;)
+	{
+		while (shadow->nr_jobs == 0 && !shadow->stop)
+			pthread_cond_wait(&shadow->cond, &shadow->mutex);
+		if (shadow->nr_jobs == 0)
+			break;
+		shadow_job_t job = shadow->jobs[shadow->first_job];
+		shadow->first_job = (shadow->first_job + 1) % shadow->options.max_pending;
+		shadow->nr_jobs--;
+		shadow->verifying = TRUE;
+		pthread_mutex_unlock(&shadow->mutex);
 
-	NT_DEF("l_expr1")
-		RULE NTP("cast_expr")
-		REC_RULEC WS CHAR_WS('*') NT("cast_expr") TREE("times")
-		REC_RULEC WS CHAR_WS('/') NT("cast_expr") TREE("div")
-		REC_RULEC WS CHAR_WS('%') NT("cast_expr") TREE("mod")
+		shadow_verify(shadow, &job);
 
-	NT_DEF("l_expr2")
-		RULE NTP("l_expr1")
-		REC_RULEC WS CHAR_WS('+') NT("l_expr1") TREE("add")
-		REC_RULEC WS CHAR_WS('-') NT("l_expr1") TREE("sub")
+		pthread_mutex_lock(&shadow->mutex);
+		shadow->verifying = FALSE;
+		pthread_cond_broadcast(&shadow->cond);
+	}
+	pthread_mutex_unlock(&shadow->mutex);
+	parse_thread_free();
+	return NULL;
+}
 
-	NT_DEF("l_expr3")
-		RULE NTP("l_expr2")
-		REC_RULEC WS CHAR('<') CHAR_WS('<') NT("l_expr2") TREE("ls")
-		REC_RULEC WS CHAR('>') CHAR_WS('>') NT("l_expr2") TREE("rs")
+#endif
 
-	NT_DEF("l_expr4")
-		RULE NTP("l_expr3")
-		REC_RULEC WS CHAR('<') CHAR_WS('=') NT("l_expr3") TREE("le")
-		REC_RULEC WS CHAR('>') CHAR_WS('=') NT("l_expr3") TREE("ge")
-		REC_RULEC WS CHAR_WS('<') NT("l_expr3") TREE("lt")
-		REC_RULEC WS CHAR_WS('>') NT("l_expr3") TREE("gt")
-		REC_RULEC WS CHAR('=') CHAR_WS('=') NT("l_expr3") TREE("eq")
-		REC_RULEC WS CHAR('!') CHAR_WS('=') NT("l_expr3") TREE("ne")
+void shadow_init(shadow_p shadow, shadow_engine_p engine, shadow_options_p options)
+{
+	shadow->options = *options;
+	if (shadow->options.max_pending < 1)
+		shadow->options.max_pending = 1;
+	shadow->engine = *engine;
+	shadow->random = options->seed != 0 ? options->seed : 1;
+	shadow->nr_parses = 0;
+	shadow->nr_sampled = 0;
+	shadow->nr_dropped = 0;
+	shadow->jobs = MALLOC_N(shadow->options.max_pending, shadow_job_t);
+	shadow->first_job = 0;
+	shadow->nr_jobs = 0;
+	shadow->verifying = FALSE;
+	shadow->nr_verified = 0;
+	shadow->nr_too_long = 0;
+	shadow->nr_mismatches = 0;
+	shadow->mismatches = NULL;
+	shadow->ref_last_mismatch = &shadow->mismatches;
+	shadow->on_thread = FALSE;
+#ifdef USE_THREADS
+	shadow->stop = FALSE;
+	pthread_mutex_init(&shadow->mutex, NULL);
+	pthread_cond_init(&shadow->cond, NULL);
+	shadow->on_thread = pthread_create(&shadow->thread, NULL, shadow_thread, shadow) == 0;
+#endif
+}
 
-	NT_DEF("l_expr5")
-		RULE NTP("l_expr4")
-		REC_RULEC WS CHAR_WS('^') NT("l_expr4") TREE("bexor")
+/*	- Function to parse a non-terminal with the primary engine. When the
+	  parse is sampled, it is verified with the reference parser. */
 
-	NT_DEF("l_expr6")
-		RULE NTP("l_expr5")
-		REC_RULEC WS CHAR_WS('&') NT("l_expr5") TREE("land")
+bool shadow_parse(shadow_p shadow, non_terminal_p nt, text_buffer_p text_buffer, result_p result)
+{
+	size_t start_pos = text_buffer->pos.pos;
+	bool parsed = shadow_engine_parse(shadow, FALSE, nt, text_buffer, result);
+	shadow->nr_parses++;
 
-	NT_DEF("l_expr7")
-		RULE NTP("l_expr6")
-		REC_RULEC WS CHAR_WS('|') NT("l_expr6") TREE("lor")
+	/* Select the sample (xorshift64*) */
+	shadow->random ^= shadow->random >> 12;
+	shadow->random ^= shadow->random << 25;
+	shadow->random ^= shadow->random >> 27;
+	if ((double)((shadow->random * 0x2545F4914F6CDD1DULL) >> 11) >= shadow->options.fraction * (double)(1ULL << 53))
+		return parsed;
+	shadow->nr_sampled++;
 
-	NT_DEF("l_expr8")
-		RULE NTP("l_expr7")
-		REC_RULEC WS CHAR('&') CHAR_WS('&') NT("l_expr7") TREE("and")
+#ifdef USE_THREADS
+	if (shadow->on_thread)
+	{
+		pthread_mutex_lock(&shadow->mutex);
+		bool full = shadow->nr_jobs == shadow->options.max_pending;
+		pthread_mutex_unlock(&shadow->mutex);
+		if (full)
+		{
+			shadow->nr_dropped++;
+			return parsed;
+		}
+	}
+#endif
 
-	NT_DEF("l_expr9")
-		RULE NTP("l_expr8")
-		REC_RULEC WS CHAR('|') CHAR_WS('|') NT("l_expr8") TREE("or")
+	shadow_job_t job;
+	job.nt = nt;
+	job.len = text_buffer->buffer_len - start_pos;
+	job.text = MALLOC_N(job.len + 1, char);
+	memcpy(job.text, text_buffer->buffer + start_pos, job.len);
+	job.text[job.len] = '\0';
+	shadow_outcome_init(shadow, &job.primary, parsed, text_buffer->pos.pos - start_pos, result);
 
-	NT_DEF("conditional_expr")
-		RULE NT("l_expr9") WS CHAR_WS('?') NT("l_expr9") WS CHAR_WS(':') NT("conditional_expr") TREE("if_expr")
-		RULE NTP("l_expr9")
+#ifdef USE_THREADS
+	if (shadow->on_thread)
+	{
+		/* Only this thread adds jobs, thus there is still room */
+		pthread_mutex_lock(&shadow->mutex);
+		shadow->jobs[(shadow->first_job + shadow->nr_jobs) % shadow->options.max_pending] = job;
+		shadow->nr_jobs++;
+		pthread_cond_broadcast(&shadow->cond);
+		pthread_mutex_unlock(&shadow->mutex);
+		return parsed;
+	}
+#endif
+	shadow_verify(shadow, &job);
+	return parsed;
+}
 
-	NT_DEF("assignment_expr")
-		RULE NT("unary_expr") WS NT("assignment_operator") WS NT("assignment_expr") TREE("assignment")
-		RULE NTP("conditional_expr")
+/*	- Function to wait until all samples are verified and to stop the
+	  background thread */
 
-	NT_DEF("assignment_operator")
-		RULE CHAR_WS('=') TREE("ass")
-		RULE CHAR('*') CHAR_WS('=') TREE("times_ass")
-		RULE CHAR('/') CHAR_WS('=') TREE("div_ass")
-		RULE CHAR('%') CHAR_WS('=') TREE("mod_ass")
-		RULE CHAR('+') CHAR_WS('=') TREE("add_ass")
-		RULE CHAR('-') CHAR_WS('=') TREE("sub_ass")
-		RULE CHAR('<') CHAR('<') CHAR_WS('=') TREE("sl_ass")
-		RULE CHAR('>') CHAR('>') CHAR_WS('=') TREE("sr_ass")
-		RULE CHAR('&') CHAR_WS('=') TREE("and_ass")
-		RULE CHAR('|') CHAR_WS('=') TREE("or_ass")
-		RULE CHAR('^') CHAR_WS('=') TREE("exor_ass")
+void shadow_finish(shadow_p shadow)
+{
+#ifdef USE_THREADS
+	if (shadow->on_thread)
+	{
+		pthread_mutex_lock(&shadow->mutex);
+		shadow->stop = TRUE;
+		pthread_cond_broadcast(&shadow->cond);
+		pthread_mutex_unlock(&shadow->mutex);
+		pthread_join(shadow->thread, NULL);
+		shadow->on_thread = FALSE;
+	}
+#endif
+}
 
-	NT_DEF("expr")
-		RULE NT("assignment_expr") SEQL { CHAIN CHAR_WS(',') } PASS
+void shadow_write_report(shadow_p shadow, ostream_p ostream)
+{
+	char buffer[200];
+	snprintf(buffer, 200, "shadow: %lu parses, %lu sampled, %lu dropped, %lu verified, %lu too long, %lu mismatches\n",
+			 shadow->nr_parses, shadow->nr_sampled, shadow->nr_dropped, shadow->nr_verified, shadow->nr_too_long, shadow->nr_mismatches);
+	ostream_puts(ostream, buffer);
+	for (shadow_mismatch_p mismatch = shadow->mismatches; mismatch != NULL; mismatch = mismatch->next)
+	{
+		snprintf(buffer, 200, "mismatch in %s (%s) on %lu bytes, minimized from %lu: \"",
+				 mismatch->nt, mismatch->difference, (unsigned long)mismatch->len, (unsigned long)mismatch->original_len);
+		ostream_puts(ostream, buffer);
+		ostream_put_c_string(ostream, mismatch->input, mismatch->len);
+		ostream_puts(ostream, "\"\n");
+	}
+}
 
-	NT_DEF("constant_expr")
-		RULE NTP("conditional_expr")
+void shadow_free(shadow_p shadow)
+{
+	shadow_finish(shadow);
+#ifdef USE_THREADS
+	pthread_cond_destroy(&shadow->cond);
+	pthread_mutex_destroy(&shadow->mutex);
+#endif
+	while (shadow->mismatches != NULL)
+	{
+		shadow_mismatch_p mismatch = shadow->mismatches;
+		shadow->mismatches = mismatch->next;
+		FREE(mismatch->input);
+		FREE(mismatch);
+	}
+	FREE(shadow->jobs);
+}
 
-	NT_DEF("declaration")
-		RULE
-		{ GROUPING
-			RULE NT("storage_class_specifier") PASS
-			RULE NT("type_specifier") PASS
-		} SEQL OPTN ADD_CHILD AVOID
-		{ GROUPING
-			RULE NT("func_declarator") CHAR_WS('(')
-			{ GROUPING
-				RULE NTP("parameter_declaration_list") OPTN
-				RULE KEYWORD("void") TREE("void")
-			} ADD_CHILD
-			CHAR_WS(')')
-			{ GROUPING
-				RULE CHAR_WS(';')
-				RULE CHAR_WS('{') NTP("decl_or_stat") CHAR_WS('}')
-			} ADD_CHILD TREE("new_style") WS
-			RULE NT("func_declarator") CHAR_WS('(') NT("ident_list") OPTN CHAR_WS(')') NT("declaration") SEQL OPTN CHAR_WS('{') NT("decl_or_stat") CHAR_WS('}') TREE("old_style")
-			RULE
-			{ GROUPING
-				RULE NT("declarator")
-				{ GROUPING
-					RULE WS CHAR_WS('=') NTP("initializer")
-				} OPTN ADD_CHILD TREE("decl_init")
-			} SEQL OPTN ADD_CHILD { CHAIN CHAR_WS(',') } CHAR_WS(';') TREE("decl")
-		}
+/*
+	Error recovery tests
+	~~~~~~~~~~~~~~~~~~~~
+*/
+
+void test_parse_recover(non_terminal_dict_p *all_nt, const char *nt, const char *input, const char *exp_output, int exp_nr_errors)
+{
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, input);
+	
+	solutions_t solutions;
+	solutions_init(&solutions, &text_buffer);
+	
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	parser.cache_hit_function = solutions_find;
+	parser.cache = &solutions;
+	parser.recover = TRUE;
+	init_expected();
+	
+	char output[1000];
+	bool parsed = parse_to_string(&parser, find_nt(nt, all_nt), output, 1000);
+	int nr_errors = 0;
+	for (parse_error_p error = parser.errors; error != NULL; error = error->next)
+		nr_errors++;
+	if (!parsed)
+		fprintf(stderr, "ERROR: failed to parse '%s' with error recovery\n", input);
+	else if (strcmp(output, exp_output) != 0 || nr_errors != exp_nr_errors)
+	{
+		fprintf(stderr, "ERROR: parsed '%s' to '%s' with %d errors instead of '%s' with %d errors\n",
+				input, output, nr_errors, exp_output, exp_nr_errors);
+		print_parse_errors(stderr, &parser);
+	}
+	else
+		fprintf(stderr, "OK: parsed '%s' to '%s' with %d errors\n", input, output, nr_errors);
+	
+	parse_errors_free(&parser);
+	solutions_free(&solutions);
+}
 
-	NT_DEF("storage_class_specifier")
-		RULE KEYWORD("typedef") TREE("typedef")
-		RULE KEYWORD("extern") TREE("extern")
-		RULE KEYWORD("inline") TREE("inline")
-		RULE KEYWORD("static") TREE("static")
-		RULE KEYWORD("auto") TREE("auto")
-		RULE KEYWORD("register") TREE("register")
+void test_c_grammar_recover(non_terminal_dict_p *all_nt)
+{
+	test_parse_recover(all_nt, "root", "int a; int b;", "list(decl(list(int()),list(decl_init(a,<>))),decl(list(int()),list(decl_init(b,<>))))", 0);
+	test_parse_recover(all_nt, "root", "int a; int b = ; int d;", "list(decl(list(int()),list(decl_init(a,<>))),error(),decl(list(int()),list(decl_init(d,<>))))", 1);
+	test_parse_recover(all_nt, "root", "int f(int a)\n{\n\ta = ;\n\treturn a;\n}\n", "list(new_style(list(int()),f,parameter_declaration_list(list(type(int(),type(a,<>))),<>),decl_or_stat(<>,list(error(),ret(list(a))))))", 1);
+}
 
-	NT_DEF("type_specifier")
-		RULE KEYWORD("char") TREE("char")
-		RULE KEYWORD("short") TREE("short")
-		RULE KEYWORD("int") TREE("int")
-		RULE KEYWORD("long") TREE("long")
-		RULE KEYWORD("signed") TREE("signed")
-		RULE KEYWORD("unsigned") TREE("unsigned")
-		RULE KEYWORD("float") TREE("float")
-		RULE KEYWORD("double") TREE("double")
-		RULE KEYWORD("const") TREE("const")
-		RULE KEYWORD("volatile") TREE("volatile")
-		RULE KEYWORD("void") TREE("void")
-		RULE NT("struct_or_union_specifier")
-		RULE NT("enum_specifier")
-		RULE IDENT PASS
+/*	- The first rule of the root recovers from an error in the block and
+	  then fails, after which the second rule takes the block from the
+	  cache: the error should be reported once. The statements resume at
+	  the next statement. */
 
-	NT_DEF("struct_or_union_specifier")
-		RULE KEYWORD("struct") IDENT_OPT
-		{ GROUPING
-			RULE CHAR_WS('{')
-			{ GROUPING
-				RULE NTP("struct_declaration_or_anon")
-			} SEQL ADD_CHILD
-			CHAR_WS('}') PASS
-		} OPTN ADD_CHILD TREE("struct")
-		RULE KEYWORD("union") IDENT_OPT
-		{ GROUPING
-			RULE CHAR_WS('{')
-			{ GROUPING
-				RULE NTP("struct_declaration_or_anon")
-			} SEQL ADD_CHILD
-			CHAR_WS('}') PASS
-		} OPTN ADD_CHILD TREE("union")
+void recover_test_grammar(non_terminal_dict_p *all_nt)
+{
+	HEADER(all_nt)
+	(void)ref_rec_rule;
+
+	NT_DEF("rec_root")
+		RULE NT("rec_block") CHAR('!') TREE("excl")
+		RULE NT("rec_block") CHAR('?') TREE("quest")
+	NT_DEF("rec_block")
+		RULE CHAR('{') NT("rec_item") SEQL OPTN RECOVER(";", "}", add_error_child) CHAR('}') TREE("block")
+	NT_DEF("rec_item")
+		RULE CHAR('a') CHAR(';') TREE("a")
+	NT_DEF("rec_stats")
+		RULE NT("rec_stat") SEQL OPTN RECOVER("", "", add_error_child) RECOVER_AT("rec_stat") END TREE("stats")
+	NT_DEF("rec_stat")
+		RULE CHAR('x') CHAR('=') CHAR('1') TREE("assign")
+}
 
-	NT_DEF("struct_declaration_or_anon")
-		RULE NTP("struct_or_union_specifier") CHAR_WS(';')
-		RULE NTP("struct_declaration")
+void test_recover_backtracking()
+{
+	non_terminal_dict_p all_nt = NULL;
+	recover_test_grammar(&all_nt);
+	test_parse_recover(&all_nt, "rec_root", "{a;b;a;}!", "excl(block(list(a(),error(),a())))", 1);
+	test_parse_recover(&all_nt, "rec_root", "{a;b;a;}?", "quest(block(list(a(),error(),a())))", 1);
+	test_parse_recover(&all_nt, "rec_root", "{b;a;c;}?", "quest(block(list(error(),a(),error())))", 2);
+	test_parse_recover(&all_nt, "rec_stats", "x=1x=x=1", "stats(list(assign(),error(),assign()))", 1);
+	test_parse_recover(&all_nt, "rec_stats", "x=1yyx=1x", "stats(list(assign(),error(),assign(),error()))", 2);
+}
 
-	NT_DEF("struct_declaration")
-		RULE NT("type_specifier") NT("struct_declaration") TREE("type")
-		RULE NT("struct_declarator") SEQL { CHAIN CHAR_WS(',') } CHAR_WS(';') TREE("strdec")
 
-	NT_DEF("struct_declarator")
-		RULE NT("declarator")
-		{ GROUPING
-			RULE CHAR_WS(':') NT("constant_expr")
-		} OPTN ADD_CHILD TREE("record_field")
+/*
+	Profiler tests
+	~~~~~~~~~~~~~~
+*/
 
-	NT_DEF("enum_specifier")
-		RULE KEYWORD("enum") IDENT_OPT CHAR_WS('{') NT("enumerator") SEQL { CHAIN CHAR_WS(',') } CHAR_WS('}') TREE("enum")
+void test_profile_contains(const char *output, const char *exp_line)
+{
+	if (strstr(output, exp_line) == NULL)
+		fprintf(stderr, "ERROR: profile does not contain '%s'\n", exp_line);
+	else
+		fprintf(stderr, "OK: profile contains '%s'\n", exp_line);
+}
 
-	NT_DEF("enumerator")
-		RULE IDENT
-		{ GROUPING
-			RULE CHAR_WS('=') NTP("constant_expr")
-		} OPTN ADD_CHILD TREE("enumerator")
+void test_profile(non_terminal_dict_p *all_nt)
+{
+	/* Samples of a stack of non-terminals that is constructed by hand */
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, "");
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	profile_reset();
+	nt_stack_push("root", &parser);
+	nt_stack_set_rule(parser.nt_stack, 1);
+	nt_stack_push("expr", &parser);
+	nt_stack_set_rule(parser.nt_stack, -1);
+	profile_sample(&parser);
+	profile_sample(&parser);
+	nt_stack_pop(&parser);
+	profile_sample(&parser);
+	nt_stack_pop(&parser);
+
+	/* (Starting with a newline, such that each line is preceded by one) */
+	char output[1000];
+	output[0] = '\n';
+	fixed_string_ostream_t fixed_string_ostream;
+	fixed_string_ostream_init(&fixed_string_ostream, output + 1, 999);
+	profile_write(&fixed_string_ostream.ostream);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+	test_profile_contains(output, "root#1;expr#r0 2\n");
+	test_profile_contains(output, "\nroot#1 1\n");
+
+	/* Sampling while parsing should not influence the result */
+	const char *unit = "int f(int a)\n{\n\tint b = a; /* one */\n\treturn b * (a + b);\n}\n";
+	size_t unit_len = strlen(unit);
+	char *input = MALLOC_N(200 * unit_len + 1, char);
+	for (int i = 0; i < 200; i++)
+		strcpy(input + i * unit_len, unit);
+	/* (Parsing again until at least one sample was taken) */
+	bool parsed = TRUE;
+#if defined(__unix__) || defined(__APPLE__)
+	struct sigaction old_action;
+	sigaction(SIGPROF, NULL, &old_action);
+#endif
+	profile_start(&parser, 100);
+	for (int i = 0; parsed && (i == 0 || profile_nr_samples == 0) && i < 1000; i++)
+	{
+		text_buffer_assign_string(&text_buffer, input);
+		parser_init(&parser, &text_buffer);
+		solutions_t solutions;
+		solutions_init(&solutions, &text_buffer);
+		parser.cache_hit_function = solutions_find;
+		parser.cache = &solutions;
+		parsed = parse_to_string(&parser, find_nt("root", all_nt), output, 10);
+		solutions_free(&solutions);
+	}
+	profile_stop();
+#if defined(__unix__) || defined(__APPLE__)
+	struct sigaction new_action;
+	sigaction(SIGPROF, NULL, &new_action);
+	if (new_action.sa_handler != old_action.sa_handler)
+		fprintf(stderr, "ERROR: the action for the profiling signal was not restored\n");
+	else
+		fprintf(stderr, "OK: the action for the profiling signal was restored\n");
+#endif
+	if (!parsed)
+		fprintf(stderr, "ERROR: failed to parse while profiling\n");
+	else
+		fprintf(stderr, "OK: parsed while profiling\n");
+	if (profile_nr_samples == 0)
+		fprintf(stderr, "ERROR: no samples were taken while profiling\n");
+	else
+		fprintf(stderr, "OK: samples were taken while profiling\n");
+	FREE(input);
+}
 
-	NT_DEF("func_declarator")
-		RULE CHAR_WS('*')
-		{ GROUPING
-			RULE KEYWORD("const") TREE("const")
-		} OPTN ADD_CHILD NT("func_declarator") TREE("pointdecl")
-		RULE CHAR_WS('(') NT("func_declarator") CHAR_WS(')')
-		RULE IDENT PASS
+/*
+	Heatmap tests
+	~~~~~~~~~~~~~
+*/
 
-	NT_DEF("declarator")
-		RULE CHAR_WS('*')
-		{ GROUPING
-			RULE KEYWORD("const") TREE("const")
-		} OPTN ADD_CHILD NT("declarator") TREE("pointdecl")
-		RULE CHAR_WS('(') NT("declarator") CHAR_WS(')') TREE("brackets")
-		RULE WS IDENT PASS
-		REC_RULEC CHAR_WS('[') NT("constant_expr") OPTN CHAR_WS(']') TREE("array")
-		REC_RULEC CHAR_WS('(') NT("abstract_declaration_list") OPTN CHAR_WS(')') TREE("function")
+void test_heatmap(non_terminal_dict_p *all_nt)
+{
+	/* The histogram of the rewind distances */
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, "ab\ncd");
+	heatmap_t heatmap;
+	heatmap_init(&heatmap, &text_buffer);
+	parse_heatmap = &heatmap;
+	text_buffer_advance_to(&text_buffer, 5);
+	text_pos_t start = heatmap_text_pos(&heatmap, 0);
+	text_buffer_set_pos(&text_buffer, &start);
+	parse_heatmap = NULL;
+	if (heatmap.nr_rewinds != 1 || heatmap.max_rewind != 5 || heatmap.rewind_histogram[2] != 1)
+		fprintf(stderr, "ERROR: heatmap rewind of 5 counted as %lu rewinds with maximum %lu\n",
+				heatmap.nr_rewinds, (unsigned long)heatmap.max_rewind);
+	else
+		fprintf(stderr, "OK: heatmap rewind of 5 counted\n");
+	char output[1000];
+	fixed_string_ostream_t fixed_string_ostream;
+	fixed_string_ostream_init(&fixed_string_ostream, output, 1000);
+	heatmap_write_csv(&heatmap, &fixed_string_ostream.ostream);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+	if (strcmp(output, "offset,line,column,examinations\n0,1,1,0\n1,1,2,0\n2,1,3,0\n3,2,1,0\n4,2,2,0\n5,2,3,0\n") != 0)
+		fprintf(stderr, "ERROR: heatmap csv is '%s'\n", output);
+	else
+		fprintf(stderr, "OK: heatmap csv\n");
+	heatmap_release(&heatmap);
 
-	NT_DEF("abstract_declaration_list")
-		RULE
-			NT("abstract_declaration") SEQL BACK_TRACKING { CHAIN CHAR_WS(',') }
-			{ GROUPING
-				RULE CHAR_WS(',') CHAR('.') CHAR('.') CHAR_WS('.') TREE("varargs")
-			} OPTN ADD_CHILD TREE("abstract_declaration_list")
+	/* Parsing without a cache examines the input more than once */
+	const char *input = "int f(int a)\n{\n\tint b = a; /* one */\n\treturn b * (a + b);\n}\n";
+	text_buffer_assign_string(&text_buffer, input);
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	heatmap_init(&heatmap, &text_buffer);
+	parse_heatmap = &heatmap;
+	bool parsed = parse_to_string(&parser, find_nt("root", all_nt), output, 10);
+	parse_heatmap = NULL;
+	fixed_string_ostream_init(&fixed_string_ostream, output, 1000);
+	heatmap_write_report(&heatmap, &fixed_string_ostream.ostream, 1);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+	if (!parsed || heatmap_rescan_ratio(&heatmap) <= 1.0 || heatmap.nr_rewinds == 0 || strstr(output, "1.1-6.1: ") == NULL)
+		fprintf(stderr, "ERROR: heatmap report '%s'\n", output);
+	else
+		fprintf(stderr, "OK: heatmap re-scan ratio %.2f\n", heatmap_rescan_ratio(&heatmap));
+	heatmap_release(&heatmap);
+}
 
-	NT_DEF("parameter_declaration_list")
-		RULE
-			NT("parameter_declaration") SEQL BACK_TRACKING { CHAIN CHAR_WS(',') }
-			{ GROUPING
-				RULE CHAR_WS(',') CHAR('.') CHAR('.') CHAR_WS('.') TREE("varargs")
-			} OPTN ADD_CHILD TREE("parameter_declaration_list")
+/*
+	Generator tests
+	~~~~~~~~~~~~~~~
+*/
 
-	NT_DEF("ident_list")
-		RULE IDENT
-		{ GROUPING
-			RULE CHAR_WS(',')
-			{ GROUPING
-				RULE CHAR('.') CHAR('.') CHAR_WS('.') TREE("varargs")
-				RULE NT("ident_list") TREE("ident_list")
-			}
-		} OPTN ADD_CHILD TREE("ident_list")
+void test_generator(non_terminal_dict_p *all_nt)
+{
+	generator_options_t options;
+	generator_options_init(&options);
+	options.seed = 1;
+	options.size = 2000;
+	generator_t generator;
+	generator_init(&generator, *all_nt, &options);
+	non_terminal_p root = find_nt("root", all_nt);
+	if (!generate_sentence(&generator, root) || generator.state.len < options.size)
+		fprintf(stderr, "ERROR: generator did not generate a sentence of %lu bytes\n", (unsigned long)options.size);
+	else
+		fprintf(stderr, "OK: generator generated a sentence of %lu bytes in %d tries\n",
+				(unsigned long)generator.state.len, generator.nr_tries);
+
+	/* The same seed gives the same sentence */
+	char *text = MALLOC_N(generator.state.len + 1, char);
+	strcpy(text, generator.text);
+	generator_free(&generator);
+	generator_init(&generator, *all_nt, &options);
+	if (!generate_sentence(&generator, root) || strcmp(generator.text, text) != 0)
+		fprintf(stderr, "ERROR: generator is not deterministic\n");
+	else
+		fprintf(stderr, "OK: generator is deterministic\n");
+	FREE(text);
+	generator_free(&generator);
+
+	/* Identifiers are not keywords and consist of the characters from the sets */
+	options.size = 0;
+	generator_init(&generator, *all_nt, &options);
+	non_terminal_p ident = find_nt("ident", all_nt);
+	int nr_valid = 0;
+	for (int i = 0; i < 20; i++)
+		if (generate_sentence(&generator, ident))
+			nr_valid++;
+	if (nr_valid != 20)
+		fprintf(stderr, "ERROR: generator generated %d of 20 identifiers\n", nr_valid);
+	else
+		fprintf(stderr, "OK: generator generated 20 identifiers\n");
+	generator_free(&generator);
+}
 
-	NT_DEF("parameter_declaration")
-		RULE NT("type_specifier") NT("parameter_declaration") TREE("type")
-		RULE NTP("declarator")
-		RULE NTP("abstract_declarator")
+/*
+	Compressed input tests
+	~~~~~~~~~~~~~~~~~~~~~~
+*/
 
-	NT_DEF("abstract_declaration")
-		RULE NT("type_specifier") NT("parameter_declaration") TREE("type")
-		RULE NTP("abstract_declarator")
+#if defined(__unix__) || defined(__APPLE__)
 
-	NT_DEF("abstract_declarator")
-		RULE CHAR_WS('*')
-		{ GROUPING
-			RULE KEYWORD("const") TREE("const")
-		} OPTN ADD_CHILD NT("abstract_declarator") TREE("abs_pointdecl")
-		RULE CHAR_WS('(') NT("abstract_declarator") CHAR_WS(')') TREE("abs_brackets")
-		RULE
-		REC_RULEC CHAR_WS('[') NT("constant_expr") OPTN CHAR_WS(']') TREE("abs_array")
-		REC_RULEC CHAR_WS('(') NT("parameter_declaration_list") CHAR_WS(')') TREE("abs_func")
+void test_text_load_file(non_terminal_dict_p *all_nt, const char *kind, const char *file_name, const char *input)
+{
+	/* The file is loaded on the helper thread while the input is parsed */
+	text_load_t load;
+	text_load_start(&load, file_name);
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, input);
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	char exp_output[1000];
+	parse_to_string(&parser, find_nt("root", all_nt), exp_output, 1000);
 
-	NT_DEF("initializer")
-		RULE NTP("assignment_expr")
-		RULE CHAR_WS('{') NT("initializer") SEQL { CHAIN CHAR_WS(',') } CHAR(',') OPTN WS CHAR_WS('}') TREE("initializer")
+	if (!text_load_finish(&load, &text_buffer))
+	{
+		fprintf(stderr, "ERROR: loading %s file failed: %s\n", kind, load.error);
+		return;
+	}
+	parser_init(&parser, &text_buffer);
+	char output[1000];
+	bool parsed = parse_to_string(&parser, find_nt("root", all_nt), output, 1000);
+	if (strcmp(text_buffer.buffer, input) != 0 || !parsed || strcmp(output, exp_output) != 0)
+		fprintf(stderr, "ERROR: loaded %s file '%s' parsed to '%s'\n", kind, text_buffer.buffer, output);
+	else
+		fprintf(stderr, "OK: loaded and parsed %s file\n", kind);
+	FREE((char*)text_buffer.buffer);
+}
 
-	NT_DEF("decl_or_stat")
-		RULE NT("declaration") SEQL OPTN NT("statement") SEQL OPTN TREE("decl_or_stat")
+void test_text_load(non_terminal_dict_p *all_nt)
+{
+	const char *input = "int f(int a)\n{\n\tint b = a; /* one */\n\treturn b * (a + b);\n}\n";
+	text_buffer_t text_buffer;
+	char file_name[] = "/tmp/RawParserXXXXXX";
+	int fd = mkstemp(file_name);
+	if (fd < 0)
+	{
+		fprintf(stderr, "ERROR: cannot create temporary file\n");
+		return;
+	}
+	FILE *f = fdopen(fd, "wb");
+	fputs(input, f);
+	fclose(f);
+	test_text_load_file(all_nt, "plain", file_name, input);
+
+#ifdef HAVE_ZLIB
+	gzFile gz = gzopen(file_name, "wb");
+	gzputs(gz, input);
+	gzclose(gz);
+	test_text_load_file(all_nt, "gzip", file_name, input);
+
+	/* A corrupt size at the end of the file does not allocate a huge buffer */
+	f = fopen(file_name, "r+b");
+	fseek(f, -4L, SEEK_END);
+	fputs("\xF0\xFF\xFF\xFF", f);
+	fclose(f);
+	text_load_t load;
+	text_load_start(&load, file_name);
+	if (text_load_finish(&load, &text_buffer) || load.allocated > 1000000)
+		fprintf(stderr, "ERROR: loaded gzip file with corrupt size into %lu bytes\n", (unsigned long)load.allocated);
+	else
+		fprintf(stderr, "OK: gzip file with corrupt size not loaded\n");
+#else
+	/* A gzip file is recognized, but cannot be decompressed */
+	f = fopen(file_name, "wb");
+	fputs("\x1F\x8B\x08", f);
+	fclose(f);
+	if (text_buffer_from_compressed_file(&text_buffer, file_name))
+		fprintf(stderr, "ERROR: loaded gzip file without HAVE_ZLIB\n");
+	else
+		fprintf(stderr, "OK: gzip file not loaded without HAVE_ZLIB\n");
+#endif
+#ifdef HAVE_ZSTD
+	size_t input_len = strlen(input);
+	size_t compressed_size = ZSTD_compressBound(input_len);
+	char *compressed = MALLOC_N(compressed_size, char);
+	compressed_size = ZSTD_compress(compressed, compressed_size, input, input_len, 3);
+	f = fopen(file_name, "wb");
+	fwrite(compressed, 1, compressed_size, f);
+	fclose(f);
+	FREE(compressed);
+	test_text_load_file(all_nt, "zstd", file_name, input);
+#endif
+	remove(file_name);
 
-	NT_DEF("statement")
-		RULE
-		{ GROUPING
-			RULE
-			{ GROUPING
-				RULE IDENT
-				RULE KEYWORD("case") NT("constant_expr") TREE("case")
-				RULE KEYWORD("default") TREE("default")
-			} ADD_CHILD CHAR_WS(':') NT("statement") TREE("label")
-			RULE CHAR_WS('{') NTP("decl_or_stat") CHAR_WS('}')
-		}
-		RULE
-		{ GROUPING
-			RULE NTP("expr") OPTN CHAR_WS(';')
-			RULE KEYWORD("if") WS CHAR_WS('(') NT("expr") CHAR_WS(')') NT("statement")
-			{ GROUPING
-				RULE KEYWORD("else") NTP("statement")
-			} OPTN ADD_CHILD TREE("if")
-			RULE KEYWORD("switch") WS CHAR_WS('(') NT("expr") CHAR_WS(')') NT("statement") TREE("switch")
-			RULE KEYWORD("while") WS CHAR_WS('(') NT("expr") CHAR_WS(')') NT("statement") TREE("while")
-			RULE KEYWORD("do") NT("statement") KEYWORD("while") WS CHAR_WS('(') NT("expr") CHAR_WS(')') CHAR_WS(';') TREE("do")
-			RULE KEYWORD("for") WS CHAR_WS('(') NT("expr") OPTN CHAR_WS(';')
-			{ GROUPING
-				RULE WS NTP("expr")
-			} OPTN ADD_CHILD CHAR_WS(';')
-			{ GROUPING
-				RULE WS NTP("expr")
-			} OPTN ADD_CHILD CHAR_WS(')') NT("statement") TREE("for")
-			RULE KEYWORD("goto") IDENT CHAR_WS(';') TREE("goto")
-			RULE KEYWORD("continue") CHAR_WS(';') TREE("cont")
-			RULE KEYWORD("break") CHAR_WS(';') TREE("break")
-			RULE KEYWORD("return") NT("expr") OPTN CHAR_WS(';') TREE("ret")
+	if (text_buffer_from_compressed_file(&text_buffer, file_name))
+		fprintf(stderr, "ERROR: loaded file that does not exist\n");
+	else
+		fprintf(stderr, "OK: file that does not exist not loaded\n");
+}
+
+#endif
+
+/*
+	Batch loading tests
+	~~~~~~~~~~~~~~~~~~~
+*/
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#define TEST_BATCH_NR_FILES 20
+
+typedef struct
+{
+	non_terminal_dict_p *all_nt;
+	const char **inputs;
+	int next_file_nr;
+	int nr_correct;
+} test_batch_t;
+
+void test_batch_parse(void *data, int file_nr, text_buffer_p text_buffer, const char *error)
+{
+	test_batch_t *test = (test_batch_t*)data;
+	bool in_order = file_nr == test->next_file_nr++;
+	if (test->inputs[file_nr] == NULL)
+	{
+		/* The file does not exist */
+		if (in_order && text_buffer == NULL && error != NULL)
+			test->nr_correct++;
+		return;
+	}
+	if (text_buffer == NULL)
+		return;
+	parser_t parser;
+	parser_init(&parser, text_buffer);
+	char output[200];
+	if (in_order && strcmp(text_buffer->buffer, test->inputs[file_nr]) == 0
+		&& parse_to_string(&parser, find_nt("root", test->all_nt), output, 200)
+		&& strncmp(output, "list(decl(", 10) == 0)
+		test->nr_correct++;
+}
+
+void test_batch_load(non_terminal_dict_p *all_nt)
+{
+	char file_names[TEST_BATCH_NR_FILES][30];
+	const char *file_name_ps[TEST_BATCH_NR_FILES];
+	char inputs[TEST_BATCH_NR_FILES][30];
+	const char *input_ps[TEST_BATCH_NR_FILES];
+	for (int i = 0; i < TEST_BATCH_NR_FILES; i++)
+	{
+		strcpy(file_names[i], "/tmp/RawParserXXXXXX");
+		file_name_ps[i] = file_names[i];
+		int fd = mkstemp(file_names[i]);
+		if (fd < 0)
+		{
+			fprintf(stderr, "ERROR: cannot create temporary file\n");
+			return;
 		}
+		FILE *f = fdopen(fd, "wb");
+		snprintf(inputs[i], 30, "int a%d; char *b%d;", i, i);
+		input_ps[i] = inputs[i];
+		if (i == 7)
+			input_ps[i] = NULL;
+		else
+			fputs(inputs[i], f);
+		fclose(f);
+	}
+	remove(file_names[7]);
 
-	NT_DEF("root")
-		RULE
-		WS
-		{ GROUPING
-			RULE NT("declaration")
-		} SEQL OPTN END PASS
+	for (int use_io_uring = 1; use_io_uring >= 0; use_io_uring--)
+	{
+		batch_load_t batch;
+		batch_load_init(&batch);
+		batch.window = 4;
+		batch.use_io_uring = use_io_uring;
+		test_batch_t test;
+		test.all_nt = all_nt;
+		test.inputs = input_ps;
+		test.next_file_nr = 0;
+		test.nr_correct = 0;
+		batch_load_files(&batch, file_name_ps, TEST_BATCH_NR_FILES, test_batch_parse, &test);
+		const char *method = batch.used_io_uring ? "io_uring" : "a fallback";
+		if (test.nr_correct != TEST_BATCH_NR_FILES || batch.nr_failed != 1 || (!use_io_uring && batch.used_io_uring))
+			fprintf(stderr, "ERROR: batch loaded with %s %d files correctly and %d failed\n", method, test.nr_correct, batch.nr_failed);
+		else
+			fprintf(stderr, "OK: batch loaded with %s %d files\n", method, TEST_BATCH_NR_FILES);
+	}
+
+	for (int i = 0; i < TEST_BATCH_NR_FILES; i++)
+		remove(file_names[i]);
+
+	/* Every method loads a compressed file the same way (without
+	   HAVE_ZLIB, a gzip file fails to load) */
+	char file_name[] = "/tmp/RawParserXXXXXX";
+	const char *input = "int a; char *b;";
+	int fd = mkstemp(file_name);
+	if (fd < 0)
+	{
+		fprintf(stderr, "ERROR: cannot create temporary file\n");
+		return;
+	}
+	close(fd);
+#ifdef HAVE_ZLIB
+	gzFile gz = gzopen(file_name, "wb");
+	gzputs(gz, input);
+	gzclose(gz);
+#else
+	FILE *f = fopen(file_name, "wb");
+	fputs("\x1F\x8B\x08", f);
+	fclose(f);
+	input = NULL;
+#endif
+	file_name_ps[0] = file_name;
+	input_ps[0] = input;
+	const char *methods[] = { "io_uring", "a pool of threads", "sequential loading" };
+	for (int method = 0; method < 3; method++)
+	{
+		batch_load_t batch;
+		batch_load_init(&batch);
+		batch.use_io_uring = method == 0;
+		batch.nr_threads = method == 2 ? 0 : 4;
+		test_batch_t test;
+		test.all_nt = all_nt;
+		test.inputs = input_ps;
+		test.next_file_nr = 0;
+		test.nr_correct = 0;
+		batch_load_files(&batch, file_name_ps, 1, test_batch_parse, &test);
+		if (test.nr_correct != 1)
+			fprintf(stderr, "ERROR: batch loaded compressed file with %s incorrectly\n", methods[method]);
+		else
+			fprintf(stderr, "OK: batch loaded compressed file with %s\n", methods[method]);
+	}
+	remove(file_name);
 }
 
+#endif
 
 /*
-	Fixed string output stream
-	~~~~~~~~~~~~~~~~~~~~~~~~~~
+	Slow input search tests
+	~~~~~~~~~~~~~~~~~~~~~~~
 */
 
-typedef struct fixed_string_ostream fixed_string_ostream_t, *fixed_string_ostream_p;
-struct fixed_string_ostream
+void test_slow_search(non_terminal_dict_p *all_nt)
 {
-	ostream_t ostream;
-	char *buffer;
-	unsigned int i;
-	unsigned int len;
-};
+	/* Parsing stops when the budget of the heatmap is exhausted */
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, "int a;");
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	heatmap_t heatmap;
+	heatmap_init(&heatmap, &text_buffer);
+	heatmap.max_examinations = 10;
+	parse_heatmap = &heatmap;
+	char output[1000];
+	bool parsed = parse_to_string(&parser, find_nt("root", all_nt), output, 1000);
+	parse_heatmap = NULL;
+	if (parsed || heatmap.nr_examinations != 10)
+		fprintf(stderr, "ERROR: parsed with a budget of 10 examinations (%lu)\n", heatmap.nr_examinations);
+	else
+		fprintf(stderr, "OK: parsing stopped at a budget of 10 examinations\n");
+	heatmap_release(&heatmap);
+
+	/* Without a cache, some inputs are examined many times */
+	slow_search_options_t options;
+	slow_search_options_init(&options);
+	options.nr_runs = 200;
+	options.max_examinations = 20000;
+	slow_search_t search;
+	slow_search_init(&search, *all_nt, find_nt("root", all_nt), &options);
+	bool found = slow_search(&search);
+	fixed_string_ostream_t fixed_string_ostream;
+	fixed_string_ostream_init(&fixed_string_ostream, output, 1000);
+	slow_search_write_report(&search, &fixed_string_ostream.ostream);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+	if (   !found || search.slowest.len > options.max_len || slow_input_ratio(&search.slowest) < 10.0
+		|| search.nts[0].name == NULL || strstr(output, "non-terminals: ") == NULL)
+		fprintf(stderr, "ERROR: slow input search reported '%s'\n", output);
+	else
+		fprintf(stderr, "OK: slow input search found %lu bytes with %.2f examinations per byte\n",
+				(unsigned long)search.slowest.len, slow_input_ratio(&search.slowest));
+	slow_search_free(&search);
+}
 
-void fixed_string_ostream_put(ostream_p ostream, char ch)
+/*
+	Grammar linter tests
+	~~~~~~~~~~~~~~~~~~~~
+*/
+
+void lint_test_grammar(non_terminal_dict_p *all_nt)
 {
-	if (((fixed_string_ostream_p)ostream)->i < ((fixed_string_ostream_p)ostream)->len)
-		((fixed_string_ostream_p)ostream)->buffer[((fixed_string_ostream_p)ostream)->i++] = ch;
+	HEADER(all_nt)
+	(void)ref_rec_rule;
+
+	NT_DEF("lint_root")
+		RULE NT("lint_nullable")
+		RULE NT("lint_nested")
+		RULE NT("lint_shadowed")
+		RULE NT("lint_avoid")
+
+	/* A sequence of an element that can be empty */
+	NT_DEF("lint_nullable")
+		RULE NT("lint_empty") SEQ(0, 0) CHAR(';')
+	NT_DEF("lint_empty")
+		RULE CHAR('a') OPT(0)
+
+	/* A back-tracking sequence within a back-tracking sequence */
+	NT_DEF("lint_nested")
+		RULE NT("lint_inner") SEQ(0, 0) BACK_TRACKING CHAR('.')
+	NT_DEF("lint_inner")
+		RULE CHAR('b') SEQ(0, 0) BACK_TRACKING CHAR(';')
+
+	/* The second rule is never used */
+	NT_DEF("lint_shadowed")
+		RULE CHAR('c')
+		RULE CHAR('c') CHAR('d')
+
+	/* An avoided sequence of the character that follows it */
+	NT_DEF("lint_avoid")
+		RULE CHAR('e') SEQ(0, 0) OPT(0) AVOID CHAR('e')
 }
 
-void fixed_string_ostream_init(fixed_string_ostream_p ostream, char *buffer, unsigned int len)
-{
-	ostream->ostream.put = fixed_string_ostream_put;
-	ostream->buffer = buffer;
-	ostream->i = 0;
-	ostream->len = len - 1;
+void test_grammar_lint()
+{
+	non_terminal_dict_p all_nt_lint = NULL;
+	lint_test_grammar(&all_nt_lint);
+	lint_t lint;
+	char output[2000];
+	fixed_string_ostream_t fixed_string_ostream;
+	fixed_string_ostream_init(&fixed_string_ostream, output, 2000);
+	int nr_hazards = lint_grammar(&lint, all_nt_lint, find_nt("lint_root", &all_nt_lint), &fixed_string_ostream.ostream);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+	bool all_found = nr_hazards == lint_nr_hazards;
+	for (int i = 0; i < lint_nr_hazards; i++)
+		if (lint.nr_hazards[i] != 1)
+			all_found = FALSE;
+	if (   !all_found
+		|| strstr(output, "nullable sequence: lint_nullable, rule 1, element 1: ") == NULL
+		|| strstr(output, "nested back-tracking: lint_nested, rule 1, element 1: back-tracking sequence with 1 nested back-tracking sequence [O(n^3) without a cache]") == NULL
+		|| strstr(output, "shadowed rule: lint_shadowed, rule 2: rule is shadowed by rule 1") == NULL
+		|| strstr(output, "avoid overlap: lint_avoid, rule 1, element 1: ") == NULL
+		|| strstr(output, "expensive path: lint_inner: only reached through 1 back-tracking construct") == NULL)
+		fprintf(stderr, "ERROR: lint of test grammar reported %d hazards:\n%s", nr_hazards, output);
+	else
+		fprintf(stderr, "OK: lint of test grammar reported all %d hazards\n", nr_hazards);
+
+	/* The C grammar has no sequences that do not terminate, but nests back-tracking
+	   sequences through the parameters of function declarators. (A copy is
+	   linted, because linting analyses the grammar.) */
+	non_terminal_dict_p all_nt = NULL;
+	c_grammar(&all_nt);
+	char c_output[10000];
+	fixed_string_ostream_init(&fixed_string_ostream, c_output, 10000);
+	nr_hazards = lint_grammar(&lint, all_nt, find_nt("root", &all_nt), &fixed_string_ostream.ostream);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+	if (   lint.nr_hazards[lint_nullable_sequence] != 0 || lint.nr_hazards[lint_nested_back_tracking] == 0
+		|| strstr(c_output, "nested back-tracking: parameter_declaration_list, rule 1, element 1: ") == NULL)
+		fprintf(stderr, "ERROR: lint of C grammar reported %d hazards:\n%s", nr_hazards, c_output);
+	else
+		fprintf(stderr, "OK: lint of C grammar reported %d hazards\n", nr_hazards);
 }
 
-void fixed_string_ostream_finish(fixed_string_ostream_p ostream)
+/*
+	Shadow verification tests
+	~~~~~~~~~~~~~~~~~~~~~~~~~
+*/
+
+typedef struct
 {
-	ostream->buffer[ostream->i] = '\0';
+	solutions_t solutions;
+	const char *text;
+	bool broken;          /* Whether it fails declarators that start with 'z' */
+	cache_item_t fail_item;
+} shadow_test_cache_t, *shadow_test_cache_p;
+
+void *shadow_test_cache_new(text_buffer_p text_buffer, bool broken)
+{
+	shadow_test_cache_p cache = MALLOC(shadow_test_cache_t);
+	solutions_init(&cache->solutions, text_buffer);
+	cache->text = text_buffer->buffer;
+	cache->broken = broken;
+	cache_item_init(&cache->fail_item);
+	cache->fail_item.success = s_fail;
+	return cache;
 }
 
+void *shadow_test_cache_new_correct(text_buffer_p text_buffer) { return shadow_test_cache_new(text_buffer, FALSE); }
+void *shadow_test_cache_new_broken(text_buffer_p text_buffer) { return shadow_test_cache_new(text_buffer, TRUE); }
 
+void shadow_test_cache_free(void *cache)
+{
+	solutions_free(&((shadow_test_cache_p)cache)->solutions);
+	FREE(cache);
+}
 
+cache_item_p shadow_test_cache_find(void *cache, size_t pos, const char *nt)
+{
+	shadow_test_cache_p test_cache = (shadow_test_cache_p)cache;
+	if (test_cache->broken && test_cache->text[pos] == 'z' && strcmp(nt, "declarator") == 0)
+		return &test_cache->fail_item;
+	return solutions_find(&test_cache->solutions, pos, nt);
+}
 
-void test_parse_grammar(non_terminal_dict_p *all_nt, const char *nt, const char *input, const char *exp_output)
+void test_shadow_parse(shadow_p shadow, non_terminal_p root, const char *input)
 {
 	ENTER_RESULT_CONTEXT
-
 	text_buffer_t text_buffer;
 	text_buffer_assign_string(&text_buffer, input);
-	
-	solutions_t solutions;
-	solutions_init(&solutions, &text_buffer);
-	
-	parser_t parser;
-	parser_init(&parser, &text_buffer);
-	parser.cache_hit_function = solutions_find;
-	parser.cache = &solutions;
-	
 	DECL_RESULT(result);
-	if (parse_nt(&parser, find_nt(nt, all_nt), &result) && text_buffer_end(&text_buffer))
-	{
-		if (result.data == NULL)
-			fprintf(stderr, "ERROR: parsing '%s' did not return result\n", input);
-		else
-		{
-			char output[200];
-			fixed_string_ostream_t fixed_string_ostream;
-			fixed_string_ostream_init(&fixed_string_ostream, output, 200);
-			result_print(&result, &fixed_string_ostream.ostream);
-			fixed_string_ostream_finish(&fixed_string_ostream);
-			if (strcmp(output, exp_output) != 0)
-			{
-				fprintf(stderr, "ERROR: parsed value '%s' from '%s' instead of expected '%s'\n",
-						output, input, exp_output);
-			}
-			else
-				fprintf(stderr, "OK: parsed '%s' to '%s'\n", input, output);
-		}
-	}
-	else
-	{
-		fprintf(stderr, "ERROR: failed to parse ident from '%s'\n", input);
-	}
+	shadow_parse(shadow, root, &text_buffer, &result);
 	DISP_RESULT(result);
-	
-	solutions_free(&solutions);
-
 	EXIT_RESULT_CONTEXT
 }
 
-void test_c_grammar(non_terminal_dict_p *all_nt)
-{
-	test_parse_grammar(all_nt, "expr", "a", "list(a)");
-	test_parse_grammar(all_nt, "expr", "a*b", "list(times(a,b))");
+void test_shadow(non_terminal_dict_p *all_nt)
+{
+	non_terminal_p root = find_nt("root", all_nt);
+	const char *inputs[] = { "int a;", "int f(int b) { return b * 2; }", "char *s; struct x { int y; } z;", "int g() { while (a) a = a - b; }" };
+	shadow_options_t options;
+	shadow_options_init(&options);
+	options.fraction = 1.0;
+	char output[1000];
+	fixed_string_ostream_t fixed_string_ostream;
+
+	/* A correct cache gives the same outcome as the reference parser */
+	shadow_engine_t engine;
+	engine.cache_new = shadow_test_cache_new_correct;
+	engine.cache_free = shadow_test_cache_free;
+	engine.cache_hit_function = shadow_test_cache_find;
+	engine.cache_set_result_function = NULL;
+	engine.recover = FALSE;
+	shadow_t shadow;
+	shadow_init(&shadow, &engine, &options);
+	for (int i = 0; i < 40; i++)
+		test_shadow_parse(&shadow, root, inputs[i % 4]);
+	shadow_finish(&shadow);
+	fixed_string_ostream_init(&fixed_string_ostream, output, 1000);
+	shadow_write_report(&shadow, &fixed_string_ostream.ostream);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+	if (   shadow.nr_parses != 40 || shadow.nr_sampled != 40 || shadow.nr_verified == 0
+		|| shadow.nr_verified + shadow.nr_dropped != 40 || shadow.nr_mismatches != 0)
+		fprintf(stderr, "ERROR: shadow of correct cache reported: %s", output);
+	else
+		fprintf(stderr, "OK: shadow of correct cache verified %lu parses without mismatches\n", shadow.nr_verified);
+	shadow_free(&shadow);
+
+	/* A result that does not fit in the output is not verified */
+	options.max_output = 10;
+	shadow_init(&shadow, &engine, &options);
+	for (int i = 0; i < 4; i++)
+		test_shadow_parse(&shadow, root, inputs[2]);
+	shadow_finish(&shadow);
+	fixed_string_ostream_init(&fixed_string_ostream, output, 1000);
+	shadow_write_report(&shadow, &fixed_string_ostream.ostream);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+	if (shadow.nr_verified != 0 || shadow.nr_too_long == 0 || shadow.nr_mismatches != 0)
+		fprintf(stderr, "ERROR: shadow of long results reported: %s", output);
+	else
+		fprintf(stderr, "OK: shadow did not verify %lu long results\n", shadow.nr_too_long);
+	shadow_free(&shadow);
+	shadow_options_init(&options);
+	options.fraction = 1.0;
+
+	/* A broken cache is detected, and the input is minimized */
+	engine.cache_new = shadow_test_cache_new_broken;
+	options.fraction = 0.5;
+	shadow_init(&shadow, &engine, &options);
+	const char *input = "int a;\nchar b, *z;\nint c;\n";
+	for (int i = 0; i < 10; i++)
+		test_shadow_parse(&shadow, root, input);
+	shadow_finish(&shadow);
+	fixed_string_ostream_init(&fixed_string_ostream, output, 1000);
+	shadow_write_report(&shadow, &fixed_string_ostream.ostream);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+	if (   shadow.nr_sampled == 0 || shadow.nr_sampled == 10 || shadow.nr_mismatches != shadow.nr_verified
+		|| shadow.mismatches == NULL || shadow.mismatches->len >= strlen(input)
+		|| strstr(output, "mismatch in root (success)") == NULL)
+		fprintf(stderr, "ERROR: shadow of broken cache reported: %s", output);
+	else
+		fprintf(stderr, "OK: shadow of broken cache reported mismatch on '%.*s'\n", (int)shadow.mismatches->len, shadow.mismatches->input);
+	shadow_free(&shadow);
 }
 
 /*
-	File output stream
-	~~~~~~~~~~~~~~~~~~
+	Typed tree tests
+	~~~~~~~~~~~~~~~~
 */
 
-typedef struct file_ostream file_ostream_t, *file_ostream_p;
-struct file_ostream
+void test_typed_tree_count(tree_node_p node, void *data)
 {
-	ostream_t ostream;
-	FILE *f;
-};
+	(void)node;
+	(*(int*)data)++;
+}
 
-void file_ostream_put(ostream_p ostream, char ch)
+/*	- Dispatches all trees (and returns the number of typed trees) */
+int test_typed_tree_walk(ast_schema_p schema, ast_visit_function *table, tree_node_p node, void *data)
 {
-	if (((file_ostream_p)ostream)->f != NULL)
-		fputc(ch, ((file_ostream_p)ostream)->f);
+	if (node == NULL || (node->type_name != tree_node_type && node->type_name != typed_tree_node_type))
+		return 0;
+	int nr_typed = node->type_name == typed_tree_node_type ? 1 : 0;
+	ast_dispatch(schema, table, node, data);
+	for (int i = 0; i < ast_nr_children(node); i++)
+		nr_typed += test_typed_tree_walk(schema, table, ast_child(node, i), data);
+	return nr_typed;
 }
 
-void file_ostream_init(file_ostream_p ostream, FILE *f)
+/*	- Returns the number of generic trees (other than lists) without a kind */
+int test_typed_tree_nr_unkinded(tree_node_p node)
 {
-	ostream->ostream.put = file_ostream_put;
-	ostream->f = f;
+	if (node == NULL || (node->type_name != tree_node_type && node->type_name != typed_tree_node_type))
+		return 0;
+	int nr_unkinded = 0;
+	if (node->type_name == tree_node_type)
+	{
+		tree_p tree = CAST(tree_p, node);
+		if (tree->kind == NULL && strcmp(tree->tree_name, list_type) != 0)
+			nr_unkinded++;
+	}
+	for (int i = 0; i < ast_nr_children(node); i++)
+		nr_unkinded += test_typed_tree_nr_unkinded(ast_child(node, i));
+	return nr_unkinded;
+}
+
+void test_typed_tree(non_terminal_dict_p *all_nt)
+{
+	ENTER_RESULT_CONTEXT
+	ast_schema_t schema;
+	ast_schema_init(&schema);
+	ast_schema_derive(&schema, *all_nt);
+	ast_kind_p arrayexp = ast_schema_find(&schema, "arrayexp");
+	ast_kind_p call = ast_schema_find(&schema, "call");
+	ast_kind_p decl_init = ast_schema_find(&schema, "decl_init");
+	ast_kind_p signed_kind = ast_schema_find(&schema, "signed");
+	if (   arrayexp == NULL || arrayexp->nr_children != 2
+		|| strcmp(arrayexp->child_types[0], "postfix_expr") != 0 || strcmp(arrayexp->child_types[1], "expr") != 0
+		|| call == NULL || call->nr_children != 2 || strcmp(call->child_types[1], "list") != 0
+		|| decl_init == NULL || decl_init->nr_children != 2 || decl_init->child_types[1] != NULL
+		|| signed_kind == NULL || signed_kind->nr_children != -1
+		|| ast_schema_find(&schema, "list") != NULL)
+		fprintf(stderr, "ERROR: derived schema of the C grammar\n");
+	else
+		fprintf(stderr, "OK: derived schema with %d kinds from %d rules\n", schema.nr_kinds, schema.nr_tree_rules);
+
+	/* The generated code has a struct with the layout of a typed tree */
+	char *output = MALLOC_N(100000, char);
+	fixed_string_ostream_t fixed_string_ostream;
+	fixed_string_ostream_init(&fixed_string_ostream, output, 100000);
+	ast_schema_write_c(&schema, "c", &fixed_string_ostream.ostream);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+	if (   strstr(output, "struct c_arrayexp_t\n{\n\ttree_node_t _node;\n\tast_kind_p kind;\n\ttree_node_p postfix_expr;\n\ttree_node_p expr;\n};") == NULL
+		|| strstr(output, "c_if_expr_p c_make_if_expr(ast_schema_p schema, tree_node_p l_expr9_1, tree_node_p l_expr9_2, tree_node_p conditional_expr)") == NULL
+		|| strstr(output, "\tvoid (*visit_signed)(tree_p node, void *data);") == NULL
+		|| strstr(output, "\t\tvisitor->visit_generic_form((tree_p)node, kind, data);") == NULL
+		|| strstr(output, "\t\tcase c_call:") == NULL)
+		fprintf(stderr, "ERROR: generated code for the schema:\n%s\n", output);
+	else
+		fprintf(stderr, "OK: generated code for the schema\n");
+	ast_schema_free(&schema);
+
+	/* A bound grammar constructs typed trees, which print the same */
+	non_terminal_dict_p typed_all_nt = NULL;
+	c_grammar(&typed_all_nt);
+	ast_schema_derive(&schema, typed_all_nt);
+	int nr_bound = ast_schema_bind(&schema);
+	const char *input = "int f(int a)\n{\n\tint b = a; /* one */\n\treturn b * (a + b) - f(a[b]);\n}\n";
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, input);
+	solutions_t solutions;
+	solutions_init(&solutions, &text_buffer);
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	parser.cache_hit_function = solutions_find;
+	parser.cache = &solutions;
+	char exp_output[2000];
+	bool exp_parsed = parse_to_string(&parser, find_nt("root", all_nt), exp_output, 2000);
+	solutions_free(&solutions);
+
+	text_buffer_assign_string(&text_buffer, input);
+	solutions_init(&solutions, &text_buffer);
+	parser_init(&parser, &text_buffer);
+	parser.cache_hit_function = solutions_find;
+	parser.cache = &solutions;
+	DECL_RESULT(result);
+	bool parsed = parse_nt(&parser, find_nt("root", &typed_all_nt), &result) && text_buffer_end(&text_buffer);
+	fixed_string_ostream_init(&fixed_string_ostream, output, 2000);
+	result_print(&result, &fixed_string_ostream.ostream);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+
+	/* Count the trees of some kinds through a dispatch table */
+	ast_visit_function *table = MALLOC_N(schema.nr_kinds, ast_visit_function);
+	for (int i = 0; i < schema.nr_kinds; i++)
+		table[i] = NULL;
+	table[ast_schema_find(&schema, "times")->index] = test_typed_tree_count;
+	table[ast_schema_find(&schema, "arrayexp")->index] = test_typed_tree_count;
+	table[ast_schema_find(&schema, "call")->index] = test_typed_tree_count;
+	int nr_visited = 0;
+	int nr_typed = parsed ? test_typed_tree_walk(&schema, table, (tree_node_p)result.data, &nr_visited) : 0;
+	int nr_unkinded = parsed ? test_typed_tree_nr_unkinded((tree_node_p)result.data) : 0;
+	FREE(table);
+	DISP_RESULT(result);
+	solutions_free(&solutions);
+
+	if (!exp_parsed || !parsed || strcmp(output, exp_output) != 0)
+		fprintf(stderr, "ERROR: parsed with typed trees to '%s' instead of '%s'\n", output, exp_output);
+	else if (nr_bound == 0 || nr_typed == 0 || nr_visited != 3 || nr_unkinded != 0)
+		fprintf(stderr, "ERROR: parsed with %d typed trees, %d generic trees without kind, and visited %d\n", nr_typed, nr_unkinded, nr_visited);
+	else
+		fprintf(stderr, "OK: parsed with %d typed trees (from %d rules)\n", nr_typed, nr_bound);
+	FREE(output);
+	ast_schema_free(&schema);
+	EXIT_RESULT_CONTEXT
 }
 
 /*
-	Expect
+	Memory budget tests
+	~~~~~~~~~~~~~~~~~~~
 */
 
-#define MAX_EXP_SYM 200
-
-struct nt_stack
-{
-	const char *name;
-	unsigned long int ref_count;
-	text_pos_t pos;
-	nt_stack_p parent;
-};
-nt_stack_p nt_stack_allocated = NULL;
+#ifdef USE_MEMORY_BUDGET
 
-nt_stack_p nt_stack_push(const char *name, parser_p parser)
+bool test_memory_budget_parse(non_terminal_dict_p *all_nt, const char *input, bool compact, memory_budget_p budget, char *output, unsigned int len)
 {
-	nt_stack_p child;
-	if (nt_stack_allocated != NULL)
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, input);
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	memory_budget_start(budget, &parser);
+	solutions_t solutions;
+	compact_memo_t compact_memo;
+	if (compact)
 	{
-		child = nt_stack_allocated;
-		nt_stack_allocated = child->parent;
+		compact_memo_init(&compact_memo, &text_buffer);
+		parser.cache_hit_function = compact_memo_find;
+		parser.cache_set_result_function = compact_memo_set_result;
+		parser.cache_evict_function = compact_memo_evict;
+		parser.cache = &compact_memo;
 	}
 	else
-		child = MALLOC(struct nt_stack);
-	child->name = name;
-	child->ref_count = 1;
-	child->pos = parser->text_buffer->pos;
-	child->parent = parser->nt_stack;
-	if (parser->nt_stack != 0)
-		parser->nt_stack->ref_count++;
-	//DEBUG_TAB; DEBUG_P1("push %s\n", child->name);
-	return child;
-}
-
-void nt_stack_dispose(nt_stack_p nt_stack)
-{
-	while (nt_stack != NULL && --nt_stack->ref_count == 0)
 	{
-		nt_stack_p parent = nt_stack->parent;
-		nt_stack->parent = nt_stack_allocated;
-		nt_stack_allocated = nt_stack;
-		nt_stack = parent;
+		solutions_init(&solutions, &text_buffer);
+		parser.cache_hit_function = solutions_find;
+		parser.cache_evict_function = solutions_evict;
+		parser.cache = &solutions;
 	}
+	bool parsed = parse_to_string(&parser, find_nt("root", all_nt), output, len);
+	memory_budget_stop(budget, &parser);
+	if (compact)
+		compact_memo_free(&compact_memo);
+	else
+		solutions_free(&solutions);
+	return parsed;
 }
 
-nt_stack_p nt_stack_pop(nt_stack_p cur)
-{
-	//DEBUG_TAB; DEBUG_P1("pop %s\n", cur == NULL ? "<NULL>" : cur->name);
-	nt_stack_p parent = cur->parent;
-	nt_stack_dispose(cur);
-	return parent;
+void test_memory_budget()
+{
+	/* Not memoizing depends on the cheap non-terminals found by the
+	   analysis, which is done on a copy of the grammar */
+	non_terminal_dict_p analysed_nt = NULL;
+	c_grammar(&analysed_nt);
+	grammar_analyse(analysed_nt);
+
+	const char *unit = "int f(int a)\n{\n\tint b = a; /* one */\n\treturn b * (a + b);\n}\n";
+	size_t unit_len = strlen(unit);
+	char *input = MALLOC_N(20 * unit_len + 1, char);
+	for (int i = 0; i < 20; i++)
+		strcpy(input + i * unit_len, unit);
+	char *exp_output = MALLOC_N(20000, char);
+	char *output = MALLOC_N(20000, char);
+	char report[300];
+	fixed_string_ostream_t fixed_string_ostream;
+
+	/* Only the blocks counted by the budget are subtracted */
+	memory_budget_t budget;
+	memory_budget_init(&budget, (size_t)1 << 40);
+	parser_t parser;
+	char *before = MALLOC_N(1000, char);
+	memory_budget_start(&budget, &parser);
+	char *during = MALLOC_N(100, char);
+	size_t used_during = budget.used;
+	FREE(before);
+	FREE(during);
+	memory_budget_stop(&budget, &parser);
+	if (used_during < 100 || budget.used != 0)
+		fprintf(stderr, "ERROR: memory budget counted %lu bytes and %lu after freeing\n", (unsigned long)used_during, (unsigned long)budget.used);
+	else
+		fprintf(stderr, "OK: memory budget counted %lu bytes and none after freeing\n", (unsigned long)used_during);
+
+	/* Without degradations within a large budget */
+	memory_budget_init(&budget, (size_t)1 << 40);
+	bool parsed = test_memory_budget_parse(&analysed_nt, input, FALSE, &budget, exp_output, 20000);
+	size_t peak = budget.peak;
+	if (!parsed || budget.degradations != 0 || peak == 0)
+		fprintf(stderr, "ERROR: parsed within large memory budget with peak %lu\n", (unsigned long)peak);
+	else
+		fprintf(stderr, "OK: parsed within large memory budget with peak %lu bytes\n", (unsigned long)peak);
+
+	/* Evicting and not memoizing does not change the result */
+	memory_budget_init(&budget, peak);
+	parsed = test_memory_budget_parse(&analysed_nt, input, FALSE, &budget, output, 20000);
+	fixed_string_ostream_init(&fixed_string_ostream, report, 300);
+	memory_budget_write_report(&budget, &fixed_string_ostream.ostream);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+	if (   !parsed || strcmp(output, exp_output) != 0
+		|| (budget.degradations & md_evict) == 0 || (budget.degradations & md_recognize_only) != 0)
+		fprintf(stderr, "ERROR: parsed with budget of peak: %s", report);
+	else
+		fprintf(stderr, "OK: parsed with budget of peak: %s", report);
+
+	/* The compact cache is evicted as well */
+	memory_budget_init(&budget, (size_t)1 << 40);
+	parsed = test_memory_budget_parse(&analysed_nt, input, TRUE, &budget, output, 20000);
+	size_t compact_peak = budget.peak;
+	memory_budget_init(&budget, compact_peak);
+	parsed = parsed && test_memory_budget_parse(&analysed_nt, input, TRUE, &budget, output, 20000);
+	fixed_string_ostream_init(&fixed_string_ostream, report, 300);
+	memory_budget_write_report(&budget, &fixed_string_ostream.ostream);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+	if (   !parsed || strcmp(output, exp_output) != 0
+		|| (budget.degradations & md_evict) == 0 || budget.evicted == 0 || (budget.degradations & md_recognize_only) != 0)
+		fprintf(stderr, "ERROR: parsed with compact cache with budget of peak: %s", report);
+	else
+		fprintf(stderr, "OK: parsed with compact cache with budget of peak: %s", report);
+
+	/* With a quarter of it, only recognizing is possible */
+	memory_budget_init(&budget, peak / 4);
+	parsed = test_memory_budget_parse(&analysed_nt, input, FALSE, &budget, output, 20000);
+	fixed_string_ostream_init(&fixed_string_ostream, report, 300);
+	memory_budget_write_report(&budget, &fixed_string_ostream.ostream);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+	if (!parsed || (budget.degradations & md_recognize_only) == 0 || (budget.degradations & md_abandon) != 0)
+		fprintf(stderr, "ERROR: recognized with quarter budget: %s", report);
+	else
+		fprintf(stderr, "OK: recognized with quarter budget: %s", report);
+
+	/* With a tiny budget, parsing is abandoned */
+	memory_budget_init(&budget, peak / 50);
+	parsed = test_memory_budget_parse(&analysed_nt, input, FALSE, &budget, output, 20000);
+	fixed_string_ostream_init(&fixed_string_ostream, report, 300);
+	memory_budget_write_report(&budget, &fixed_string_ostream.ostream);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+	if (parsed || (budget.degradations & md_abandon) == 0)
+		fprintf(stderr, "ERROR: parsed with tiny budget: %s", report);
+	else
+		fprintf(stderr, "OK: abandoned with tiny budget: %s", report);
+
+	FREE(output);
+	FREE(exp_output);
+	FREE(input);
 }
 
-text_pos_t highest_pos;
-typedef struct
-{
-	nt_stack_p nt_stack;
-	element_p element;
-} expect_t;
-expect_t expected[MAX_EXP_SYM];
-int nr_expected;
+#endif
 
-void init_expected()
-{
-	highest_pos.pos = 0;
-	nr_expected = 0;
-}
+/*
+	Allocation attribution tests
+	~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+*/
 
-void expect_element(parser_p parser, element_p element)
+#ifdef ALLOC_ATTRIBUTION
+
+#ifdef USE_THREADS
+
+#define TEST_ALLOC_NR_FREED 10000
+
+void *test_alloc_free_thread(void *data)
 {
-	if (parser->text_buffer->pos.pos < highest_pos.pos) return;
-	
-	if (parser->text_buffer->pos.pos > highest_pos.pos)
-	{
-		highest_pos = parser->text_buffer->pos;
-		//for (int i = 0; i < nr_expected; i++)
-		//	nt_stack_dispose(expected[i].nt_stack);
-		nr_expected = 0;
-	}
-	for (int i = 0; i < nr_expected; i++)
-		if (expected[i].nt_stack == parser->nt_stack && expected[i].element == element)
-			return;
-	if (nr_expected < MAX_EXP_SYM)
-	{
-		parser->nt_stack->ref_count++;
-		expected[nr_expected].nt_stack = parser->nt_stack;
-		expected[nr_expected].element = element;
-		nr_expected++;
-	}
+	unsigned long *seqs = (unsigned long*)data;
+	for (int i = 0; i < TEST_ALLOC_NR_FREED; i++)
+		alloc_attribution_free(seqs[i]);
+	return NULL;
 }
 
+#endif
+
+void test_alloc_attribution(non_terminal_dict_p *all_nt)
+{
+	/* Nested rules that fail, count each allocation as wasted once */
+	alloc_attribution_start(NULL);
+	unsigned long outer = alloc_attribution_mark();
+	unsigned long seq = alloc_attribute("data", "a", 10);
+	unsigned long inner = alloc_attribution_mark();
+	alloc_attribute("data", "b", 20);
+	alloc_attribution_backtrack(inner);
+	alloc_attribute("data", "a", 10);
+	alloc_attribution_backtrack(outer);
+	alloc_attribution_free(seq);
+	alloc_site_p site_a = alloc_sites[(POINTER_HASH("data") ^ POINTER_HASH("a")) % ALLOC_SITES_SIZE];
+	while (site_a != NULL && site_a->nt != (const char*)"a")
+		site_a = site_a->next;
+	if (   alloc_nr_records != 3 || alloc_nr_wasted != 1 || site_a == NULL
+		|| site_a->count != 2 || site_a->live_bytes != 10 || site_a->wasted_bytes != 20 || site_a->max_age != 2)
+		fprintf(stderr, "ERROR: allocation attribution of nested failing rules\n");
+	else
+		fprintf(stderr, "OK: allocation attribution of nested failing rules\n");
+
+#ifdef USE_THREADS
+	/* Data can be freed on another thread, while allocations are recorded */
+	alloc_attribution_start(NULL);
+	unsigned long *seqs = MALLOC_N(TEST_ALLOC_NR_FREED, unsigned long);
+	for (int i = 0; i < TEST_ALLOC_NR_FREED; i++)
+		seqs[i] = alloc_attribute("data", "freed", 8);
+	pthread_t thread;
+	bool started = pthread_create(&thread, NULL, test_alloc_free_thread, seqs) == 0;
+	for (int i = 0; i < 10 * TEST_ALLOC_NR_FREED; i++)
+		alloc_attribute("data", "kept", 8);
+	if (started)
+		pthread_join(thread, NULL);
+	FREE(seqs);
+	alloc_site_p site_freed = alloc_sites[(POINTER_HASH("data") ^ POINTER_HASH("freed")) % ALLOC_SITES_SIZE];
+	while (site_freed != NULL && site_freed->nt != (const char*)"freed")
+		site_freed = site_freed->next;
+	if (   !started || alloc_nr_records != 11 * TEST_ALLOC_NR_FREED || site_freed == NULL
+		|| site_freed->count != TEST_ALLOC_NR_FREED || site_freed->live_count != 0)
+		fprintf(stderr, "ERROR: allocation attribution with data freed on another thread\n");
+	else
+		fprintf(stderr, "OK: allocation attribution with data freed on another thread\n");
+#endif
 
+	/* Parsing with the brute force cache */
+	const char *input = "int f(int a)\n{\n\tint b = a; /* one */\n\treturn b * (a + b);\n}\n";
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, input);
+	parser_t parser;
+	parser_init(&parser, &text_buffer);
+	solutions_t solutions;
+	solutions_init(&solutions, &text_buffer);
+	parser.cache_hit_function = solutions_find;
+	parser.cache = &solutions;
+	alloc_attribution_start(&parser);
+	char output[20000];
+	bool parsed = parse_to_string(&parser, find_nt("root", all_nt), output, 20000);
+	alloc_attribution_stop();
+	solutions_free(&solutions);
 
-void print_expected(FILE *fout)
-{
-	fprintf(fout, "Expect at %d.%d:\n", highest_pos.cur_line, highest_pos.cur_column);
-	for (int i = 0; i < nr_expected; i++)
-	{
-		element_p element = expected[i].element;
-		fprintf(fout, "- expect ");
-		element_print(fout, element);
-		fprintf(fout, "\n");
-		for (nt_stack_p nt_stack = expected[i].nt_stack; nt_stack != NULL; nt_stack = nt_stack->parent)
-			fprintf(fout, "  in %s at %d.%d\n", nt_stack->name, nt_stack->pos.cur_line, nt_stack->pos.cur_column);
-	}
+	unsigned long nr_trees = 0;
+	unsigned long nr_children = 0;
+	unsigned long nr_live_solutions = 0;
+	unsigned long nr_wasted = 0;
+	for (int i = 0; i < ALLOC_SITES_SIZE; i++)
+		for (alloc_site_p site = alloc_sites[i]; site != NULL; site = site->next)
+		{
+			if (strcmp(site->type, "tree_p") == 0)
+				nr_trees += site->count;
+			if (strcmp(site->type, "children") == 0)
+				nr_children += site->count - site->live_count;
+			if (strcmp(site->type, "solution") == 0)
+				nr_live_solutions += site->live_count;
+			nr_wasted += site->wasted_count;
+		}
+	fixed_string_ostream_t fixed_string_ostream;
+	fixed_string_ostream_init(&fixed_string_ostream, output, 20000);
+	alloc_attribution_write(&fixed_string_ostream.ostream);
+	fixed_string_ostream_finish(&fixed_string_ostream);
+	if (   !parsed || nr_trees == 0 || nr_children == 0 || nr_live_solutions != 0 || nr_wasted == 0
+		|| strstr(output, "\nsolution ") == NULL || strstr(output, "\n(Not attributed:") == NULL)
+		fprintf(stderr, "ERROR: allocation attribution while parsing: %s\n", output);
+	else
+		fprintf(stderr, "OK: allocation attribution while parsing\n");
+	alloc_attribution_reset();
 }
 
+#endif
 
 #ifndef INCLUDED
 
@@ -3653,6 +13476,7 @@ int main(int argc, char *argv[])
 
 	white_space_grammar(&all_nt);
 	test_white_space_grammar(&all_nt);
+	test_until_fails();
 
 	number_grammar(&all_nt);
 	test_number_grammar(&all_nt);
@@ -3668,10 +13492,36 @@ int main(int argc, char *argv[])
 	
 	int_grammar(&all_nt);
 	test_int_grammar(&all_nt);
+
+	test_scan(&all_nt);
 	
 	non_terminal_dict_p all_nt_c_grammar = NULL;
 	c_grammar(&all_nt_c_grammar);
     test_c_grammar(&all_nt_c_grammar);
+	test_c_grammar_compact_memo(&all_nt_c_grammar);
+	test_cache_strategies(&all_nt_c_grammar);
+	test_predicates();
+	test_earley(&all_nt_c_grammar);
+	test_jit(&all_nt_c_grammar);
+	test_c_grammar_recover(&all_nt_c_grammar);
+	test_recover_backtracking();
+	test_profile(&all_nt_c_grammar);
+	test_heatmap(&all_nt_c_grammar);
+	test_generator(&all_nt_c_grammar);
+#if defined(__unix__) || defined(__APPLE__)
+	test_text_load(&all_nt_c_grammar);
+	test_batch_load(&all_nt_c_grammar);
+#endif
+	test_slow_search(&all_nt_c_grammar);
+	test_grammar_lint();
+	test_shadow(&all_nt_c_grammar);
+	test_typed_tree(&all_nt_c_grammar);
+#ifdef USE_MEMORY_BUDGET
+	test_memory_budget();
+#endif
+#ifdef ALLOC_ATTRIBUTION
+	test_alloc_attribution(&all_nt_c_grammar);
+#endif
 
 	return 0;
 }
@@ -0,0 +1,194 @@
+/*
+	Tests for the C++ front-end
+	~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+	Build with:
+
+		gcc -c -DINCLUDED RawParser.c
+		g++ -std=c++17 RawParser.cpp RawParser.o
+*/
+
+#include <cstdio>
+#include <cstring>
+#include "RawParser.hpp"
+
+using namespace raw_parser;
+
+extern "C"
+{
+	typedef struct fixed_string_ostream fixed_string_ostream_t;
+	struct fixed_string_ostream
+	{
+		ostream_t ostream;
+		char *buffer;
+		unsigned int i;
+		unsigned int len;
+	};
+	void fixed_string_ostream_init(fixed_string_ostream_t *ostream, char *buffer, unsigned int len);
+	void fixed_string_ostream_finish(fixed_string_ostream_t *ostream);
+
+	int ident_add_char(result_p prev, char ch, result_p result);
+	int create_ident_tree(const result_p rule_result, void *data, result_p result);
+}
+
+/*
+	Grammars
+	~~~~~~~~
+*/
+
+constexpr char_set letter_chars = range('a', 'z') | range('A', 'Z') | one('_');
+constexpr char_set digit_chars = range('0', '9');
+
+static_assert(letter_chars.contains('q') && !letter_chars.contains('3'), "char_set is constexpr");
+
+constexpr auto ident = set(letter_chars) >> *set(letter_chars | digit_chars);
+constexpr auto ws = *set(one(' ') | one('\t') | one('\n'));
+
+/*	- A grammar with a recursive rule for expressions that calculates the value */
+
+struct calc_context
+{
+	long values[20];
+	int depth = 0;
+};
+
+constexpr auto push_number = [](calc_context &ctx, const char *begin, const char *end)
+{
+	long value = 0;
+	for (const char *s = begin; s < end; s++)
+		value = 10 * value + *s - '0';
+	ctx.values[ctx.depth++] = value;
+};
+constexpr auto number = (+set(digit_chars))[push_number];
+
+template <char Op>
+constexpr auto reduce = [](calc_context &ctx, const char *, const char *)
+{
+	long rhs = ctx.values[--ctx.depth];
+	long &lhs = ctx.values[ctx.depth - 1];
+	if (Op == '/' && rhs == 0)
+	{
+		ctx.depth++;
+		return false;
+	}
+	lhs = Op == '+' ? lhs + rhs : Op == '-' ? lhs - rhs : Op == '*' ? lhs * rhs : lhs / rhs;
+	return true;
+};
+
+struct expr { static constexpr auto definition(); };
+
+constexpr auto primary = ws >> (number | ch('(') >> rule<expr>() >> ws >> ch(')'));
+constexpr auto term = primary >> *(ws >> (ch('*') >> primary)[reduce<'*'>] | ws >> (ch('/') >> primary)[reduce<'/'>]);
+constexpr auto expr::definition() { return term >> *(ws >> (ch('+') >> term)[reduce<'+'>] | ws >> (ch('-') >> term)[reduce<'-'>]); }
+
+/*	- A grammar that uses the functions from RawParser.c */
+
+constexpr auto c_ident = c_end(c_chars(letter_chars, ident_add_char) >> *c_chars(letter_chars | digit_chars, ident_add_char), create_ident_tree);
+
+/*	- Alternatives and predicates that add characters before they fail */
+
+constexpr auto c_letter = c_chars(letter_chars, ident_add_char);
+constexpr auto c_question = c_end((c_letter >> ch('!')) | (c_letter >> ch('?')), create_ident_tree);
+constexpr auto c_lookahead = c_end(c_letter >> &c_letter >> !(c_letter >> ch('!')) >> c_letter, create_ident_tree);
+
+/*
+	Tests
+	~~~~~
+*/
+
+static int nr_errors = 0;
+
+static void check(bool cond, const char *text, const char *what)
+{
+	if (cond)
+		fprintf(stderr, "OK: %s '%s'\n", what, text);
+	else
+	{
+		fprintf(stderr, "ERROR: %s '%s'\n", what, text);
+		nr_errors++;
+	}
+}
+
+static void test_ident(const char *text, bool exp)
+{
+	context ctx;
+	check(parse(ident >> eoi, text, ctx) == exp, text, exp ? "ident" : "not ident");
+}
+
+static void test_predicates()
+{
+	context ctx;
+	constexpr auto keyword_if = ch('i') >> ch('f') >> !set(letter_chars | digit_chars);
+	check(parse(keyword_if, "if", ctx), "if", "keyword");
+	check(!parse(keyword_if, "iffy", ctx), "iffy", "not keyword");
+	check(parse(&ch('a') >> ident, "abc", ctx), "abc", "and predicate");
+	check(parse(-ch('-') >> +set(digit_chars), "-12", ctx), "-12", "option");
+}
+
+static void test_calc(const char *text, long exp)
+{
+	calc_context ctx;
+	bool parsed = parse(rule<expr>() >> ws, text, ctx);
+	check(parsed && ctx.depth == 1 && ctx.values[0] == exp, text, "calc");
+}
+
+static void test_calc_fails(const char *text)
+{
+	calc_context ctx;
+	check(!parse(rule<expr>() >> ws, text, ctx), text, "calc fails");
+}
+
+static void test_c_ident(const char *text)
+{
+	context ctx;
+	bool parsed = parse(c_ident, text, ctx);
+	char output[100];
+	fixed_string_ostream_t ostream;
+	fixed_string_ostream_init(&ostream, output, 100);
+	ctx.current.print(&ostream.ostream);
+	fixed_string_ostream_finish(&ostream);
+	check(parsed && strcmp(output, text) == 0, text, "c_ident");
+}
+
+template <class P>
+static void test_c_backtrack(const char *text, const P &p, const char *exp)
+{
+	context ctx;
+	bool parsed = parse(p, text, ctx);
+	char output[100];
+	fixed_string_ostream_t ostream;
+	fixed_string_ostream_init(&ostream, output, 100);
+	ctx.current.print(&ostream.ostream);
+	fixed_string_ostream_finish(&ostream);
+	check(parsed && strcmp(output, exp) == 0, text, "c_backtrack");
+}
+
+static void test_result_move()
+{
+	context ctx;
+	parse(c_ident, "abc", ctx);
+	owned_result shared = ctx.current.share();
+	owned_result moved = std::move(ctx.current);
+	check(ctx.current.data() == nullptr && moved.data() == shared.data() && moved.data() != nullptr, "abc", "result move");
+}
+
+int main()
+{
+	test_ident("a", true);
+	test_ident("_x12", true);
+	test_ident("1x", false);
+	test_ident("a-b", false);
+	test_predicates();
+	test_calc("1", 1);
+	test_calc("1+2*3", 7);
+	test_calc(" (1 + 2) * 3", 9);
+	test_calc("20 / (7 - 2) - 1", 3);
+	test_calc_fails("1 +");
+	test_calc_fails("1 / 0");
+	test_c_ident("hello");
+	test_c_ident("x42");
+	test_c_backtrack("a?", c_question, "a");
+	test_c_backtrack("ab", c_lookahead, "ab");
+	test_result_move();
+	return nr_errors == 0 ? 0 : 1;
+}
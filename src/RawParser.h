@@ -0,0 +1,34 @@
+/*
+	Declarations shared with the C++ front-end
+	~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+	The structs for the output stream and for results are used both by
+	RawParser.c, where they are explained, and by RawParser.hpp, which
+	keeps results by value. Both should be compiled with the same setting
+	of CHECK_LOCAL_RESULT.
+*/
+
+#ifndef RAW_PARSER_H
+#define RAW_PARSER_H
+
+typedef struct ostream ostream_t, *ostream_p;
+struct ostream
+{
+	void (*put)(ostream_p ostream, char ch);
+};
+
+typedef struct result result_t, *result_p;
+struct result
+{	
+	void *data;
+	void (*inc)(void *data);
+	void (*dec)(void *data);
+	void (*print)(void *data, ostream_p ostream);
+#ifdef CHECK_LOCAL_RESULT
+	int line;
+	const char *name;
+	result_p context;
+#endif
+};
+
+#endif
@@ -0,0 +1,543 @@
+/*
+	C++ front-end for RawParser
+	~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+	In RawParser.c a grammar is a graph of structs that is built at run-time
+	and interpreted by the parsing functions, calling the functions for
+	processing results through function pointers. This header offers an
+	alternative where a grammar is expressed with C++ expressions, such as:
+
+		constexpr auto letter = set(range('a', 'z') | range('A', 'Z') | one('_'));
+		constexpr auto ident = letter >> *(letter | set(range('0', '9')));
+
+	The type of such an expression describes the grammar, and because all
+	types are known at compile-time, the compiler can inline the complete
+	parser. The character sets are constexpr bit vectors. The parsers have
+	the same meaning as the elements in RawParser.c with the non
+	back-tracking sequences:
+
+		a >> b     a followed by b
+		a | b      a, or when that fails, b
+		-a         optionally a
+		*a         zero or more times a (as many as possible)
+		+a         one or more times a (as many as possible)
+		&a         only if a follows (without consuming it)
+		!a         only if a does not follow
+		a[f]       a, after which f(ctx, begin, end) is called, where f
+		           can return false to let parsing fail
+		eoi        the end of the input
+
+	A recursive grammar is defined with a rule, which takes a struct with a
+	static member function definition that returns the expression:
+
+		struct expr { static constexpr auto definition(); };
+		constexpr auto expr::definition() { return ch('(') >> rule<expr>() >> ch(')') | ident; }
+
+	The results of RawParser.c are wrapped in the class owned_result, which takes
+	care of the reference counting in its destructor, such that result_assign
+	and DISP_RESULT are no longer needed. The parsers c_chars, c_add and
+	c_end call the functions for processing results that are defined in C,
+	passing the result of the previous elements (ctx.current). For this
+	RawParser.c should be compiled with INCLUDED defined. The structs for
+	results are taken from RawParser.h, which RawParser.c also includes, so
+	CHECK_LOCAL_RESULT should be defined for both or for neither.
+*/
+
+#ifndef RAW_PARSER_HPP
+#define RAW_PARSER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <type_traits>
+
+extern "C"
+{
+#include "RawParser.h"
+
+	void result_assign(result_p trg, result_p src);
+#ifdef CHECK_LOCAL_RESULT
+	void result_release(result_p result, result_p *context, int line);
+#else
+	void result_release(result_p result);
+#endif
+	void result_print(result_p result, ostream_p ostream);
+}
+
+namespace raw_parser
+{
+
+/*
+	Result
+	~~~~~~
+
+	A move-only owner of a struct result. Sharing the data (incrementing
+	the reference count) has to be done explicitly with share.
+*/
+
+class owned_result
+{
+public:
+	owned_result() noexcept { clear(); }
+	~owned_result() { release(); }
+	owned_result(const owned_result &) = delete;
+	owned_result &operator=(const owned_result &) = delete;
+	owned_result(owned_result &&other) noexcept : _result(other._result) { other.clear(); }
+	owned_result &operator=(owned_result &&other) noexcept
+	{
+		if (this != &other)
+		{
+			release();
+			_result = other._result;
+			other.clear();
+		}
+		return *this;
+	}
+
+	owned_result share() const
+	{
+		owned_result copy;
+		result_assign(&copy._result, const_cast<result_p>(&_result));
+		return copy;
+	}
+
+	result_p get() noexcept { return &_result; }
+	void *data() const noexcept { return _result.data; }
+	void print(ostream_p ostream) { result_print(&_result, ostream); }
+
+private:
+	void clear() noexcept { _result = result_t(); }
+	void release()
+	{
+#ifdef CHECK_LOCAL_RESULT
+		result_release(&_result, nullptr, __LINE__);
+#else
+		result_release(&_result);
+#endif
+	}
+	result_t _result;
+};
+
+/*
+	Input and context
+	~~~~~~~~~~~~~~~~~
+
+	The input is a range of characters with a current position. The context
+	(ctx) is a user defined type that is passed to all actions. The C
+	interoperability parsers require a member current of type owned_result.
+
+	When a parser backtracks, it restores the position of the input and,
+	when the context has a member current, also the result, such that the
+	result of a failed alternative does not end up in the next one. The
+	struct saved_state takes care of this. (Other members of the context
+	are not restored: an action that changes them should only be used
+	where it cannot be undone by backtracking, or it should undo the
+	change itself.)
+*/
+
+struct input
+{
+	const char *begin;
+	const char *cur;
+	const char *end;
+
+	input(const char *text) : begin(text), cur(text), end(text + std::strlen(text)) {}
+	input(const char *text, std::size_t len) : begin(text), cur(text), end(text + len) {}
+	bool at_end() const { return cur >= end; }
+};
+
+struct context
+{
+	owned_result current;
+};
+
+template <class Ctx, class = void>
+struct saved_state
+{
+	const char *cur;
+	saved_state(const input &in, Ctx &) : cur(in.cur) {}
+	void restore(input &in, Ctx &) { in.cur = cur; }
+};
+
+template <class Ctx>
+struct saved_state<Ctx, std::void_t<decltype(std::declval<Ctx &>().current)>>
+{
+	const char *cur;
+	owned_result current;
+	saved_state(const input &in, Ctx &ctx) : cur(in.cur), current(ctx.current.share()) {}
+	void restore(input &in, Ctx &ctx)
+	{
+		in.cur = cur;
+		ctx.current = std::move(current);
+	}
+};
+
+/*
+	Character sets
+	~~~~~~~~~~~~~~
+*/
+
+class char_set
+{
+public:
+	constexpr char_set() : _bits{0, 0, 0, 0} {}
+	constexpr bool contains(char ch) const
+	{
+		unsigned char c = static_cast<unsigned char>(ch);
+		return (_bits[c >> 6] >> (c & 63)) & 1;
+	}
+	constexpr char_set operator|(const char_set &other) const
+	{
+		char_set set;
+		for (int i = 0; i < 4; i++)
+			set._bits[i] = _bits[i] | other._bits[i];
+		return set;
+	}
+	constexpr char_set operator~() const
+	{
+		char_set set;
+		for (int i = 0; i < 4; i++)
+			set._bits[i] = ~_bits[i];
+		return set;
+	}
+	constexpr char_set &add(char ch)
+	{
+		unsigned char c = static_cast<unsigned char>(ch);
+		_bits[c >> 6] |= std::uint64_t(1) << (c & 63);
+		return *this;
+	}
+
+private:
+	std::uint64_t _bits[4];
+};
+
+constexpr char_set one(char ch) { return char_set().add(ch); }
+
+constexpr char_set range(char from, char to)
+{
+	char_set set;
+	for (int c = static_cast<unsigned char>(from); c <= static_cast<unsigned char>(to); c++)
+		set.add(static_cast<char>(c));
+	return set;
+}
+
+/*
+	Parsers
+	~~~~~~~
+
+	Each parser is a (small) literal type derived from parser<Derived>,
+	with a member function template parse, which returns whether it
+	succeeded. On failure the position of the input and the result are
+	restored (see saved_state). The predicates only look ahead: they parse
+	with a fresh context, which is discarded afterwards, such that actions
+	called within them have no effect on the context. (The functions for
+	processing results in C may change the data of the previous result in
+	place, which restoring the result cannot undo.)
+*/
+
+template <class Derived>
+struct parser
+{
+	template <class F>
+	constexpr auto operator[](F f) const;
+};
+
+template <class P>
+using is_parser = std::is_base_of<parser<P>, P>;
+
+struct chr_p : parser<chr_p>
+{
+	char ch;
+	constexpr explicit chr_p(char c) : ch(c) {}
+	template <class Ctx>
+	bool parse(input &in, Ctx &) const
+	{
+		if (in.at_end() || *in.cur != ch)
+			return false;
+		in.cur++;
+		return true;
+	}
+};
+
+struct set_p : parser<set_p>
+{
+	char_set chars;
+	constexpr explicit set_p(char_set s) : chars(s) {}
+	template <class Ctx>
+	bool parse(input &in, Ctx &) const
+	{
+		if (in.at_end() || !chars.contains(*in.cur))
+			return false;
+		in.cur++;
+		return true;
+	}
+};
+
+struct eoi_p : parser<eoi_p>
+{
+	template <class Ctx>
+	bool parse(input &in, Ctx &) const { return in.at_end(); }
+};
+
+template <class A, class B>
+struct seq_p : parser<seq_p<A, B>>
+{
+	A a;
+	B b;
+	constexpr seq_p(A a_, B b_) : a(a_), b(b_) {}
+	template <class Ctx>
+	bool parse(input &in, Ctx &ctx) const
+	{
+		saved_state<Ctx> state(in, ctx);
+		if (a.parse(in, ctx) && b.parse(in, ctx))
+			return true;
+		state.restore(in, ctx);
+		return false;
+	}
+};
+
+template <class A, class B>
+struct alt_p : parser<alt_p<A, B>>
+{
+	A a;
+	B b;
+	constexpr alt_p(A a_, B b_) : a(a_), b(b_) {}
+	template <class Ctx>
+	bool parse(input &in, Ctx &ctx) const
+	{
+		saved_state<Ctx> state(in, ctx);
+		if (a.parse(in, ctx))
+			return true;
+		state.restore(in, ctx);
+		return b.parse(in, ctx);
+	}
+};
+
+template <class A>
+struct opt_p : parser<opt_p<A>>
+{
+	A a;
+	constexpr explicit opt_p(A a_) : a(a_) {}
+	template <class Ctx>
+	bool parse(input &in, Ctx &ctx) const
+	{
+		saved_state<Ctx> state(in, ctx);
+		if (!a.parse(in, ctx))
+			state.restore(in, ctx);
+		return true;
+	}
+};
+
+template <class A, bool at_least_one>
+struct repeat_p : parser<repeat_p<A, at_least_one>>
+{
+	A a;
+	constexpr explicit repeat_p(A a_) : a(a_) {}
+	template <class Ctx>
+	bool parse(input &in, Ctx &ctx) const
+	{
+		if (at_least_one && !a.parse(in, ctx))
+			return false;
+		/* Stop when an element does not consume anything, as it would loop */
+		for (;;)
+		{
+			saved_state<Ctx> state(in, ctx);
+			if (!a.parse(in, ctx))
+			{
+				state.restore(in, ctx);
+				return true;
+			}
+			if (in.cur == state.cur)
+				return true;
+		}
+	}
+};
+
+template <class A, bool positive>
+struct pred_p : parser<pred_p<A, positive>>
+{
+	A a;
+	constexpr explicit pred_p(A a_) : a(a_) {}
+	template <class Ctx>
+	bool parse(input &in, Ctx &) const
+	{
+		static_assert(std::is_default_constructible_v<Ctx>, "a predicate parses with a fresh context");
+		const char *start = in.cur;
+		Ctx scratch{};
+		bool parsed = a.parse(in, scratch);
+		in.cur = start;
+		return parsed == positive;
+	}
+};
+
+template <class A, class F>
+struct action_p : parser<action_p<A, F>>
+{
+	A a;
+	F f;
+	constexpr action_p(A a_, F f_) : a(a_), f(f_) {}
+	template <class Ctx>
+	bool parse(input &in, Ctx &ctx) const
+	{
+		saved_state<Ctx> state(in, ctx);
+		if (!a.parse(in, ctx))
+			return false;
+		if constexpr (std::is_void_v<decltype(f(ctx, state.cur, in.cur))>)
+			f(ctx, state.cur, in.cur);
+		else if (!f(ctx, state.cur, in.cur))
+		{
+			state.restore(in, ctx);
+			return false;
+		}
+		return true;
+	}
+};
+
+template <class Derived>
+template <class F>
+constexpr auto parser<Derived>::operator[](F f) const
+{
+	return action_p<Derived, F>(static_cast<const Derived &>(*this), f);
+}
+
+template <class Tag>
+struct rule : parser<rule<Tag>>
+{
+	template <class Ctx>
+	bool parse(input &in, Ctx &ctx) const { return Tag::definition().parse(in, ctx); }
+};
+
+constexpr chr_p ch(char c) { return chr_p(c); }
+constexpr set_p set(char_set s) { return set_p(s); }
+constexpr eoi_p eoi{};
+
+template <class A, class B, class = std::enable_if_t<is_parser<A>::value && is_parser<B>::value>>
+constexpr seq_p<A, B> operator>>(A a, B b) { return seq_p<A, B>(a, b); }
+
+template <class A, class B, class = std::enable_if_t<is_parser<A>::value && is_parser<B>::value>>
+constexpr alt_p<A, B> operator|(A a, B b) { return alt_p<A, B>(a, b); }
+
+template <class A, class = std::enable_if_t<is_parser<A>::value>>
+constexpr opt_p<A> operator-(A a) { return opt_p<A>(a); }
+
+template <class A, class = std::enable_if_t<is_parser<A>::value>>
+constexpr repeat_p<A, false> operator*(A a) { return repeat_p<A, false>(a); }
+
+template <class A, class = std::enable_if_t<is_parser<A>::value>>
+constexpr repeat_p<A, true> operator+(A a) { return repeat_p<A, true>(a); }
+
+template <class A, class = std::enable_if_t<is_parser<A>::value>>
+constexpr pred_p<A, true> operator&(A a) { return pred_p<A, true>(a); }
+
+template <class A, class = std::enable_if_t<is_parser<A>::value>>
+constexpr pred_p<A, false> operator!(A a) { return pred_p<A, false>(a); }
+
+/*
+	Interoperability with C functions for processing results
+	~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+	c_chars(s, add_char_function) parses a character from the set and
+	calls add_char_function (as for a CHARSET element).
+	c_add(a, add_function) parses a with an empty current result and
+	thereafter calls add_function with the previous result and the result
+	of a (as for a non-terminal element).
+	c_end(a, end_function, data) parses a and thereafter calls end_function
+	on the result (as at the end of a rule).
+	The functions in C return an int for their Boolean result.
+*/
+
+typedef int (*add_char_function_p)(result_p prev, char ch, result_p result);
+typedef int (*add_function_p)(result_p prev, result_p elem, result_p result);
+typedef int (*end_function_p)(const result_p rule_result, void *data, result_p result);
+
+struct c_chars_p : parser<c_chars_p>
+{
+	char_set chars;
+	add_char_function_p add_char_function;
+	constexpr c_chars_p(char_set s, add_char_function_p f) : chars(s), add_char_function(f) {}
+	template <class Ctx>
+	bool parse(input &in, Ctx &ctx) const
+	{
+		if (in.at_end() || !chars.contains(*in.cur))
+			return false;
+		owned_result next;
+		if (!add_char_function(ctx.current.get(), *in.cur, next.get()))
+			return false;
+		ctx.current = std::move(next);
+		in.cur++;
+		return true;
+	}
+};
+
+template <class A>
+struct c_add_p : parser<c_add_p<A>>
+{
+	A a;
+	add_function_p add_function;
+	constexpr c_add_p(A a_, add_function_p f) : a(a_), add_function(f) {}
+	template <class Ctx>
+	bool parse(input &in, Ctx &ctx) const
+	{
+		const char *start = in.cur;
+		owned_result prev = std::move(ctx.current);
+		bool parsed = a.parse(in, ctx);
+		owned_result elem = std::move(ctx.current);
+		owned_result next;
+		if (parsed && add_function(prev.get(), elem.get(), next.get()))
+		{
+			ctx.current = std::move(next);
+			return true;
+		}
+		ctx.current = std::move(prev);
+		in.cur = start;
+		return false;
+	}
+};
+
+template <class A>
+struct c_end_p : parser<c_end_p<A>>
+{
+	A a;
+	end_function_p end_function;
+	void *data;
+	constexpr c_end_p(A a_, end_function_p f, void *d) : a(a_), end_function(f), data(d) {}
+	template <class Ctx>
+	bool parse(input &in, Ctx &ctx) const
+	{
+		saved_state<Ctx> state(in, ctx);
+		if (!a.parse(in, ctx))
+			return false;
+		owned_result next;
+		if (!end_function(ctx.current.get(), data, next.get()))
+		{
+			state.restore(in, ctx);
+			return false;
+		}
+		ctx.current = std::move(next);
+		return true;
+	}
+};
+
+constexpr c_chars_p c_chars(char_set s, add_char_function_p f) { return c_chars_p(s, f); }
+
+template <class A, class = std::enable_if_t<is_parser<A>::value>>
+constexpr c_add_p<A> c_add(A a, add_function_p f) { return c_add_p<A>(a, f); }
+
+template <class A, class = std::enable_if_t<is_parser<A>::value>>
+constexpr c_end_p<A> c_end(A a, end_function_p f, void *data = nullptr) { return c_end_p<A>(a, f, data); }
+
+/*
+	- Function to parse a complete input
+*/
+
+template <class P, class Ctx>
+bool parse(const P &p, const char *text, Ctx &ctx)
+{
+	input in(text);
+	return p.parse(in, ctx) && in.at_end();
+}
+
+} // namespace raw_parser
+
+#endif
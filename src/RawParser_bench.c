@@ -0,0 +1,496 @@
+/*
+	Microbenchmarks for the primitives of RawParser
+	~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+	This program measures the innermost functions of the parser in
+	isolation, such that the effect of a change to one of them can be
+	evaluated without the noise of parsing a complete input. Build it with:
+
+		gcc -O2 -o RawParser_bench RawParser_bench.c
+
+	and run it with the optional arguments: the number of operations per
+	repetition, the number of repetitions and a part of the name of the
+	benchmarks to run. Each benchmark is first run a number of times to
+	warm up the caches and the branch predictors. Then for each repetition
+	the time per operation is measured, from which the median and the 99th
+	percentile are reported. On Linux, the hardware counters for cycles,
+	instructions, cache misses and branch misses are read with
+	perf_event_open (when this is permitted) and reported per operation.
+
+	With the arguments 'corpus', a size and a seed, a C program of the
+	given size is generated from the C grammar, and the time to parse it
+	with each of the cache strategies is reported, such that these can be
+	compared on the same (reproducible) input. With the argument 'files'
+	followed by file names, the files are parsed with the batch loader,
+	using io_uring, a pool of threads and no overlap at all.
+*/
+
+#define INCLUDED
+#include "RawParser.c"
+
+#include <time.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*
+	Hardware counters
+	~~~~~~~~~~~~~~~~~
+*/
+
+#define NR_COUNTERS 4
+
+const char *counter_names[NR_COUNTERS] = { "cycles", "instr", "cache-miss", "branch-miss" };
+int counter_fds[NR_COUNTERS] = { -1, -1, -1, -1 };
+
+void counters_open()
+{
+#ifdef __linux__
+	static const unsigned long long configs[NR_COUNTERS] =
+		{ PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+	for (int i = 0; i < NR_COUNTERS; i++)
+	{
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = configs[i];
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		counter_fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+#endif
+}
+
+void counters_start()
+{
+#ifdef __linux__
+	for (int i = 0; i < NR_COUNTERS; i++)
+		if (counter_fds[i] >= 0)
+		{
+			ioctl(counter_fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(counter_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+}
+
+void counters_stop(unsigned long long *values)
+{
+	for (int i = 0; i < NR_COUNTERS; i++)
+	{
+		values[i] = 0;
+#ifdef __linux__
+		if (counter_fds[i] >= 0)
+		{
+			ioctl(counter_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+			if (read(counter_fds[i], &values[i], sizeof(values[i])) != sizeof(values[i]))
+				values[i] = 0;
+		}
+#endif
+	}
+}
+
+/*
+	The benchmarks
+	~~~~~~~~~~~~~~
+
+	Each benchmark performs the given number of operations on the data
+	that is set up by bench_setup. The results are added to bench_sink,
+	such that the compiler cannot remove the operations.
+*/
+
+volatile size_t bench_sink = 0;
+
+const char *bench_text =
+	"int f(int a)\n{\n\tint b = a; /* one */\n\treturn b * (a + b);\n}\n"
+	"struct s { int x; long yy; };\n";
+text_buffer_t bench_text_buffer;
+parser_t bench_parser;
+solutions_t bench_solutions;
+const char *bench_nt_names[8] = { "expr", "statement", "ident", "type", "decl", "primary", "root", "white_space" };
+char bench_idents[8][10] = { "alpha", "beta", "gamma", "int", "return", "x", "struct", "while" };
+result_t bench_result;
+char_set_p bench_char_set;
+element_p bench_elements[4];
+result_t bench_list;
+prev_child_p bench_children;
+
+void bench_setup()
+{
+	text_buffer_assign_string(&bench_text_buffer, bench_text);
+	parser_init(&bench_parser, &bench_text_buffer);
+	solutions_init(&bench_solutions, &bench_text_buffer);
+	for (size_t pos = 0; pos < bench_text_buffer.buffer_len; pos++)
+		for (int i = 0; i < 8; i++)
+			solutions_find(&bench_solutions, pos, bench_nt_names[i]);
+	for (int i = 0; i < 8; i++)
+		ident_string(bench_idents[i]);
+
+	RESULT_INIT(&bench_result);
+	new_number_data(&bench_result);
+
+	bench_char_set = new_char_set();
+	char_set_add_range(bench_char_set, 'a', 'z');
+	char_set_add_range(bench_char_set, 'A', 'Z');
+	char_set_add_char(bench_char_set, '_');
+
+	for (int i = 0; i < 4; i++)
+		bench_elements[i] = new_element(rk_char);
+
+	/* A list of three children for make_tree_with_children */
+	RESULT_INIT(&bench_list);
+	for (int i = 0; i < 3; i++)
+	{
+		result_t elem, next;
+		RESULT_INIT(&elem);
+		RESULT_INIT(&next);
+		new_number_data(&elem);
+		add_child(&bench_list, &elem, &next);
+		result_assign(&bench_list, &next);
+		RESULT_RELEASE(&next);
+		RESULT_RELEASE(&elem);
+	}
+	bench_children = CAST(prev_child_p, bench_list.data);
+}
+
+void bench_result_assign_release(size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+	{
+		result_t result;
+		RESULT_INIT(&result);
+		result_assign(&result, &bench_result);
+		bench_sink += result.data != NULL;
+		RESULT_RELEASE(&result);
+	}
+}
+
+void bench_ref_counted_base_dec(size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+	{
+		ref_counted_base_inc(bench_result.data);
+		ref_counted_base_dec(bench_result.data);
+	}
+	bench_sink += ((ref_counted_base_p)bench_result.data)->cnt;
+}
+
+void bench_char_set_contains(size_t n)
+{
+	size_t len = bench_text_buffer.buffer_len;
+	size_t count = 0;
+	for (size_t i = 0; i < n; i++)
+		count += char_set_contains(bench_char_set, bench_text[i % len]);
+	bench_sink += count;
+}
+
+void bench_text_buffer_next(size_t n)
+{
+	text_pos_t start = bench_text_buffer.pos;
+	for (size_t i = 0; i < n; i++)
+	{
+		if (text_buffer_end(&bench_text_buffer))
+			text_buffer_set_pos(&bench_text_buffer, &start);
+		text_buffer_next(&bench_text_buffer);
+	}
+	bench_sink += bench_text_buffer.pos.cur_column;
+	text_buffer_set_pos(&bench_text_buffer, &start);
+}
+
+void bench_text_buffer_set_pos(size_t n)
+{
+	text_pos_t positions[2];
+	positions[0] = bench_text_buffer.pos;
+	text_buffer_advance_to(&bench_text_buffer, 40);
+	positions[1] = bench_text_buffer.pos;
+	for (size_t i = 0; i < n; i++)
+		text_buffer_set_pos(&bench_text_buffer, &positions[i & 1]);
+	bench_sink += bench_text_buffer.pos.pos;
+	text_buffer_set_pos(&bench_text_buffer, &positions[0]);
+}
+
+void bench_solutions_find(size_t n)
+{
+	size_t len = bench_text_buffer.buffer_len;
+	for (size_t i = 0; i < n; i++)
+		bench_sink += solutions_find(&bench_solutions, i % len, bench_nt_names[i & 7])->success;
+}
+
+void bench_ident_string(size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		bench_sink += (size_t)ident_string(bench_idents[i & 7]);
+}
+
+void bench_nt_stack_push_pop(size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+	{
+		nt_stack_push(bench_nt_names[i & 7], &bench_parser);
+		nt_stack_pop(&bench_parser);
+	}
+}
+
+void bench_expect_element(size_t n)
+{
+	init_expected();
+	nt_stack_push("root", &bench_parser);
+	for (size_t i = 0; i < n; i++)
+		expect_element(&bench_parser, bench_elements[i & 3]);
+	bench_sink += nr_expected;
+	for (int i = 0; i < nr_expected; i++)
+		nt_stack_dispose(expected[i].nt_stack);
+	init_expected();
+	nt_stack_pop(&bench_parser);
+}
+
+void bench_make_tree_with_children(size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+	{
+		result_t result;
+		RESULT_INIT(&result);
+		tree_p tree = make_tree_with_children("tree", bench_children);
+		result_assign_ref_counted(&result, tree, tree_print);
+		SET_TYPE(tree_p, tree);
+		bench_sink += tree->nr_children;
+		RESULT_RELEASE(&result);
+	}
+}
+
+typedef struct
+{
+	const char *name;
+	void (*function)(size_t n);
+} benchmark_t;
+
+benchmark_t benchmarks[] =
+{
+	{ "result_assign+release", bench_result_assign_release },
+	{ "ref_counted_base_inc+dec", bench_ref_counted_base_dec },
+	{ "char_set_contains", bench_char_set_contains },
+	{ "text_buffer_next", bench_text_buffer_next },
+	{ "text_buffer_set_pos", bench_text_buffer_set_pos },
+	{ "solutions_find", bench_solutions_find },
+	{ "ident_string", bench_ident_string },
+	{ "nt_stack_push+pop", bench_nt_stack_push_pop },
+	{ "expect_element", bench_expect_element },
+	{ "make_tree_with_children", bench_make_tree_with_children },
+};
+
+/*
+	Running the benchmarks
+	~~~~~~~~~~~~~~~~~~~~~~
+*/
+
+#define NR_WARMUP 5
+
+double now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+	double d = *(const double*)a - *(const double*)b;
+	return d < 0 ? -1 : d > 0 ? 1 : 0;
+}
+
+void run_benchmark(benchmark_t *benchmark, size_t nr_ops, int nr_reps)
+{
+	for (int i = 0; i < NR_WARMUP; i++)
+		benchmark->function(nr_ops);
+
+	double *samples = MALLOC_N(nr_reps, double);
+	unsigned long long totals[NR_COUNTERS] = { 0, 0, 0, 0 };
+	for (int rep = 0; rep < nr_reps; rep++)
+	{
+		unsigned long long values[NR_COUNTERS];
+		counters_start();
+		double start = now_ns();
+		benchmark->function(nr_ops);
+		samples[rep] = (now_ns() - start) / nr_ops;
+		counters_stop(values);
+		for (int i = 0; i < NR_COUNTERS; i++)
+			totals[i] += values[i];
+	}
+	qsort(samples, nr_reps, sizeof(double), compare_doubles);
+
+	printf("%-26s %9.2f %9.2f", benchmark->name, samples[nr_reps / 2], samples[(nr_reps * 99) / 100]);
+	for (int i = 0; i < NR_COUNTERS; i++)
+		if (counter_fds[i] >= 0)
+			printf(" %11.2f", (double)totals[i] / ((double)nr_ops * nr_reps));
+		else
+			printf(" %11s", "-");
+	printf("\n");
+	FREE(samples);
+}
+
+/*
+	Parsing a generated corpus
+	~~~~~~~~~~~~~~~~~~~~~~~~~~
+*/
+
+void bench_corpus_cache(non_terminal_p root, text_buffer_p text_buffer, const char *name, void *cache,
+						cache_item_p (*find)(void *cache, size_t pos, const char *nt),
+						void (*set_result)(void *cache, size_t pos, const char *nt, cache_item_p cache_item))
+{
+	text_buffer_assign_string(text_buffer, text_buffer->buffer);
+	parser_t parser;
+	parser_init(&parser, text_buffer);
+	parser.cache_hit_function = find;
+	parser.cache_set_result_function = set_result;
+	parser.cache = cache;
+	result_t result;
+	RESULT_INIT(&result);
+	double start = now_ns();
+	bool parsed = parse_nt(&parser, root, &result) && text_buffer_end(text_buffer);
+	double time = now_ns() - start;
+	RESULT_RELEASE(&result);
+	printf("%-14s %s %9.2f ms %7.2f ns/byte  ", name, parsed ? "ok  " : "FAIL", time / 1e6, time / text_buffer->buffer_len);
+	file_ostream_t ostream;
+	file_ostream_init(&ostream, stdout);
+	cache_stats_print(cache_stats(cache), &ostream.ostream);
+	printf("\n");
+}
+
+int bench_corpus(size_t size, unsigned long long seed)
+{
+	non_terminal_dict_p all_nt = NULL;
+	c_grammar(&all_nt);
+	generator_options_t options;
+	generator_options_init(&options);
+	options.seed = seed;
+	options.size = size;
+	generator_t generator;
+	generator_init(&generator, all_nt, &options);
+	non_terminal_p root = find_nt("root", &all_nt);
+	if (!generate_sentence(&generator, root))
+	{
+		fprintf(stderr, "Failed to generate a corpus of %lu bytes\n", (unsigned long)size);
+		return 1;
+	}
+	printf("Corpus of %lu bytes (seed %llu)\n", (unsigned long)generator.state.len, seed);
+
+	text_buffer_t text_buffer;
+	text_buffer_assign_string(&text_buffer, generator.text);
+
+	solutions_t solutions;
+	solutions_init(&solutions, &text_buffer);
+	bench_corpus_cache(root, &text_buffer, "brute force", &solutions, solutions_find, NULL);
+	solutions_free(&solutions);
+
+	compact_memo_t compact_memo;
+	compact_memo_init(&compact_memo, &text_buffer);
+	bench_corpus_cache(root, &text_buffer, "compact", &compact_memo, compact_memo_find, compact_memo_set_result);
+	compact_memo_free(&compact_memo);
+
+	direct_cache_t direct_cache;
+	direct_cache_init(&direct_cache, 4096);
+	bench_corpus_cache(root, &text_buffer, "direct mapped", &direct_cache, direct_cache_find, direct_cache_set_result);
+	direct_cache_free(&direct_cache);
+
+	lru_cache_t lru_cache;
+	lru_cache_init(&lru_cache, 4096);
+	bench_corpus_cache(root, &text_buffer, "LRU", &lru_cache, lru_cache_find, lru_cache_set_result);
+	lru_cache_free(&lru_cache);
+
+	window_cache_t window_cache;
+	window_cache_init(&window_cache, 64);
+	bench_corpus_cache(root, &text_buffer, "window", &window_cache, window_cache_find, window_cache_set_result);
+	window_cache_free(&window_cache);
+
+	generator_free(&generator);
+	return 0;
+}
+
+/*
+	Parsing many files
+	~~~~~~~~~~~~~~~~~~
+*/
+
+typedef struct
+{
+	non_terminal_p root;
+	int nr_parsed;
+} bench_files_t;
+
+void bench_files_parse(void *data, int file_nr, text_buffer_p text_buffer, const char *error)
+{
+	(void)file_nr;
+	(void)error;
+	bench_files_t *bench = (bench_files_t*)data;
+	if (text_buffer == NULL)
+		return;
+	solutions_t solutions;
+	solutions_init(&solutions, text_buffer);
+	parser_t parser;
+	parser_init(&parser, text_buffer);
+	parser.cache_hit_function = solutions_find;
+	parser.cache = &solutions;
+	result_t result;
+	RESULT_INIT(&result);
+	if (parse_nt(&parser, bench->root, &result) && text_buffer_end(text_buffer))
+		bench->nr_parsed++;
+	RESULT_RELEASE(&result);
+	solutions_free(&solutions);
+}
+
+int bench_files(const char **file_names, int nr_files)
+{
+	non_terminal_dict_p all_nt = NULL;
+	c_grammar(&all_nt);
+	const char *names[3] = { "io_uring", "threads", "sequential" };
+	for (int method = 0; method < 3; method++)
+	{
+		batch_load_t batch;
+		batch_load_init(&batch);
+		batch.use_io_uring = method == 0;
+		if (method == 2)
+			batch.nr_threads = 0;
+		bench_files_t bench;
+		bench.root = find_nt("root", &all_nt);
+		bench.nr_parsed = 0;
+		double start = now_ns();
+		batch_load_files(&batch, file_names, nr_files, bench_files_parse, &bench);
+		double time = now_ns() - start;
+		printf("%-10s %9.2f ms, %d files parsed, %d not loaded%s\n", names[method], time / 1e6,
+			   bench.nr_parsed, batch.nr_failed, method == 0 && !batch.used_io_uring ? " (io_uring not available)" : "");
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "corpus") == 0)
+		return bench_corpus(argc > 2 ? (size_t)atol(argv[2]) : 100000, argc > 3 ? (unsigned long long)atoll(argv[3]) : 1);
+	if (argc > 1 && strcmp(argv[1], "files") == 0)
+		return bench_files((const char **)argv + 2, argc - 2);
+
+	size_t nr_ops = argc > 1 ? (size_t)atol(argv[1]) : 100000;
+	int nr_reps = argc > 2 ? atoi(argv[2]) : 101;
+	const char *filter = argc > 3 ? argv[3] : "";
+	if (nr_ops == 0 || nr_reps <= 0)
+	{
+		fprintf(stderr, "Usage: %s [operations [repetitions [name]]] | corpus [size [seed]] | files file ...\n", argv[0]);
+		return 1;
+	}
+
+	counters_open();
+	bench_setup();
+
+	printf("%-26s %9s %9s", "ns/op", "median", "p99");
+	for (int i = 0; i < NR_COUNTERS; i++)
+		printf(" %11s", counter_names[i]);
+	printf("\n");
+	for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+		if (strstr(benchmarks[i].name, filter) != NULL)
+			run_benchmark(&benchmarks[i], nr_ops, nr_reps);
+	return 0;
+}